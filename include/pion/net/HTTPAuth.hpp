@@ -10,15 +10,19 @@
 #ifndef __PION_HTTPAUTH_HEADER__
 #define __PION_HTTPAUTH_HEADER__
 
+#include <map>
 #include <set>
 #include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/function/function0.hpp>
+#include <boost/thread/mutex.hpp>
 #include <pion/PionConfig.hpp>
 #include <pion/PionLogger.hpp>
 #include <pion/PionException.hpp>
 #include <pion/net/PionUser.hpp>
 #include <pion/net/TCPConnection.hpp>
 #include <pion/net/HTTPRequest.hpp>
+#include <pion/net/HTTPRouter.hpp>
 
 
 namespace pion {	// begin namespace pion
@@ -38,8 +42,25 @@ public:
 		UnknownOptionException(const std::string& name)
 			: PionException("Option not recognized by authentication service: ", name) {}
 	};
+
+	/// exception thrown if a configuration option is set to an invalid value
+	class InvalidOptionValueException : public PionException {
+	public:
+		InvalidOptionValueException(const std::string& option, const std::string& value)
+			: PionException("Authentication service invalid value for " + option + " option: ", value) {}
+	};
 	
 	
+	/// data type for a set of resources to be authenticated
+	typedef HTTPRouter::AuthResourceSet		AuthResourceSet;
+
+	/// type of function called after the authentication rules have changed
+	typedef boost::function0<void>			UpdateHandler;
+
+	/// data type for the update handlers of each owner
+	typedef std::map<const void*, UpdateHandler>	UpdateHandlerMap;
+
+
 	/// default constructor
 	HTTPAuth(PionUserManagerPtr userManager) 
 		: m_logger(PION_GET_LOGGER("pion.net.HTTPAuth")),
@@ -56,12 +77,35 @@ public:
 	 * If request not authenticated, appropriate response is sent over tcp_conn
 	 * and return "false";
 	 *
+	 * HTTPServer calls this version, with the rule that the router found for
+	 * the resource.  Subclasses must override it or the version without the
+	 * rule (which earlier subclasses override); each one calls the other.
+	 *
+	 * @param request the new HTTP request to handle
+	 * @param tcp_conn the TCP connection that has the new request
+	 * @param restricted true if the rules require authentication for the
+	 *                   resource requested (as found by the HTTPRouter)
+	 *
+	 * @return true if request valid and user identity inserted into request 
+	 */
+	virtual bool handleRequest(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn,
+							   bool restricted)
+	{
+		return handleRequest(request, tcp_conn);
+	}
+
+	/**
+	 * attempts to validate authentication of a new HTTP request, finding
+	 * whether the rules require authentication for the resource requested
+	 *
 	 * @param request the new HTTP request to handle
 	 * @param tcp_conn the TCP connection that has the new request
 	 *
 	 * @return true if request valid and user identity inserted into request 
 	 */
-	virtual bool handleRequest(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn) = 0;
+	virtual bool handleRequest(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn) {
+		return handleRequest(request, tcp_conn, needAuthentication(request));
+	}
 	
 	/**
 	 * sets a configuration option
@@ -72,6 +116,10 @@ public:
 	virtual void setOption(const std::string& name, const std::string& value) {
 		throw UnknownOptionException(name);
 	}
+
+	/// cancels any timers that are waiting for a server's io_service; called
+	/// before the server stops, and they are started again when needed
+	virtual void cancelTimers(void) {}
 	
 	/**
 	 * adds a resource that requires authentication
@@ -87,6 +135,27 @@ public:
 	 */
 	void addPermit(const std::string& resource);
 
+	/**
+	 * copies the authentication rules, so that they may be compiled into
+	 * an HTTPRouter
+	 *
+	 * @param restrict_list set to the resources that require authentication
+	 * @param white_list set to the resources that do NOT require authentication
+	 */
+	void getRules(AuthResourceSet& restrict_list, AuthResourceSet& white_list) const;
+
+	/**
+	 * sets a function that is called after the rules have changed (without
+	 * the rules' lock held); each server that uses this object sets its own
+	 * function.  Once this returns, the owner's previous function is not
+	 * running and will not be called again, so functions may not call this.
+	 *
+	 * @param owner identifies the owner of the function (e.g. its server)
+	 * @param h the function to call, or an empty function to remove the
+	 *          owner's function
+	 */
+	void setUpdateHandler(const void *owner, const UpdateHandler& h);
+
 	/**
 	 * used to add a new user
 	 *
@@ -124,27 +193,37 @@ public:
 	
 protected:
 
-	/// data type for a set of resources to be authenticated
-	typedef std::set<std::string>	AuthResourceSet;
+	/**
+	 * check if a HTTP request requires authentication
+	 *
+	 * @param restricted true if the rules require authentication for the resource
+	 */
+	inline bool needAuthentication(bool restricted) const {
+		// if no users are defined, authentication is never required
+		return restricted && ! m_user_manager->empty();
+	}
 
-	
 	/**
-	 * check if given HTTP request requires authentication
+	 * check if a HTTP request requires authentication, using the rules
+	 * directly instead of a router
 	 *
 	 * @param http_request the HTTP request to check
 	 */
-	bool needAuthentication(HTTPRequestPtr const& http_request) const;
-	
+	bool needAuthentication(const HTTPRequestPtr& http_request) const;
+
 	/**
 	 * tries to find a resource in a given collection
 	 * 
 	 * @param resource_set the collection of resource to look in
 	 * @param resource the resource to look for
 	 *
-	 * @return true if the resource was found
+	 * @return true if the resource is within the collection
 	 */
-	bool findResource(const AuthResourceSet& resource_set,
-					  const std::string& resource) const;
+	static bool findResource(const AuthResourceSet& resource_set,
+							 const std::string& resource);
+
+	/// calls the update handlers of all the owners
+	void notifyUpdate(void);
 
 	/// sets the logger to be used
 	inline void setLogger(PionLogger log_ptr) { m_logger = log_ptr; }
@@ -162,8 +241,16 @@ protected:
 	/// collection of resources that do NOT require authentication 
 	AuthResourceSet				m_white_list;
 
+	/// called after the collections of resources have changed (by owner;
+	/// protected by m_update_mutex)
+	UpdateHandlerMap			m_update_handlers;
+
 	/// mutex used to protect access to the resources
 	mutable boost::mutex		m_resource_mutex;
+
+	/// mutex held while the update handlers are changed or called, so that
+	/// an owner's handler is never called after it has been removed
+	boost::mutex				m_update_mutex;
 };
 
 /// data type for a HTTPAuth pointer
@@ -10,8 +10,8 @@
 #ifndef __PION_HTTPBASICAUTH_HEADER__
 #define __PION_HTTPBASICAUTH_HEADER__
 
-#include <map>
 #include <string>
+#include <boost/shared_ptr.hpp>
 #include <pion/PionConfig.hpp>
 #include <pion/net/HTTPAuth.hpp>
 #include <pion/PionDateTime.hpp>  // order important , otherwise compiling error under win32
@@ -33,7 +33,7 @@ public:
 	HTTPBasicAuth(PionUserManagerPtr userManager, const std::string& realm="PION:NET");
 	
 	/// virtual destructor
-	virtual ~HTTPBasicAuth() {}
+	virtual ~HTTPBasicAuth();
 	
 	/**
 	 * attempts to validate authentication of a new HTTP request. 
@@ -44,21 +44,48 @@ public:
 	 *
 	 * @param request the new HTTP request to handle
 	 * @param tcp_conn the TCP connection that has the new request
+	 * @param restricted true if the rules require authentication for the resource
 	 *
 	 * @return true if request valid and user identity inserted into request 
 	 */
-	virtual bool handleRequest(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn);
+	virtual bool handleRequest(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn,
+							   bool restricted);
+
+	/// the version that finds the rule for the resource itself
+	using HTTPAuth::handleRequest;
 	
 	/**
 	 * sets a configuration option
 	 * Valid options:
-	 *    - "domain" - name of authentication domain
+	 *    - "realm" - name of authentication domain
+	 *    - "cache_size" - maximum number of credentials cached (0 = no caching)
+	 *    - "cache_expiration" - seconds after which unused credentials are
+	 *      removed from the cache (default 300)
 	 *
 	 * @param name the name of the option to change
 	 * @param value the value of the option
 	 */
 	virtual void setOption(const std::string& name, const std::string& value);
 
+	/// cancels the expiry timer of the credential cache (the next credentials
+	/// that are cached start it again)
+	virtual void cancelTimers(void);
+
+	/// returns the number of requests whose credentials were found in the cache
+	unsigned long getCacheHits(void) const;
+
+	/// returns the number of requests whose credentials were not in the cache
+	unsigned long getCacheMisses(void) const;
+
+	/// returns the number of credentials removed to keep the cache within its size
+	unsigned long getCacheEvictions(void) const;
+
+	/// returns the number of credentials removed because they were not used recently
+	unsigned long getCacheExpirations(void) const;
+
+	/// returns the number of credentials that are currently cached
+	std::size_t getCacheSize(void) const;
+
 	
 protected:
 
@@ -85,24 +112,26 @@ protected:
 	
 private:
 	
-	/// data type used to map authentication credentials to PionUser objects
-	typedef std::map<std::string,std::pair<PionDateTime,PionUserPtr> >  PionUserCache;
-	
-	/// number of seconds after which entires in the user cache will be expired
-	static const unsigned int	CACHE_EXPIRATION;
+	/// cache of users that are currently active, split into separately locked
+	/// shards (defined in HTTPBasicAuth.cpp)
+	class UserCache;
+
+	/// data type for a pointer to the cache of active users
+	typedef boost::shared_ptr<UserCache>	UserCachePtr;
+
+
+	/// default number of seconds after which entries in the user cache expire
+	static const unsigned int	DEFAULT_CACHE_EXPIRATION;
+
+	/// default maximum number of entries in the user cache
+	static const std::size_t	DEFAULT_CACHE_SIZE;
 
 
 	/// authentication realm ( "PION:NET" by default)
 	std::string					m_realm; 
 
-	/// time of the last cache clean up
-	PionDateTime				m_cache_cleanup_time;
-		
-	/// cache of users that are currently active
-	PionUserCache				m_user_cache;
-	
-	/// mutex used to protect access to the user cache
-	mutable boost::mutex		m_cache_mutex;
+	/// cache of users that are currently active (shared with its expiry timer)
+	UserCachePtr				m_user_cache;
 };
 
 	
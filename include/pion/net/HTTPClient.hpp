@@ -0,0 +1,362 @@
+// ------------------------------------------------------------------
+// pion-net: a C++ framework for building lightweight HTTP interfaces
+// ------------------------------------------------------------------
+// Copyright (C) 2007-2010 Atomic Labs, Inc.  (http://www.atomiclabs.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See http://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef __PION_HTTPCLIENT_HEADER__
+#define __PION_HTTPCLIENT_HEADER__
+
+#include <map>
+#include <set>
+#include <list>
+#include <deque>
+#include <vector>
+#include <string>
+#include <boost/asio.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/function/function0.hpp>
+#include <boost/function/function2.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <pion/PionConfig.hpp>
+#include <pion/PionLogger.hpp>
+#include <pion/PionScheduler.hpp>
+#include <pion/net/TCPConnection.hpp>
+#include <pion/net/HTTPRequest.hpp>
+#include <pion/net/HTTPResponse.hpp>
+
+
+namespace pion {	// begin namespace pion
+namespace net {		// begin namespace net (Pion Network Library)
+
+
+///
+/// HTTPClient: sends HTTP requests asynchronously, re-using keep-alive
+///             connections that are pooled for each remote host
+///
+class PION_NET_API HTTPClient :
+	public boost::enable_shared_from_this<HTTPClient>,
+	private boost::noncopyable
+{
+public:
+
+	/// function called with the response to a request, or with an error
+	/// (in which case the response pointer is empty)
+	typedef boost::function2<void, HTTPResponsePtr,
+		const boost::system::error_code&>	ResponseHandler;
+
+	/// default maximum number of connections for each remote host
+	static const unsigned int		DEFAULT_MAX_CONNECTIONS;
+
+	/// default number of seconds that idle connections are kept open
+	static const boost::uint32_t	DEFAULT_IDLE_TIMEOUT;
+
+	/// default number of seconds that host name resolutions are cached
+	static const boost::uint32_t	DEFAULT_DNS_CACHE_TTL;
+
+	/// default maximum number of seconds for reading each response
+	static const boost::uint32_t	DEFAULT_READ_TIMEOUT;
+
+
+	/**
+	 * creates new HTTPClient objects
+	 *
+	 * @param scheduler the scheduler whose threads will handle the client's
+	 *                  connections (it is kept running until the client is
+	 *                  closed or destroyed)
+	 */
+	static inline boost::shared_ptr<HTTPClient> create(PionScheduler& scheduler) {
+		return boost::shared_ptr<HTTPClient>(new HTTPClient(scheduler));
+	}
+
+	/// virtual destructor
+	virtual ~HTTPClient();
+
+	/**
+	 * sends a request to a remote host using an idle pooled connection, or a
+	 * new connection if none are idle and the host's limit is not reached.
+	 * Otherwise the request waits for a connection to become available.
+	 *
+	 * @param host name or IP address of the remote host
+	 * @param port port number of the remote host
+	 * @param request the request to send; a Host header is added if missing
+	 * @param handler called with the response after it has been received
+	 * @param ssl_flag if true then the connection will be encrypted using SSL
+	 */
+	void sendRequest(const std::string& host, const unsigned int port,
+					 HTTPRequestPtr& request, ResponseHandler handler,
+					 const bool ssl_flag = false);
+
+	/// closes all connections, and stops keeping the scheduler running until
+	/// another request is sent; requests that are waiting or in progress
+	/// fail with boost::asio::error::operation_aborted
+	void close(void);
+
+	/// sets the maximum number of connections for each remote host
+	inline void setMaxConnections(unsigned int n) { m_max_connections = (n > 0 ? n : 1); }
+
+	/// returns the maximum number of connections for each remote host
+	inline unsigned int getMaxConnections(void) const { return m_max_connections; }
+
+	/// sets the number of seconds that idle connections are kept open (0 = never)
+	inline void setIdleTimeout(boost::uint32_t seconds) { m_idle_timeout = seconds; }
+
+	/// returns the number of seconds that idle connections are kept open
+	inline boost::uint32_t getIdleTimeout(void) const { return m_idle_timeout; }
+
+	/**
+	 * sets the maximum number of idempotent requests (GET, HEAD, PUT & DELETE)
+	 * that may be pipelined on a connection when all of the host's
+	 * connections are busy (1 = disabled)
+	 */
+	inline void setPipelineDepth(unsigned int n) { m_pipeline_depth = (n > 0 ? n : 1); }
+
+	/// returns the maximum number of requests that may be pipelined on a connection
+	inline unsigned int getPipelineDepth(void) const { return m_pipeline_depth; }
+
+	/// sets the number of seconds that host name resolutions are cached
+	inline void setDNSCacheTTL(boost::uint32_t seconds) { m_dns_cache_ttl = seconds; }
+
+	/// returns the number of seconds that host name resolutions are cached
+	inline boost::uint32_t getDNSCacheTTL(void) const { return m_dns_cache_ttl; }
+
+	/// sets the maximum number of seconds for reading each response (0 = unlimited)
+	inline void setReadTimeout(boost::uint32_t seconds) { m_read_timeout = seconds; }
+
+	/// returns the maximum number of seconds for reading each response
+	inline boost::uint32_t getReadTimeout(void) const { return m_read_timeout; }
+
+	/// returns the number of connections that are open or being opened
+	std::size_t getConnectionCount(void);
+
+	/// returns the number of idle connections that are waiting to be re-used
+	std::size_t getIdleConnectionCount(void);
+
+	/// returns the total number of connections that have been opened
+	unsigned long getConnectionsOpened(void);
+
+	/// returns the SSL context used for encrypted connections
+	inline TCPConnection::SSLContext& getSSLContext(void) { return m_ssl_context; }
+
+	/// sets the logger to be used
+	inline void setLogger(PionLogger log_ptr) { m_logger = log_ptr; }
+
+	/// returns the logger currently in use
+	inline PionLogger getLogger(void) { return m_logger; }
+
+
+protected:
+
+	/**
+	 * protected constructor restricts creation of objects (use create())
+	 *
+	 * @param scheduler the scheduler whose threads will handle the connections
+	 */
+	explicit HTTPClient(PionScheduler& scheduler);
+
+
+	/// primary logging interface used by this class
+	PionLogger								m_logger;
+
+
+private:
+
+	/// a request that has not yet been answered
+	struct PendingRequest {
+		PendingRequest(HTTPRequestPtr& request, ResponseHandler handler)
+			: m_request(request), m_handler(handler), m_retried(false)
+		{}
+		HTTPRequestPtr						m_request;
+		ResponseHandler						m_handler;
+		bool								m_retried;
+	};
+
+	/// data type for a queue of requests (oldest first)
+	typedef std::deque<PendingRequest>		RequestQueue;
+
+	struct HostPool;
+
+	/// a pooled connection and the requests that have been assigned to it
+	struct ClientConnection {
+		ClientConnection(HostPool& pool, TCPConnectionPtr tcp_conn)
+			: m_pool(pool), m_tcp_conn(tcp_conn), m_num_written(0),
+			m_next_address(0), m_reused(false), m_closed(false)
+		{}
+		HostPool &								m_pool;
+		TCPConnectionPtr						m_tcp_conn;
+		RequestQueue							m_requests;
+		std::size_t								m_num_written;
+		std::vector<boost::asio::ip::address>	m_addresses;
+		std::size_t								m_next_address;
+		boost::posix_time::ptime				m_idle_since;
+		bool									m_reused;
+		bool									m_closed;
+	};
+
+	/// data type for a pointer to a pooled connection
+	typedef boost::shared_ptr<ClientConnection>	ClientConnectionPtr;
+
+	/// connections & waiting requests for one remote host
+	struct HostPool {
+		HostPool(const std::string& host, unsigned int port, bool ssl_flag)
+			: m_host(host), m_port(port), m_ssl_flag(ssl_flag)
+		{}
+		std::string							m_host;
+		unsigned int						m_port;
+		bool								m_ssl_flag;
+		std::list<ClientConnectionPtr>		m_idle;		// most recently used first
+		std::set<ClientConnectionPtr>		m_busy;
+		RequestQueue						m_waiting;
+	};
+
+	/// data type for a map of "host:port" strings to connection pools
+	typedef std::map<std::string, boost::shared_ptr<HostPool> >	PoolMap;
+
+	/// a cached host name resolution
+	struct DNSCacheEntry {
+		std::vector<boost::asio::ip::address>	m_addresses;
+		boost::posix_time::ptime				m_expires;
+		std::vector<ClientConnectionPtr>		m_waiting;
+		boost::shared_ptr<boost::asio::ip::tcp::resolver>	m_resolver;
+	};
+
+	/// data type for a map of host names to resolutions
+	typedef std::map<std::string, DNSCacheEntry>	DNSCache;
+
+	/// work that is deferred until the client's mutex has been released
+	struct DeferredWork {
+		std::vector<boost::function0<void> >	m_operations;
+		std::vector<std::pair<PendingRequest, HTTPResponsePtr> >	m_responses;
+		std::vector<std::pair<PendingRequest, boost::system::error_code> >	m_errors;
+	};
+
+
+	/// performs deferred work (m_mutex must not be locked)
+	static void runDeferredWork(DeferredWork& work);
+
+	/// assigns a request to an idle or new connection, or makes it wait
+	void dispatchRequest(HostPool& pool, const PendingRequest& request, DeferredWork& work);
+
+	/// assigns waiting requests to connections that are available
+	void dispatchWaitingRequests(HostPool& pool, DeferredWork& work);
+
+	/// moves pipelinable requests from the waiting queue to a connection
+	void fillPipeline(HostPool& pool, ClientConnection& conn);
+
+	/// opens a new connection for a request
+	void openConnection(HostPool& pool, const PendingRequest& request, DeferredWork& work);
+
+	/// resolves the host name for a new connection, using the DNS cache
+	void resolveHost(ClientConnectionPtr& conn, DeferredWork& work);
+
+	/// connects to the next address resolved for a connection
+	void connectNext(ClientConnectionPtr& conn, DeferredWork& work);
+
+	/// writes the next request that has been assigned to a connection
+	void writeNext(ClientConnectionPtr& conn, DeferredWork& work);
+
+	/// starts reading the response to the oldest request on a connection
+	void readNext(ClientConnectionPtr& conn, DeferredWork& work);
+
+	/// makes a connection idle, or assigns waiting requests to it
+	void releaseConnection(ClientConnectionPtr& conn, DeferredWork& work);
+
+	/**
+	 * closes a connection and removes it from its pool
+	 *
+	 * @param conn the connection to close
+	 * @param ec the error passed to the handlers of requests that are not retried
+	 * @param retry if true, idempotent requests are retried once
+	 * @param work deferred work
+	 */
+	void closeConnection(ClientConnectionPtr& conn, const boost::system::error_code& ec,
+						 bool retry, DeferredWork& work);
+
+	/// starts the timer that closes connections which have been idle too long
+	void startIdleTimer(void);
+
+	/// called after the host name for a connection has been resolved
+	void handleResolve(const std::string& host, const boost::system::error_code& ec,
+					   boost::asio::ip::tcp::resolver::iterator endpoint_iterator);
+
+	/// called after a connection has been established (or failed)
+	void handleConnect(ClientConnectionPtr conn, const boost::system::error_code& ec);
+
+	/// called after the SSL handshake for a connection has completed
+	void handleHandshake(ClientConnectionPtr conn, const boost::system::error_code& ec);
+
+	/// called after a request has been written
+	void handleWrite(ClientConnectionPtr conn, const boost::system::error_code& ec);
+
+	/// called after a response has been read
+	void handleResponse(ClientConnectionPtr conn, HTTPResponsePtr http_response,
+						const boost::system::error_code& ec);
+
+	/// called when the idle connection timer expires
+	void handleIdleTimer(const boost::system::error_code& ec);
+
+	/// calls handleIdleTimer() unless the client has been destroyed (idle
+	/// connections do not keep the client alive)
+	static void handleIdleTimerIfAlive(boost::weak_ptr<HTTPClient> client_weak_ptr,
+									   const boost::system::error_code& ec);
+
+
+	/// the scheduler used to handle connections
+	PionScheduler &							m_scheduler;
+
+	/// context used for encrypted connections
+	TCPConnection::SSLContext				m_ssl_context;
+
+	/// timer used to close connections that have been idle too long
+	boost::asio::deadline_timer				m_idle_timer;
+
+	/// true if the idle connection timer is active
+	bool									m_idle_timer_active;
+
+	/// true if the client is keeping the scheduler running
+	bool									m_active_user;
+
+	/// connection pools for each remote host
+	PoolMap									m_pools;
+
+	/// cached host name resolutions
+	DNSCache								m_dns_cache;
+
+	/// mutex used to make the client thread-safe
+	boost::mutex							m_mutex;
+
+	/// maximum number of connections for each remote host
+	unsigned int							m_max_connections;
+
+	/// number of seconds that idle connections are kept open
+	boost::uint32_t							m_idle_timeout;
+
+	/// maximum number of requests that may be pipelined on a connection
+	unsigned int							m_pipeline_depth;
+
+	/// number of seconds that host name resolutions are cached
+	boost::uint32_t							m_dns_cache_ttl;
+
+	/// maximum number of seconds for reading each response
+	boost::uint32_t							m_read_timeout;
+
+	/// total number of connections that have been opened
+	unsigned long							m_connections_opened;
+};
+
+
+/// data type for a HTTPClient pointer
+typedef boost::shared_ptr<HTTPClient>		HTTPClientPtr;
+
+
+}	// end namespace net
+}	// end namespace pion
+
+#endif
@@ -0,0 +1,182 @@
+// ------------------------------------------------------------------
+// pion-net: a C++ framework for building lightweight HTTP interfaces
+// ------------------------------------------------------------------
+// Copyright (C) 2007-2010 Atomic Labs, Inc.  (http://www.atomiclabs.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See http://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef __PION_HTTPCOMPRESSOR_HEADER__
+#define __PION_HTTPCOMPRESSOR_HEADER__
+
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <pion/PionConfig.hpp>
+
+
+namespace pion {	// begin namespace pion
+namespace net {		// begin namespace net (Pion Network Library)
+
+
+///
+/// HTTPCompressor: incrementally compresses HTTP payload content using the
+///                 gzip or deflate content-codings (requires zlib)
+///
+class PION_NET_API HTTPCompressor :
+	private boost::noncopyable
+{
+public:
+
+	/// content-codings that may be used to compress payload content
+	enum EncodingType {
+		ENCODING_IDENTITY, ENCODING_DEFLATE, ENCODING_GZIP
+	};
+
+	/// default zlib compression level (1 = fastest, 9 = smallest)
+	static const int				DEFAULT_LEVEL;
+
+	/// default minimum content length for compressing non-chunked messages
+	static const std::size_t		DEFAULT_MIN_SIZE;
+
+
+	///
+	/// Options: settings that determine whether and how messages are compressed
+	///
+	class PION_NET_API Options {
+	public:
+
+		/// constructs options using default settings & MIME types
+		Options(void);
+
+		/// sets the zlib compression level (1 = fastest, 9 = smallest)
+		inline void setLevel(int level) { m_level = level; }
+
+		/// returns the zlib compression level
+		inline int getLevel(void) const { return m_level; }
+
+		/// sets the smallest content length that non-chunked messages are compressed for
+		inline void setMinSize(std::size_t n) { m_min_size = n; }
+
+		/// returns the smallest content length that non-chunked messages are compressed for
+		inline std::size_t getMinSize(void) const { return m_min_size; }
+
+		/**
+		 * adds a MIME type that may be compressed
+		 *
+		 * @param mime_type the MIME type; types that end with a slash match all
+		 *                  subtypes (i.e. "text/" matches "text/html")
+		 */
+		inline void addMimeType(const std::string& mime_type) { m_mime_types.push_back(mime_type); }
+
+		/// removes all of the MIME types that may be compressed
+		inline void clearMimeTypes(void) { m_mime_types.clear(); }
+
+		/// returns true if content with the given Content-Type may be compressed
+		bool isCompressible(const std::string& content_type) const;
+
+	private:
+
+		/// zlib compression level
+		int							m_level;
+
+		/// smallest content length that non-chunked messages are compressed for
+		std::size_t					m_min_size;
+
+		/// MIME types that may be compressed
+		std::vector<std::string>	m_mime_types;
+	};
+
+	/// data type for a pointer to (shared) compression options
+	typedef boost::shared_ptr<const Options>	OptionsPtr;
+
+
+	/**
+	 * creates a new compressor, re-using a zlib stream from the calling
+	 * thread's pool if one is available
+	 *
+	 * @param encoding the content-coding to use (gzip or deflate)
+	 * @param level zlib compression level
+	 */
+	HTTPCompressor(EncodingType encoding, int level);
+
+	/// returns the zlib stream to the calling thread's pool
+	~HTTPCompressor();
+
+	/**
+	 * compresses data, appending any output to a string
+	 *
+	 * @param ptr points to the data to compress
+	 * @param length the length, in bytes, of the data
+	 * @param out string to which compressed data is appended
+	 *
+	 * @return bool true if successful
+	 */
+	bool compress(const void *ptr, std::size_t length, std::string& out);
+
+	/**
+	 * flushes all of the data compressed so far, so that it can be decoded
+	 * by the recipient before the next chunk arrives
+	 *
+	 * @param out string to which compressed data is appended
+	 *
+	 * @return bool true if successful
+	 */
+	bool flush(std::string& out);
+
+	/**
+	 * finishes the compressed stream; the compressor may not be used afterwards
+	 *
+	 * @param out string to which compressed data is appended
+	 *
+	 * @return bool true if successful
+	 */
+	bool finish(std::string& out);
+
+	/// returns the content-coding used by the compressor
+	inline EncodingType getEncoding(void) const { return m_encoding; }
+
+	/// returns true if the compressor was initialized successfully
+	inline bool isOpen(void) const { return m_stream != NULL; }
+
+
+	/**
+	 * chooses a content-coding using the value of an Accept-Encoding header
+	 *
+	 * @param accept_encoding value of the request's Accept-Encoding header
+	 *
+	 * @return EncodingType the preferred content-coding supported by both
+	 *                      sides, or ENCODING_IDENTITY if there is none
+	 */
+	static EncodingType parseAcceptEncoding(const std::string& accept_encoding);
+
+	/// returns the name used for a content-coding in Content-Encoding headers
+	static const std::string& getEncodingName(EncodingType encoding);
+
+	/// returns true if compression is supported (pion-net was built with zlib)
+	static bool isSupported(void);
+
+	/// returns shared options that use the default settings
+	static OptionsPtr getDefaultOptions(void);
+
+
+private:
+
+	/// sends data through the zlib stream using the given flush mode
+	bool deflateData(const void *ptr, std::size_t length, int flush_mode, std::string& out);
+
+
+	/// the content-coding used by the compressor
+	const EncodingType		m_encoding;
+
+	/// zlib stream state (z_stream), or NULL if it could not be initialized
+	void *					m_stream;
+};
+
+
+}	// end namespace net
+}	// end namespace pion
+
+#endif
@@ -30,6 +30,14 @@ class PION_NET_API HTTPCookieAuth :
 {
 public:
 	
+	/// exception thrown if the session mode is not recognized or not supported
+	class BadSessionModeException : public PionException {
+	public:
+		BadSessionModeException(const std::string& mode)
+			: PionException("Session mode not supported by cookie authentication: ", mode) {}
+	};
+	
+	
 	/**
 	 * default constructor
 	 *
@@ -63,10 +71,15 @@ public:
 	 *
 	 * @param request the new HTTP request to handle
 	 * @param tcp_conn the TCP connection that has the new request
+	 * @param restricted true if the rules require authentication for the resource
 	 *
 	 * @return true if request valid and user identity inserted into request 
 	 */
-	virtual bool handleRequest(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn);
+	virtual bool handleRequest(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn,
+							   bool restricted);
+
+	/// the version that finds the rule for the resource itself
+	using HTTPAuth::handleRequest;
 	
 	/**
 	 * sets a configuration option
@@ -77,6 +90,13 @@ public:
 	 *				http://website/logout?url="redirection_url"
 	 *	  - "redirect" - if not empty, URL for redirection in case of authentication failure
 	 *					if empty - send code 401 on authentication failure
+	 *    - "session" - "cache" (default) keeps sessions in memory, so that they may be
+	 *				ended by logging out; "signed" issues cookies that carry the username
+	 *				and login time, signed with HMAC-SHA1, and are valid for one hour
+	 *				without any server-side state (requires OpenSSL)
+	 *    - "secret" - key used to sign session cookies; servers that share it accept
+	 *				each other's cookies (a random key is used if it is not set); it
+	 *				may not be empty
 	 *
 	 * @param name the name of the option to change
 	 * @param value the value of the option
@@ -127,6 +147,28 @@ protected:
 	 */
 	void expireCache(const PionDateTime &time_now);
 
+	/**
+	 * creates a signed session cookie
+	 *
+	 * @param username name of the user that has logged in
+	 * @param time_now the time of the login
+	 */
+	std::string createSessionToken(const std::string& username, const PionDateTime& time_now) const;
+
+	/**
+	 * validates a signed session cookie
+	 *
+	 * @param token the value of the session cookie
+	 * @param time_now the current time
+	 *
+	 * @return PionUserPtr the user that the cookie was issued to, or null if it is
+	 *                     not valid, has expired, or the user no longer exists
+	 */
+	PionUserPtr checkSessionToken(const std::string& token, const PionDateTime& time_now) const;
+
+	/// returns the signature of a session cookie's payload
+	std::string signSessionToken(const std::string& payload) const;
+
 	
 private:
 	
@@ -160,6 +202,12 @@ private:
     /// random dice that uses m_random_gen to produce ints within m_random_range
 	boost::variate_generator<boost::mt19937&, boost::uniform_int<> >    m_random_die;
 
+	/// true if session cookies are signed, rather than kept in m_user_cache
+	bool						m_signed_sessions;
+
+	/// key used to sign session cookies
+	std::string					m_session_key;
+
 	/// time of the last cache clean up
 	PionDateTime				m_cache_cleanup_time;
 		
@@ -162,6 +162,11 @@ public:
 		return m_remote_ip;
 	}
 
+	/// returns IP address of the remote endpoint
+	inline const boost::asio::ip::address& getRemoteIp(void) const {
+		return m_remote_ip;
+	}
+
 	/// returns the major HTTP version number
 	inline boost::uint16_t getVersionMajor(void) const { return m_version_major; }
 
@@ -202,6 +207,11 @@ public:
 		return m_headers;
 	}
 
+	/// returns a reference to the HTTP headers
+	inline const Headers& getHeaders(void) const {
+		return m_headers;
+	}
+
 	/// returns true if at least one value for the header is defined
 	inline bool hasHeader(const std::string& key) const {
 		return(m_headers.find(key) != m_headers.end());
@@ -287,6 +297,9 @@ public:
 	/// if called, the content-length will not be sent in the HTTP headers
 	inline void setDoNotSendContentLength(void) { m_do_not_send_content_length = true; }
 
+	/// returns true if the content-length will not be sent in the HTTP headers
+	inline bool getDoNotSendContentLength(void) const { return m_do_not_send_content_length; }
+
 	/// return the data receival status
 	inline DataStatus getStatus() const { return m_status; }
 
@@ -18,6 +18,7 @@
 #include <pion/PionConfig.hpp>
 #include <pion/PionLogger.hpp>
 #include <pion/net/HTTPMessage.hpp>
+#include <pion/net/IPNetworkTrie.hpp>
 
 
 namespace pion {	// begin namespace pion
@@ -351,6 +352,76 @@ public:
 	 * @return bool true if a public IP address was found and extracted
 	 */
 	static bool parseForwardedFor(const std::string& header, std::string& public_ip);
+
+	/**
+	 * parses an X-Forwarded-For HTTP header that was added to by trusted
+	 * proxies, and extracts from it the address of the client that the
+	 * nearest trusted proxy received the request from
+	 *
+	 * @param header the X-Forwarded-For HTTP header to parse
+	 * @param trusted_proxies networks of the proxies that are trusted
+	 * @param client the client's IP address, if found
+	 *
+	 * @return bool true if an IP address was found and extracted
+	 */
+	static bool parseForwardedFor(const std::string& header,
+								  const IPNetworkTrie& trusted_proxies,
+								  boost::asio::ip::address& client);
+
+	/**
+	 * extracts the address of the client that made a request through trusted
+	 * proxies, from its X-Forwarded-For (or else Client-IP) HTTP headers
+	 *
+	 * @param http_msg the HTTP message that was received from a trusted proxy
+	 * @param trusted_proxies networks of the proxies that are trusted
+	 * @param client the client's IP address, if found
+	 *
+	 * @return bool true if an IP address was found and extracted
+	 */
+	static bool parseClientAddress(const HTTPMessage& http_msg,
+								   const IPNetworkTrie& trusted_proxies,
+								   boost::asio::ip::address& client);
+
+	/**
+	 * parses an IPv4 or IPv6 address that may be surrounded by spaces, and may
+	 * have a port ("192.0.2.1:8080", "[2001:db8::1]:8080")
+	 *
+	 * @param ptr points to the start of the address
+	 * @param len length of the address, in bytes
+	 * @param address the address that was parsed
+	 *
+	 * @return bool true if the address is valid
+	 */
+	static bool parseIPAddress(const char *ptr, const std::size_t len,
+							   boost::asio::ip::address& address);
+
+	/**
+	 * parses a Range HTTP header ("bytes=0-499,-500"), and finds which of its
+	 * ranges are satisfiable.  The header is not valid if it has a syntax
+	 * error, if it has too many ranges, or if the ranges overlap so much
+	 * that they are larger than the content (it should then be ignored).
+	 *
+	 * @param header the Range HTTP header to parse
+	 * @param content_length length of the content that the ranges select from
+	 * @param ranges the ranges that are satisfiable, in the order requested,
+	 *               with their last positions limited to the end of the content
+	 *
+	 * @return bool true if the header is valid (if none of its ranges are
+	 *              satisfiable, ranges is empty)
+	 */
+	static bool parseRange(const std::string& header, const boost::uint64_t content_length,
+						   HTTPTypes::ByteRanges& ranges);
+
+	/**
+	 * checks if an entity tag is in the list of an If-None-Match HTTP header
+	 * (using the weak comparison, so W/"x" matches "x")
+	 *
+	 * @param header the If-None-Match HTTP header to check ("*" or a list)
+	 * @param etag the entity tag of the current response, with its quotes
+	 *
+	 * @return bool true if the header matches the entity tag
+	 */
+	static bool matchETag(const std::string& header, const std::string& etag);
 	
 	/// returns an instance of HTTPParser::ErrorCategory
 	static inline ErrorCategory& getErrorCategory(void) {
@@ -494,6 +565,9 @@ protected:
 	/// maximum length for the value of a cookie; also used for path and domain
 	static const boost::uint32_t		COOKIE_VALUE_MAX;
 
+	/// maximum number of ranges in a Range header
+	static const boost::uint32_t		RANGES_MAX;
+
 
 	/// primary logging interface used by this class
 	mutable PionLogger					m_logger;
@@ -0,0 +1,241 @@
+// ------------------------------------------------------------------
+// pion-net: a C++ framework for building lightweight HTTP interfaces
+// ------------------------------------------------------------------
+// Copyright (C) 2007-2010 Atomic Labs, Inc.  (http://www.atomiclabs.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See http://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef __PION_HTTPRATELIMITER_HEADER__
+#define __PION_HTTPRATELIMITER_HEADER__
+
+#include <map>
+#include <string>
+#include <boost/asio.hpp>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/once.hpp>
+#include <pion/PionConfig.hpp>
+#include <pion/PionDateTime.hpp>
+#include <pion/net/TCPConnection.hpp>
+#include <pion/net/HTTPRequest.hpp>
+
+
+namespace pion {	// begin namespace pion
+namespace net {		// begin namespace net (Pion Network Library)
+
+///
+/// HTTPRateLimiter: limits the rate of requests that each client may make,
+///                  using a token bucket for each client and limited resource
+///
+/// Clients are identified by the remote IP address of their requests (which
+/// HTTPServer resolves for requests forwarded by trusted proxies).  The
+/// buckets are kept in a fixed number of slots that are claimed and updated
+/// with atomic operations, so that requests never wait for each other; a
+/// slot is reused once its bucket would have been refilled anyway.  If there
+/// is no slot left for a client, it is allowed.
+///
+class PION_NET_API HTTPRateLimiter :
+	private boost::noncopyable
+{
+public:
+
+	/// default number of token buckets that are kept
+	static const std::size_t		DEFAULT_CAPACITY;
+
+	/// maximum number of requests that a client may make at once
+	static const unsigned int		MAX_BURST;
+
+
+	/**
+	 * constructs a new rate limiter
+	 *
+	 * @param capacity number of token buckets that are kept
+	 */
+	explicit HTTPRateLimiter(std::size_t capacity = DEFAULT_CAPACITY);
+
+	/// virtual destructor
+	virtual ~HTTPRateLimiter() {}
+
+	/**
+	 * limits the requests that each client makes for a resource (and
+	 * everything within it); the limit of the longest matching resource applies
+	 *
+	 * @param resource the resource name or uri-stem to limit
+	 * @param rate number of requests per second that a client may make
+	 * @param burst number of requests that a client may make at once
+	 */
+	void setLimit(const std::string& resource, double rate, unsigned int burst);
+
+	/**
+	 * removes the limit for a resource
+	 *
+	 * @param resource the resource name or uri-stem to stop limiting
+	 */
+	void removeLimit(const std::string& resource);
+
+	/**
+	 * takes a token from the bucket of the client that made a request
+	 *
+	 * @param http_request the request (before any redirection)
+	 *
+	 * @return true if the request is allowed, or false if the client has
+	 *         made too many requests
+	 */
+	bool allow(const HTTPRequest& http_request);
+
+	/**
+	 * takes a token from the bucket of a client
+	 *
+	 * @param resource the resource requested
+	 * @param client the IP address of the client
+	 *
+	 * @return true if the request is allowed, or false if the client has
+	 *         made too many requests
+	 */
+	bool allow(const std::string& resource, const boost::asio::ip::address& client);
+
+	/**
+	 * sends a "429 Too Many Requests" response, and closes the connection
+	 *
+	 * @param tcp_conn the TCP connection that has the request
+	 * @param head_request true if the request is a HEAD request, so that the
+	 *                     response has no content
+	 */
+	static void sendTooManyRequests(TCPConnectionPtr& tcp_conn, bool head_request = false);
+
+	/// returns the number of requests that were allowed by a limit
+	unsigned long getAllowed(void) const;
+
+	/// returns the number of requests that were rejected by a limit
+	unsigned long getRejected(void) const;
+
+	/// returns the number of requests allowed because all of the slots were in use
+	unsigned long getOverflows(void) const;
+
+
+private:
+
+	/// a limit on the rate of requests (in units of 1/256 of a token)
+	struct Limit {
+		/// number of token units that a bucket gains each millisecond
+		double						m_refill;
+
+		/// maximum number of token units in a bucket
+		boost::uint64_t				m_burst;
+
+		/// hash of the limited resource, which is part of the buckets' keys
+		boost::uint64_t				m_hash;
+	};
+
+	/// data type for a map of resources to limits
+	typedef std::map<std::string, Limit>	LimitMap;
+
+	/// the limits; replaced (not changed) when they are updated
+	struct Config {
+		Config(void) : m_idle_time(1000) {}
+
+		/// limits for the resources
+		LimitMap								m_limits;
+
+		/// milliseconds after which any bucket would have been refilled
+		boost::uint64_t							m_idle_time;
+	};
+
+	/// data type for a pointer to an (immutable) configuration
+	typedef boost::shared_ptr<const Config>	ConfigPtr;
+
+	/// a token bucket; the state has the time it was last used, and its tokens
+	struct Slot {
+		boost::atomic<boost::uint64_t>		m_key;
+		boost::atomic<boost::uint64_t>		m_state;
+	};
+
+	/// a group of slots, and the number of requests that they have handled
+	struct Shard {
+		boost::scoped_array<Slot>			m_slots;
+		boost::atomic<unsigned long>		m_allowed;
+		boost::atomic<unsigned long>		m_rejected;
+		boost::atomic<unsigned long>		m_overflows;
+	};
+
+	/// number of shards that the slots are divided into
+	static const std::size_t		NUM_SHARDS;
+
+	/// number of slots that are searched for a bucket
+	static const std::size_t		MAX_PROBES;
+
+	/// number of bits in the state that hold the tokens
+	static const unsigned int		TOKEN_BITS;
+
+	/// number of units in one token
+	static const boost::uint64_t	TOKEN;
+
+	/// serializes the "429 Too Many Requests" responses (with and without content)
+	static void createTooManyRequestsResponses(void);
+
+	/// returns the limit of the longest resource that matches, or NULL
+	static const Limit *findLimit(const LimitMap& limits, const std::string& resource);
+
+	/// takes a token from the bucket of a client (using a configuration)
+	bool allow(const Config& config, const std::string& resource,
+			   const boost::asio::ip::address& client);
+
+	/**
+	 * takes a token from a bucket
+	 *
+	 * @param shard the shard that has the bucket
+	 * @param slot the slot that has the bucket
+	 * @param limit the limit of the bucket
+	 * @param time_now the current time, in milliseconds
+	 *
+	 * @return true if a token was taken
+	 */
+	static bool take(Shard& shard, Slot& slot, const Limit& limit, boost::uint64_t time_now);
+
+	/// publishes a new configuration (m_mutex must be locked)
+	void publish(boost::shared_ptr<Config> config);
+
+	/// returns the number of milliseconds since the limiter was constructed
+	boost::uint64_t getTime(void) const;
+
+
+	/// the current configuration
+	ConfigPtr						m_config;
+
+	/// the shards of the buckets
+	boost::scoped_array<Shard>		m_shards;
+
+	/// number of slots in each shard
+	const std::size_t				m_shard_size;
+
+	/// when the limiter was constructed (buckets' times are relative to it)
+	const PionDateTime				m_epoch;
+
+	/// mutex used to protect changes to the configuration
+	boost::mutex					m_mutex;
+
+	/// the "429 Too Many Requests" response, serialized once
+	static std::string *			m_response_ptr;
+
+	/// the same response without content, for HEAD requests
+	static std::string *			m_head_response_ptr;
+
+	/// used to serialize the responses only once
+	static boost::once_flag			m_responses_flag;
+};
+
+
+/// data type for a HTTPRateLimiter pointer
+typedef boost::shared_ptr<HTTPRateLimiter>	HTTPRateLimiterPtr;
+
+
+}	// end namespace net
+}	// end namespace pion
+
+#endif
@@ -11,6 +11,7 @@
 #define __PION_HTTPREQUEST_HEADER__
 
 #include <boost/shared_ptr.hpp>
+#include <boost/function/function2.hpp>
 #include <pion/PionConfig.hpp>
 #include <pion/net/HTTPMessage.hpp>
 #include <pion/net/PionUser.hpp>
@@ -27,6 +28,11 @@ class HTTPRequest
 {
 public:
 
+	/// type of function that is given a copy of the response to a request
+	/// (see setResponseCapture())
+	typedef boost::function2<void, const HTTPMessage&, const std::string&>	ResponseCapture;
+
+
 	/**
 	 * constructs a new HTTPRequest object
 	 *
@@ -50,6 +56,7 @@ public:
 		m_query_string.erase();
 		m_query_params.clear();
 		m_user_record.reset();
+		m_response_capture.clear();
 	}
 
 	/// the content length of the message can never be implied for requests
@@ -57,6 +64,15 @@ public:
 
 	/// returns the request method (i.e. GET, POST, PUT)
 	inline const std::string& getMethod(void) const { return m_method; }
+
+	/// returns true if the request method is idempotent, so that the request
+	/// may be sent again if its connection fails before a response arrives
+	inline bool isIdempotent(void) const {
+		return (m_method == HTTPTypes::REQUEST_METHOD_GET
+				|| m_method == HTTPTypes::REQUEST_METHOD_HEAD
+				|| m_method == HTTPTypes::REQUEST_METHOD_PUT
+				|| m_method == HTTPTypes::REQUEST_METHOD_DELETE);
+	}
 	
 	/// returns the resource uri-stem to be delivered (possibly the result of a redirect)
 	inline const std::string& getResource(void) const { return m_resource; }
@@ -148,6 +164,18 @@ public:
 	/// get the user record for HTTP request after authentication
 	inline PionUserPtr getUser() const { return m_user_record; }
 
+	/**
+	 * sets a function that is given the complete response to this request,
+	 * as sent by an HTTPResponseWriter in a single send() (responses that are
+	 * sent in chunks, or without a content-length, are not captured)
+	 *
+	 * @param h called with the response and all of the bytes that were sent
+	 */
+	inline void setResponseCapture(const ResponseCapture& h) { m_response_capture = h; }
+
+	/// returns the function that is given a copy of the response, if any
+	inline const ResponseCapture& getResponseCapture(void) const { return m_response_capture; }
+
 
 protected:
 
@@ -188,6 +216,9 @@ private:
 
 	/// pointer to PionUser record if this request had been authenticated 
 	PionUserPtr						m_user_record;
+
+	/// function that is given a copy of the response, if any
+	ResponseCapture					m_response_capture;
 };
 
 
@@ -123,6 +123,9 @@ protected:
 											  sendingChunkedMessage());
 	}
 
+	/// returns the HTTP message that is being sent
+	virtual HTTPMessage& getMessage(void) { return *m_http_request; }
+
 	/// returns a function bound to HTTPWriter::handleWrite()
 	virtual WriteHandler bindToWriteHandler(void) {
 		return boost::bind(&HTTPRequestWriter::handleWrite, shared_from_this(),
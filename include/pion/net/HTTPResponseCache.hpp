@@ -0,0 +1,341 @@
+// ------------------------------------------------------------------
+// pion-net: a C++ framework for building lightweight HTTP interfaces
+// ------------------------------------------------------------------
+// Copyright (C) 2007-2010 Atomic Labs, Inc.  (http://www.atomiclabs.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See http://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef __PION_HTTPRESPONSECACHE_HEADER__
+#define __PION_HTTPRESPONSECACHE_HEADER__
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/function/function1.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time_duration.hpp>
+#include <pion/PionConfig.hpp>
+#include <pion/PionDateTime.hpp>
+#include <pion/net/HTTPMessage.hpp>
+#include <pion/net/HTTPRequest.hpp>
+
+
+namespace pion {	// begin namespace pion
+namespace net {		// begin namespace net (Pion Network Library)
+
+///
+/// HTTPResponseCache: keeps complete, serialized responses to GET and HEAD
+///                    requests for a short time, so that they may be sent
+///                    again without running the request handler
+///
+/// Responses are only kept if they are "200 OK", set no cookies, are not
+/// marked no-store or private, and vary only by request headers that are
+/// part of the key.  Responses are discarded when they expire, or when the
+/// least recently used ones must make room for others.
+///
+/// While a response is not cached, the first request for it may be followed
+/// as a "flight" that identical requests join, so that they are answered
+/// with its response instead of running the request handler again.
+///
+class PION_NET_API HTTPResponseCache :
+	public boost::enable_shared_from_this<HTTPResponseCache>,
+	private boost::noncopyable
+{
+public:
+
+	/// how the responses for a resource are cached
+	struct Policy {
+		Policy(void) : m_ttl(0) {}
+
+		/// number of seconds that a response is reused for
+		unsigned int				m_ttl;
+
+		/// query parameters that the responses depend upon
+		std::vector<std::string>	m_query_keys;
+
+		/// request headers that the responses depend upon
+		std::vector<std::string>	m_header_keys;
+	};
+
+	/// data type for a pointer to a caching policy
+	typedef boost::shared_ptr<const Policy>			PolicyPtr;
+
+	/// data type for a map of resources to caching policies
+	typedef std::map<std::string, PolicyPtr>		PolicyMap;
+
+	/// data type for a pointer to the bytes of a cached response
+	typedef boost::shared_ptr<const std::string>	ResponsePtr;
+
+	/// type of function called for a request that joined a flight, with the
+	/// response to send, or null if the request must be handled on its own
+	typedef boost::function1<void, ResponsePtr>		Waiter;
+
+	/// a request whose response identical requests are waiting for
+	class Flight;
+
+	/// data type for a pointer to a flight
+	typedef boost::shared_ptr<Flight>				FlightPtr;
+
+
+	/// default maximum number of bytes for all of the cached responses
+	static const std::size_t	DEFAULT_MAX_SIZE;
+
+
+	/**
+	 * constructs a new response cache
+	 *
+	 * @param max_size maximum number of bytes for all of the cached responses
+	 */
+	explicit HTTPResponseCache(std::size_t max_size = DEFAULT_MAX_SIZE)
+		: m_max_size(max_size), m_size(0), m_hits(0), m_misses(0), m_evictions(0),
+		m_coalesced(0), m_coalesce_timeouts(0), m_epoch(0)
+	{}
+
+	/**
+	 * returns the key that the response to a request is cached with
+	 *
+	 * @param policy the caching policy for the resource requested
+	 * @param http_request the request (after any redirection)
+	 * @param keep_alive true if the connection will be kept alive, which
+	 *                   changes the Connection header of the response
+	 */
+	static std::string makeKey(const Policy& policy, const HTTPRequest& http_request,
+							   bool keep_alive);
+
+	/**
+	 * finds a response that has not expired
+	 *
+	 * @param key the key of the request
+	 * @param etag_ptr if not null, set to the response's entity tag (ETag
+	 *                 header), or to an empty string if it has none
+	 *
+	 * @return ResponsePtr the bytes of the response, or null if there is none
+	 */
+	ResponsePtr find(const std::string& key, std::string *etag_ptr = NULL);
+
+	/**
+	 * keeps a response, if it may be cached (used as a HTTPRequest::ResponseCapture)
+	 *
+	 * @param policy the caching policy for the resource requested
+	 * @param key the key of the request
+	 * @param http_response the response that was sent
+	 * @param response_bytes all of the bytes that were sent
+	 *
+	 * @return ResponsePtr the bytes of the response, or null if it was not kept
+	 */
+	ResponsePtr store(PolicyPtr policy, const std::string& key,
+					  const HTTPMessage& http_response, const std::string& response_bytes);
+
+	/**
+	 * joins the flight for a request, or starts a new one if there is none
+	 * (the cache must be managed by a HTTPResponseCachePtr)
+	 *
+	 * @param policy the caching policy for the resource requested
+	 * @param key the key of the request
+	 * @param io_service used to call the waiter and to time out the wait
+	 * @param waiter called once, when the flight lands or the wait times out
+	 * @param timeout maximum number of milliseconds to wait for the flight
+	 *
+	 * @return FlightPtr a new flight, whose response must be captured with
+	 *                   Flight::land(), or null if the waiter joined one
+	 */
+	FlightPtr join(PolicyPtr policy, const std::string& key,
+				   boost::asio::io_service& io_service, Waiter waiter,
+				   boost::uint32_t timeout);
+
+	/// sets the maximum number of bytes for all of the cached responses
+	void setMaxSize(std::size_t max_size);
+
+	/// discards all of the cached responses
+	void clear(void);
+
+	/// releases all of the requests waiting for flights, without calling
+	/// their waiters (including those that are about to be called)
+	void cancelWaiters(void);
+
+	/// returns the number of bytes in the cached responses
+	std::size_t getSize(void) const;
+
+	/// returns the number of requests that were answered from the cache
+	unsigned long getHits(void) const;
+
+	/// returns the number of requests that were not answered from the cache
+	unsigned long getMisses(void) const;
+
+	/// returns the number of responses discarded to make room for others
+	unsigned long getEvictions(void) const;
+
+	/// returns the number of requests that were answered with another's response
+	unsigned long getCoalesced(void) const;
+
+	/// returns the number of requests that stopped waiting for another's response
+	unsigned long getCoalesceTimeouts(void) const;
+
+
+private:
+
+	/// a cached response
+	struct Entry {
+		std::string				m_key;
+		ResponsePtr				m_response;
+		std::string				m_etag;
+		PionDateTime			m_expires;
+	};
+
+	/// data type for entries ordered by when they were last used (most recent first)
+	typedef std::list<Entry>								EntryList;
+
+	/// data type used to index the entries by their keys
+	typedef std::map<std::string, EntryList::iterator>		EntryIndex;
+
+	/// a request that is waiting for a flight
+	struct Passenger {
+		Passenger(boost::asio::io_service& io_service, Waiter waiter)
+			: m_io_service(io_service), m_waiter(waiter), m_timer(io_service),
+			m_done(false), m_epoch(0)
+		{}
+		boost::asio::io_service&	m_io_service;
+		Waiter						m_waiter;
+		boost::asio::deadline_timer	m_timer;
+		bool						m_done;
+		unsigned long				m_epoch;
+	};
+
+	/// data type for a pointer to a passenger
+	typedef boost::shared_ptr<Passenger>					PassengerPtr;
+
+	/// data type used to find the flights by their keys
+	typedef std::map<std::string, Flight*>					FlightIndex;
+
+	/// Flight calls finish() when it lands or is abandoned
+	friend class Flight;
+
+	/**
+	 * ends a flight, and calls its passengers that are still waiting
+	 *
+	 * @param flight the flight that has ended
+	 * @param response the bytes of its response, or null if it was not cached
+	 */
+	void finish(Flight& flight, ResponsePtr response);
+
+	/// called when a passenger's wait has timed out
+	void expire(PassengerPtr passenger, const boost::system::error_code& ec);
+
+	/// calls a passenger's waiter, unless it has been cancelled
+	void deliver(PassengerPtr passenger, ResponsePtr response);
+
+
+	/// removes the least recently used entries until the size is within max_size
+	void evict(std::size_t max_size);
+
+	/// removes an entry
+	void erase(EntryIndex::iterator index_itr);
+
+
+	/// cached responses, most recently used first
+	EntryList					m_entries;
+
+	/// index of the cached responses by their keys
+	EntryIndex					m_index;
+
+	/// maximum number of bytes for all of the cached responses
+	std::size_t					m_max_size;
+
+	/// number of bytes in the cached responses
+	std::size_t					m_size;
+
+	/// number of requests that were answered from the cache
+	unsigned long				m_hits;
+
+	/// number of requests that were not answered from the cache
+	unsigned long				m_misses;
+
+	/// number of responses discarded to make room for others
+	unsigned long				m_evictions;
+
+	/// number of requests that were answered with another's response
+	unsigned long				m_coalesced;
+
+	/// number of requests that stopped waiting for another's response
+	unsigned long				m_coalesce_timeouts;
+
+	/// flights that requests may join, by their keys
+	FlightIndex					m_flights;
+
+	/// incremented when the waiters are cancelled (passengers that joined
+	/// before then are not called)
+	unsigned long				m_epoch;
+
+	/// mutex used to protect the cached responses and the flights
+	mutable boost::mutex		m_mutex;
+};
+
+
+/// data type for a HTTPResponseCache pointer
+typedef boost::shared_ptr<HTTPResponseCache>	HTTPResponseCachePtr;
+
+
+///
+/// HTTPResponseCache::Flight: the first request for a response that is not
+///                            cached; if it is destroyed without landing,
+///                            its passengers are handled on their own
+///
+class PION_NET_API HTTPResponseCache::Flight :
+	private boost::noncopyable
+{
+public:
+
+	/// releases any passengers that are still waiting
+	~Flight() { m_cache->finish(*this, ResponsePtr()); }
+
+	/**
+	 * caches the response and sends it to the passengers
+	 * (used as a HTTPRequest::ResponseCapture)
+	 *
+	 * @param http_response the response that was sent
+	 * @param response_bytes all of the bytes that were sent
+	 */
+	inline void land(const HTTPMessage& http_response, const std::string& response_bytes) {
+		m_cache->finish(*this, m_cache->store(m_policy, m_key, http_response, response_bytes));
+	}
+
+
+private:
+
+	/// only the cache creates flights
+	friend class HTTPResponseCache;
+
+	/// constructs a new flight
+	Flight(HTTPResponseCachePtr cache, PolicyPtr policy, const std::string& key)
+		: m_cache(cache), m_policy(policy), m_key(key), m_landed(false)
+	{}
+
+	/// the cache that the response is kept in
+	HTTPResponseCachePtr		m_cache;
+
+	/// the caching policy for the resource requested
+	PolicyPtr					m_policy;
+
+	/// the key of the request
+	const std::string			m_key;
+
+	/// requests waiting for the response (protected by the cache's mutex)
+	std::vector<PassengerPtr>	m_passengers;
+
+	/// true once the flight has ended (protected by the cache's mutex)
+	bool						m_landed;
+};
+
+
+}	// end namespace net
+}	// end namespace pion
+
+#endif
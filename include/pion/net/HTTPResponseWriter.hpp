@@ -114,6 +114,11 @@ protected:
 		setLogger(PION_GET_LOGGER("pion.net.HTTPResponseWriter"));
 		// tell the HTTPWriter base class whether or not the client supports chunks
 		supportsChunkedMessages(m_http_response->getChunksSupported());
+		// and which content-codings it accepts (used if compression is enabled)
+		setAcceptEncoding(http_request.getHeader(HTTPTypes::HEADER_ACCEPT_ENCODING));
+		// and whether the response is wanted by anything else (such as a cache)
+		if (http_request.getResponseCapture())
+			setCaptureHandler(http_request.getResponseCapture());
 	}
 	
 	
@@ -130,6 +135,9 @@ protected:
 											   sendingChunkedMessage());
 	}	
 
+	/// returns the HTTP message that is being sent
+	virtual HTTPMessage& getMessage(void) { return *m_http_response; }
+
 	/// returns a function bound to HTTPWriter::handleWrite()
 	virtual WriteHandler bindToWriteHandler(void) {
 		return boost::bind(&HTTPResponseWriter::handleWrite, shared_from_this(),
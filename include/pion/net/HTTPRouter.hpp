@@ -0,0 +1,226 @@
+// ------------------------------------------------------------------
+// pion-net: a C++ framework for building lightweight HTTP interfaces
+// ------------------------------------------------------------------
+// Copyright (C) 2007-2010 Atomic Labs, Inc.  (http://www.atomiclabs.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See http://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef __PION_HTTPROUTER_HEADER__
+#define __PION_HTTPROUTER_HEADER__
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/function/function2.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <pion/PionConfig.hpp>
+#include <pion/net/TCPConnection.hpp>
+#include <pion/net/HTTPRequest.hpp>
+#include <pion/net/HTTPResponseCache.hpp>
+
+
+namespace pion {	// begin namespace pion
+namespace net {		// begin namespace net (Pion Network Library)
+
+///
+/// HTTPRouter: an immutable prefix trie of resource path segments, used to
+///             find the request handler for a resource
+///
+/// A resource matches a registered resource if they are equal, or if the
+/// registered resource is followed by a '/' in it; the longest match wins.
+/// The empty resource matches every request.  Redirections, authentication
+/// rules and caching policies are resolved when the router is built, so a
+/// lookup walks the trie only once.
+///
+/// Routers are never changed after they have been built, so any number of
+/// threads may use one without locking.
+///
+class PION_NET_API HTTPRouter :
+	private boost::noncopyable
+{
+public:
+
+	/// type of function that is used to handle requests
+	typedef boost::function2<void, HTTPRequestPtr&, TCPConnectionPtr&>	RequestHandler;
+
+	/// data type for a map of resources to request handlers
+	typedef std::map<std::string, RequestHandler>	ResourceMap;
+
+	/// data type for a map of requested resources to other resources
+	typedef std::map<std::string, std::string>		RedirectMap;
+
+	/// data type for a set of resources that authentication rules apply to
+	typedef std::set<std::string>					AuthResourceSet;
+
+	/// result of looking up a resource
+	struct Match {
+		Match(void)
+			: m_handler(NULL), m_redirect(NULL), m_too_many_redirects(false),
+			m_auth_required(false)
+		{}
+
+		/// the handler for the (redirected) resource, or NULL if there is none
+		const RequestHandler *	m_handler;
+
+		/// the resource that the request is redirected to, or NULL if it is not
+		const std::string *		m_redirect;
+
+		/// true if the redirections loop or exceed the maximum allowed
+		bool					m_too_many_redirects;
+
+		/// true if the (redirected) resource is restricted and not permitted
+		bool					m_auth_required;
+
+		/// caching policy of the (redirected) resource, or null if it is not cached
+		HTTPResponseCache::PolicyPtr	m_cache_policy;
+	};
+
+
+	/**
+	 * builds a new router
+	 *
+	 * @param resources resources recognized, without trailing slashes
+	 * @param redirects requested resources that are redirected to others
+	 * @param max_redirects maximum length of a chain of redirections
+	 * @param restrict_list resources that require authentication
+	 * @param white_list resources that do not require authentication, even
+	 *                   if they are within a restricted resource
+	 * @param cache_policies resources whose responses may be cached
+	 */
+	HTTPRouter(const ResourceMap& resources, const RedirectMap& redirects,
+			   unsigned int max_redirects,
+			   const AuthResourceSet& restrict_list = AuthResourceSet(),
+			   const AuthResourceSet& white_list = AuthResourceSet(),
+			   const HTTPResponseCache::PolicyMap& cache_policies = HTTPResponseCache::PolicyMap());
+
+	/**
+	 * finds the handler for a resource, after applying any redirection
+	 *
+	 * @param resource the resource requested (without a trailing slash)
+	 *
+	 * @return Match pointers into the router, valid for the router's lifetime
+	 */
+	Match find(const std::string& resource) const;
+
+	/**
+	 * finds the handler for a resource, without applying any redirection
+	 *
+	 * @param resource the resource requested (without a trailing slash)
+	 *
+	 * @return const RequestHandler* the handler, or NULL if there is none
+	 */
+	const RequestHandler *findHandler(const std::string& resource) const;
+
+	/// returns true if there are no resources or redirections
+	inline bool empty(void) const { return m_empty; }
+
+
+private:
+
+	/// what is found while walking the trie along a resource
+	struct Route {
+		Route(void) : m_handler(NULL), m_restricted(false), m_permitted(false) {}
+
+		/// true if the resource is restricted and not permitted
+		inline bool authRequired(void) const { return m_restricted && ! m_permitted; }
+
+		/// the handler of the longest matching resource, or NULL
+		const RequestHandler *	m_handler;
+
+		/// true if any matching resource requires authentication
+		bool					m_restricted;
+
+		/// true if any matching resource is exempt from authentication
+		bool					m_permitted;
+
+		/// the caching policy of the longest matching resource that has one
+		HTTPResponseCache::PolicyPtr	m_cache_policy;
+	};
+
+	/// a redirection that has been resolved to its final resource
+	struct Redirect {
+		Redirect(void) : m_too_many_redirects(false) {}
+		std::string				m_resource;
+		Route					m_route;
+		bool					m_too_many_redirects;
+	};
+
+	/// a node of the trie, for one or more path segments
+	struct Node;
+
+	/// data type for a pointer to a trie node
+	typedef boost::shared_ptr<Node>		NodePtr;
+
+	struct Node {
+		Node(void) : m_handler(NULL), m_restricted(false), m_permitted(false) {}
+
+		/// path segments from the parent node (only the root has none)
+		std::vector<std::string>	m_segments;
+
+		/// child nodes, ordered by their first path segment
+		std::vector<NodePtr>		m_children;
+
+		/// handler registered for the node's resource, or NULL
+		const RequestHandler *		m_handler;
+
+		/// redirection for the node's resource (exact matches only)
+		boost::shared_ptr<Redirect>	m_redirect;
+
+		/// true if the node's resource requires authentication
+		bool						m_restricted;
+
+		/// true if the node's resource does not require authentication
+		bool						m_permitted;
+
+		/// caching policy for the node's resource, or null
+		HTTPResponseCache::PolicyPtr	m_cache_policy;
+	};
+
+	/// returns the node for a resource, creating it (and splitting others) if necessary
+	Node& insert(const std::string& resource);
+
+	/**
+	 * walks the trie along a resource
+	 *
+	 * @param resource the resource to walk along
+	 * @param route updated with the handler and rules of the matching resources
+	 *
+	 * @return const Node* the node that matches the whole resource, or NULL
+	 */
+	const Node *walk(const std::string& resource, Route& route) const;
+
+	/// updates a route with the handler, rules and policy of a matching node
+	static inline void visit(const Node& node, Route& route) {
+		if (node.m_handler != NULL)
+			route.m_handler = node.m_handler;
+		route.m_restricted |= node.m_restricted;
+		route.m_permitted |= node.m_permitted;
+		if (node.m_cache_policy)
+			route.m_cache_policy = node.m_cache_policy;
+	}
+
+
+	/// the root node, for the empty resource
+	Node					m_root;
+
+	/// handlers for the resources, referred to by the nodes
+	ResourceMap				m_resources;
+
+	/// true if there are no resources or redirections
+	bool					m_empty;
+};
+
+
+/// data type for a pointer to an (immutable) HTTPRouter
+typedef boost::shared_ptr<const HTTPRouter>		HTTPRouterPtr;
+
+
+}	// end namespace net
+}	// end namespace pion
+
+#endif
@@ -12,6 +12,7 @@
 
 #include <map>
 #include <string>
+#include <vector>
 #include <boost/asio.hpp>
 #include <boost/function.hpp>
 #include <boost/function/function2.hpp>
@@ -24,6 +25,10 @@
 #include <pion/net/HTTPRequest.hpp>
 #include <pion/net/HTTPAuth.hpp>
 #include <pion/net/HTTPParser.hpp>
+#include <pion/net/HTTPRouter.hpp>
+#include <pion/net/HTTPResponseCache.hpp>
+#include <pion/net/HTTPRateLimiter.hpp>
+#include <pion/net/IPNetworkTrie.hpp>
 
 
 namespace pion {	// begin namespace pion
@@ -39,7 +44,7 @@ class PION_NET_API HTTPServer :
 public:
 
 	/// type of function that is used to handle requests
-	typedef boost::function2<void, HTTPRequestPtr&, TCPConnectionPtr&>	RequestHandler;
+	typedef HTTPRouter::RequestHandler	RequestHandler;
 
 	/// handler for requests that result in "500 Server Error"
 	typedef boost::function3<void, HTTPRequestPtr&, TCPConnectionPtr&,
@@ -47,7 +52,10 @@ public:
 
 
 	/// default destructor
-	virtual ~HTTPServer() { if (isListening()) stop(); }
+	virtual ~HTTPServer() {
+		if (isListening()) stop();
+		if (m_auth) m_auth->setUpdateHandler(this, HTTPAuth::UpdateHandler());
+	}
 
 	/**
 	 * creates a new HTTPServer object
@@ -59,6 +67,8 @@ public:
 		m_bad_request_handler(HTTPServer::handleBadRequest),
 		m_not_found_handler(HTTPServer::handleNotFoundRequest),
 		m_server_error_handler(HTTPServer::handleServerError),
+		m_response_cache(new HTTPResponseCache),
+		m_coalesce_timeout(DEFAULT_COALESCE_TIMEOUT),
 		m_max_content_length(HTTPParser::DEFAULT_CONTENT_MAX)
 	{ 
 		setLogger(PION_GET_LOGGER("pion.net.HTTPServer"));
@@ -74,6 +84,8 @@ public:
 		m_bad_request_handler(HTTPServer::handleBadRequest),
 		m_not_found_handler(HTTPServer::handleNotFoundRequest),
 		m_server_error_handler(HTTPServer::handleServerError),
+		m_response_cache(new HTTPResponseCache),
+		m_coalesce_timeout(DEFAULT_COALESCE_TIMEOUT),
 		m_max_content_length(HTTPParser::DEFAULT_CONTENT_MAX)
 	{ 
 		setLogger(PION_GET_LOGGER("pion.net.HTTPServer"));
@@ -90,6 +102,8 @@ public:
 		m_bad_request_handler(HTTPServer::handleBadRequest),
 		m_not_found_handler(HTTPServer::handleNotFoundRequest),
 		m_server_error_handler(HTTPServer::handleServerError),
+		m_response_cache(new HTTPResponseCache),
+		m_coalesce_timeout(DEFAULT_COALESCE_TIMEOUT),
 		m_max_content_length(HTTPParser::DEFAULT_CONTENT_MAX)
 	{ 
 		setLogger(PION_GET_LOGGER("pion.net.HTTPServer"));
@@ -106,6 +120,8 @@ public:
 		m_bad_request_handler(HTTPServer::handleBadRequest),
 		m_not_found_handler(HTTPServer::handleNotFoundRequest),
 		m_server_error_handler(HTTPServer::handleServerError),
+		m_response_cache(new HTTPResponseCache),
+		m_coalesce_timeout(DEFAULT_COALESCE_TIMEOUT),
 		m_max_content_length(HTTPParser::DEFAULT_CONTENT_MAX)
 	{ 
 		setLogger(PION_GET_LOGGER("pion.net.HTTPServer"));
@@ -134,6 +150,44 @@ public:
 	 */
 	void addRedirect(const std::string& requested_resource, const std::string& new_resource);
 
+	/**
+	 * caches the responses to GET and HEAD requests for a resource (and
+	 * everything within it), so that the request handler is not run again
+	 * until they expire; only responses that do not depend upon anything
+	 * but the request's method, resource, version and the given keys are
+	 * safe to cache.  Identical requests that arrive while a response is
+	 * not cached wait for the first one, instead of running the handler too.
+	 *
+	 * @param resource the resource name or uri-stem whose responses are cached
+	 * @param ttl number of seconds that a response is reused for
+	 * @param query_keys query parameters that the responses depend upon
+	 * @param header_keys request headers that the responses depend upon
+	 */
+	void addCachedResource(const std::string& resource, unsigned int ttl,
+						   const std::vector<std::string>& query_keys = std::vector<std::string>(),
+						   const std::vector<std::string>& header_keys = std::vector<std::string>());
+
+	/**
+	 * stops caching the responses for a resource
+	 *
+	 * @param resource the resource name or uri-stem whose responses are cached
+	 */
+	void removeCachedResource(const std::string& resource);
+
+	/// sets the maximum number of bytes for all of the cached responses
+	inline void setResponseCacheSize(std::size_t n) { m_response_cache->setMaxSize(n); }
+
+	/// returns the cache of responses
+	inline HTTPResponseCache& getResponseCache(void) { return *m_response_cache; }
+
+	/**
+	 * sets the maximum time that a request for a cached resource waits for an
+	 * identical request that is being handled, before it is handled on its own
+	 *
+	 * @param n number of milliseconds, or 0 to never wait for other requests
+	 */
+	inline void setCoalesceTimeout(boost::uint32_t n) { m_coalesce_timeout = n; }
+
 	/// sets the function that handles bad HTTP requests
 	inline void setBadRequestHandler(RequestHandler h) { m_bad_request_handler = h; }
 
@@ -148,6 +202,9 @@ public:
 		if (isListening()) stop();
 		boost::mutex::scoped_lock resource_lock(m_resource_mutex);
 		m_resources.clear();
+		m_cache_policies.clear();
+		updateRouter();
+		m_response_cache->clear();
 	}
 
 	/**
@@ -216,12 +273,26 @@ public:
 
 	/**
 	 * sets the handler object for authentication verification processing
+	 * (its rules are compiled into the router, and again whenever they change)
 	 */ 
-	inline void setAuthentication(HTTPAuthPtr auth) { m_auth = auth; }
+	void setAuthentication(HTTPAuthPtr auth);
 
 	/// sets the maximum length for HTTP request payload content
 	inline void setMaxContentLength(std::size_t n) { m_max_content_length = n; }
 
+	/// sets the rate limiter that is checked before requests are routed
+	inline void setRateLimiter(HTTPRateLimiterPtr limiter) { boost::atomic_store(&m_rate_limiter, limiter); }
+
+	/**
+	 * trusts the proxies in a network to forward the addresses of their
+	 * clients (using the X-Forwarded-For or Client-IP headers); the remote IP
+	 * address of their requests is changed to their client's address
+	 *
+	 * @param network an address with a prefix length ("10.0.0.0/8"), or a
+	 *                single address
+	 */
+	void addTrustedProxy(const std::string& network);
+
 protected:
 
 	/**
@@ -242,25 +313,105 @@ protected:
 		TCPConnectionPtr& tcp_conn, const boost::system::error_code& ec);
 
 	/**
-	 * searches for the appropriate request handler to use for a given resource
+	 * searches for the appropriate request handler to use for a given resource,
+	 * without applying any redirection (handleRequest() does not call this;
+	 * override selectRequestHandler() to change how requests are routed)
 	 *
 	 * @param resource the name of the resource to search for
 	 * @param request_handler function that can handle requests for this resource
 	 */
-	virtual bool findRequestHandler(const std::string& resource,
+	bool findRequestHandler(const std::string& resource,
 							RequestHandler& request_handler) const;
 
+	/**
+	 * chooses the request handler for a request, after the router has found
+	 * the resource's handler (and applied any redirection) in a single lookup
+	 *
+	 * @param resource the (redirected) resource requested
+	 * @param match what the router found for the resource
+	 *
+	 * @return const RequestHandler* the handler to use, or NULL if none is
+	 *         found; it must stay valid until the request has been handled,
+	 *         as match.m_handler does (the default)
+	 */
+	virtual const RequestHandler *selectRequestHandler(const std::string& resource,
+													   const HTTPRouter::Match& match);
+
+	/// releases requests that are waiting for identical ones, since they are
+	/// bound to this server and hold their connections open, and cancels the
+	/// authentication's timers, which may never run once the server stops
+	virtual void beforeStopping(void) {
+		m_response_cache->cancelWaiters();
+		if (m_auth) m_auth->cancelTimers();
+	}
+
 
 private:
 
 	/// maximum number of redirections
 	static const unsigned int	MAX_REDIRECTS;
 
+	/// default number of milliseconds that requests wait for identical ones
+	static const boost::uint32_t	DEFAULT_COALESCE_TIMEOUT;
+
 	/// data type for a map of resources to request handlers
-	typedef std::map<std::string, RequestHandler>	ResourceMap;
+	typedef HTTPRouter::ResourceMap		ResourceMap;
 
 	/// data type for a map of requested resources to other resources
-	typedef std::map<std::string, std::string>		RedirectMap;
+	typedef HTTPRouter::RedirectMap		RedirectMap;
+
+
+	/// publishes a new router for the resources (m_resource_mutex must be locked)
+	void updateRouter(void);
+
+	/// publishes a new router after the authentication rules have changed
+	void updateAuthentication(void);
+
+	/**
+	 * runs a request handler, sending a server error if it throws an exception
+	 *
+	 * @param http_request the HTTP request to handle
+	 * @param tcp_conn TCP connection containing the request
+	 * @param request_handler the handler for the requested resource
+	 */
+	void runRequestHandler(HTTPRequestPtr& http_request, TCPConnectionPtr& tcp_conn,
+						   const RequestHandler& request_handler);
+
+	/**
+	 * handles a request after the identical request that it waited for has finished
+	 *
+	 * @param http_request the HTTP request to handle
+	 * @param tcp_conn TCP connection containing the request
+	 * @param router keeps the request handler valid while the request waited
+	 * @param request_handler the handler for the requested resource
+	 * @param policy the caching policy for the requested resource
+	 * @param key the key that the response is cached with
+	 * @param response the response to send, or null to run the handler
+	 */
+	void resumeRequest(HTTPRequestPtr& http_request, TCPConnectionPtr& tcp_conn,
+					   HTTPRouterPtr router, const RequestHandler *request_handler,
+					   HTTPResponseCache::PolicyPtr policy, const std::string& key,
+					   HTTPResponseCache::ResponsePtr response);
+
+	/**
+	 * sends a "304 Not Modified" response to a conditional request whose
+	 * If-None-Match header matches a cached response
+	 *
+	 * @param http_request the conditional request
+	 * @param tcp_conn the TCP connection to send the response over
+	 * @param etag the entity tag of the cached response
+	 */
+	static void sendNotModifiedResponse(HTTPRequestPtr& http_request, TCPConnectionPtr& tcp_conn,
+										const std::string& etag);
+
+	/// sends the bytes of a cached response
+	static void sendCachedResponse(TCPConnectionPtr& tcp_conn,
+								   HTTPResponseCache::ResponsePtr response);
+
+	/// finishes a connection after a cached response has been sent
+	static void finishCachedResponse(TCPConnectionPtr& tcp_conn,
+									 HTTPResponseCache::ResponsePtr response,
+									 const boost::system::error_code& write_error);
 
 
 	/// collection of resources that are recognized by this HTTP server
@@ -269,6 +420,9 @@ private:
 	/// collection of redirections from a requested resource to another resource
 	RedirectMap					m_redirects;
 
+	/// collection of resources whose responses are cached
+	HTTPResponseCache::PolicyMap	m_cache_policies;
+
 	/// points to a function that handles bad HTTP requests
 	RequestHandler				m_bad_request_handler;
 
@@ -278,12 +432,27 @@ private:
 	/// points to the function that handles server errors
 	ServerErrorHandler			m_server_error_handler;
 
-	/// mutex used to protect access to the resources
+	/// finds request handlers; replaced (not changed) when resources are updated
+	HTTPRouterPtr				m_router;
+
+	/// mutex used to protect changes to the resources
 	mutable boost::mutex		m_resource_mutex;
 
 	/// pointer to authentication handler object
 	HTTPAuthPtr					m_auth;
 
+	/// pointer to the rate limiter, if requests are limited
+	HTTPRateLimiterPtr			m_rate_limiter;
+
+	/// networks of the trusted proxies; replaced (not changed) when one is added
+	IPNetworkTriePtr			m_trusted_proxies;
+
+	/// responses kept for the cached resources (shared with the responses being captured)
+	HTTPResponseCachePtr		m_response_cache;
+
+	/// number of milliseconds that requests wait for identical ones (0 to not wait)
+	boost::uint32_t				m_coalesce_timeout;
+
 	/// maximum length for HTTP request payload content
 	std::size_t					m_max_content_length;
 };
@@ -11,6 +11,9 @@
 #define __PION_HTTPTYPES_HEADER__
 
 #include <string>
+#include <vector>
+#include <utility>
+#include <boost/cstdint.hpp>
 #include <pion/PionConfig.hpp>
 #include <pion/PionHashMap.hpp>
 
@@ -41,8 +44,17 @@ struct PION_NET_API HTTPTypes
 	static const std::string	HEADER_CONTENT_LENGTH;
 	static const std::string	HEADER_CONTENT_LOCATION;
 	static const std::string	HEADER_CONTENT_ENCODING;
+	static const std::string	HEADER_ACCEPT_ENCODING;
+	static const std::string	HEADER_VARY;
+	static const std::string	HEADER_CACHE_CONTROL;
 	static const std::string	HEADER_LAST_MODIFIED;
 	static const std::string	HEADER_IF_MODIFIED_SINCE;
+	static const std::string	HEADER_ETAG;
+	static const std::string	HEADER_IF_NONE_MATCH;
+	static const std::string	HEADER_RANGE;
+	static const std::string	HEADER_IF_RANGE;
+	static const std::string	HEADER_CONTENT_RANGE;
+	static const std::string	HEADER_ACCEPT_RANGES;
 	static const std::string	HEADER_TRANSFER_ENCODING;
 	static const std::string	HEADER_LOCATION;
 	static const std::string	HEADER_AUTHORIZATION;
@@ -69,6 +81,7 @@ struct PION_NET_API HTTPTypes
 	static const std::string	RESPONSE_MESSAGE_CREATED;
 	static const std::string	RESPONSE_MESSAGE_ACCEPTED;
 	static const std::string	RESPONSE_MESSAGE_NO_CONTENT;
+	static const std::string	RESPONSE_MESSAGE_PARTIAL_CONTENT;
 	static const std::string	RESPONSE_MESSAGE_FOUND;
 	static const std::string	RESPONSE_MESSAGE_UNAUTHORIZED;
 	static const std::string	RESPONSE_MESSAGE_FORBIDDEN;
@@ -76,8 +89,11 @@ struct PION_NET_API HTTPTypes
 	static const std::string	RESPONSE_MESSAGE_METHOD_NOT_ALLOWED;
 	static const std::string	RESPONSE_MESSAGE_NOT_MODIFIED;
 	static const std::string	RESPONSE_MESSAGE_BAD_REQUEST;
+	static const std::string	RESPONSE_MESSAGE_RANGE_NOT_SATISFIABLE;
+	static const std::string	RESPONSE_MESSAGE_TOO_MANY_REQUESTS;
 	static const std::string	RESPONSE_MESSAGE_SERVER_ERROR;
 	static const std::string	RESPONSE_MESSAGE_NOT_IMPLEMENTED;
+	static const std::string	RESPONSE_MESSAGE_BAD_GATEWAY;
 	static const std::string	RESPONSE_MESSAGE_CONTINUE;
 
 	// common HTTP response codes
@@ -85,6 +101,7 @@ struct PION_NET_API HTTPTypes
 	static const unsigned int	RESPONSE_CODE_CREATED;
 	static const unsigned int	RESPONSE_CODE_ACCEPTED;
 	static const unsigned int	RESPONSE_CODE_NO_CONTENT;
+	static const unsigned int	RESPONSE_CODE_PARTIAL_CONTENT;
 	static const unsigned int	RESPONSE_CODE_FOUND;
 	static const unsigned int	RESPONSE_CODE_UNAUTHORIZED;
 	static const unsigned int	RESPONSE_CODE_FORBIDDEN;
@@ -92,8 +109,11 @@ struct PION_NET_API HTTPTypes
 	static const unsigned int	RESPONSE_CODE_METHOD_NOT_ALLOWED;
 	static const unsigned int	RESPONSE_CODE_NOT_MODIFIED;
 	static const unsigned int	RESPONSE_CODE_BAD_REQUEST;
+	static const unsigned int	RESPONSE_CODE_RANGE_NOT_SATISFIABLE;
+	static const unsigned int	RESPONSE_CODE_TOO_MANY_REQUESTS;
 	static const unsigned int	RESPONSE_CODE_SERVER_ERROR;
 	static const unsigned int	RESPONSE_CODE_NOT_IMPLEMENTED;
+	static const unsigned int	RESPONSE_CODE_BAD_GATEWAY;
 	static const unsigned int	RESPONSE_CODE_CONTINUE;
 	
 	/// data type for HTTP headers
@@ -105,6 +125,12 @@ struct PION_NET_API HTTPTypes
 	/// data type for HTTP query parameters
 	typedef StringDictionary	QueryParams;
 
+	/// data type for a range of bytes (the positions of its first and last bytes)
+	typedef std::pair<boost::uint64_t, boost::uint64_t>	ByteRange;
+
+	/// data type for the ranges of bytes requested by a Range header
+	typedef std::vector<ByteRange>	ByteRanges;
+
 	
 	/// converts time_t format into an HTTP-date string
 	static std::string get_date_string(const time_t t);
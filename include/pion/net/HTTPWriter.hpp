@@ -10,17 +10,22 @@
 #ifndef __PION_HTTPWRITER_HEADER__
 #define __PION_HTTPWRITER_HEADER__
 
+#include <list>
 #include <vector>
 #include <string>
 #include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/function.hpp>
 #include <boost/function/function0.hpp>
 #include <boost/function/function2.hpp>
 #include <boost/asio.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/thread/mutex.hpp>
 #include <pion/PionConfig.hpp>
 #include <pion/PionLogger.hpp>
 #include <pion/net/HTTPMessage.hpp>
+#include <pion/net/HTTPCompressor.hpp>
 #include <pion/net/TCPConnection.hpp>
 
 
@@ -41,6 +46,9 @@ protected:
 	/// data type for a function that handles write operations
 	typedef boost::function2<void,const boost::system::error_code&,std::size_t>	WriteHandler;
 	
+	/// data type for a function that is given a copy of a complete message
+	typedef boost::function2<void, const HTTPMessage&, const std::string&>	CaptureHandler;
+	
 	
 	/**
 	 * protected constructor: only derived classes may create objects
@@ -52,7 +60,14 @@ protected:
 		: m_logger(PION_GET_LOGGER("pion.net.HTTPWriter")),
 		m_tcp_conn(tcp_conn), m_content_length(0), m_stream_is_empty(true), 
 		m_client_supports_chunks(true), m_sending_chunks(false),
-		m_sent_headers(false), m_finished(handler)
+		m_sent_headers(false), m_finished(handler),
+		m_queue_low_watermark(DEFAULT_QUEUE_LOW_WATERMARK),
+		m_queue_high_watermark(DEFAULT_QUEUE_HIGH_WATERMARK),
+		m_queued_bytes(0), m_queue_bytes_in_flight(0), m_queue_bytes_sent(0),
+		m_queue_blocked(false), m_queue_closed(false), m_send_failed(false),
+		m_file_fd(-1), m_file_offset(0), m_file_length(0),
+		m_file_content_index(0), m_file_write_index(0),
+		m_accept_encoding(HTTPCompressor::ENCODING_IDENTITY)
 	{}
 	
 	/**
@@ -71,6 +86,9 @@ protected:
 	 * @param write_buffers vector of write buffers to initialize
 	 */
 	virtual void prepareBuffersForSend(HTTPMessage::WriteBuffers& write_buffers) = 0;
+	
+	/// returns the HTTP message that is being sent
+	virtual HTTPMessage& getMessage(void) = 0;
 									  
 	/// returns a function bound to HTTPWriter::handleWrite()
 	virtual WriteHandler bindToWriteHandler(void) = 0;
@@ -83,6 +101,16 @@ protected:
 	
 public:
 
+	/// function called when a queued writer is ready to accept more data
+	typedef boost::function0<void>	WritableHandler;
+
+	/// default number of queued bytes at which queueChunk() asks producers to wait
+	static const std::size_t		DEFAULT_QUEUE_HIGH_WATERMARK;
+
+	/// default number of queued bytes below which producers are told to resume
+	static const std::size_t		DEFAULT_QUEUE_LOW_WATERMARK;
+
+
 	/// default destructor
 	virtual ~HTTPWriter() {}
 
@@ -94,6 +122,7 @@ public:
 		m_content_stream.str("");
 		m_stream_is_empty = true;
 		m_content_length = 0;
+		m_file_length = 0;
 	}
 
 	/**
@@ -152,6 +181,20 @@ public:
 	}
 
 	
+	/**
+	 * write a region of a file as payload content.  For unencrypted connections
+	 * the region is sent directly from the file using sendfile (the descriptor
+	 * must stay open until the message has finished sending); otherwise, or if
+	 * a file region was already written, the region is read into memory.
+	 *
+	 * @param file_fd open file descriptor for the file to send
+	 * @param file_offset offset within the file where the region begins
+	 * @param length the length, in bytes, of the file region
+	 *
+	 * @return bool true if successful, false if the file could not be read
+	 */
+	bool writeFile(int file_fd, boost::uint64_t file_offset, std::size_t length);
+	
 	/**
 	 * Sends all data buffered as a single HTTP message (without chunking).
 	 * Following a call to this function, it is not thread safe to use your
@@ -226,6 +269,98 @@ public:
 		sendMoreData(true, bindToWriteHandler());
 	}
 	
+	/**
+	 * Moves all data buffered into the writer's internal queue as a single HTTP
+	 * chunk.  Unlike sendChunk(), this may be called again without waiting for
+	 * a completion handler: the buffered data is copied into the queue and the
+	 * writer is cleared, and at most one write operation is kept in flight,
+	 * coalescing everything queued while it was busy.  Do not mix queued and
+	 * non-queued send functions for a message.
+	 *
+	 * Only the queue is locked, not the data buffered by the writer, so this
+	 * must be called from the connection's handler thread (the request handler
+	 * or the writable handler), never concurrently with other writes.
+	 *
+	 * @return bool true if more data may be queued right away; false if the
+	 *              queue has reached its high watermark (or the connection has
+	 *              failed), in which case the producer should wait for the
+	 *              writable handler before queuing more data
+	 */
+	inline bool queueChunk(void) {
+		return queueMoreData(false);
+	}
+	
+	/**
+	 * Moves all data buffered (if any) and the final HTTP chunk into the
+	 * writer's internal queue.  This must be called after any calls to
+	 * queueChunk().  The FinishedHandler passed to the writer is called after
+	 * the queue has drained, or as soon as a write operation fails.  Following
+	 * a call to this function, it is not thread safe to use your reference to
+	 * the HTTPWriter object.
+	 */
+	inline void queueFinalChunk(void) {
+		queueMoreData(true);
+	}
+	
+	/**
+	 * sets the queue sizes used to throttle producers
+	 *
+	 * @param low_watermark writable handler is called once the number of
+	 *                      queued bytes drops to or below this value
+	 * @param high_watermark queueChunk() returns false once the number of
+	 *                       queued bytes reaches or exceeds this value
+	 */
+	inline void setQueueWatermarks(std::size_t low_watermark, std::size_t high_watermark) {
+		boost::mutex::scoped_lock queue_lock(m_queue_mutex);
+		m_queue_low_watermark = low_watermark;
+		m_queue_high_watermark = (high_watermark < low_watermark ? low_watermark : high_watermark);
+	}
+	
+	/// sets the function called when a blocked producer may resume queuing data
+	inline void setWritableHandler(WritableHandler h) {
+		boost::mutex::scoped_lock queue_lock(m_queue_mutex);
+		m_writable_handler = h;
+	}
+	
+	/// returns the number of bytes queued that have not yet been sent
+	inline std::size_t getQueuedBytes(void) const {
+		boost::mutex::scoped_lock queue_lock(m_queue_mutex);
+		return m_queued_bytes;
+	}
+	
+	
+	/**
+	 * enables compression of the payload content.  The content is compressed
+	 * only if the recipient accepts a supported content-coding (see
+	 * setAcceptEncoding()), the message has a compressible Content-Type and
+	 * no Content-Encoding, and it is either sent in chunks or is at least as
+	 * large as the minimum size.  This must be called before any data is sent.
+	 *
+	 * @param options compression settings; use a null pointer to disable
+	 */
+	inline void setCompression(HTTPCompressor::OptionsPtr options) {
+		m_compression_options = options;
+	}
+	
+	/**
+	 * sets the content-codings accepted by the recipient of the message
+	 *
+	 * @param accept_encoding value of the request's Accept-Encoding header
+	 */
+	inline void setAcceptEncoding(const std::string& accept_encoding) {
+		m_accept_encoding = HTTPCompressor::parseAcceptEncoding(accept_encoding);
+	}
+	
+	/// returns true if the payload content is being compressed
+	inline bool isCompressing(void) const { return m_compressor.get() != NULL; }
+	
+	/**
+	 * sets a function that is given a copy of the message, if all of it is
+	 * sent by the first call to send() (with a content-length, and not in chunks)
+	 *
+	 * @param h called with the message and all of the bytes that are sent
+	 */
+	inline void setCaptureHandler(const CaptureHandler& h) { m_capture_handler = h; }
 	
 	/// returns a shared pointer to the TCP connection
 	inline TCPConnectionPtr& getTCPConnection(void) { return m_tcp_conn; }
@@ -267,18 +402,170 @@ private:
 		flushContentStream();
 		// prepare the write buffers to be sent
 		HTTPMessage::WriteBuffers write_buffers;
-		prepareWriteBuffers(write_buffers, send_final_chunk);
-		// send data in the write buffers
-		m_tcp_conn->async_write(write_buffers, send_handler);
+		const bool complete_message = (! m_sent_headers && ! sendingChunkedMessage()
+									   && ! getMessage().getDoNotSendContentLength());
+		if (! prepareWriteBuffers(write_buffers, send_final_chunk)) {
+			// the rest of the message cannot be sent, so close the connection
+			m_tcp_conn->setLifecycle(TCPConnection::LIFECYCLE_CLOSE);
+			m_tcp_conn->getIOService().post(boost::bind<void>(send_handler,
+				boost::system::errc::make_error_code(boost::system::errc::io_error),
+				static_cast<std::size_t>(0)));
+			return;
+		}
+		if (m_capture_handler) {
+			if (complete_message)
+				captureMessage(write_buffers);
+			m_capture_handler.clear();
+		}
+		if (m_file_length > 0) {
+			// send the buffers before the file region, then the file region
+			// using sendfile, and then the buffers that follow it
+			typedef FileSendOperation<SendHandler>	SendOperation;
+			typename SendOperation::StatePtr state(new typename SendOperation::State(m_tcp_conn, send_handler));
+			state->m_file_fd = m_file_fd;
+			state->m_file_offset = m_file_offset;
+			state->m_file_length = m_file_length;
+			state->m_trailing_buffers.assign(write_buffers.begin() + m_file_write_index,
+											 write_buffers.end());
+			write_buffers.resize(m_file_write_index);
+			m_tcp_conn->async_write(write_buffers, SendOperation(state));
+		} else {
+			// send data in the write buffers
+			m_tcp_conn->async_write(write_buffers, send_handler);
+		}
 	}
 	
+	///
+	/// FileSendOperation: writes a message that includes a file region, which
+	/// takes three steps: leading buffers, file region and trailing buffers
+	///
+	template <typename SendHandler>
+	class FileSendOperation {
+	public:
+		/// state shared by all of the steps
+		struct State {
+			State(TCPConnectionPtr& tcp_conn, SendHandler handler)
+				: m_tcp_conn(tcp_conn), m_handler(handler), m_file_fd(-1),
+				m_file_offset(0), m_file_length(0), m_bytes_written(0), m_step(0)
+			{}
+			TCPConnectionPtr			m_tcp_conn;
+			SendHandler					m_handler;
+			HTTPMessage::WriteBuffers	m_trailing_buffers;
+			int							m_file_fd;
+			boost::uint64_t				m_file_offset;
+			std::size_t					m_file_length;
+			std::size_t					m_bytes_written;
+			int							m_step;
+		};
+		typedef boost::shared_ptr<State>	StatePtr;
+		
+		explicit FileSendOperation(StatePtr& state) : m_state(state) {}
+		
+		/// called after each step has finished
+		void operator()(const boost::system::error_code& ec, std::size_t bytes_written) {
+			m_state->m_bytes_written += bytes_written;
+			if (ec) {
+				m_state->m_handler(ec, m_state->m_bytes_written);
+			} else if (++m_state->m_step == 1) {
+				m_state->m_tcp_conn->async_sendfile(m_state->m_file_fd, m_state->m_file_offset,
+													m_state->m_file_length, *this);
+			} else if (m_state->m_step == 2 && ! m_state->m_trailing_buffers.empty()) {
+				m_state->m_tcp_conn->async_write(m_state->m_trailing_buffers, *this);
+			} else {
+				m_state->m_handler(ec, m_state->m_bytes_written);
+			}
+		}
+		
+	private:
+		StatePtr	m_state;
+	};
+	
+	/**
+	 * gives a copy of a complete message to the capture handler
+	 *
+	 * @param write_buffers all of the message's buffers (except any file region)
+	 */
+	void captureMessage(const HTTPMessage::WriteBuffers& write_buffers);
+	
+	/**
+	 * copies all of the buffered data into the write queue
+	 *
+	 * @param send_final_chunk true if the final 0-byte chunk should be included
+	 *
+	 * @return bool true if the queue is below its high watermark
+	 */
+	bool queueMoreData(const bool send_final_chunk);
+	
+	/**
+	 * closes the queue after a chunk could not be queued, without sending
+	 * anything more than the write operation in flight (if any);
+	 * m_queue_mutex must be locked when this is called
+	 *
+	 * @param ec the error reported to the finished handler
+	 *
+	 * @return bool true if nothing is in flight, so that the finished
+	 *              handler should be called right away
+	 */
+	bool abortQueue(const boost::system::error_code& ec);
+	
+	/**
+	 * starts a write operation for all of the data waiting in the queue;
+	 * m_queue_mutex must be locked when this is called
+	 *
+	 * @param finished_handler called when the queue has been completely sent
+	 */
+	void startQueuedWrite(WriteHandler finished_handler);
+	
+	/**
+	 * called after a queued write operation has finished
+	 *
+	 * @param finished_handler called when the queue has been completely sent
+	 * @param write_error error status from the last write operation
+	 * @param bytes_written number of bytes sent by the last write operation
+	 */
+	void handleQueuedWrite(WriteHandler finished_handler,
+						   const boost::system::error_code& write_error,
+						   std::size_t bytes_written);
+	
+	/**
+	 * reads a region of a file into memory
+	 *
+	 * @param file_fd open file descriptor for the file to read
+	 * @param file_offset offset within the file where the region begins
+	 * @param length the length, in bytes, of the file region
+	 * @param buf buffer that will receive the file region
+	 *
+	 * @return bool true if successful, false if the file could not be read
+	 */
+	static bool readFile(int file_fd, boost::uint64_t file_offset,
+						 std::size_t length, char *buf);
+	
+	/**
+	 * starts compressing the payload content if it is enabled and suitable for
+	 * the message; this is called before the HTTP headers are prepared
+	 */
+	void startCompression(void);
+	
+	/**
+	 * replaces the buffered payload content with its compressed form
+	 *
+	 * @param send_final_chunk true if this is the end of the payload content
+	 *
+	 * @return bool true if successful; false if the content could not be
+	 *              compressed (and was discarded), so nothing more is sent
+	 */
+	bool compressContent(const bool send_final_chunk);
+	
 	/**
 	 * prepares write_buffers for next send operation
 	 *
 	 * @param write_buffers buffers to which data will be appended
 	 * @param send_final_chunk true if the final 0-byte chunk should be included
+	 *
+	 * @return bool true if successful; false if nothing may be sent because
+	 *              part of the message could not be prepared
 	 */
-	void prepareWriteBuffers(HTTPMessage::WriteBuffers &write_buffers,
+	bool prepareWriteBuffers(HTTPMessage::WriteBuffers &write_buffers,
 							 const bool send_final_chunk);
 	
 	/// flushes any text data in the content stream after caching it in the TextCache
@@ -310,11 +597,19 @@ private:
 			push_back( std::make_pair(data_ptr, size) );
 			return boost::asio::buffer(data_ptr, size);
 		}
+		inline char *allocate(const size_t size) {
+			char *data_ptr = new char[size];
+			push_back( std::make_pair(data_ptr, size) );
+			return data_ptr;
+		}
 	};
 	
 	/// used to cache text (non-binary) data included within the payload content
 	typedef std::list<std::string>				TextCache;
 
+	/// data type for serialized chunks that are waiting in the write queue
+	typedef std::list<std::string>				WriteQueue;
+
 	
 	/// primary logging interface used by this class
 	PionLogger								m_logger;
@@ -351,6 +646,72 @@ private:
 
 	/// function called after the HTTP message has been sent
 	FinishedHandler							m_finished;
+	
+	/// function called when a blocked producer may resume queuing data
+	WritableHandler							m_writable_handler;
+	
+	/// serialized chunks waiting for the next write operation
+	WriteQueue								m_queue_pending;
+	
+	/// serialized chunks referenced by the write operation in flight
+	WriteQueue								m_queue_in_flight;
+	
+	/// writable handler is called when queued bytes drop to this value
+	std::size_t								m_queue_low_watermark;
+	
+	/// queueChunk() returns false when queued bytes reach this value
+	std::size_t								m_queue_high_watermark;
+	
+	/// number of bytes queued (including those in flight) not yet sent
+	std::size_t								m_queued_bytes;
+	
+	/// number of bytes referenced by the write operation in flight
+	std::size_t								m_queue_bytes_in_flight;
+	
+	/// total number of queued bytes that have been sent
+	std::size_t								m_queue_bytes_sent;
+	
+	/// true if queueChunk() has told the producer to wait
+	bool									m_queue_blocked;
+	
+	/// true if the final chunk has been queued or a queued write failed
+	bool									m_queue_closed;
+	
+	/// error reported when the queue has drained, if a chunk could not be queued
+	boost::system::error_code				m_queue_error;
+	
+	/// true if part of the message could not be prepared, so nothing more is sent
+	bool									m_send_failed;
+	
+	/// used to protect the write queue
+	mutable boost::mutex					m_queue_mutex;
+	
+	/// file descriptor for the file region included within the payload content
+	int										m_file_fd;
+	
+	/// offset within the file where the file region begins
+	boost::uint64_t							m_file_offset;
+	
+	/// length of the file region (zero if there is none)
+	std::size_t								m_file_length;
+	
+	/// number of content buffers that precede the file region
+	std::size_t								m_file_content_index;
+	
+	/// position of the file region within the last set of write buffers
+	std::size_t								m_file_write_index;
+	
+	/// settings used to compress the payload content (null if disabled)
+	HTTPCompressor::OptionsPtr				m_compression_options;
+	
+	/// content-coding preferred by the recipient of the message
+	HTTPCompressor::EncodingType			m_accept_encoding;
+	
+	/// used to compress the payload content (null if it is not compressed)
+	boost::scoped_ptr<HTTPCompressor>		m_compressor;
+	
+	/// function that is given a copy of the message, if any
+	CaptureHandler							m_capture_handler;
 };
 
 
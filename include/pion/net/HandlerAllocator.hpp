@@ -0,0 +1,181 @@
+// ------------------------------------------------------------------
+// pion-net: a C++ framework for building lightweight HTTP interfaces
+// ------------------------------------------------------------------
+// Copyright (C) 2007-2010 Atomic Labs, Inc.  (http://www.atomiclabs.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See http://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef __PION_HANDLERALLOCATOR_HEADER__
+#define __PION_HANDLERALLOCATOR_HEADER__
+
+#include <cstddef>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/aligned_storage.hpp>
+#include <boost/atomic.hpp>
+#include <boost/asio/handler_alloc_hook.hpp>
+#include <boost/asio/handler_invoke_hook.hpp>
+#include <boost/asio/detail/handler_invoke_helpers.hpp>
+#include <pion/PionConfig.hpp>
+
+
+namespace pion {	// begin namespace pion
+namespace net {		// begin namespace net (Pion Network Library)
+
+
+///
+/// HandlerAllocator: memory arena used by asio for the state of asynchronous
+///                   operations; an object that performs one operation at a
+///                   time (i.e. reading from a connection) re-uses the same
+///                   block of memory instead of allocating one each time
+///
+class HandlerAllocator :
+	private boost::noncopyable
+{
+public:
+
+	/// size of the arena; larger operations fall back to the heap
+	enum { ARENA_SIZE = 1024 };
+
+	/// default constructor
+	HandlerAllocator(void)
+		: m_in_use(false), m_arena_allocations(0), m_heap_allocations(0)
+	{}
+
+	/**
+	 * allocates memory for an asynchronous operation
+	 *
+	 * @param size number of bytes required
+	 *
+	 * @return void* the arena if it is large enough and not already in use,
+	 *               otherwise memory allocated from the heap
+	 */
+	inline void *allocate(std::size_t size) {
+		if (size <= ARENA_SIZE && ! m_in_use.exchange(true, boost::memory_order_acquire)) {
+			m_arena_allocations.fetch_add(1, boost::memory_order_relaxed);
+			return m_storage.address();
+		}
+		m_heap_allocations.fetch_add(1, boost::memory_order_relaxed);
+		return ::operator new(size);
+	}
+
+	/// releases memory that was returned by allocate()
+	inline void deallocate(void *ptr) {
+		if (ptr == m_storage.address())
+			m_in_use.store(false, boost::memory_order_release);
+		else
+			::operator delete(ptr);
+	}
+
+	/// returns true if the arena is being used by an operation
+	inline bool isInUse(void) const { return m_in_use.load(boost::memory_order_acquire); }
+
+	/// returns the number of operations that used the arena
+	inline unsigned long getArenaAllocations(void) const {
+		return m_arena_allocations.load(boost::memory_order_relaxed);
+	}
+
+	/// returns the number of operations that had to allocate memory from the heap
+	inline unsigned long getHeapAllocations(void) const {
+		return m_heap_allocations.load(boost::memory_order_relaxed);
+	}
+
+
+private:
+
+	/// memory used for one asynchronous operation at a time
+	boost::aligned_storage<ARENA_SIZE>		m_storage;
+
+	/// true if the arena is being used by an operation (it is released by the
+	/// thread that completes the operation, which may not be the one that
+	/// allocated it)
+	boost::atomic<bool>						m_in_use;
+
+	/// number of operations that used the arena (operations may be started
+	/// by different threads, so the counters are atomic)
+	boost::atomic<unsigned long>			m_arena_allocations;
+
+	/// number of operations that had to allocate memory from the heap
+	boost::atomic<unsigned long>			m_heap_allocations;
+};
+
+
+/// data type for a HandlerAllocator pointer
+typedef boost::shared_ptr<HandlerAllocator>	HandlerAllocatorPtr;
+
+
+///
+/// AllocHandler: wraps a completion handler so that asio allocates the
+///               memory for its operation using a HandlerAllocator
+///
+template <typename Handler>
+class AllocHandler {
+public:
+
+	/**
+	 * creates a new wrapped handler
+	 *
+	 * @param allocator the arena used to allocate memory for the operation
+	 *                  (the handler keeps it until the operation completes)
+	 * @param handler the completion handler to wrap
+	 */
+	AllocHandler(const HandlerAllocatorPtr& allocator, Handler handler)
+		: m_allocator(allocator), m_handler(handler)
+	{}
+
+	template <typename Arg1>
+	inline void operator()(Arg1 arg1) { m_handler(arg1); }
+
+	template <typename Arg1, typename Arg2>
+	inline void operator()(Arg1 arg1, Arg2 arg2) { m_handler(arg1, arg2); }
+
+	/// called by asio to allocate memory for an operation
+	friend inline void *asio_handler_allocate(std::size_t size, AllocHandler<Handler> *this_handler) {
+		return this_handler->m_allocator->allocate(size);
+	}
+
+	/// called by asio to release memory for an operation
+	friend inline void asio_handler_deallocate(void *ptr, std::size_t /* size */,
+											   AllocHandler<Handler> *this_handler)
+	{
+		this_handler->m_allocator->deallocate(ptr);
+	}
+
+	/// invokes the wrapped handler the same way it would be if it was not wrapped
+	template <typename Function>
+	friend inline void asio_handler_invoke(const Function& function, AllocHandler<Handler> *this_handler) {
+		boost_asio_handler_invoke_helpers::invoke(function, this_handler->m_handler);
+	}
+
+
+private:
+
+	/// the arena used to allocate memory for the operation (shared, so that
+	/// it cannot be released before the operation's memory is)
+	HandlerAllocatorPtr		m_allocator;
+
+	/// the wrapped completion handler
+	Handler					m_handler;
+};
+
+
+/**
+ * wraps a completion handler so that asio allocates the memory for its
+ * operation using a HandlerAllocator
+ *
+ * @param allocator the arena used to allocate memory for the operation
+ * @param handler the completion handler to wrap
+ */
+template <typename Handler>
+inline AllocHandler<Handler> makeAllocHandler(const HandlerAllocatorPtr& allocator, Handler handler)
+{
+	return AllocHandler<Handler>(allocator, handler);
+}
+
+
+}	// end namespace net
+}	// end namespace pion
+
+#endif
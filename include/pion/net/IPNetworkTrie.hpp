@@ -0,0 +1,129 @@
+// ------------------------------------------------------------------
+// pion-net: a C++ framework for building lightweight HTTP interfaces
+// ------------------------------------------------------------------
+// Copyright (C) 2007-2010 Atomic Labs, Inc.  (http://www.atomiclabs.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See http://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef __PION_IPNETWORKTRIE_HEADER__
+#define __PION_IPNETWORKTRIE_HEADER__
+
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/once.hpp>
+#include <pion/PionConfig.hpp>
+#include <pion/PionException.hpp>
+
+
+namespace pion {	// begin namespace pion
+namespace net {		// begin namespace net (Pion Network Library)
+
+///
+/// IPNetworkTrie: a set of IPv4 and IPv6 networks (in CIDR notation), kept as
+///                a binary trie of their address prefixes
+///
+/// Finding whether an address is within any of the networks walks the trie
+/// along the address's bits, and stops at the first network that it finds,
+/// so it takes at most as many steps as the longest prefix.  IPv4 addresses
+/// that are mapped into IPv6 are treated as IPv4 addresses.
+///
+class PION_NET_API IPNetworkTrie {
+public:
+
+	/// exception thrown if a network is not valid
+	class BadNetworkException : public PionException {
+	public:
+		BadNetworkException(const std::string& network)
+			: PionException("Invalid IP network: ", network) {}
+	};
+
+
+	/// constructs an empty set of networks
+	IPNetworkTrie(void);
+
+	/**
+	 * adds a network to the set
+	 *
+	 * @param network an address with a prefix length ("10.0.0.0/8",
+	 *                "fc00::/7"), or a single address
+	 */
+	void insert(const std::string& network);
+
+	/**
+	 * adds a network to the set
+	 *
+	 * @param address an address within the network
+	 * @param prefix_length number of bits in the network's prefix
+	 */
+	void insert(const boost::asio::ip::address& address, unsigned int prefix_length);
+
+	/// returns true if an address is within any of the networks
+	bool contains(const boost::asio::ip::address& address) const;
+
+	/// returns true if there are no networks
+	inline bool empty(void) const { return m_empty; }
+
+	/// returns the networks that are not public (loopback, private and link-local)
+	static inline const IPNetworkTrie& getPrivateNetworks(void) {
+		boost::call_once(IPNetworkTrie::createPrivateNetworks, m_private_flag);
+		return *m_private_networks_ptr;
+	}
+
+
+private:
+
+	/// a node of the trie, for one bit of a prefix
+	struct Node {
+		Node(void) : m_network(false) { m_children[0] = m_children[1] = 0; }
+
+		/// the nodes for the next bit being 0 or 1 (0 if there is none)
+		boost::uint32_t		m_children[2];
+
+		/// true if the prefix up to this node is one of the networks
+		bool				m_network;
+	};
+
+	/// index of the root node for IPv4 prefixes
+	static const boost::uint32_t	IPV4_ROOT;
+
+	/// index of the root node for IPv6 prefixes
+	static const boost::uint32_t	IPV6_ROOT;
+
+
+	/// adds the first prefix_length bits of an address below a root node
+	void insert(const unsigned char *bytes, unsigned int prefix_length, boost::uint32_t root);
+
+	/// returns true if a prefix of an address is one of the networks below a root node
+	bool contains(const unsigned char *bytes, unsigned int num_bits, boost::uint32_t root) const;
+
+	/// creates the networks that are not public
+	static void createPrivateNetworks(void);
+
+
+	/// the nodes of the trie, starting with the two roots
+	std::vector<Node>					m_nodes;
+
+	/// true if there are no networks
+	bool								m_empty;
+
+	/// the networks that are not public
+	static IPNetworkTrie *				m_private_networks_ptr;
+
+	/// used to create the networks that are not public only once
+	static boost::once_flag				m_private_flag;
+};
+
+
+/// data type for a pointer to an (immutable) IPNetworkTrie
+typedef boost::shared_ptr<const IPNetworkTrie>	IPNetworkTriePtr;
+
+
+}	// end namespace net
+}	// end namespace pion
+
+#endif
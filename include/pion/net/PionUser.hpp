@@ -10,10 +10,12 @@
 #ifndef __PION_PIONUSER_HEADER__
 #define __PION_PIONUSER_HEADER__
 
-#include <map>
 #include <string>
+#include <vector>
+#include <utility>
 #include <cstring>
 #include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/numeric/conversion/cast.hpp>
@@ -144,21 +146,29 @@ typedef boost::shared_ptr<PionUser>	PionUserPtr;
 ///
 /// PionUserManager base class for PionUser container/manager
 ///
+/// Users are looked up in an immutable snapshot of the user records, without
+/// locking.  Changes copy the snapshot and publish the copy, so password
+/// hashes are computed before the (writers only) lock is acquired, and a
+/// batch of users should be added with a single call to addUsers().
+///
 class PionUserManager :
 	private boost::noncopyable
 {
 public:
 
+	/// data type for a list of usernames and plaintext passwords
+	typedef std::vector<std::pair<std::string, std::string> >	UserList;
+
+
 	/// construct a new PionUserManager object
-	PionUserManager(void) {}
+	PionUserManager(void) : m_users(new UserMap) {}
 
 	/// virtual destructor
 	virtual ~PionUserManager() {}
 
 	/// returns true if no users are defined
 	inline bool empty(void) const {
-		boost::mutex::scoped_lock lock(m_mutex);
-		return m_users.empty();
+		return getUsers()->empty();
 	}
 
 	/**
@@ -172,13 +182,33 @@ public:
 	virtual bool addUser(const std::string &username,
 		const std::string &password)
 	{
-		boost::mutex::scoped_lock lock(m_mutex);
-		UserMap::iterator i = m_users.find(username);
-		if (i!=m_users.end())
-			return false;
 		PionUserPtr user(new PionUser(username, password));
-		m_users.insert(std::make_pair(username, user));
-		return true;
+		return publishUser(username, user, false);
+	}
+
+	/**
+	 * used to add many new users with plaintext passwords at once
+	 *
+	 * @param users names and plaintext passwords of the users to add
+	 *
+	 * @return std::size_t number of users added (existing users are skipped)
+	 */
+	virtual std::size_t addUsers(const UserList& users) {
+		// hash all of the passwords before changing anything
+		std::vector<PionUserPtr> new_users;
+		new_users.reserve(users.size());
+		for (UserList::const_iterator i = users.begin(); i != users.end(); ++i)
+			new_users.push_back(PionUserPtr(new PionUser(i->first, i->second)));
+
+		boost::mutex::scoped_lock lock(m_mutex);
+		boost::shared_ptr<UserMap> user_map(new UserMap(*m_users));
+		std::size_t num_added = 0;
+		for (std::vector<PionUserPtr>::const_iterator i = new_users.begin(); i != new_users.end(); ++i) {
+			if (user_map->insert(std::make_pair((*i)->getUsername(), *i)).second)
+				++num_added;
+		}
+		boost::atomic_store(&m_users, UserMapPtr(user_map));
+		return num_added;
 	}
 
 	/**
@@ -192,12 +222,8 @@ public:
 	virtual bool updateUser(const std::string &username,
 		const std::string &password)
 	{
-		boost::mutex::scoped_lock lock(m_mutex);
-		UserMap::iterator i = m_users.find(username);
-		if (i==m_users.end())
-			return false;
-		i->second->setPassword(password);
-		return true;
+		PionUserPtr user(new PionUser(username, password));
+		return publishUser(username, user, true);
 	}
 
 #ifdef PION_HAVE_SSL
@@ -212,14 +238,9 @@ public:
 	virtual bool addUserHash(const std::string &username,
 		const std::string &password_hash)
 	{
-		boost::mutex::scoped_lock lock(m_mutex);
-		UserMap::iterator i = m_users.find(username);
-		if (i!=m_users.end())
-			return false;
 		PionUserPtr user(new PionUser(username));
 		user->setPasswordHash(password_hash);
-		m_users.insert(std::make_pair(username, user));
-		return true;
+		return publishUser(username, user, false);
 	}
 
 	/**
@@ -233,12 +254,9 @@ public:
 	virtual bool updateUserHash(const std::string &username,
 		const std::string &password_hash)
 	{
-		boost::mutex::scoped_lock lock(m_mutex);
-		UserMap::iterator i = m_users.find(username);
-		if (i==m_users.end())
-			return false;
-		i->second->setPasswordHash(password_hash);
-		return true;
+		PionUserPtr user(new PionUser(username));
+		user->setPasswordHash(password_hash);
+		return publishUser(username, user, true);
 	}
 #endif
 
@@ -248,21 +266,16 @@ public:
 	 * @return false if no user with such username
 	 */
 	virtual bool removeUser(const std::string &username) {
-		boost::mutex::scoped_lock lock(m_mutex);
-		UserMap::iterator i = m_users.find(username);
-		if (i==m_users.end())
-			return false;
-		m_users.erase(i);
-		return true;
+		return publishUser(username, PionUserPtr(), true);
 	}
 
 	/**
 	 * Used to locate user object by username
 	 */
 	virtual PionUserPtr getUser(const std::string &username) {
-		boost::mutex::scoped_lock lock(m_mutex);
-		UserMap::const_iterator i = m_users.find(username);
-		if (i==m_users.end())
+		UserMapPtr users(getUsers());
+		UserMap::const_iterator i = users->find(username);
+		if (i==users->end())
 			return PionUserPtr();
 		else
 			return i->second;
@@ -272,9 +285,9 @@ public:
 	 * Used to locate user object by username and password
 	 */
 	virtual PionUserPtr getUser(const std::string& username, const std::string& password) {
-		boost::mutex::scoped_lock lock(m_mutex);
-		UserMap::const_iterator i = m_users.find(username);
-		if (i==m_users.end() || !i->second->matchPassword(password))
+		UserMapPtr users(getUsers());
+		UserMap::const_iterator i = users->find(username);
+		if (i==users->end() || !i->second->matchPassword(password))
 			return PionUserPtr();
 		else
 			return i->second;
@@ -284,14 +297,46 @@ public:
 protected:
 
 	/// data type for a map of usernames to user objects
-	typedef std::map<std::string, PionUserPtr>	UserMap;
+	typedef boost::unordered_map<std::string, PionUserPtr>	UserMap;
+
+	/// data type for a pointer to an (immutable) snapshot of the user objects
+	typedef boost::shared_ptr<const UserMap>				UserMapPtr;
+
+
+	/// returns the current snapshot of the user objects
+	inline UserMapPtr getUsers(void) const {
+		return boost::atomic_load(&m_users);
+	}
+
+	/**
+	 * publishes a new snapshot in which a user has been added, replaced or removed
+	 *
+	 * @param username name or identifier of the user to change
+	 * @param user the new user object, or null to remove the user
+	 * @param must_exist true if the user must already exist, false if it must not
+	 *
+	 * @return false if the user's existence did not match must_exist
+	 */
+	bool publishUser(const std::string& username, const PionUserPtr& user, bool must_exist) {
+		boost::mutex::scoped_lock lock(m_mutex);
+		const bool exists = (m_users->find(username) != m_users->end());
+		if (exists != must_exist)
+			return false;
+		boost::shared_ptr<UserMap> user_map(new UserMap(*m_users));
+		if (user)
+			(*user_map)[username] = user;
+		else
+			user_map->erase(username);
+		boost::atomic_store(&m_users, UserMapPtr(user_map));
+		return true;
+	}
 
 
-	/// mutex used to protect access to the user list
+	/// mutex used to serialize changes to the user objects
 	mutable boost::mutex		m_mutex;
 
-	/// user records container
-	UserMap						m_users;
+	/// user records container; replaced (not changed) when users are updated
+	UserMapPtr					m_users;
 };
 
 /// data type for a PionUserManager pointer
@@ -26,13 +26,28 @@
 #include <boost/array.hpp>
 #include <boost/function.hpp>
 #include <boost/function/function1.hpp>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
 #include <pion/PionConfig.hpp>
+#include <pion/net/HandlerAllocator.hpp>
 #include <string>
 
+#if defined(__linux__) && !defined(PION_HAVE_SENDFILE)
+	// sendfile(2) can send file contents directly to a (plaintext) socket
+	#include <sys/types.h>
+	#include <sys/sendfile.h>
+	#include <errno.h>
+	#define PION_HAVE_SENDFILE
+#endif
+
 
 namespace pion {	// begin namespace pion
 namespace net {		// begin namespace net (Pion Network Library)
 
+// forward declaration of the class used to time-out connections
+class TCPTimer;
+
+
 ///
 /// TCPConnection: represents a single tcp connection
 /// 
@@ -115,6 +130,8 @@ public:
 		m_ssl_socket(io_service),
 		m_ssl_flag(false),
 #endif
+		m_read_allocator(new HandlerAllocator),
+		m_write_allocator(new HandlerAllocator),
 		m_lifecycle(LIFECYCLE_CLOSE)
 	{
 		saveReadPosition(NULL, NULL);
@@ -135,6 +152,8 @@ public:
 		m_ssl_context(0),
 		m_ssl_socket(io_service), m_ssl_flag(false), 
 #endif
+		m_read_allocator(new HandlerAllocator),
+		m_write_allocator(new HandlerAllocator),
 		m_lifecycle(LIFECYCLE_CLOSE)
 	{
 		saveReadPosition(NULL, NULL);
@@ -175,7 +194,8 @@ public:
 	inline void async_accept(boost::asio::ip::tcp::acceptor& tcp_acceptor,
 							 AcceptHandler handler)
 	{
-		tcp_acceptor.async_accept(m_ssl_socket.lowest_layer(), handler);
+		tcp_acceptor.async_accept(m_ssl_socket.lowest_layer(),
+								  makeAllocHandler(m_read_allocator, handler));
 	}
 
 	/**
@@ -205,7 +225,8 @@ public:
 	inline void async_connect(boost::asio::ip::tcp::endpoint& tcp_endpoint,
 							  ConnectHandler handler)
 	{
-		m_ssl_socket.lowest_layer().async_connect(tcp_endpoint, handler);
+		m_ssl_socket.lowest_layer().async_connect(tcp_endpoint,
+												  makeAllocHandler(m_read_allocator, handler));
 	}
 
 	/**
@@ -303,7 +324,8 @@ public:
 	template <typename SSLHandshakeHandler>
 	inline void async_handshake_client(SSLHandshakeHandler handler) {
 #ifdef PION_HAVE_SSL
-		m_ssl_socket.async_handshake(boost::asio::ssl::stream_base::client, handler);
+		m_ssl_socket.async_handshake(boost::asio::ssl::stream_base::client,
+									 makeAllocHandler(m_read_allocator, handler));
 		m_ssl_flag = true;
 #endif
 	}
@@ -318,7 +340,8 @@ public:
 	template <typename SSLHandshakeHandler>
 	inline void async_handshake_server(SSLHandshakeHandler handler) {
 #ifdef PION_HAVE_SSL
-		m_ssl_socket.async_handshake(boost::asio::ssl::stream_base::server, handler);
+		m_ssl_socket.async_handshake(boost::asio::ssl::stream_base::server,
+									 makeAllocHandler(m_read_allocator, handler));
 		m_ssl_flag = true;
 #endif
 	}
@@ -367,11 +390,11 @@ public:
 #ifdef PION_HAVE_SSL
 		if (getSSLFlag())
 			m_ssl_socket.async_read_some(boost::asio::buffer(m_read_buffer),
-										 handler);
+										 makeAllocHandler(m_read_allocator, handler));
 		else
 #endif		
 			m_ssl_socket.next_layer().async_read_some(boost::asio::buffer(m_read_buffer),
-										 handler);
+										 makeAllocHandler(m_read_allocator, handler));
 	}
 	
 	/**
@@ -387,10 +410,12 @@ public:
 								ReadHandler handler) {
 #ifdef PION_HAVE_SSL
 		if (getSSLFlag())
-			m_ssl_socket.async_read_some(read_buffer, handler);
+			m_ssl_socket.async_read_some(read_buffer,
+										 makeAllocHandler(m_read_allocator, handler));
 		else
 #endif		
-			m_ssl_socket.next_layer().async_read_some(read_buffer, handler);
+			m_ssl_socket.next_layer().async_read_some(read_buffer,
+										 makeAllocHandler(m_read_allocator, handler));
 	}
 	
 	/**
@@ -447,11 +472,13 @@ public:
 #ifdef PION_HAVE_SSL
 		if (getSSLFlag())
 			boost::asio::async_read(m_ssl_socket, boost::asio::buffer(m_read_buffer),
-									completion_condition, handler);
+									completion_condition,
+									makeAllocHandler(m_read_allocator, handler));
 		else
 #endif		
 			boost::asio::async_read(m_ssl_socket.next_layer(), boost::asio::buffer(m_read_buffer),
-									completion_condition, handler);
+									completion_condition,
+									makeAllocHandler(m_read_allocator, handler));
 	}
 			
 	/**
@@ -471,12 +498,12 @@ public:
 	{
 #ifdef PION_HAVE_SSL
 		if (getSSLFlag())
-			boost::asio::async_read(m_ssl_socket, buffers,
-									completion_condition, handler);
+			boost::asio::async_read(m_ssl_socket, buffers, completion_condition,
+									makeAllocHandler(m_read_allocator, handler));
 		else
 #endif		
-			boost::asio::async_read(m_ssl_socket.next_layer(), buffers,
-									completion_condition, handler);
+			boost::asio::async_read(m_ssl_socket.next_layer(), buffers, completion_condition,
+									makeAllocHandler(m_read_allocator, handler));
 	}
 	
 	/**
@@ -541,10 +568,12 @@ public:
 	inline void async_write(const ConstBufferSequence& buffers, WriteHandler handler) {
 #ifdef PION_HAVE_SSL
 		if (getSSLFlag())
-			boost::asio::async_write(m_ssl_socket, buffers, handler);
+			boost::asio::async_write(m_ssl_socket, buffers,
+									 makeAllocHandler(m_write_allocator, handler));
 		else
 #endif		
-			boost::asio::async_write(m_ssl_socket.next_layer(), buffers, handler);
+			boost::asio::async_write(m_ssl_socket.next_layer(), buffers,
+									 makeAllocHandler(m_write_allocator, handler));
 	}	
 		
 	/**
@@ -571,6 +600,48 @@ public:
 	}	
 	
 	
+	/**
+	 * asynchronously writes a region of a file to the connection without
+	 * copying its contents through user space (using sendfile).  This is only
+	 * supported for unencrypted connections; see canSendFile().
+	 *
+	 * @param file_fd open file descriptor for the file to send
+	 * @param file_offset offset within the file where the region begins
+	 * @param length number of bytes to send from the file
+	 * @param handler called after the data has been written
+	 */
+	template <typename WriteHandler>
+	inline void async_sendfile(int file_fd, boost::uint64_t file_offset,
+							   std::size_t length, WriteHandler handler)
+	{
+		boost::system::error_code ec(boost::asio::error::operation_not_supported);
+#ifdef PION_HAVE_SENDFILE
+		if (canSendFile()) {
+			// sendfile() must not block the thread running the io_service
+			getSocket().non_blocking(true, ec);
+			if (! ec) {
+				// wait until the socket is writable before sending anything
+				getSocket().async_write_some(boost::asio::null_buffers(),
+					makeAllocHandler(m_write_allocator,
+						SendFileOperation<WriteHandler>(getSocket(), m_write_allocator,
+														file_fd, file_offset, length, handler)));
+				return;
+			}
+		}
+#endif
+		getIOService().post(boost::bind<void>(handler, ec, static_cast<std::size_t>(0)));
+	}
+
+	/// returns true if file regions may be sent using async_sendfile()
+	inline bool canSendFile(void) const {
+#ifdef PION_HAVE_SENDFILE
+		return ! getSSLFlag();
+#else
+		return false;
+#endif
+	}
+	
+	
 	/// This function should be called when a server has finished handling
 	/// the connection
 	inline void finish(void) { if (m_finished_handler) m_finished_handler(shared_from_this()); }
@@ -592,6 +663,18 @@ public:
 
 	/// returns the buffer used for reading data from the TCP connection
 	inline ReadBuffer& getReadBuffer(void) { return m_read_buffer; }
+
+	/// returns the memory arena used for asynchronous read operations
+	inline const HandlerAllocator& getReadAllocator(void) const { return *m_read_allocator; }
+
+	/// returns the memory arena used for asynchronous write operations
+	inline const HandlerAllocator& getWriteAllocator(void) const { return *m_write_allocator; }
+
+	/// returns the timer that is re-used to time-out reads (null until one is set)
+	inline const boost::shared_ptr<TCPTimer>& getTimer(void) const { return m_timer_ptr; }
+
+	/// sets the timer that is re-used to time-out reads
+	inline void setTimer(const boost::shared_ptr<TCPTimer>& timer_ptr) { m_timer_ptr = timer_ptr; }
 	
 	/**
 	 * saves a read position bookmark
@@ -690,6 +773,60 @@ private:
 	/// data type for a read position bookmark
 	typedef std::pair<const char*, const char*>		ReadPosition;
 
+#ifdef PION_HAVE_SENDFILE
+	///
+	/// SendFileOperation: sends a file region using sendfile() each time that
+	/// the (non-blocking) socket becomes writable
+	///
+	template <typename WriteHandler>
+	class SendFileOperation {
+	public:
+		SendFileOperation(Socket& tcp_socket, const HandlerAllocatorPtr& allocator, int file_fd,
+						  boost::uint64_t file_offset, std::size_t length, WriteHandler handler)
+			: m_socket(tcp_socket), m_allocator(allocator), m_file_fd(file_fd), m_file_offset(file_offset),
+			m_bytes_left(length), m_bytes_sent(0), m_handler(handler)
+		{}
+		
+		/// called by asio each time that the socket becomes writable
+		void operator()(const boost::system::error_code& wait_error, std::size_t /* unused */) {
+			boost::system::error_code ec(wait_error);
+			while (!ec && m_bytes_left > 0) {
+				off_t offset = static_cast<off_t>(m_file_offset);
+				const ssize_t n = ::sendfile(m_socket.native_handle(), m_file_fd,
+											 &offset, m_bytes_left);
+				if (n > 0) {
+					m_file_offset += n;
+					m_bytes_left -= n;
+					m_bytes_sent += n;
+				} else if (n == 0) {
+					// the file is shorter than expected (it was truncated)
+					ec = boost::asio::error::eof;
+				} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+					// socket buffer is full: wait until it is writable again
+					m_socket.async_write_some(boost::asio::null_buffers(),
+											  makeAllocHandler(m_allocator, *this));
+					return;
+				} else if (errno != EINTR) {
+					ec = boost::system::error_code(errno, boost::system::system_category());
+				}
+			}
+			// restore blocking mode for synchronous operations
+			boost::system::error_code ignored_ec;
+			m_socket.non_blocking(false, ignored_ec);
+			m_handler(ec, m_bytes_sent);
+		}
+		
+	private:
+		Socket &			m_socket;
+		HandlerAllocatorPtr	m_allocator;
+		int					m_file_fd;
+		boost::uint64_t		m_file_offset;
+		std::size_t			m_bytes_left;
+		std::size_t			m_bytes_sent;
+		WriteHandler		m_handler;
+	};
+#endif
+
 	
 	/// context object for the SSL connection socket
 	SSLContext					m_ssl_context;
@@ -702,6 +839,16 @@ private:
 
 	/// buffer used for reading data from the TCP connection
 	ReadBuffer					m_read_buffer;
+
+	/// memory used for asynchronous accept, connect, handshake & read operations
+	/// (each operation's handler shares it, so it may outlive the connection)
+	HandlerAllocatorPtr			m_read_allocator;
+
+	/// memory used for asynchronous write operations
+	HandlerAllocatorPtr			m_write_allocator;
+
+	/// timer that is re-armed for each read (it refers back to the connection weakly)
+	boost::shared_ptr<TCPTimer>	m_timer_ptr;
 	
 	/// saved read position bookmark
 	ReadPosition				m_read_position;
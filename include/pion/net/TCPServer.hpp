@@ -142,6 +142,9 @@ protected:
 	/// called before the TCP server starts listening for new connections
 	virtual void beforeStarting(void) {}
 
+	/// called when the TCP server is stopping, before it waits for open connections to finish
+	virtual void beforeStopping(void) {}
+
 	/// called after the TCP server has stopped listing for new connections
 	virtual void afterStopping(void) {}
 	
@@ -12,10 +12,12 @@
 
 #include <boost/asio.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/thread/mutex.hpp>
 #include <pion/PionConfig.hpp>
 #include <pion/net/TCPConnection.hpp>
+#include <pion/net/HandlerAllocator.hpp>
 
 
 namespace pion {	// begin namespace pion
@@ -23,7 +25,9 @@ namespace net {		// begin namespace net (Pion Network Library)
 
 
 ///
-/// TCPTimer: helper class used to time-out TCP connections
+/// TCPTimer: helper class used to time-out TCP connections; a timer may be
+///           started again after it has been cancelled, so that a connection
+///           re-uses one timer for all of its operations
 ///
 class TCPTimer
 	: public boost::enable_shared_from_this<TCPTimer>
@@ -54,15 +58,25 @@ private:
 	 * Callback handler for the deadline timer
 	 *
 	 * @param ec deadline timer error status code
+	 * @param generation value of m_generation when the timer was started
 	 */
-	void timerCallback(const boost::system::error_code& ec);
+	void timerCallback(const boost::system::error_code& ec, unsigned long generation);
 
 
-	/// pointer to the TCP connection that is being monitored
-	TCPConnectionPtr						m_conn_ptr;
+	/// the TCP connection that is being monitored (which may own the timer)
+	boost::weak_ptr<TCPConnection>			m_conn_ptr;
 
 	/// deadline timer used to timeout TCP operations
 	boost::asio::deadline_timer				m_timer;
+
+	/// memory used for the deadline timer's asynchronous wait operations
+	HandlerAllocatorPtr						m_allocator;
+	
+	/// used instead while a cancelled wait has not yet released m_allocator
+	HandlerAllocatorPtr						m_spare_allocator;
+	
+	/// incremented each time that the timer is started
+	unsigned long							m_generation;
 	
 	/// mutex used to synchronize the TCP connection timer
 	boost::mutex							m_mutex;
@@ -147,6 +147,16 @@ public:
 	 */
 	void setServiceOption(const std::string& resource,
 						  const std::string& name, const std::string& value);
+
+	/**
+	 * returns the web service associated with resource
+	 *
+	 * @param resource the resource name or uri-stem that identifies the web service
+	 * @return WebService* the web service, or NULL if there is none
+	 */
+	inline WebService *getService(const std::string& resource) {
+		return m_services.get(stripTrailingSlash(resource));
+	}
 	
 	/**
 	 * Parses a simple web service configuration file. Each line in the file
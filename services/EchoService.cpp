@@ -34,6 +34,21 @@ void writeDictionaryTerm(HTTPResponseWriterPtr& writer,
 
 // EchoService member functions
 
+void EchoService::setOption(const std::string& name, const std::string& value)
+{
+	if (name == "compress") {
+		if (value == "true") {
+			m_compress = true;
+		} else if (value == "false") {
+			m_compress = false;
+		} else {
+			throw InvalidOptionValueException("compress", value);
+		}
+	} else {
+		throw UnknownOptionException(name);
+	}
+}
+
 /// handles requests for EchoService
 void EchoService::operator()(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn)
 {
@@ -50,6 +65,9 @@ void EchoService::operator()(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn
 	HTTPResponseWriterPtr writer(HTTPResponseWriter::create(tcp_conn, *request,
 															boost::bind(&TCPConnection::finish, tcp_conn)));
 	writer->getResponse().setContentType(HTTPTypes::CONTENT_TYPE_TEXT);
+	// compress the response if enabled and the client accepts gzip or deflate
+	if (m_compress)
+		writer->setCompression(HTTPCompressor::getDefaultOptions());
 	
 	// write request information
 	writer->writeNoCopy(REQUEST_ECHO_TEXT);
@@ -10,6 +10,7 @@
 #ifndef __PION_ECHOSERVICE_HEADER__
 #define __PION_ECHOSERVICE_HEADER__
 
+#include <pion/PionException.hpp>
 #include <pion/net/WebService.hpp>
 
 
@@ -23,10 +24,35 @@ class EchoService :
 	public pion::net::WebService
 {
 public:
-	EchoService(void) {}
+
+	/// exception thrown if an option has a value that is not supported
+	class InvalidOptionValueException : public PionException {
+	public:
+		InvalidOptionValueException(const std::string& option, const std::string& value)
+			: PionException("EchoService invalid value for " + option + " option: ", value) {}
+	};
+
+	EchoService(void) : m_compress(false) {}
 	virtual ~EchoService() {}
+
+	/**
+	 * configuration options supported by EchoService:
+	 *
+	 * compress: if true, responses are compressed when the client accepts
+	 *           gzip or deflate (default false)
+	 *
+	 * @param name the name of the option to change
+	 * @param value the value of the option
+	 */
+	virtual void setOption(const std::string& name, const std::string& value);
+
 	virtual void operator()(pion::net::HTTPRequestPtr& request,
 							pion::net::TCPConnectionPtr& tcp_conn);
+
+private:
+
+	/// true if responses are compressed when the client accepts it
+	bool		m_compress;
 };
 
 }	// end namespace plugins
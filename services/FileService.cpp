@@ -7,16 +7,55 @@
 // See http://www.boost.org/LICENSE_1_0.txt
 //
 
+#ifdef __linux__
+	// open(2) and posix_fadvise(2) prepare files for sendfile(2), which
+	// TCPConnection.hpp enables (PION_HAVE_SENDFILE) on Linux only
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+#ifndef _MSC_VER
+	// stat(2) returns a file's size, timestamp and serial number at once
+	#include <sys/stat.h>
+	// mkstemp(3) creates the temporary files that replace files
+	#include <stdlib.h>
+	#include <unistd.h>
+#endif
+#include <ctime>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include <limits>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/filesystem/operations.hpp>
 #include <boost/filesystem/fstream.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/condition.hpp>
 #include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/trim.hpp>
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 
 #include "FileService.hpp"
 #include <pion/PionPlugin.hpp>
 #include <pion/net/HTTPResponseWriter.hpp>
+#include <pion/net/HTTPParser.hpp>
+
+#if defined(__linux__) && !defined(PION_HAVE_INOTIFY)
+	// inotify(7) reports changes to files, so that they need not be checked
+	#include <sys/inotify.h>
+	#include <poll.h>
+	#include <unistd.h>
+	#include <errno.h>
+	#include <boost/scoped_ptr.hpp>
+	#define PION_HAVE_INOTIFY
+#endif
 
 using namespace pion;
 using namespace pion::net;
@@ -31,21 +70,552 @@ const std::string			FileService::DEFAULT_MIME_TYPE("application/octet-stream");
 const unsigned int			FileService::DEFAULT_CACHE_SETTING = 1;
 const unsigned int			FileService::DEFAULT_SCAN_SETTING = 0;
 const unsigned long			FileService::DEFAULT_MAX_CACHE_SIZE = 0;	/* 0=disabled */
+const unsigned long			FileService::DEFAULT_CACHE_SIZE = 0;		/* 0=unlimited */
 const unsigned long			FileService::DEFAULT_MAX_CHUNK_SIZE = 0;	/* 0=disabled */
+const unsigned int			FileService::DEFAULT_COMPRESS_SETTING = 0;
+const unsigned int			FileService::DEFAULT_IO_THREADS = 0;		/* 0=disabled */
+const unsigned int			FileService::DEFAULT_SCAN_THREADS = 1;
+const std::size_t			FileService::NUM_CACHE_SHARDS = 16;
+const std::string			FileService::TEMP_FILE_PREFIX(".pion-put.");
 boost::once_flag			FileService::m_mime_types_init_flag = BOOST_ONCE_INIT;
 FileService::MIMETypeMap	*FileService::m_mime_types_ptr = NULL;
 
 
+#ifdef PION_HAVE_INOTIFY
+
+///
+/// FileService::FileWatcher: a thread that reads inotify(7) events for the
+///                           watched directories, and updates the cache
+///
+class FileService::FileWatcher :
+	private boost::noncopyable
+{
+public:
+
+	/// creates the inotify instance (see isOpen())
+	FileWatcher(FileService& service)
+		: m_service(service), m_inotify_fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC))
+	{
+		m_stop_pipe[0] = m_stop_pipe[1] = -1;
+		if (m_inotify_fd >= 0 && ::pipe(m_stop_pipe) != 0)
+			m_stop_pipe[0] = m_stop_pipe[1] = -1;
+	}
+
+	/// stops the thread and releases the inotify instance
+	~FileWatcher() {
+		stop();
+		if (m_inotify_fd >= 0) ::close(m_inotify_fd);
+		if (m_stop_pipe[0] >= 0) ::close(m_stop_pipe[0]);
+		if (m_stop_pipe[1] >= 0) ::close(m_stop_pipe[1]);
+	}
+
+	/// returns true if the inotify instance was created
+	inline bool isOpen(void) const { return m_inotify_fd >= 0 && m_stop_pipe[0] >= 0; }
+
+	/**
+	 * watches a directory for changes to the files within it
+	 *
+	 * @param dir_path the directory to watch
+	 * @param recursive if true, its sub-directories are watched too
+	 *
+	 * @return true if the directory (and its sub-directories) are being watched
+	 */
+	bool watch(const boost::filesystem::path& dir_path, bool recursive) {
+		const int wd = inotify_add_watch(m_inotify_fd, dir_path.directory_string().c_str(),
+										 IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE
+										 | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR);
+		if (wd < 0)
+			return false;
+		// a directory may be watched both for the file and as part of the directory
+		WatchedDirectory& watched = m_watches[wd];
+		if (watched.m_path.empty())
+			watched.m_path = dir_path;
+		watched.m_recursive = (watched.m_recursive || recursive);
+		if (recursive) {
+			boost::filesystem::directory_iterator end_itr;
+			for (boost::filesystem::directory_iterator itr(dir_path); itr != end_itr; ++itr) {
+				if (boost::filesystem::is_directory(*itr) && ! watch(*itr, true))
+					return false;
+			}
+		}
+		return true;
+	}
+
+	/// starts the thread that handles changes
+	void start(void) {
+		m_thread.reset(new boost::thread(boost::bind(&FileWatcher::run, this)));
+	}
+
+	/// stops the thread (and waits for it to finish)
+	void stop(void) {
+		if (m_thread) {
+			const char c = 0;
+			if (::write(m_stop_pipe[1], &c, 1) == 1)
+				m_thread->join();
+			m_thread.reset();
+		}
+	}
+
+
+private:
+
+	/// a directory that is being watched
+	struct WatchedDirectory {
+		WatchedDirectory(void) : m_recursive(false) {}
+
+		/// path to the directory
+		boost::filesystem::path		m_path;
+
+		/// true if its sub-directories are watched too
+		bool						m_recursive;
+	};
+
+	/// data type for map of watch descriptors to the directories that they watch
+	typedef std::map<int, WatchedDirectory>		WatchMap;
+
+
+	/// reads and handles events until stop() is called
+	void run(void) {
+		struct pollfd fds[2];
+		fds[0].fd = m_inotify_fd;
+		fds[0].events = POLLIN;
+		fds[1].fd = m_stop_pipe[0];
+		fds[1].events = POLLIN;
+		char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+		for (;;) {
+			if (::poll(fds, 2, -1) < 0) {
+				if (errno == EINTR)
+					continue;
+				PION_LOG_ERROR(m_service.m_logger, "Unable to watch files ("
+							   << m_service.getResource() << "): " << strerror(errno));
+				break;
+			}
+			if (fds[1].revents != 0)
+				break;
+			ssize_t len;
+			while ((len = ::read(m_inotify_fd, buffer, sizeof(buffer))) > 0) {
+				for (const char *ptr = buffer; ptr < buffer + len; ) {
+					const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(ptr);
+					try {
+						handleEvent(*event);
+					} catch (std::exception& e) {
+						PION_LOG_WARN(m_service.m_logger, "Unable to handle file change ("
+									  << m_service.getResource() << "): " << e.what());
+					}
+					ptr += sizeof(struct inotify_event) + event->len;
+				}
+			}
+		}
+		// requests check for updates again
+		m_service.m_watching.store(false);
+	}
+
+	/// updates the cache for an event (may throw)
+	void handleEvent(const struct inotify_event& event) {
+		if (event.mask & IN_Q_OVERFLOW) {
+			// some changes were lost, so start again from what is on disk
+			PION_LOG_WARN(m_service.m_logger, "Too many file changes to follow ("
+						  << m_service.getResource() << "), reloading the cache");
+			m_service.handleLostChanges();
+			return;
+		}
+		WatchMap::iterator i = m_watches.find(event.wd);
+		if (i == m_watches.end())
+			return;
+		if (event.mask & IN_IGNORED) {
+			// the directory was removed
+			m_watches.erase(i);
+			return;
+		}
+		if (event.len == 0)
+			return;
+
+		const boost::filesystem::path changed_path(i->second.m_path / event.name);
+		const bool is_directory = ((event.mask & IN_ISDIR) != 0);
+		const bool removed = ((event.mask & (IN_DELETE | IN_MOVED_FROM)) != 0);
+		if (is_directory) {
+			if (! i->second.m_recursive)
+				return;
+			if (removed) {
+				// stop watching a directory that was moved away (and its sub-directories)
+				const std::string dir_string(changed_path.directory_string() + '/');
+				for (WatchMap::iterator j = m_watches.begin(); j != m_watches.end(); ) {
+					if (j->second.m_path == changed_path
+						|| j->second.m_path.directory_string().compare(0, dir_string.size(), dir_string) == 0)
+					{
+						inotify_rm_watch(m_inotify_fd, j->first);
+						m_watches.erase(j++);
+					} else {
+						++j;
+					}
+				}
+			} else if (! watch(changed_path, true)) {
+				PION_LOG_WARN(m_service.m_logger, "Unable to watch directory ("
+							  << m_service.getResource() << "): " << changed_path.directory_string());
+			}
+		}
+		m_service.handleFileChange(changed_path, is_directory, removed);
+	}
+
+
+	/// the service whose cache is updated
+	FileService &						m_service;
+
+	/// the inotify instance
+	const int							m_inotify_fd;
+
+	/// written to by stop() to wake up the thread
+	int									m_stop_pipe[2];
+
+	/// the directories that are being watched
+	WatchMap							m_watches;
+
+	/// the thread that handles changes
+	boost::scoped_ptr<boost::thread>	m_thread;
+};
+
+#endif
+
+
+///
+/// FileService::DirectoryScanner: adds the files within the directory to the
+///                                cache using several threads, and reuses the
+///                                listings saved in a manifest by the last scan
+///                                for the directories that have not changed
+///
+class FileService::DirectoryScanner :
+	private boost::noncopyable
+{
+public:
+
+	/**
+	 * constructs a scanner for the directory of a service
+	 *
+	 * @param service the service whose cache is populated
+	 * @param dir_path the directory that is scanned
+	 * @param holdable true if the scan waits while the service holds scans
+	 *                 (only for scans in the background)
+	 */
+	DirectoryScanner(FileService& service, const boost::filesystem::path& dir_path,
+					 bool holdable)
+		: m_service(service), m_dir_path(dir_path), m_holdable(holdable),
+		m_start_time(0), m_busy(0)
+	{
+		m_stopped.store(false);
+		m_num_files.store(0);
+		m_listed_dirs.store(0);
+		m_reused_dirs.store(0);
+	}
+
+	/**
+	 * scans the directory and its sub-directories (returns when finished)
+	 *
+	 * @param num_threads the number of threads that scan (including this one)
+	 * @return true if the scan finished, or false if it was stopped
+	 */
+	bool scan(unsigned int num_threads) {
+		m_start_time = std::time(NULL);
+		m_queue.push_back(std::string());
+		boost::thread_group threads;
+		for (unsigned int n = 1; n < num_threads; ++n)
+			threads.create_thread(boost::bind(&DirectoryScanner::run, this));
+		run();
+		threads.join_all();
+		return ! m_stopped.load();
+	}
+
+	/// stops a scan that is in progress (its threads finish soon after)
+	void stop(void) {
+		m_stopped.store(true);
+		boost::mutex::scoped_lock queue_lock(m_mutex);
+		m_queue_changed.notify_all();
+	}
+
+	/**
+	 * loads the listings saved by a previous scan of the same directory
+	 *
+	 * @param manifest_path the file that the listings were saved in
+	 * @return true if the manifest was loaded, or false if none could be
+	 *         (in which case all the directories are listed)
+	 */
+	bool loadManifest(const boost::filesystem::path& manifest_path) {
+		boost::filesystem::ifstream manifest(manifest_path, std::ios::in | std::ios::binary);
+		std::string line;
+		if (! std::getline(manifest, line) || line != getManifestHeader())
+			return false;
+		Listing *listing_ptr = NULL;
+		while (std::getline(manifest, line)) {
+			if (line.size() < 2 || line[1] != '\t')
+				break;
+			const std::string value(line, 2);
+			if (line[0] == 'D') {
+				// "D <modified> <relative path>" starts a directory's listing
+				const std::string::size_type pos = value.find('\t');
+				if (pos == std::string::npos)
+					break;
+				std::time_t modified;
+				try { modified = boost::lexical_cast<std::time_t>(value.substr(0, pos)); }
+				catch (boost::bad_lexical_cast&) { break; }
+				listing_ptr = &m_saved[value.substr(pos + 1)];
+				listing_ptr->m_modified = modified;
+			} else if (line[0] == 'd' && listing_ptr != NULL) {
+				listing_ptr->m_dirs.push_back(value);
+			} else if (line[0] == 'f' && listing_ptr != NULL) {
+				listing_ptr->m_files.push_back(value);
+			} else if (line[0] == 'E' && value == boost::lexical_cast<std::string>(m_saved.size())) {
+				// the manifest is complete
+				return true;
+			} else {
+				break;
+			}
+		}
+		m_saved.clear();
+		return false;
+	}
+
+	/**
+	 * saves the listings found by the last scan (replacing the manifest
+	 * only once the new one has been written)
+	 *
+	 * @param manifest_path the file that the listings are saved in
+	 * @return true if the manifest was saved
+	 */
+	bool saveManifest(const boost::filesystem::path& manifest_path) const {
+		const boost::filesystem::path temp_path(manifest_path.file_string() + ".tmp");
+		boost::filesystem::ofstream manifest(temp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+		manifest << getManifestHeader() << '\n';
+		for (ListingMap::const_iterator i = m_found.begin(); i != m_found.end(); ++i) {
+			manifest << "D\t" << i->second.m_modified << '\t' << i->first << '\n';
+			for (std::vector<std::string>::const_iterator j = i->second.m_dirs.begin();
+				 j != i->second.m_dirs.end(); ++j)
+				manifest << "d\t" << *j << '\n';
+			for (std::vector<std::string>::const_iterator j = i->second.m_files.begin();
+				 j != i->second.m_files.end(); ++j)
+				manifest << "f\t" << *j << '\n';
+		}
+		manifest << "E\t" << m_found.size() << '\n';
+		manifest.close();
+		return (manifest && std::rename(temp_path.file_string().c_str(),
+										manifest_path.file_string().c_str()) == 0);
+	}
+
+	/// releases the listings (once the manifest has been saved)
+	inline void clear(void) {
+		ListingMap().swap(m_saved);
+		ListingMap().swap(m_found);
+	}
+
+	/// returns the number of files that were added to the cache
+	inline unsigned long getNumFiles(void) const { return m_num_files.load(); }
+
+	/// returns the number of directories that were listed
+	inline unsigned long getListedDirectories(void) const { return m_listed_dirs.load(); }
+
+	/// returns the number of directories whose saved listings were used
+	inline unsigned long getReusedDirectories(void) const { return m_reused_dirs.load(); }
+
+
+private:
+
+	/// the names of the files and sub-directories within a directory
+	struct Listing {
+		Listing(void) : m_modified(0) {}
+
+		/// the directory's last modified time when it was listed
+		std::time_t					m_modified;
+
+		/// names of the files within the directory
+		std::vector<std::string>	m_files;
+
+		/// names of the sub-directories within the directory
+		std::vector<std::string>	m_dirs;
+	};
+
+	/// data type for map of relative paths of directories ("" = root) to their listings
+	typedef std::map<std::string, Listing>		ListingMap;
+
+
+	/// returns the first line of a manifest of the directory
+	inline std::string getManifestHeader(void) const {
+		return "pion FileService manifest 1\t" + m_dir_path.directory_string();
+	}
+
+	/// returns true if the unit tests hold the scan before it lists more directories
+	inline bool isHeld(void) const {
+		return m_holdable && m_service.m_scan_held.load();
+	}
+
+	/// returns true if a name cannot be saved in a manifest
+	static inline bool hasNewLine(const std::string& name) {
+		return name.find('\n') != std::string::npos;
+	}
+
+	/// scans the directories in the queue until all have been scanned (or stop() is called)
+	void run(void) {
+		boost::mutex::scoped_lock queue_lock(m_mutex);
+		for (;;) {
+			// wait for another thread to find more directories (or to finish),
+			// and for the unit tests to stop holding the scan
+			while (((m_queue.empty() && m_busy > 0) || isHeld()) && ! m_stopped.load()) {
+				if (isHeld())
+					m_queue_changed.timed_wait(queue_lock, boost::posix_time::milliseconds(10));
+				else
+					m_queue_changed.wait(queue_lock);
+			}
+			if (m_queue.empty() || m_stopped.load())
+				break;
+			const std::string relative_dir(m_queue.front());
+			m_queue.pop_front();
+			++m_busy;
+			queue_lock.unlock();
+
+			Listing listing;
+			const bool scanned = scanDirectory(relative_dir, listing);
+
+			queue_lock.lock();
+			--m_busy;
+			if (scanned) {
+				bool saveable = ! hasNewLine(relative_dir);
+				for (std::vector<std::string>::const_iterator i = listing.m_dirs.begin();
+					 i != listing.m_dirs.end(); ++i)
+				{
+					m_queue.push_back(relative_dir.empty() ? *i : relative_dir + '/' + *i);
+					saveable = saveable && ! hasNewLine(*i);
+				}
+				saveable = saveable && std::find_if(listing.m_files.begin(), listing.m_files.end(),
+													&DirectoryScanner::hasNewLine) == listing.m_files.end();
+				// a directory modified since the scan started may change again
+				// without its timestamp changing, so it is listed again next time
+				if (saveable && listing.m_modified < m_start_time) {
+					Listing& found = m_found[relative_dir];
+					found.m_modified = listing.m_modified;
+					found.m_files.swap(listing.m_files);
+					found.m_dirs.swap(listing.m_dirs);
+				}
+			}
+			m_queue_changed.notify_all();
+		}
+	}
+
+	/**
+	 * lists a directory (unless its saved listing is still current), and
+	 * adds its files to the cache
+	 *
+	 * @param relative_dir path of the directory relative to the root directory
+	 * @param listing the directory's files and sub-directories
+	 * @return true if the directory was scanned
+	 */
+	bool scanDirectory(const std::string& relative_dir, Listing& listing) {
+		const boost::filesystem::path dir_path(relative_dir.empty() ? m_dir_path : m_dir_path / relative_dir);
+		try {
+			listing.m_modified = boost::filesystem::last_write_time(dir_path);
+			// each directory is scanned once, so its saved listing may be taken
+			ListingMap::iterator saved = m_saved.find(relative_dir);
+			if (saved != m_saved.end() && saved->second.m_modified == listing.m_modified) {
+				listing.m_files.swap(saved->second.m_files);
+				listing.m_dirs.swap(saved->second.m_dirs);
+				++m_reused_dirs;
+			} else {
+				boost::filesystem::directory_iterator end_itr;
+				for (boost::filesystem::directory_iterator itr(dir_path); itr != end_itr; ++itr) {
+					if (boost::filesystem::is_directory(itr->status()))
+						listing.m_dirs.push_back(itr->path().leaf());
+					else if (! FileService::isTempFile(itr->path().leaf()))
+						listing.m_files.push_back(itr->path().leaf());
+				}
+				++m_listed_dirs;
+			}
+		} catch (std::exception& e) {
+			PION_LOG_ERROR(m_service.m_logger, "Unable to scan directory ("
+						   << m_service.getResource() << "): " << e.what());
+			return false;
+		}
+
+		// add the files to the cache (use placeholders if scan == 1)
+		for (std::vector<std::string>::const_iterator i = listing.m_files.begin();
+			 i != listing.m_files.end() && ! m_stopped.load(); ++i)
+		{
+			m_service.addCacheEntry(relative_dir.empty() ? *i : relative_dir + '/' + *i,
+									dir_path / *i, m_service.m_scan_setting == 1);
+			++m_num_files;
+		}
+		return true;
+	}
+
+
+	/// the service whose cache is populated
+	FileService &						m_service;
+
+	/// the directory that is scanned
+	const boost::filesystem::path		m_dir_path;
+
+	/// true if the scan waits while the service holds scans
+	const bool							m_holdable;
+
+	/// when the scan started
+	std::time_t							m_start_time;
+
+	/// listings loaded from the manifest
+	ListingMap							m_saved;
+
+	/// listings found by the scan, which may be saved in the manifest
+	ListingMap							m_found;
+
+	/// relative paths of the directories that are waiting to be scanned
+	std::deque<std::string>				m_queue;
+
+	/// number of directories that are being scanned
+	unsigned int						m_busy;
+
+	/// true if the scan has been stopped
+	boost::atomic<bool>					m_stopped;
+
+	/// mutex used to protect m_queue, m_busy and m_found
+	boost::mutex						m_mutex;
+
+	/// signaled when directories are added to the queue, or finish being scanned
+	boost::condition					m_queue_changed;
+
+	/// number of files that were added to the cache
+	boost::atomic<unsigned long>		m_num_files;
+
+	/// number of directories that were listed
+	boost::atomic<unsigned long>		m_listed_dirs;
+
+	/// number of directories whose saved listings were used
+	boost::atomic<unsigned long>		m_reused_dirs;
+};
+
+
 // FileService member functions
 
 FileService::FileService(void)
 	: m_logger(PION_GET_LOGGER("pion.FileService")),
+	m_cache_shards(new CacheShard[NUM_CACHE_SHARDS]),
+	m_clock_hand(m_cache_clock.end()),
 	m_cache_setting(DEFAULT_CACHE_SETTING),
 	m_scan_setting(DEFAULT_SCAN_SETTING),
 	m_max_cache_size(DEFAULT_MAX_CACHE_SIZE),
+	m_cache_size(DEFAULT_CACHE_SIZE),
 	m_max_chunk_size(DEFAULT_MAX_CHUNK_SIZE),
-	m_writable(false)
-{}
+	m_writable(false),
+	m_map_content(false),
+	m_watch_files(false),
+	m_compress_setting(DEFAULT_COMPRESS_SETTING),
+	m_hash_etags(false),
+	m_io_threads(DEFAULT_IO_THREADS),
+	m_scan_threads(DEFAULT_SCAN_THREADS),
+	m_lazy_scan(false)
+{
+	m_watching.store(false);
+	m_io_running.store(false);
+	m_scanning.store(false);
+	m_scan_held.store(false);
+	m_cache_bytes.store(0);
+	m_cache_hits.store(0);
+	m_cache_misses.store(0);
+	m_cache_evictions.store(0);
+}
 
 void FileService::setOption(const std::string& name, const std::string& value)
 {
@@ -89,6 +659,12 @@ void FileService::setOption(const std::string& name, const std::string& value)
 		}
 	} else if (name == "max_chunk_size") {
 		m_max_chunk_size = boost::lexical_cast<unsigned long>(value);
+	} else if (name == "cache_size") {
+		try {
+			m_cache_size = boost::lexical_cast<unsigned long>(value);
+		} catch (boost::bad_lexical_cast&) {
+			throw InvalidOptionValueException("cache_size", value);
+		}
 	} else if (name == "writable") {
 		if (value == "true") {
 			m_writable = true;
@@ -97,12 +673,148 @@ void FileService::setOption(const std::string& name, const std::string& value)
 		} else {
 			throw InvalidOptionValueException("writable", value);
 		}
+	} else if (name == "mmap") {
+		if (value == "true") {
+			m_map_content = true;
+		} else if (value == "false") {
+			m_map_content = false;
+		} else {
+			throw InvalidOptionValueException("mmap", value);
+		}
+	} else if (name == "watch") {
+		if (value == "true") {
+			m_watch_files = true;
+		} else if (value == "false") {
+			m_watch_files = false;
+		} else {
+			throw InvalidOptionValueException("watch", value);
+		}
+	} else if (name == "compress") {
+		if (value == "0") {
+			m_compress_setting = 0;
+		} else if (value == "1") {
+			m_compress_setting = 1;
+		} else if (value == "2") {
+			m_compress_setting = 2;
+		} else {
+			throw InvalidOptionValueException("compress", value);
+		}
+	} else if (name == "compress_level") {
+		int level = 0;
+		try {
+			level = boost::lexical_cast<int>(value);
+		} catch (boost::bad_lexical_cast&) {}
+		if (level < 1 || level > 9)
+			throw InvalidOptionValueException("compress_level", value);
+		m_compress_options.setLevel(level);
+	} else if (name == "compress_min_size") {
+		try {
+			m_compress_options.setMinSize(boost::lexical_cast<std::size_t>(value));
+		} catch (boost::bad_lexical_cast&) {
+			throw InvalidOptionValueException("compress_min_size", value);
+		}
+	} else if (name == "compress_types") {
+		std::vector<std::string> mime_types;
+		boost::algorithm::split(mime_types, value, boost::algorithm::is_any_of(","));
+		m_compress_options.clearMimeTypes();
+		for (std::vector<std::string>::iterator i = mime_types.begin(); i != mime_types.end(); ++i) {
+			boost::algorithm::trim(*i);
+			if (! i->empty())
+				m_compress_options.addMimeType(*i);
+		}
+	} else if (name == "etag") {
+		if (value == "stat") {
+			m_hash_etags = false;
+		} else if (value == "hash") {
+			m_hash_etags = true;
+		} else {
+			throw InvalidOptionValueException("etag", value);
+		}
+	} else if (name == "max_age") {
+		// "<seconds>" applies to all files, "<path>=<seconds>" to those within the path
+		const std::string::size_type pos = value.rfind('=');
+		std::string path(pos == std::string::npos ? std::string() : value.substr(0, pos));
+		boost::algorithm::trim_if(path, boost::algorithm::is_any_of("/ "));
+		unsigned long max_age;
+		try {
+			max_age = boost::lexical_cast<unsigned long>(value.substr(pos + 1));
+		} catch (boost::bad_lexical_cast&) {
+			throw InvalidOptionValueException("max_age", value);
+		}
+		m_cache_controls[path] = "max-age=" + boost::lexical_cast<std::string>(max_age);
+	} else if (name == "io_threads") {
+		try {
+			m_io_threads = boost::lexical_cast<unsigned int>(value);
+		} catch (boost::bad_lexical_cast&) {
+			throw InvalidOptionValueException("io_threads", value);
+		}
+	} else if (name == "scan_threads") {
+		try {
+			m_scan_threads = boost::lexical_cast<unsigned int>(value);
+		} catch (boost::bad_lexical_cast&) {
+			throw InvalidOptionValueException("scan_threads", value);
+		}
+		if (m_scan_threads == 0)
+			throw InvalidOptionValueException("scan_threads", value);
+	} else if (name == "lazy_scan") {
+		if (value == "true") {
+			m_lazy_scan = true;
+		} else if (value == "false") {
+			m_lazy_scan = false;
+		} else {
+			throw InvalidOptionValueException("lazy_scan", value);
+		}
+	} else if (name == "scan_manifest") {
+		m_scan_manifest = value;
+		PionPlugin::checkCygwinPath(m_scan_manifest, value);
 	} else {
 		throw UnknownOptionException(name);
 	}
 }
 
 void FileService::operator()(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn)
+{
+	// requests that may have to wait for the disk are handled by the disk
+	// I/O threads (if there are any), rather than by the connection's thread
+	if (m_io_running.load(boost::memory_order_relaxed)
+		&& ! isCachedInMemory(getRelativeResource(request->getResource())))
+	{
+		m_io_scheduler.getIOService().post(boost::bind(&FileService::handleDiskRequest,
+													   this, request, tcp_conn));
+	} else {
+		handleRequest(request, tcp_conn);
+	}
+}
+
+bool FileService::isCachedInMemory(const std::string& relative_path)
+{
+	if (m_cache_setting != 2 && ! m_watching.load(boost::memory_order_relaxed))
+		return false;
+	CacheEntryPtr cache_entry(findCacheEntry(relative_path));
+	if (! cache_entry)
+		return false;
+	DiskFilePtr cached_file(cache_entry->getFile());
+	return (cached_file && (cached_file->hasFileContent() || cached_file->getFileSize() == 0));
+}
+
+void FileService::handleDiskRequest(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn)
+{
+	try {
+		handleRequest(request, tcp_conn);
+	} catch (std::bad_alloc&) {
+		throw;
+	} catch (std::exception& e) {
+		// there is no request handler to recover from the error for us
+		PION_LOG_ERROR(m_logger, "Unable to handle request (" << getResource() << "): " << e.what());
+		HTTPResponseWriterPtr writer(HTTPResponseWriter::create(tcp_conn, *request,
+									 boost::bind(&TCPConnection::finish, tcp_conn)));
+		writer->getResponse().setStatusCode(HTTPTypes::RESPONSE_CODE_SERVER_ERROR);
+		writer->getResponse().setStatusMessage(HTTPTypes::RESPONSE_MESSAGE_SERVER_ERROR);
+		writer->send();
+	}
+}
+
+void FileService::handleRequest(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn)
 {
 	// get the relative resource path for the request
 	const std::string relative_path(getRelativeResource(request->getResource()));
@@ -163,8 +875,17 @@ void FileService::operator()(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn
 		return;
 	}
 
-	// requests specifying directories are not allowed
-	if (boost::filesystem::is_directory(file_path)) {
+	// temporary files that are being written to replace files are not served
+	if (isTempFile(file_path.leaf())) {
+		sendNotFoundResponse(request, tcp_conn);
+		return;
+	}
+
+	// requests specifying directories are not allowed (files that are in the
+	// cache are known not to be directories while they are watched)
+	if ((! m_watching.load(boost::memory_order_relaxed) || ! findCacheEntry(relative_path))
+		&& boost::filesystem::is_directory(file_path))
+	{
 		PION_LOG_WARN(m_logger, "Request for directory ("
 					  << getResource() << "): " << relative_path);
 		static const std::string FORBIDDEN_HTML_START =
@@ -198,11 +919,12 @@ void FileService::operator()(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn
 			RESPONSE_OK,			// normal response that includes the file's content
 			RESPONSE_HEAD_OK,		// response to HEAD request (would send file's content)
 			RESPONSE_NOT_FOUND,		// Not Found (404)
-			RESPONSE_NOT_MODIFIED	// Not Modified (304) response to If-Modified-Since
+			RESPONSE_NOT_MODIFIED,	// Not Modified (304) response to If-Modified-Since
+			RESPONSE_RANGE_NOT_SATISFIABLE	// Requested Range Not Satisfiable (416)
 		} response_type = RESPONSE_UNDEFINED;
 
-		// used to hold our response information
-		DiskFile response_file;
+		// used to hold our response information (shared with the cache, if it is cached)
+		DiskFilePtr response_file;
 
 		// get the If-Modified-Since request header
 		const std::string if_modified_since(request->getHeader(HTTPTypes::HEADER_IF_MODIFIED_SINCE));
@@ -212,13 +934,14 @@ void FileService::operator()(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn
 		if (m_cache_setting > 0 || m_scan_setting > 0) {
 
 			// search for a matching cache entry
-			boost::mutex::scoped_lock cache_lock(m_cache_mutex);
-			CacheMap::iterator cache_itr = m_cache_map.find(relative_path);
+			CacheEntryPtr cache_entry(findCacheEntry(relative_path));
 
-			if (cache_itr == m_cache_map.end()) {
+			if (! cache_entry) {
 				// no existing cache entries found
 
-				if (m_scan_setting == 1 || m_scan_setting == 3) {
+				if ((m_scan_setting == 1 || m_scan_setting == 3)
+					&& ! m_scanning.load(boost::memory_order_relaxed))
+				{
 					// do not allow files to be added;
 					// all requests must correspond with existing cache entries
 					// since no match was found, just return file not found
@@ -226,85 +949,37 @@ void FileService::operator()(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn
 								  << getResource() << "): " << relative_path);
 					response_type = RESPONSE_NOT_FOUND;
 				} else {
+					// (or the file may not have been scanned yet)
 					PION_LOG_DEBUG(m_logger, "No cache entry for request ("
 								   << getResource() << "): " << relative_path);
 				}
 
-			} else {
-				// found an existing cache entry
-
-				PION_LOG_DEBUG(m_logger, "Found cache entry for request ("
-							   << getResource() << "): " << relative_path);
-
-				if (m_cache_setting == 0) {
-					// cache is disabled
-
-					// copy & re-use file_path and mime_type
-					response_file.setFilePath(cache_itr->second.getFilePath());
-					response_file.setMimeType(cache_itr->second.getMimeType());
+			} else if (m_cache_setting == 0) {
+				// found an existing cache entry, but the cache is disabled
 
-					// get the file_size and last_modified timestamp
-					response_file.update();
+				// re-use file_path and mime_type, and get the file_size and
+				// last_modified timestamp
+				boost::shared_ptr<DiskFile> disk_file(new DiskFile(cache_entry->getFilePath(), NULL, 0, 0,
+																   cache_entry->getMimeType()));
+				disk_file->update();
+				updateVariants(*disk_file);
+				updateETag(*disk_file);
+				response_file = disk_file;
 
-					// just compare strings for simplicity (parsing this date format sucks!)
-					if (response_file.getLastModifiedString() == if_modified_since) {
-						// no need to read the file; the modified times match!
-						response_type = RESPONSE_NOT_MODIFIED;
-					} else {
-						if (request->getMethod() == HTTPTypes::REQUEST_METHOD_HEAD) {
-							response_type = RESPONSE_HEAD_OK;
-						} else {
-							response_type = RESPONSE_OK;
-							PION_LOG_DEBUG(m_logger, "Cache disabled, reading file ("
-										   << getResource() << "): " << relative_path);
-						}
-					}
-
-				} else {
-					// cache is enabled
-
-					// true if the entry was updated (used for log message)
-					bool cache_was_updated = false;
-
-					if (cache_itr->second.getLastModified() == 0) {
-
-						// cache file for the first time
-						cache_was_updated = true;
-						cache_itr->second.update();
-						if (m_max_cache_size==0 || cache_itr->second.getFileSize() <= m_max_cache_size) {
-							// read the file (may throw exception)
-							cache_itr->second.read();
-						} else {
-							cache_itr->second.resetFileContent();
-						}
-
-					} else if (m_cache_setting == 1) {
-
-						// check if file has been updated (may throw exception)
-						cache_was_updated = cache_itr->second.checkUpdated();
-
-					} // else cache_setting == 2 (use existing values)
-
-					// get the response type
-					if (cache_itr->second.getLastModifiedString() == if_modified_since) {
-						response_type = RESPONSE_NOT_MODIFIED;
-					} else if (request->getMethod() == HTTPTypes::REQUEST_METHOD_HEAD) {
-						response_type = RESPONSE_HEAD_OK;
-					} else {
-						response_type = RESPONSE_OK;
-					}
+				PION_LOG_DEBUG(m_logger, "Cache disabled, using file ("
+							   << getResource() << "): " << relative_path);
 
-					// copy cache contents so that we can release the mutex
-					response_file = cache_itr->second;
+			} else {
+				// found an existing cache entry, and the cache is enabled
+				// (only requests for the same file wait while it is loaded)
+				response_file = getCachedFile(cache_entry);
 
-					PION_LOG_DEBUG(m_logger, (cache_was_updated ? "Updated" : "Using")
-								   << " cache entry for request ("
-								   << getResource() << "): " << relative_path);
-				}
+				PION_LOG_DEBUG(m_logger, "Using cache entry for request ("
+							   << getResource() << "): " << relative_path);
 			}
 		}
 
-		if (response_type == RESPONSE_UNDEFINED) {
+		if (response_type == RESPONSE_UNDEFINED && ! response_file) {
 			// make sure that the file exists
 			if (! boost::filesystem::exists(file_path)) {
 				PION_LOG_WARN(m_logger, "File not found ("
@@ -313,44 +988,80 @@ void FileService::operator()(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn
 				return;
 			}
 
-			response_file.setFilePath(file_path);
-
 			PION_LOG_DEBUG(m_logger, "Found file for request ("
 						   << getResource() << "): " << relative_path);
 
-			// determine the MIME type
-			response_file.setMimeType(findMIMEType( response_file.getFilePath().leaf() ));
+			if (m_cache_setting != 0) {
+				// add new entry to the cache, unless another request just has
+				PION_LOG_DEBUG(m_logger, "Adding cache entry for request ("
+							   << getResource() << "): " << relative_path);
+				CacheEntryPtr cache_entry(addCacheEntry(relative_path, file_path, true));
+				response_file = getCachedFile(cache_entry);
+			} else {
+				// determine the MIME type, and get the file_size and last_modified timestamp
+				boost::shared_ptr<DiskFile> disk_file(new DiskFile(file_path, NULL, 0, 0,
+																   findMIMEType(file_path.leaf())));
+				disk_file->update();
+				updateVariants(*disk_file);
+				updateETag(*disk_file);
+				response_file = disk_file;
+			}
+		}
 
-			// get the file_size and last_modified timestamp
-			response_file.update();
+		// the gzip-encoded variant of the file is used if the client accepts it
+		const bool accepts_gzip = (response_file && response_file->hasGzipVariant()
+			&& HTTPCompressor::parseAcceptEncoding(request->getHeader(HTTPTypes::HEADER_ACCEPT_ENCODING))
+				== HTTPCompressor::ENCODING_GZIP);
 
-			// just compare strings for simplicity (parsing this date format sucks!)
-			if (response_file.getLastModifiedString() == if_modified_since) {
-				// no need to read the file; the modified times match!
+		if (response_type == RESPONSE_UNDEFINED) {
+			// If-None-Match is used instead of If-Modified-Since if it is present;
+			// for the latter, just compare strings for simplicity (parsing this
+			// date format sucks!)
+			const std::string& if_none_match(request->getHeader(HTTPTypes::HEADER_IF_NONE_MATCH));
+			if (if_none_match.empty()
+				? response_file->getLastModifiedString() == if_modified_since
+				: HTTPParser::matchETag(if_none_match, response_file->getVariantETag(accepts_gzip)))
+			{
+				// no need to read the file; the client has the current version!
 				response_type = RESPONSE_NOT_MODIFIED;
 			} else if (request->getMethod() == HTTPTypes::REQUEST_METHOD_HEAD) {
 				response_type = RESPONSE_HEAD_OK;
 			} else {
 				response_type = RESPONSE_OK;
-				if (m_cache_setting != 0) {
-					if (m_max_cache_size==0 || response_file.getFileSize() <= m_max_cache_size) {
-						// read the file (may throw exception)
-						response_file.read();
-					}
-					// add new entry to the cache
-					PION_LOG_DEBUG(m_logger, "Adding cache entry for request ("
-								   << getResource() << "): " << relative_path);
-					boost::mutex::scoped_lock cache_lock(m_cache_mutex);
-					m_cache_map.insert( std::make_pair(relative_path, response_file) );
-				}
 			}
 		}
 
+		// find the ranges requested, unless the file has changed since the
+		// client got the part that it has (If-Range); the ranges are always
+		// within the file's own content, and not its gzip-encoded variant
+		HTTPTypes::ByteRanges ranges;
+		bool use_ranges = false;
+		if (response_type == RESPONSE_OK && request->hasHeader(HTTPTypes::HEADER_RANGE)) {
+			const std::string& if_range = request->getHeader(HTTPTypes::HEADER_IF_RANGE);
+			if (if_range.empty() || if_range == response_file->getVariantETag(false)
+				|| if_range == response_file->getLastModifiedString())
+			{
+				use_ranges = HTTPParser::parseRange(request->getHeader(HTTPTypes::HEADER_RANGE),
+													response_file->getFileSize(), ranges);
+				if (use_ranges && ranges.empty())
+					response_type = RESPONSE_RANGE_NOT_SATISFIABLE;
+			}
+		}
+
+		const bool use_gzip = (accepts_gzip && ! use_ranges);
+		const std::string& cache_control(findCacheControl(relative_path));
+
 		if (response_type == RESPONSE_OK) {
-			// use DiskFileSender to send a file
-			DiskFileSenderPtr sender_ptr(DiskFileSender::create(response_file,
+			// use DiskFileSender to send a file (or ranges of it)
+			DiskFileSenderPtr sender_ptr(DiskFileSender::create(response_file, use_gzip,
 																request, tcp_conn,
 																m_max_chunk_size));
+			if (use_ranges)
+				sender_ptr->setRanges(ranges);
+			if (! cache_control.empty())
+				sender_ptr->setCacheControl(cache_control);
+			if (m_io_running.load(boost::memory_order_relaxed))
+				sender_ptr->setDiskIOService(m_io_scheduler.getIOService());
 			sender_ptr->send();
 		} else if (response_type == RESPONSE_NOT_FOUND) {
 			sendNotFoundResponse(request, tcp_conn);
@@ -360,11 +1071,22 @@ void FileService::operator()(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn
 			// prepare a response and set the Content-Type
 			HTTPResponseWriterPtr writer(HTTPResponseWriter::create(tcp_conn, *request,
 										 boost::bind(&TCPConnection::finish, tcp_conn)));
-			writer->getResponse().setContentType(response_file.getMimeType());
+			writer->getResponse().setContentType(response_file->getMimeType());
 
-			// set Last-Modified header to enable client-side caching
+			// set Last-Modified, ETag & Cache-Control headers to enable client-side caching
 			writer->getResponse().addHeader(HTTPTypes::HEADER_LAST_MODIFIED,
-											response_file.getLastModifiedString());
+											response_file->getLastModifiedString());
+			writer->getResponse().addHeader(HTTPTypes::HEADER_ETAG,
+											response_file->getVariantETag(use_gzip));
+			if (! cache_control.empty())
+				writer->getResponse().addHeader(HTTPTypes::HEADER_CACHE_CONTROL, cache_control);
+
+			// set Vary & Content-Encoding headers if there are several variants
+			if (response_file->hasVariants())
+				writer->getResponse().addHeader(HTTPTypes::HEADER_VARY, HTTPTypes::HEADER_ACCEPT_ENCODING);
+			if (use_gzip)
+				writer->getResponse().addHeader(HTTPTypes::HEADER_CONTENT_ENCODING,
+												HTTPCompressor::getEncodingName(HTTPCompressor::ENCODING_GZIP));
 
 			switch(response_type) {
 				case RESPONSE_UNDEFINED:
@@ -382,6 +1104,14 @@ void FileService::operator()(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn
 					// set "OK" response (not really necessary since this is the default)
 					writer->getResponse().setStatusCode(HTTPTypes::RESPONSE_CODE_OK);
 					writer->getResponse().setStatusMessage(HTTPTypes::RESPONSE_MESSAGE_OK);
+					writer->getResponse().addHeader(HTTPTypes::HEADER_ACCEPT_RANGES, "bytes");
+					break;
+				case RESPONSE_RANGE_NOT_SATISFIABLE:
+					// set "Requested Range Not Satisfiable" response, with the file's size
+					writer->getResponse().setStatusCode(HTTPTypes::RESPONSE_CODE_RANGE_NOT_SATISFIABLE);
+					writer->getResponse().setStatusMessage(HTTPTypes::RESPONSE_MESSAGE_RANGE_NOT_SATISFIABLE);
+					writer->getResponse().addHeader(HTTPTypes::HEADER_CONTENT_RANGE, "bytes */"
+						+ boost::lexical_cast<std::string>(response_file->getFileSize()));
 					break;
 			}
 
@@ -458,11 +1188,22 @@ void FileService::operator()(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn
 					writer << request->getResource();
 					writer->writeNoCopy(CREATED_HTML_FINISH);
 				}
-				std::ios_base::openmode mode = request->getMethod() == HTTPTypes::REQUEST_METHOD_POST?
-											   std::ios::app : std::ios::out;
-				boost::filesystem::ofstream file_stream(file_path, mode);
-				file_stream.write(request->getContent(), request->getContentLength());
-				file_stream.close();
+				// with mmap, an existing file is replaced rather than truncated, since
+				// responses that are in flight may still be sending its mapped content
+				bool file_written = false;
+				if (m_map_content && request->getMethod() == HTTPTypes::REQUEST_METHOD_PUT
+					&& boost::filesystem::exists(file_path))
+				{
+					file_written = replaceFile(file_path, request->getContent(),
+											   request->getContentLength());
+				}
+				if (! file_written) {
+					std::ios_base::openmode mode = request->getMethod() == HTTPTypes::REQUEST_METHOD_POST?
+												   std::ios::app : std::ios::out;
+					boost::filesystem::ofstream file_stream(file_path, mode);
+					file_stream.write(request->getContent(), request->getContentLength());
+					file_stream.close();
+				}
 				if (!boost::filesystem::exists(file_path)) {
 					static const std::string PUT_FAILED_HTML_START =
 						"<html><head>\n"
@@ -537,6 +1278,80 @@ void FileService::operator()(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn
 	}
 }
 
+bool FileService::replaceFile(const boost::filesystem::path& file_path,
+							  const char *content, std::size_t length) const
+{
+	// the temporary file is in the same directory, so that it can be renamed
+	const std::string temp_prefix((file_path.branch_path()
+								   / (TEMP_FILE_PREFIX + file_path.leaf())).file_string());
+#ifndef _MSC_VER
+	// a unique name, so that concurrent requests do not share a temporary file
+	std::vector<char> temp_name(temp_prefix.begin(), temp_prefix.end());
+	static const char TEMP_SUFFIX[] = ".XXXXXX";
+	temp_name.insert(temp_name.end(), TEMP_SUFFIX, TEMP_SUFFIX + sizeof(TEMP_SUFFIX));
+	const int temp_fd = ::mkstemp(&temp_name[0]);
+	if (temp_fd < 0)
+		return false;
+	const std::string temp_path(&temp_name[0]);
+	bool file_written = true;
+	for (std::size_t n = 0; file_written && n < length; ) {
+		const ssize_t bytes_written = ::write(temp_fd, content + n, length - n);
+		if (bytes_written <= 0)
+			file_written = false;
+		else
+			n += bytes_written;
+	}
+	// mkstemp creates a file that only its owner may read
+	struct stat file_stat;
+	if (::stat(file_path.file_string().c_str(), &file_stat) == 0)
+		::fchmod(temp_fd, file_stat.st_mode & 07777);
+	if (::close(temp_fd) != 0)
+		file_written = false;
+#else
+	const std::string temp_path(temp_prefix);
+	boost::filesystem::ofstream file_stream(temp_path, std::ios::out | std::ios::binary);
+	file_stream.write(content, length);
+	file_stream.close();
+	const bool file_written = ! file_stream.fail();
+#endif
+	if (file_written && std::rename(temp_path.c_str(), file_path.file_string().c_str()) == 0)
+		return true;
+	std::remove(temp_path.c_str());
+	return false;
+}
+
+void FileService::updateVariants(DiskFile& file) const
+{
+	if (m_compress_setting == 0
+		|| ! m_compress_options.isCompressible(file.getMimeType()))
+		return;
+	file.updateGzipVariant(m_compress_options, m_compress_setting == 2);
+}
+
+void FileService::updateETag(DiskFile& file) const
+{
+	if (m_hash_etags)
+		file.hashContent();
+}
+
+const std::string& FileService::findCacheControl(const std::string& relative_path) const
+{
+	// use the longest path that contains the file
+	if (! m_cache_controls.empty()) {
+		std::string path(relative_path);
+		while (true) {
+			CacheControlMap::const_iterator i = m_cache_controls.find(path);
+			if (i != m_cache_controls.end())
+				return i->second;
+			if (path.empty())
+				break;
+			const std::string::size_type pos = path.find_last_of('/');
+			path.resize(pos == std::string::npos ? 0 : pos);
+		}
+	}
+	return HTTPTypes::STRING_EMPTY;
+}
+
 void FileService::sendNotFoundResponse(HTTPRequestPtr& http_request,
 									   TCPConnectionPtr& tcp_conn)
 {
@@ -565,33 +1380,263 @@ void FileService::start(void)
 {
 	PION_LOG_DEBUG(m_logger, "Starting up resource (" << getResource() << ')');
 
-	// scan directory/file if scan setting != 0
-	if (m_scan_setting != 0) {
-		// force caching if scan == (2 | 3)
-		if (m_cache_setting == 0 && m_scan_setting > 1)
-			m_cache_setting = 1;
+	// force caching if scan == (2 | 3)
+	if (m_cache_setting == 0 && m_scan_setting > 1)
+		m_cache_setting = 1;
+
+	// watch for changes before scanning, so that none are missed
+	if (m_watch_files) {
+#ifdef PION_HAVE_INOTIFY
+		m_watcher.reset(new FileWatcher(*this));
+		bool watching = m_watcher->isOpen();
+		if (watching && ! m_directory.empty())
+			watching = m_watcher->watch(m_directory, true);
+		if (watching && ! m_file.empty())
+			watching = m_watcher->watch(m_file.branch_path(), false);
+		if (watching) {
+			m_watcher->start();
+		} else {
+			PION_LOG_WARN(m_logger, "Unable to watch files (" << getResource()
+						  << "), checking them for updates instead: " << strerror(errno));
+			m_watcher.reset();
+		}
+#else
+		PION_LOG_WARN(m_logger, "Watching files is not supported (" << getResource()
+					  << "), checking them for updates instead");
+#endif
+	}
 
-		boost::mutex::scoped_lock cache_lock(m_cache_mutex);
+	// scan directory/file if scan setting != 0
+	populateCache();
 
-		// add entry for file if one is defined
-		if (! m_file.empty()) {
-			// use empty relative_path for file option
-			// use placeholder entry (do not pre-populate) if scan == 1
-			addCacheEntry("", m_file, m_scan_setting == 1);
-		}
+	m_watching.store(m_watcher.get() != NULL);
 
-		// scan directory if one is defined
-		if (! m_directory.empty())
-			scanDirectory(m_directory);
+	// start the threads that read files from the disk
+	if (m_io_threads > 0) {
+		m_io_scheduler.setNumThreads(m_io_threads);
+		m_io_scheduler.startup();
+		m_io_running.store(true);
 	}
 }
 
 void FileService::stop(void)
 {
 	PION_LOG_DEBUG(m_logger, "Shutting down resource (" << getResource() << ')');
+	m_io_running.store(false);
+	m_io_scheduler.shutdown();
+	m_watching.store(false);
+	m_watcher.reset();
+
+	boost::mutex::scoped_lock scan_lock(m_scan_mutex);
+	stopScanning();
+	scan_lock.unlock();
+
+	PION_LOG_INFO(m_logger, "Cache statistics (" << getResource() << "): "
+				  << getCacheHits() << " hits, " << getCacheMisses() << " misses, "
+				  << getCacheEvictions() << " evictions, " << getCacheBytes() << " bytes cached");
+
 	// clear cached files (if started again, it will re-scan)
-	boost::mutex::scoped_lock cache_lock(m_cache_mutex);
-	m_cache_map.clear();
+	clearCache();
+	boost::mutex::scoped_lock clock_lock(m_clock_mutex);
+	m_cache_clock.clear();
+	m_clock_hand = m_cache_clock.end();
+	m_cache_bytes.store(0);
+}
+
+void FileService::populateCache(void)
+{
+	if (m_scan_setting == 0)
+		return;
+
+	// add entry for file if one is defined
+	if (! m_file.empty()) {
+		// use empty relative_path for file option
+		// use placeholder entry (do not pre-populate) if scan == 1
+		addCacheEntry("", m_file, m_scan_setting == 1);
+	}
+
+	// scan directory if one is defined
+	if (! m_directory.empty()) {
+		boost::mutex::scoped_lock scan_lock(m_scan_mutex);
+		startScanning(m_lazy_scan);
+	}
+}
+
+void FileService::startScanning(bool in_background)
+{
+	stopScanning();
+	m_scanner.reset(new DirectoryScanner(*this, m_directory, in_background));
+	if (! m_scan_manifest.empty() && ! m_scanner->loadManifest(m_scan_manifest))
+		PION_LOG_DEBUG(m_logger, "No valid scan manifest (" << getResource() << "): "
+					   << m_scan_manifest.file_string());
+	m_scanning.store(true);
+	if (in_background) {
+		m_scan_thread.reset(new boost::thread(boost::bind(&FileService::scanFiles, this)));
+	} else {
+		scanFiles();
+	}
+}
+
+void FileService::stopScanning(void)
+{
+	// the directory may still be scanned in the background
+	if (m_scanner)
+		m_scanner->stop();
+	if (m_scan_thread) {
+		m_scan_thread->join();
+		m_scan_thread.reset();
+	}
+	m_scanner.reset();
+	m_scanning.store(false);
+}
+
+void FileService::scanFiles(void)
+{
+	PION_LOG_DEBUG(m_logger, "Scanning directory (" << getResource() << "): "
+				   << m_directory.directory_string());
+
+	if (m_scanner->scan(m_scan_threads)) {
+		PION_LOG_INFO(m_logger, "Scanned directory (" << getResource() << "): "
+					  << m_scanner->getNumFiles() << " files, "
+					  << m_scanner->getListedDirectories() << " directories listed, "
+					  << m_scanner->getReusedDirectories() << " unchanged");
+		if (! m_scan_manifest.empty() && ! m_scanner->saveManifest(m_scan_manifest))
+			PION_LOG_WARN(m_logger, "Unable to save scan manifest (" << getResource() << "): "
+						  << m_scan_manifest.file_string());
+	}
+	m_scanner->clear();
+	m_scanning.store(false);
+}
+
+void FileService::clearCache(void)
+{
+	for (std::size_t n = 0; n < NUM_CACHE_SHARDS; ++n) {
+		CacheMap entries;
+		boost::mutex::scoped_lock shard_lock(m_cache_shards[n].m_mutex);
+		entries.swap(m_cache_shards[n].m_entries);
+		shard_lock.unlock();
+		for (CacheMap::iterator i = entries.begin(); i != entries.end(); ++i)
+			releaseCacheEntry(i->second);
+	}
+}
+
+void FileService::handleLostChanges(void)
+{
+	// the entries are kept (requests for them continue to be served), but
+	// their files are loaded again when they are next requested
+	for (std::size_t n = 0; n < NUM_CACHE_SHARDS; ++n) {
+		std::vector<CacheEntryPtr> stale_entries;
+		boost::mutex::scoped_lock shard_lock(m_cache_shards[n].m_mutex);
+		const CacheMap& entries = m_cache_shards[n].m_entries;
+		for (CacheMap::const_iterator i = entries.begin(); i != entries.end(); ++i)
+			stale_entries.push_back(i->second);
+		shard_lock.unlock();
+		std::for_each(stale_entries.begin(), stale_entries.end(),
+					  boost::bind(&FileService::releaseCacheEntry, this, _1));
+	}
+
+	// files that were added are found by scanning the directory again (if
+	// only scanned files may be requested, others are read from the disk
+	// until the scan has finished)
+	if (m_scan_setting != 0 && ! m_directory.empty()) {
+		boost::mutex::scoped_lock scan_lock(m_scan_mutex);
+		startScanning(true);
+	}
+}
+
+void FileService::releaseCacheEntry(const CacheEntryPtr& entry)
+{
+	boost::mutex::scoped_lock entry_lock(entry->getMutex());
+	entry->setFile(DiskFilePtr());
+	admitCacheEntry(entry, 0);
+}
+
+void FileService::invalidateCacheEntry(const std::string& relative_path, bool removed)
+{
+	CacheShard& shard = getCacheShard(relative_path);
+	boost::mutex::scoped_lock shard_lock(shard.m_mutex);
+	CacheMap::iterator i = shard.m_entries.find(relative_path);
+	if (i == shard.m_entries.end())
+		return;
+	const CacheEntryPtr entry(i->second);
+	if (removed)
+		shard.m_entries.erase(i);
+	shard_lock.unlock();
+
+	PION_LOG_DEBUG(m_logger, (removed ? "Removed" : "Invalidated")
+				   << " cache entry for file: " << entry->getFilePath().file_string());
+	releaseCacheEntry(entry);
+}
+
+void FileService::handleFileChange(const boost::filesystem::path& file_path,
+								   bool is_directory, bool removed)
+{
+	// temporary files are only seen once they are renamed over a file
+	if (! is_directory && isTempFile(file_path.leaf()))
+		return;
+
+	// the file may be served both by the file option and within the directory
+	if (! m_file.empty() && file_path == m_file && ! is_directory)
+		updateCacheEntry("", file_path, removed);
+
+	// a file's gzip variant is found again if its precompressed sibling changes
+	static const std::string GZIP_EXTENSION(".gz");
+	const bool is_gzip_sibling = (! is_directory
+		&& file_path.file_string().size() > GZIP_EXTENSION.size()
+		&& file_path.file_string().compare(file_path.file_string().size() - GZIP_EXTENSION.size(),
+										   GZIP_EXTENSION.size(), GZIP_EXTENSION) == 0);
+	if (is_gzip_sibling && ! m_file.empty() && file_path.file_string() == m_file.file_string() + GZIP_EXTENSION)
+		invalidateCacheEntry("", false);
+
+	// find the path of the file relative to the directory (if it is within it)
+	const std::string dir_string(m_directory.directory_string());
+	const std::string file_string(file_path.file_string());
+	if (m_directory.empty() || file_string.size() <= dir_string.size() + 1
+		|| file_string.compare(0, dir_string.size(), dir_string) != 0
+		|| file_string[dir_string.size()] != '/')
+		return;
+	const std::string relative_path(file_string.substr(dir_string.size() + 1));
+
+	if (is_directory) {
+		if (removed) {
+			// remove the entries for the files within a directory that was moved away
+			const std::string prefix(relative_path + '/');
+			for (std::size_t n = 0; n < NUM_CACHE_SHARDS; ++n) {
+				std::vector<CacheEntryPtr> removed_entries;
+				boost::mutex::scoped_lock shard_lock(m_cache_shards[n].m_mutex);
+				CacheMap& entries = m_cache_shards[n].m_entries;
+				for (CacheMap::iterator i = entries.begin(); i != entries.end(); ) {
+					if (i->first.compare(0, prefix.size(), prefix) == 0) {
+						removed_entries.push_back(i->second);
+						entries.erase(i++);
+					} else {
+						++i;
+					}
+				}
+				shard_lock.unlock();
+				std::for_each(removed_entries.begin(), removed_entries.end(),
+							  boost::bind(&FileService::releaseCacheEntry, this, _1));
+			}
+		} else if (m_scan_setting != 0) {
+			// add the files within a directory that was added
+			scanDirectory(file_path);
+		}
+	} else {
+		updateCacheEntry(relative_path, file_path, removed);
+		if (is_gzip_sibling && relative_path.size() > GZIP_EXTENSION.size())
+			invalidateCacheEntry(relative_path.substr(0, relative_path.size() - GZIP_EXTENSION.size()), false);
+	}
+}
+
+void FileService::updateCacheEntry(const std::string& relative_path,
+								   const boost::filesystem::path& file_path, bool removed)
+{
+	if (removed || findCacheEntry(relative_path)) {
+		invalidateCacheEntry(relative_path, removed);
+	} else if (m_scan_setting == 1 || m_scan_setting == 3) {
+		// requests find only the files that were scanned, so add a new one
+		addCacheEntry(relative_path, file_path, true);
+	}
 }
 
 void FileService::scanDirectory(const boost::filesystem::path& dir_path)
@@ -610,7 +1655,7 @@ void FileService::scanDirectory(const boost::filesystem::path& dir_path)
 			// recursively call scanDirectory()
 			scanDirectory(*itr);
 
-		} else {
+		} else if (! isTempFile(itr->path().leaf())) {
 			// item is a regular file
 
 			// figure out relative path to the file
@@ -623,37 +1668,158 @@ void FileService::scanDirectory(const boost::filesystem::path& dir_path)
 	}
 }
 
-std::pair<FileService::CacheMap::iterator, bool>
+FileService::CacheEntryPtr
 FileService::addCacheEntry(const std::string& relative_path,
 						   const boost::filesystem::path& file_path,
 						   const bool placeholder)
 {
-	DiskFile cache_entry(file_path, NULL, 0, 0, findMIMEType(file_path.leaf()));
+	CacheEntryPtr cache_entry(new CacheEntry(file_path, findMIMEType(file_path.leaf())));
 	if (! placeholder) {
-		cache_entry.update();
-		// only read the file if its size is <= max_cache_size
-		if (m_max_cache_size==0 || cache_entry.getFileSize() <= m_max_cache_size) {
-			try { cache_entry.read(); }
-			catch (std::exception&) {
-				PION_LOG_ERROR(m_logger, "Unable to add file to cache: "
-							   << file_path.file_string());
-				return std::make_pair(m_cache_map.end(), false);
-			}
+		try { cache_entry->setFile(loadFile(*cache_entry)); }
+		catch (std::exception&) {
+			PION_LOG_ERROR(m_logger, "Unable to add file to cache: "
+						   << file_path.file_string());
+			return CacheEntryPtr();
 		}
 	}
 
+	CacheShard& shard = getCacheShard(relative_path);
+	boost::mutex::scoped_lock shard_lock(shard.m_mutex);
 	std::pair<CacheMap::iterator, bool> add_entry_result
-		= m_cache_map.insert( std::make_pair(relative_path, cache_entry) );
+		= shard.m_entries.insert( std::make_pair(relative_path, cache_entry) );
+	shard_lock.unlock();
 
 	if (add_entry_result.second) {
 		PION_LOG_DEBUG(m_logger, "Added file to cache: "
 					   << file_path.file_string());
+		if (! placeholder) {
+			boost::mutex::scoped_lock entry_lock(cache_entry->getMutex());
+			admitCacheEntry(cache_entry, cache_entry->getFile()->getCachedSize());
+		}
 	} else {
-		PION_LOG_ERROR(m_logger, "Unable to insert cache entry for file: "
+		PION_LOG_DEBUG(m_logger, "File was already added to cache: "
 					   << file_path.file_string());
 	}
 
-	return add_entry_result;
+	return add_entry_result.first->second;
+}
+
+FileService::CacheEntryPtr FileService::findCacheEntry(const std::string& relative_path)
+{
+	CacheShard& shard = getCacheShard(relative_path);
+	boost::mutex::scoped_lock shard_lock(shard.m_mutex);
+	CacheMap::const_iterator i = shard.m_entries.find(relative_path);
+	return (i == shard.m_entries.end() ? CacheEntryPtr() : i->second);
+}
+
+DiskFilePtr FileService::getCachedFile(const CacheEntryPtr& entry)
+{
+	DiskFilePtr cached_file(entry->getFile());
+	if (cached_file) {
+		// use existing values if cache_setting == 2 or the file is watched;
+		// otherwise, check if file has been updated (may throw exception)
+		bool is_current = (m_cache_setting == 2 || m_watching.load(boost::memory_order_relaxed));
+		if (! is_current) {
+			const std::streamsize cur_size = boost::numeric_cast<std::streamsize>(boost::filesystem::file_size( entry->getFilePath() ));
+			const std::time_t cur_modified = boost::filesystem::last_write_time( entry->getFilePath() );
+			is_current = (cur_modified == cached_file->getLastModified()
+						  && static_cast<boost::uint64_t>(cur_size) == cached_file->getFileSize()
+						  && cached_file->checkGzipVariant());
+		} else if (! cached_file->checkMappedContent()) {
+			// a mapped file was changed in place: map what it contains now
+			is_current = false;
+		}
+		// content that was released from the cache is loaded again
+		if (is_current && (cached_file->hasFileContent() || ! isCacheable(cached_file->getFileSize()))) {
+			entry->setReferenced();
+			m_cache_hits.fetch_add(1, boost::memory_order_relaxed);
+			return cached_file;
+		}
+	}
+
+	// (re)load the file; requests for it wait, and then use what was loaded
+	boost::mutex::scoped_lock entry_lock(entry->getMutex());
+	DiskFilePtr loaded_file(entry->getFile());
+	if (loaded_file == cached_file || ! loaded_file) {
+		loaded_file = loadFile(*entry);
+		entry->setFile(loaded_file);
+		admitCacheEntry(entry, loaded_file->getCachedSize());
+		m_cache_misses.fetch_add(1, boost::memory_order_relaxed);
+		PION_LOG_DEBUG(m_logger, (cached_file ? "Updated" : "Loaded")
+					   << " cache entry for file: " << entry->getFilePath().file_string());
+	} else {
+		m_cache_hits.fetch_add(1, boost::memory_order_relaxed);
+	}
+	return loaded_file;
+}
+
+void FileService::admitCacheEntry(const CacheEntryPtr& entry, unsigned long cached_size)
+{
+	boost::mutex::scoped_lock clock_lock(m_clock_mutex);
+
+	// update the entry's position in the clock; new entries go just behind
+	// the hand, so that they are checked last
+	if (entry->m_cached_size > 0) {
+		m_cache_bytes.fetch_sub(entry->m_cached_size, boost::memory_order_relaxed);
+		if (cached_size == 0) {
+			if (m_clock_hand == entry->m_clock_itr)
+				++m_clock_hand;
+			m_cache_clock.erase(entry->m_clock_itr);
+		}
+	} else if (cached_size > 0) {
+		entry->m_clock_itr = m_cache_clock.insert(m_clock_hand, entry);
+	}
+	entry->m_cached_size = cached_size;
+	m_cache_bytes.fetch_add(cached_size, boost::memory_order_relaxed);
+	if (m_cache_size == 0)
+		return;
+
+	// release content until the cache is small enough: entries that have been
+	// used since the hand last passed them get another turn, and entries that
+	// are being loaded are skipped
+	for (std::size_t n = m_cache_clock.size() * 2;
+		 n > 0 && m_cache_bytes.load(boost::memory_order_relaxed) > m_cache_size; --n)
+	{
+		if (m_clock_hand == m_cache_clock.end())
+			m_clock_hand = m_cache_clock.begin();
+		CacheEntryPtr victim(*m_clock_hand);
+		if (victim->m_referenced.exchange(false, boost::memory_order_relaxed)) {
+			++m_clock_hand;
+			continue;
+		}
+		boost::mutex::scoped_try_lock victim_lock(victim->getMutex());
+		if (! victim_lock.owns_lock()) {
+			++m_clock_hand;
+			continue;
+		}
+		boost::shared_ptr<DiskFile> released_file(new DiskFile(*victim->getFile()));
+		released_file->releaseContent();
+		victim->setFile(released_file);
+		m_cache_bytes.fetch_sub(victim->m_cached_size, boost::memory_order_relaxed);
+		victim->m_cached_size = 0;
+		m_clock_hand = m_cache_clock.erase(m_clock_hand);
+		m_cache_evictions.fetch_add(1, boost::memory_order_relaxed);
+		PION_LOG_DEBUG(m_logger, "Released cached content of file: "
+					   << victim->getFilePath().file_string());
+	}
+}
+
+DiskFilePtr FileService::loadFile(const CacheEntry& entry) const
+{
+	boost::shared_ptr<DiskFile> disk_file(new DiskFile(entry.getFilePath(), NULL, 0, 0,
+													   entry.getMimeType()));
+	disk_file->setMapContent(m_map_content);
+	disk_file->update();
+	// only read the file if its size is <= max_cache_size and cache_size
+	if (isCacheable(disk_file->getFileSize()))
+		disk_file->read();
+	updateVariants(*disk_file);
+	// the variant is admitted with the file: if both do not fit, only the
+	// file is cached (and a precompressed sibling is read from the disk)
+	if (! isCacheable(disk_file->getCachedSize()))
+		disk_file->releaseGzipContent();
+	updateETag(*disk_file);
+	return disk_file;
 }
 
 std::string FileService::findMIMEType(const std::string& file_name) {
@@ -694,136 +1860,406 @@ void FileService::createMIMETypes(void) {
 
 // DiskFile member functions
 
+/// unmaps a file's content when the last buffer that refers to it is released
+struct MappedRegionDeleter {
+	MappedRegionDeleter(const boost::shared_ptr<boost::interprocess::mapped_region>& region)
+		: m_region(region) {}
+	inline void operator()(char *) { m_region.reset(); }
+	boost::shared_ptr<boost::interprocess::mapped_region>	m_region;
+};
+
+
+/// adds bytes to a 64-bit FNV-1a hash
+static inline boost::uint64_t hashBytes(boost::uint64_t hash, const char *ptr, std::size_t len)
+{
+	for (const char * const end = ptr + len; ptr < end; ++ptr) {
+		hash ^= static_cast<unsigned char>(*ptr);
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+
 void DiskFile::update(void)
 {
-	// set file_size and last_modified
-	m_file_size = boost::numeric_cast<std::streamsize>(boost::filesystem::file_size( m_file_path ));
-	m_last_modified = boost::filesystem::last_write_time( m_file_path );
+	// set file_size and last_modified (using a single stat() where possible)
+	boost::uint64_t serial_number = 0;
+#ifndef _MSC_VER
+	struct stat file_stat;
+	if (::stat(m_file_path.file_string().c_str(), &file_stat) == 0 && S_ISREG(file_stat.st_mode)) {
+		m_file_size = boost::numeric_cast<std::streamsize>(file_stat.st_size);
+		m_last_modified = file_stat.st_mtime;
+		serial_number = file_stat.st_ino;
+	} else
+#endif
+	{
+		m_file_size = boost::numeric_cast<std::streamsize>(boost::filesystem::file_size( m_file_path ));
+		m_last_modified = boost::filesystem::last_write_time( m_file_path );
+	}
 	m_last_modified_string = HTTPTypes::get_date_string( m_last_modified );
+	m_serial_number = serial_number;
+
+	// the serial number distinguishes a file from one that it replaced
+	std::ostringstream tag;
+	tag << std::hex << serial_number << '-' << m_file_size << '-' << m_last_modified;
+	setETag(tag.str());
 }
 
 void DiskFile::read(void)
 {
-	// re-allocate storage buffer for the file's content
-	m_file_content.reset(new char[m_file_size]);
+	// replaces (rather than changes) the content, so that it is still valid
+	// for any copies of this object that are being sent
+	m_file_content = readContent(m_file_path, m_file_size, m_map_content);
+}
+
+bool DiskFile::checkMappedContent(void) const
+{
+#ifndef _MSC_VER
+	// (files that are mapped cannot be truncated on Windows)
+	struct stat file_stat;
+	if (m_map_content && m_file_content && m_file_size > 0
+		&& ::stat(m_file_path.file_string().c_str(), &file_stat) == 0
+		&& static_cast<boost::uint64_t>(file_stat.st_ino) == m_serial_number)
+	{
+		return (file_stat.st_size == m_file_size && file_stat.st_mtime == m_last_modified);
+	}
+#endif
+	return true;
+}
+
+void DiskFile::releaseContent(void)
+{
+	m_file_content.reset();
+	releaseGzipContent();
+}
+
+void DiskFile::releaseGzipContent(void)
+{
+	m_gzip_content.reset();
+	// content that was compressed in memory is not available any more
+	if (m_gzip_path.empty())
+		m_gzip_size = 0;
+}
+
+boost::shared_array<char> DiskFile::readContent(const boost::filesystem::path& file_path,
+												std::streamsize file_size, bool map_content)
+{
+	// empty files cannot be mapped
+	if (map_content && file_size > 0) {
+		try {
+			const boost::interprocess::file_mapping mapping(file_path.file_string().c_str(),
+															boost::interprocess::read_only);
+			boost::shared_ptr<boost::interprocess::mapped_region> region(
+				new boost::interprocess::mapped_region(mapping, boost::interprocess::read_only,
+													   0, file_size));
+			return boost::shared_array<char>(static_cast<char*>(region->get_address()),
+											 MappedRegionDeleter(region));
+		} catch (boost::interprocess::interprocess_exception&) {
+			throw FileService::FileReadException(file_path.file_string());
+		}
+	}
+
+	// allocate storage buffer for the file's content
+	boost::shared_array<char> content(new char[file_size]);
 
 	// open the file for reading
 	boost::filesystem::ifstream file_stream;
-	file_stream.open(m_file_path, std::ios::in | std::ios::binary);
+	file_stream.open(file_path, std::ios::in | std::ios::binary);
 
 	// read the file into memory
-	if (!file_stream.is_open() || !file_stream.read(m_file_content.get(), m_file_size))
-		throw FileService::FileReadException(m_file_path.file_string());
+	if (!file_stream.is_open() || !file_stream.read(content.get(), file_size))
+		throw FileService::FileReadException(file_path.file_string());
+	return content;
 }
 
-bool DiskFile::checkUpdated(void)
+void DiskFile::hashContent(void)
 {
-	// get current values
-	std::streamsize cur_size = boost::numeric_cast<std::streamsize>(boost::filesystem::file_size( m_file_path ));
-	time_t cur_modified = boost::filesystem::last_write_time( m_file_path );
+	boost::uint64_t hash = 0xcbf29ce484222325ULL;
+	if (m_file_content) {
+		hash = hashBytes(hash, m_file_content.get(), m_file_size);
+	} else {
+		// read the file in blocks, rather than all at once
+		boost::filesystem::ifstream file_stream;
+		file_stream.open(m_file_path, std::ios::in | std::ios::binary);
+		if (! file_stream.is_open())
+			throw FileService::FileReadException(m_file_path.file_string());
+		char buf[8192];
+		while (file_stream.read(buf, sizeof(buf)) || file_stream.gcount() > 0)
+			hash = hashBytes(hash, buf, static_cast<std::size_t>(file_stream.gcount()));
+		if (file_stream.bad())
+			throw FileService::FileReadException(m_file_path.file_string());
+	}
+	std::ostringstream tag;
+	tag << std::hex << hash << '-' << m_file_size;
+	setETag(tag.str());
+}
 
-	// check if file has not been updated
-	if (cur_modified == m_last_modified && cur_size == m_file_size)
-		return false;
+void DiskFile::updateGzipVariant(const HTTPCompressor::Options& options, bool compress_content)
+{
+	m_has_variants = true;
+	m_gzip_path = boost::filesystem::path();
+	m_gzip_content.reset();
+
+	// prefer a precompressed sibling, unless it is older than the file
+	std::streamsize gzip_size = 0;
+	std::time_t gzip_modified = 0;
+	boost::uint64_t gzip_serial_number = 0;
+	if (findGzipSibling(gzip_size, gzip_modified, gzip_serial_number)) {
+		m_gzip_path = m_file_path.file_string() + ".gz";
+		m_gzip_size = gzip_size;
+		m_gzip_modified = gzip_modified;
+		m_gzip_serial_number = gzip_serial_number;
+		if (m_file_content && m_gzip_size > 0) {
+			// the file is cached in memory, so cache its variant too; it is
+			// copied rather than mapped, since gzip rewrites it in place
+			m_gzip_content = readContent(m_gzip_path, m_gzip_size, false);
+		}
+		updateGzipETag();
+		return;
+	}
+	m_gzip_size = 0;
+	m_gzip_modified = 0;
+	m_gzip_serial_number = 0;
+	updateGzipETag();
+
+	// otherwise compress the cached content once, and keep it if it is smaller
+	if (compress_content && m_file_content
+		&& static_cast<std::size_t>(m_file_size) >= options.getMinSize())
+	{
+		std::string compressed;
+		HTTPCompressor compressor(HTTPCompressor::ENCODING_GZIP, options.getLevel());
+		if (compressor.compress(m_file_content.get(), m_file_size, compressed)
+			&& compressor.finish(compressed)
+			&& compressed.size() < static_cast<std::size_t>(m_file_size))
+		{
+			m_gzip_size = compressed.size();
+			m_gzip_content.reset(new char[m_gzip_size]);
+			memcpy(m_gzip_content.get(), compressed.data(), m_gzip_size);
+		}
+	}
+}
 
-	// file has been updated
 
-	// update file_size and last_modified timestamp
-	m_file_size = cur_size;
-	m_last_modified = cur_modified;
-	m_last_modified_string = HTTPTypes::get_date_string( m_last_modified );
+bool DiskFile::checkGzipVariant(void) const
+{
+	if (! m_has_variants)
+		return true;
+	std::streamsize gzip_size = 0;
+	std::time_t gzip_modified = 0;
+	boost::uint64_t gzip_serial_number = 0;
+	if (! findGzipSibling(gzip_size, gzip_modified, gzip_serial_number))
+		return m_gzip_path.empty();
+	return (! m_gzip_path.empty() && gzip_size == m_gzip_size
+			&& gzip_modified == m_gzip_modified && gzip_serial_number == m_gzip_serial_number);
+}
 
-	// read new contents
-	read();
+bool DiskFile::findGzipSibling(std::streamsize& gzip_size, std::time_t& gzip_modified,
+							   boost::uint64_t& gzip_serial_number) const
+{
+	const boost::filesystem::path gzip_path(m_file_path.file_string() + ".gz");
+#ifndef _MSC_VER
+	struct stat file_stat;
+	if (::stat(gzip_path.file_string().c_str(), &file_stat) != 0 || ! S_ISREG(file_stat.st_mode))
+		return false;
+	gzip_size = boost::numeric_cast<std::streamsize>(file_stat.st_size);
+	gzip_modified = file_stat.st_mtime;
+	gzip_serial_number = file_stat.st_ino;
+#else
+	if (! boost::filesystem::exists(gzip_path) || boost::filesystem::is_directory(gzip_path))
+		return false;
+	gzip_size = boost::numeric_cast<std::streamsize>(boost::filesystem::file_size(gzip_path));
+	gzip_modified = boost::filesystem::last_write_time(gzip_path);
+	gzip_serial_number = 0;
+#endif
+	return gzip_modified >= m_last_modified;
+}
 
-	return true;
+void DiskFile::updateGzipETag(void)
+{
+	// a sibling that is regenerated gets a new tag, even if the file does not
+	std::ostringstream tag;
+	tag << m_etag.substr(0, m_etag.empty() ? 0 : m_etag.size() - 1) << "-gzip";
+	if (! m_gzip_path.empty())
+		tag << '-' << std::hex << m_gzip_serial_number << '-' << m_gzip_size << '-' << m_gzip_modified;
+	tag << '"';
+	m_gzip_etag = tag.str();
 }
 
 
 // DiskFileSender member functions
 
-DiskFileSender::DiskFileSender(DiskFile& file, pion::net::HTTPRequestPtr& request,
+DiskFileSender::DiskFileSender(const DiskFilePtr& file, bool use_gzip,
+							   pion::net::HTTPRequestPtr& request,
 							   pion::net::TCPConnectionPtr& tcp_conn,
 							   unsigned long max_chunk_size)
-	: m_logger(PION_GET_LOGGER("pion.FileService.DiskFileSender")), m_disk_file(file),
+	: m_logger(PION_GET_LOGGER("pion.FileService.DiskFileSender")),
+	m_disk_file(file), m_use_gzip(use_gzip),
+	m_file_path(file->getVariantPath(use_gzip)),
+	m_file_content(file->getVariantContent(use_gzip)),
+	m_file_size(file->getVariantSize(use_gzip)),
+	m_send_size(m_file_size), m_part_index(0), m_part_bytes_sent(0), m_request(request),
 	m_writer(pion::net::HTTPResponseWriter::create(tcp_conn, *request, boost::bind(&TCPConnection::finish, tcp_conn))),
-	m_max_chunk_size(max_chunk_size), m_file_bytes_to_send(0), m_bytes_sent(0)
+	m_disk_io_service(NULL), m_file_fd(-1), m_max_chunk_size(max_chunk_size), m_file_bytes_to_send(0), m_bytes_sent(0)
 {
 	PION_LOG_DEBUG(m_logger, "Preparing to send file"
-				   << (m_disk_file.hasFileContent() ? " (cached): " : ": ")
-				   << m_disk_file.getFilePath().file_string());
+				   << (m_file_content != NULL ? " (cached): " : ": ")
+				   << m_file_path.file_string());
 
 		// set the Content-Type HTTP header using the file's MIME type
-	m_writer->getResponse().setContentType(m_disk_file.getMimeType());
+	m_writer->getResponse().setContentType(m_disk_file->getMimeType());
 
-	// set Last-Modified header to enable client-side caching
+	// set Last-Modified & ETag headers to enable client-side caching
 	m_writer->getResponse().addHeader(HTTPTypes::HEADER_LAST_MODIFIED,
-									  m_disk_file.getLastModifiedString());
+									  m_disk_file->getLastModifiedString());
+	m_writer->getResponse().addHeader(HTTPTypes::HEADER_ETAG,
+									  m_disk_file->getVariantETag(m_use_gzip));
+
+	// set Vary & Content-Encoding headers if there are several variants
+	if (m_disk_file->hasVariants())
+		m_writer->getResponse().addHeader(HTTPTypes::HEADER_VARY, HTTPTypes::HEADER_ACCEPT_ENCODING);
+	if (m_use_gzip)
+		m_writer->getResponse().addHeader(HTTPTypes::HEADER_CONTENT_ENCODING,
+										  HTTPCompressor::getEncodingName(HTTPCompressor::ENCODING_GZIP));
+
+	// clients may request ranges of the file's content
+	m_writer->getResponse().addHeader(HTTPTypes::HEADER_ACCEPT_RANGES, "bytes");
 
-	// use "200 OK" HTTP response
+	// use "200 OK" HTTP response, with all of the file's content
 	m_writer->getResponse().setStatusCode(HTTPTypes::RESPONSE_CODE_OK);
 	m_writer->getResponse().setStatusMessage(HTTPTypes::RESPONSE_MESSAGE_OK);
+	m_parts.push_back(ContentPart(std::string(), 0, m_file_size));
+}
+
+DiskFileSender::~DiskFileSender()
+{
+#ifdef PION_HAVE_SENDFILE
+	if (m_file_fd >= 0)
+		::close(m_file_fd);
+#endif
+}
+
+void DiskFileSender::setRanges(const HTTPTypes::ByteRanges& ranges)
+{
+	m_writer->getResponse().setStatusCode(HTTPTypes::RESPONSE_CODE_PARTIAL_CONTENT);
+	m_writer->getResponse().setStatusMessage(HTTPTypes::RESPONSE_MESSAGE_PARTIAL_CONTENT);
+	m_parts.clear();
+	m_send_size = 0;
+
+	const std::string file_size_string(boost::lexical_cast<std::string>(m_file_size));
+	if (ranges.size() == 1) {
+		// a single range is sent as the response's content
+		m_writer->getResponse().addHeader(HTTPTypes::HEADER_CONTENT_RANGE, "bytes "
+			+ boost::lexical_cast<std::string>(ranges.front().first) + '-'
+			+ boost::lexical_cast<std::string>(ranges.front().second) + '/' + file_size_string);
+		m_parts.push_back(ContentPart(std::string(), ranges.front().first,
+									  ranges.front().second - ranges.front().first + 1));
+		m_send_size = m_parts.back().m_length;
+		return;
+	}
+
+	// several ranges are sent as the parts of a multipart/byteranges response
+	std::ostringstream boundary;
+	boundary << "PION_BYTERANGES_" << std::hex << m_disk_file->getLastModified()
+		<< '_' << reinterpret_cast<std::size_t>(this);
+	m_writer->getResponse().setContentType("multipart/byteranges; boundary=" + boundary.str());
+	for (HTTPTypes::ByteRanges::const_iterator i = ranges.begin(); i != ranges.end(); ++i) {
+		std::string header(i == ranges.begin() ? "--" : "\r\n--");
+		header += boundary.str();
+		header += "\r\n";
+		header += HTTPTypes::HEADER_CONTENT_TYPE + HTTPTypes::HEADER_NAME_VALUE_DELIMITER + m_disk_file->getMimeType();
+		header += "\r\n";
+		header += HTTPTypes::HEADER_CONTENT_RANGE + HTTPTypes::HEADER_NAME_VALUE_DELIMITER + "bytes "
+			+ boost::lexical_cast<std::string>(i->first) + '-'
+			+ boost::lexical_cast<std::string>(i->second) + '/' + file_size_string;
+		header += "\r\n\r\n";
+		m_parts.push_back(ContentPart(header, i->first, i->second - i->first + 1));
+		m_send_size += m_parts.back().m_length;
+	}
+	m_trailer = "\r\n--" + boundary.str() + "--\r\n";
 }
 
 void DiskFileSender::send(void)
 {
 	// check if we have nothing to send (send 0 byte response content)
-	if (m_disk_file.getFileSize() <= m_bytes_sent) {
+	if (m_send_size <= m_bytes_sent) {
 		m_writer->send();
 		return;
 	}
 
-	// calculate the number of bytes to send (m_file_bytes_to_send)
-	m_file_bytes_to_send = m_disk_file.getFileSize() - m_bytes_sent;
+	// calculate the number of bytes to send (m_file_bytes_to_send); more
+	// than fits in memory at once is sent in chunks
+	m_file_bytes_to_send = static_cast<std::size_t>(std::min<boost::uint64_t>(m_send_size - m_bytes_sent,
+		std::numeric_limits<std::size_t>::max()));
 	if (m_max_chunk_size > 0 && m_file_bytes_to_send > m_max_chunk_size)
 		m_file_bytes_to_send = m_max_chunk_size;
 
-	// get the content to send (file_content_ptr)
-	char *file_content_ptr;
+	if (m_file_content == NULL && m_disk_io_service != NULL) {
+		// the content must be read from the disk: let a disk I/O thread wait for it
+		m_disk_io_service->post(boost::bind(&DiskFileSender::readParts, shared_from_this()));
+	} else if (addParts()) {
+		sendParts();
+	} else {
+		handleReadError();
+	}
+}
 
-	if (m_disk_file.hasFileContent()) {
+void DiskFileSender::readParts(void)
+{
+	const bool read_ok = addParts();
+	m_writer->getTCPConnection()->getIOService().post(boost::bind(&DiskFileSender::handleRead,
+																  shared_from_this(), read_ok));
+}
 
-		// the entire file IS cached in memory (m_disk_file.file_content)
-		file_content_ptr = m_disk_file.getFileContent() + m_bytes_sent;
+void DiskFileSender::handleRead(bool read_ok)
+{
+	if (read_ok)
+		sendParts();
+	else
+		handleReadError();
+}
 
+void DiskFileSender::handleReadError(void)
+{
+	TCPConnectionPtr tcp_conn(m_writer->getTCPConnection());
+	if (m_bytes_sent == 0) {
+		// the headers have not been sent yet, so the client can be told
+		HTTPResponseWriterPtr writer(HTTPResponseWriter::create(tcp_conn, *m_request,
+									 boost::bind(&TCPConnection::finish, tcp_conn)));
+		writer->getResponse().setStatusCode(HTTPTypes::RESPONSE_CODE_SERVER_ERROR);
+		writer->getResponse().setStatusMessage(HTTPTypes::RESPONSE_MESSAGE_SERVER_ERROR);
+		writer->send();
 	} else {
-		// the file is not cached in memory
-
-		// check if the file has been opened yet
-		if (! m_file_stream.is_open()) {
-			// open the file for reading
-			m_file_stream.open(m_disk_file.getFilePath(), std::ios::in | std::ios::binary);
-			if (! m_file_stream.is_open()) {
-				PION_LOG_ERROR(m_logger, "Unable to open file: "
-							   << m_disk_file.getFilePath().file_string());
-				return;
-			}
-		}
-
-		// check if the content buffer was initialized yet
-		if (! m_content_buf) {
-			// allocate memory for the new content buffer
-			m_content_buf.reset(new char[m_file_bytes_to_send]);
-		}
-		file_content_ptr = m_content_buf.get();
+		// part of the content has been sent already
+		tcp_conn->setLifecycle(TCPConnection::LIFECYCLE_CLOSE);
+		tcp_conn->finish();
+	}
+}
 
-		// read a block of data from the file into the content buffer
-		if (! m_file_stream.read(m_content_buf.get(), m_file_bytes_to_send)) {
-			if (m_file_stream.gcount() > 0) {
-				PION_LOG_ERROR(m_logger, "File size inconsistency: "
-							   << m_disk_file.getFilePath().file_string());
-			} else {
-				PION_LOG_ERROR(m_logger, "Unable to read file: "
-							   << m_disk_file.getFilePath().file_string());
-			}
-			return;
+bool DiskFileSender::addParts(void)
+{
+	for (std::size_t bytes_added = 0; bytes_added < m_file_bytes_to_send; ) {
+		const ContentPart& part = m_parts[m_part_index];
+		if (m_part_bytes_sent == 0 && ! part.m_header.empty())
+			m_writer->writeNoCopy(part.m_header);
+		const std::size_t length = static_cast<std::size_t>(std::min<boost::uint64_t>(
+			part.m_length - m_part_bytes_sent, m_file_bytes_to_send - bytes_added));
+		if (! addContent(part.m_offset + m_part_bytes_sent, length, bytes_added))
+			return false;
+		bytes_added += length;
+		m_part_bytes_sent += length;
+		if (m_part_bytes_sent == part.m_length) {
+			++m_part_index;
+			m_part_bytes_sent = 0;
 		}
 	}
+	if (m_part_index == m_parts.size() && ! m_trailer.empty())
+		m_writer->writeNoCopy(m_trailer);
+	return true;
+}
 
-	// send the content
-	m_writer->writeNoCopy(file_content_ptr, m_file_bytes_to_send);
-
-	if (m_bytes_sent + m_file_bytes_to_send >= m_disk_file.getFileSize()) {
+void DiskFileSender::sendParts(void)
+{
+	if (m_bytes_sent + m_file_bytes_to_send >= m_send_size) {
 		// this is the last piece of data to send
 		if (m_bytes_sent > 0) {
 			// send last chunk in a series
@@ -847,6 +2283,109 @@ void DiskFileSender::send(void)
 	}
 }
 
+bool DiskFileSender::addContent(boost::uint64_t offset, std::size_t length,
+								std::size_t buffer_offset)
+{
+	if (m_file_content != NULL && ! m_use_gzip && ! m_disk_file->checkMappedContent()) {
+		// the file was changed in place since it was mapped, so its mapping
+		// may no longer be readable; copy the rest of it from the file instead
+		// (which fails if the file is now too short)
+		PION_LOG_WARN(m_logger, "File changed while it was being sent: "
+					  << m_file_path.file_string());
+		m_file_content = NULL;
+	}
+
+	if (m_file_content != NULL) {
+
+		// the entire file IS cached in memory (m_file_content); it is never
+		// changed, so it is safe to send without copying it
+		m_writer->writeNoCopy(const_cast<char*>(m_file_content) + static_cast<std::size_t>(offset), length);
+
+#ifdef PION_HAVE_SENDFILE
+	} else if (m_writer->getTCPConnection()->canSendFile()) {
+		// the file is not cached in memory: send it straight from the
+		// file using sendfile, which avoids copying it through user space
+
+		// check if the file has been opened yet
+		if (m_file_fd < 0) {
+			m_file_fd = ::open(m_file_path.file_string().c_str(), O_RDONLY);
+			if (m_file_fd < 0) {
+				PION_LOG_ERROR(m_logger, "Unable to open file: "
+							   << m_file_path.file_string());
+				return false;
+			}
+			// sendfile would only find out that the file is too short after
+			// the headers have been sent
+			struct stat file_stat;
+			if (::fstat(m_file_fd, &file_stat) != 0
+				|| static_cast<boost::uint64_t>(file_stat.st_size) != m_file_size)
+			{
+				PION_LOG_ERROR(m_logger, "File size inconsistency: "
+							   << m_file_path.file_string());
+				return false;
+			}
+			// the file is read from start to end (a larger read-ahead helps)
+			if (m_send_size == m_file_size)
+				::posix_fadvise(m_file_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+		}
+
+		// a disk I/O thread waits for the region to be read into the page
+		// cache, so that sendfile does not; otherwise, the next chunk is read
+		// ahead while this one is sent
+		if (m_disk_io_service != NULL) {
+			::readahead(m_file_fd, offset, length);
+		} else if (m_max_chunk_size > 0 && offset + length < m_file_size) {
+			::posix_fadvise(m_file_fd, offset + length, m_max_chunk_size, POSIX_FADV_WILLNEED);
+		}
+
+		// add the next region of the file to the payload content
+		if (! m_writer->writeFile(m_file_fd, offset, length)) {
+			PION_LOG_ERROR(m_logger, "Unable to read file: "
+						   << m_file_path.file_string());
+			return false;
+		}
+#endif
+	} else {
+		// the file is not cached in memory
+
+		// check if the file has been opened yet
+		if (! m_file_stream.is_open()) {
+			// open the file for reading
+			m_file_stream.open(m_file_path, std::ios::in | std::ios::binary);
+			if (! m_file_stream.is_open()) {
+				PION_LOG_ERROR(m_logger, "Unable to open file: "
+							   << m_file_path.file_string());
+				return false;
+			}
+		}
+
+		// check if the content buffer was initialized yet (the first data
+		// sent is the largest)
+		if (! m_content_buf) {
+			// allocate memory for the new content buffer
+			m_content_buf.reset(new char[m_file_bytes_to_send]);
+		}
+		char * const file_content_ptr = m_content_buf.get() + buffer_offset;
+
+		// read a block of data from the file into the content buffer
+		if (! m_file_stream.seekg(static_cast<std::streamoff>(offset))
+			|| ! m_file_stream.read(file_content_ptr, length))
+		{
+			if (m_file_stream.gcount() > 0) {
+				PION_LOG_ERROR(m_logger, "File size inconsistency: "
+							   << m_file_path.file_string());
+			} else {
+				PION_LOG_ERROR(m_logger, "Unable to read file: "
+							   << m_file_path.file_string());
+			}
+			return false;
+		}
+		m_writer->writeNoCopy(file_content_ptr, length);
+	}
+
+	return true;
+}
+
 void DiskFileSender::handleWrite(const boost::system::error_code& write_error,
 								 std::size_t bytes_written)
 {
@@ -863,10 +2402,10 @@ void DiskFileSender::handleWrite(const boost::system::error_code& write_error,
 		// includes bytes for HTTP headers and chunking headers
 		m_bytes_sent += m_file_bytes_to_send;
 
-		if (m_bytes_sent >= m_disk_file.getFileSize()) {
+		if (m_bytes_sent >= m_send_size) {
 			// finished sending
 			PION_LOG_DEBUG(m_logger, "Sent "
-						   << (m_file_bytes_to_send < m_disk_file.getFileSize() ? "file chunk" : "complete file")
+						   << (m_file_bytes_to_send < m_send_size ? "file chunk" : "complete file")
 						   << " of " << m_file_bytes_to_send << " bytes (finished"
 						   << (m_writer->getTCPConnection()->getKeepAlive() ? ", keeping alive)" : ", closing)") );
 		} else {
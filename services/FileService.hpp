@@ -10,21 +10,29 @@
 #ifndef __PION_FILESERVICE_HEADER__
 #define __PION_FILESERVICE_HEADER__
 
+#include <boost/atomic.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/functional/hash.hpp>
 #include <boost/filesystem/path.hpp>
 #include <boost/thread/once.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 #include <boost/shared_array.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/noncopyable.hpp>
 #include <pion/PionLogger.hpp>
 #include <pion/PionException.hpp>
 #include <pion/PionHashMap.hpp>
+#include <pion/PionScheduler.hpp>
 #include <pion/net/WebService.hpp>
 #include <pion/net/HTTPRequest.hpp>
 #include <pion/net/HTTPResponseWriter.hpp>
+#include <pion/net/HTTPCompressor.hpp>
 #include <pion/net/HTTPServer.hpp>
 #include <string>
+#include <list>
 #include <map>
+#include <vector>
 
 
 namespace pion {		// begin namespace pion
@@ -38,35 +46,75 @@ class DiskFile {
 public:
 	/// default constructor
 	DiskFile(void)
-		: m_file_size(0), m_last_modified(0) {}
+		: m_file_size(0), m_last_modified(0), m_serial_number(0), m_gzip_size(0),
+		m_gzip_modified(0), m_gzip_serial_number(0),
+		m_has_variants(false), m_map_content(false) {}
 
 	/// used to construct new disk file objects
 	DiskFile(const boost::filesystem::path& path,
 			 char *content, unsigned long size,
 			 std::time_t modified, const std::string& mime)
 		: m_file_path(path), m_file_content(content), m_file_size(size),
-		m_last_modified(modified), m_mime_type(mime)
+		m_last_modified(modified), m_serial_number(0), m_mime_type(mime), m_gzip_size(0),
+		m_gzip_modified(0), m_gzip_serial_number(0),
+		m_has_variants(false), m_map_content(false)
 	{}
 
 	/// copy constructor
 	DiskFile(const DiskFile& f)
 		: m_file_path(f.m_file_path), m_file_content(f.m_file_content),
 		m_file_size(f.m_file_size), m_last_modified(f.m_last_modified),
-		m_last_modified_string(f.m_last_modified_string), m_mime_type(f.m_mime_type)
+		m_serial_number(f.m_serial_number), m_last_modified_string(f.m_last_modified_string), m_mime_type(f.m_mime_type),
+		m_gzip_path(f.m_gzip_path), m_gzip_content(f.m_gzip_content),
+		m_gzip_size(f.m_gzip_size), m_gzip_modified(f.m_gzip_modified),
+		m_gzip_serial_number(f.m_gzip_serial_number), m_etag(f.m_etag), m_gzip_etag(f.m_gzip_etag),
+		m_has_variants(f.m_has_variants), m_map_content(f.m_map_content)
 	{}
 
-	/// updates the file_size and last_modified timestamp to disk
+	/// updates the file_size and last_modified timestamp to disk, and the
+	/// entity tag (which is derived from them and the file's serial number)
 	void update(void);
 
-	/// reads content from disk into file_content buffer (may throw)
+	/// reads content from disk into file_content buffer, or maps it (may throw)
 	void read(void);
 
 	/**
-	 * checks if the file has been updated and updates vars if it has (may throw)
+	 * checks that mapped content still matches the file on disk.  Reading a
+	 * mapping of a file that was truncated in place raises SIGBUS, whereas a
+	 * file that was replaced (renamed over) or deleted keeps its old content.
 	 *
-	 * @return true if the file was updated
+	 * @return false if the content is mapped and the file was changed in place
 	 */
-	bool checkUpdated(void);
+	bool checkMappedContent(void) const;
+
+	/**
+	 * finds the gzip-encoded variant of the file (may throw).  A sibling file
+	 * named "<file>.gz" is used if it is not older than the file; otherwise
+	 * the cached file content may be compressed once and kept in memory.
+	 *
+	 * @param options settings used to compress the cached content
+	 * @param compress_content if true, cached content is compressed if there
+	 *                         is no precompressed sibling file
+	 */
+	void updateGzipVariant(const HTTPCompressor::Options& options, bool compress_content);
+
+	/**
+	 * checks that the precompressed (.gz) sibling that is used (if any) has
+	 * not changed, and that none has appeared if it is not used
+	 *
+	 * @return false if updateGzipVariant() would now find a different sibling
+	 */
+	bool checkGzipVariant(void) const;
+
+	/// replaces the entity tag with one derived from a hash of the file's
+	/// content, which is read from disk if it is not cached (may throw)
+	void hashContent(void);
+
+	/// returns true if there is a gzip-encoded variant of the file
+	inline bool hasGzipVariant(void) const { return m_gzip_size > 0; }
+
+	/// returns true if the content depends upon the request's Accept-Encoding
+	inline bool hasVariants(void) const { return m_has_variants; }
 
 	/// return path to the cached file
 	inline const boost::filesystem::path& getFilePath(void) const { return m_file_path; }
@@ -74,11 +122,42 @@ public:
 	/// returns content of the cached file
 	inline char *getFileContent(void) { return m_file_content.get(); }
 
+	/// returns the path of the file, or of its gzip variant's file if it has one
+	inline const boost::filesystem::path& getVariantPath(bool gzip) const {
+		return (gzip && ! m_gzip_path.empty() ? m_gzip_path : m_file_path);
+	}
+
+	/// returns the cached content of the file or of its gzip variant (NULL if not cached)
+	inline const char *getVariantContent(bool gzip) const {
+		return (gzip ? m_gzip_content.get() : m_file_content.get());
+	}
+
+	/// returns the size of the file's content or of its gzip variant
+	inline boost::uint64_t getVariantSize(bool gzip) const {
+		return (gzip ? m_gzip_size : m_file_size);
+	}
+
 	/// returns true if there is cached file content
 	inline bool hasFileContent(void) const { return m_file_content; }
 
+	/// returns the number of bytes of content (including variants) cached in memory
+	inline unsigned long getCachedSize(void) const {
+		return (m_file_content ? m_file_size : 0) + (m_gzip_content ? m_gzip_size : 0);
+	}
+
+	/// releases the cached content of the file and its variants, keeping the metadata
+	void releaseContent(void);
+
+	/// releases the cached content of the file's variants, keeping the file's content
+	void releaseGzipContent(void);
+
 	/// returns size of the file's content
-	inline unsigned long getFileSize(void) const { return m_file_size; }
+	inline boost::uint64_t getFileSize(void) const { return m_file_size; }
+
+	/// returns the (strong) entity tag of the file or of its gzip variant, with quotes
+	inline const std::string& getVariantETag(bool gzip) const {
+		return (gzip ? m_gzip_etag : m_etag);
+	}
 
 	/// returns timestamp that the cached file was last modified (0 = cache disabled)
 	inline std::time_t getLastModified(void) const { return m_last_modified; }
@@ -92,21 +171,54 @@ public:
 	/// sets the path to the cached file
 	inline void setFilePath(const boost::filesystem::path& p) { m_file_path = p; }
 
-	/// appends to the path of the cached file
-	inline void appendFilePath(const std::string& p) { m_file_path /= p; }
-
 	/// sets the mime type for the cached file
 	inline void setMimeType(const std::string& t) { m_mime_type = t; }
 
-	/// resets the size of the file content buffer
-	inline void resetFileContent(unsigned long n = 0) {
-		if (n == 0) m_file_content.reset();
-		else m_file_content.reset(new char[n]);
-	}
+	/// if true, content is mapped read-only into memory rather than copied
+	inline void setMapContent(bool b) { m_map_content = b; }
+
+	/// returns true if content is mapped read-only into memory
+	inline bool getMapContent(void) const { return m_map_content; }
 
 
 protected:
 
+	/**
+	 * reads a file's content into a new buffer, or maps it read-only (may throw).
+	 * A mapping is released when the last copy of the buffer is.
+	 *
+	 * @param file_path path of the file
+	 * @param file_size size of the file's content
+	 * @param map_content if true, the file is mapped rather than copied
+	 */
+	static boost::shared_array<char> readContent(const boost::filesystem::path& file_path,
+												 std::streamsize file_size, bool map_content);
+
+	/**
+	 * finds the file's precompressed (.gz) sibling, if there is one that is
+	 * not older than the file (may throw)
+	 *
+	 * @param gzip_size set to the size of the sibling
+	 * @param gzip_modified set to the timestamp of the sibling
+	 * @param gzip_serial_number set to the serial number of the sibling (0 if not known)
+	 *
+	 * @return true if the sibling may be used
+	 */
+	bool findGzipSibling(std::streamsize& gzip_size, std::time_t& gzip_modified,
+						 boost::uint64_t& gzip_serial_number) const;
+
+	/// sets the entity tags of the file and of its gzip variant
+	inline void setETag(const std::string& tag) {
+		m_etag = '"' + tag + '"';
+		updateGzipETag();
+	}
+
+	/// sets the entity tag of the gzip variant, which is derived from the
+	/// file's and (if it is used) from the size, timestamp and serial number
+	/// of its precompressed sibling
+	void updateGzipETag(void);
+
+
 	/// path to the cached file
 	boost::filesystem::path		m_file_path;
 
@@ -119,14 +231,48 @@ protected:
 	/// timestamp that the cached file was last modified (0 = cache disabled)
 	std::time_t					m_last_modified;
 
+	/// serial (inode) number of the file (0 if it is not known)
+	boost::uint64_t				m_serial_number;
+
 	/// timestamp that the cached file was last modified (string format)
 	std::string					m_last_modified_string;
 
 	/// mime type for the cached file
 	std::string					m_mime_type;
+
+	/// path to a precompressed (.gz) sibling of the file, if one is used
+	boost::filesystem::path		m_gzip_path;
+
+	/// gzip-encoded content of the cached file
+	boost::shared_array<char>	m_gzip_content;
+
+	/// size of the file's gzip-encoded content (0 = there is no gzip variant)
+	std::streamsize				m_gzip_size;
+
+	/// timestamp that the precompressed sibling was last modified (if it is used)
+	std::time_t					m_gzip_modified;
+
+	/// serial (inode) number of the precompressed sibling (0 if it is not known)
+	boost::uint64_t				m_gzip_serial_number;
+
+	/// entity tag of the file (with quotes)
+	std::string					m_etag;
+
+	/// entity tag of the file's gzip variant (with quotes)
+	std::string					m_gzip_etag;
+
+	/// true if the file may be sent using a different content-coding
+	bool						m_has_variants;
+
+	/// true if content is mapped read-only into memory rather than copied
+	bool						m_map_content;
 };
 
 
+/// data type for a pointer to an (immutable) DiskFile
+typedef boost::shared_ptr<const DiskFile>	DiskFilePtr;
+
+
 ///
 /// DiskFileSender: class used to send files to clients using HTTP responses
 /// 
@@ -139,28 +285,55 @@ public:
 	 * creates new DiskFileSender objects
 	 *
 	 * @param file disk file object that should be sent
+	 * @param use_gzip if true, the file's gzip-encoded variant is sent
 	 * @param request HTTP request that we are responding to
 	 * @param tcp_conn TCP connection used to send the file
 	 * @param max_chunk_size sets the maximum chunk size (default=0, unlimited)
 	 */
 	static inline boost::shared_ptr<DiskFileSender>
-		create(DiskFile& file,
+		create(const DiskFilePtr& file, bool use_gzip,
 			   pion::net::HTTPRequestPtr& request,
 			   pion::net::TCPConnectionPtr& tcp_conn,
 			   unsigned long max_chunk_size = 0) 
 	{
-		return boost::shared_ptr<DiskFileSender>(new DiskFileSender(file, request,
+		return boost::shared_ptr<DiskFileSender>(new DiskFileSender(file, use_gzip, request,
 																	tcp_conn, max_chunk_size));
 	}
 
-	/// default virtual destructor 
-	virtual ~DiskFileSender() {}
+	/// virtual destructor (closes the file if it is open)
+	virtual ~DiskFileSender();
 
 	/// Begins sending the file to the client.  Following a call to this
 	/// function, it is not thread safe to use your reference to the
 	/// DiskFileSender object.
 	void send(void);
 
+	/**
+	 * sends only some ranges of the file's content instead of all of it, in a
+	 * "206 Partial Content" response (as multipart/byteranges if there are
+	 * several).  Must be called before send().
+	 *
+	 * @param ranges the ranges to send (they must be satisfiable)
+	 */
+	void setRanges(const pion::net::HTTPTypes::ByteRanges& ranges);
+
+	/// sets the Cache-Control header of the response (before send() is called)
+	inline void setCacheControl(const std::string& cache_control) {
+		m_writer->getResponse().addHeader(pion::net::HTTPTypes::HEADER_CACHE_CONTROL, cache_control);
+	}
+
+	/**
+	 * reads content that is not cached using the threads that run an I/O
+	 * service, so that the connection's thread does not wait for the disk;
+	 * the content is then sent using the connection's thread.  Must be
+	 * called before send().
+	 *
+	 * @param io_service the I/O service used to read from the disk
+	 */
+	inline void setDiskIOService(boost::asio::io_service& io_service) {
+		m_disk_io_service = &io_service;
+	}
+
 	/// sets the logger to be used
 	inline void setLogger(PionLogger log_ptr) { m_logger = log_ptr; }
 
@@ -174,11 +347,12 @@ protected:
 	 * protected constructor restricts creation of objects (use create())
 	 * 
 	 * @param file disk file object that should be sent
+	 * @param use_gzip if true, the file's gzip-encoded variant is sent
 	 * @param request HTTP request that we are responding to
 	 * @param tcp_conn TCP connection used to send the file
 	 * @param max_chunk_size sets the maximum chunk size
 	 */
-	DiskFileSender(DiskFile& file,
+	DiskFileSender(const DiskFilePtr& file, bool use_gzip,
 				   pion::net::HTTPRequestPtr& request,
 				   pion::net::TCPConnectionPtr& tcp_conn,
 				   unsigned long max_chunk_size);
@@ -192,6 +366,45 @@ protected:
 	void handleWrite(const boost::system::error_code& write_error,
 					 std::size_t bytes_written);
 
+	/**
+	 * adds the parts' content (and their headers) until there is enough to
+	 * send, reading it from the file if it is not cached
+	 *
+	 * @return bool true if successful, false if the file could not be read
+	 */
+	bool addParts(void);
+
+	/// sends the content that was added by addParts()
+	void sendParts(void);
+
+	/// calls addParts() using a disk I/O thread, and then handleRead() using
+	/// the connection's I/O service
+	void readParts(void);
+
+	/**
+	 * handler called after the disk I/O thread has added the parts' content
+	 *
+	 * @param read_ok true if the content was added, false if it could not be read
+	 */
+	void handleRead(bool read_ok);
+
+	/// ends the response if the file could not be read: with "500 Server
+	/// Error" if nothing has been sent yet, or otherwise by closing the
+	/// connection (so that the client knows the content is incomplete)
+	void handleReadError(void);
+
+	/**
+	 * adds a region of the file's content to the next data to send
+	 *
+	 * @param offset position of the region within the file
+	 * @param length number of bytes in the region
+	 * @param buffer_offset position within m_content_buf to read it into, if
+	 *                      it must be read from the file
+	 *
+	 * @return bool true if successful, false if the file could not be read
+	 */
+	bool addContent(boost::uint64_t offset, std::size_t length, std::size_t buffer_offset);
+
 
 	/// primary logging interface used by this class
 	PionLogger								m_logger;
@@ -199,18 +412,71 @@ protected:
 
 private:
 
-	/// the disk file we are sending
-	DiskFile								m_disk_file;
+	/// a part of the file's content that is sent
+	struct ContentPart {
+		ContentPart(const std::string& header, boost::uint64_t offset, boost::uint64_t length)
+			: m_header(header), m_offset(offset), m_length(length) {}
+
+		/// text that is sent before the content (the headers of a multipart part)
+		std::string		m_header;
+
+		/// position of the content within the file
+		boost::uint64_t	m_offset;
+
+		/// number of bytes of content
+		boost::uint64_t	m_length;
+	};
+
+	/// the disk file we are sending (shared with the cache)
+	DiskFilePtr								m_disk_file;
+
+	/// true if the file's gzip-encoded variant is being sent
+	const bool								m_use_gzip;
+
+	/// path of the file (or variant) being sent
+	const boost::filesystem::path&			m_file_path;
+
+	/// content of the file (or variant) being sent, if it is cached in memory
+	const char *							m_file_content;
+
+	/// size of the file (or variant) being sent
+	const boost::uint64_t					m_file_size;
+
+	/// the parts of the file's content that are sent (all of it, or the ranges requested)
+	std::vector<ContentPart>				m_parts;
+
+	/// text that is sent after the last part (the end of a multipart response)
+	std::string								m_trailer;
+
+	/// total number of bytes of the file's content that are sent
+	boost::uint64_t							m_send_size;
+
+	/// the part whose content is sent next
+	std::size_t								m_part_index;
+
+	/// number of bytes of that part's content which have been sent already
+	boost::uint64_t							m_part_bytes_sent;
+
+	/// the HTTP request that we are responding to
+	pion::net::HTTPRequestPtr				m_request;
 
 	/// the HTTP response we are sending
 	pion::net::HTTPResponseWriterPtr		m_writer;
 
+	/// I/O service used to read content that is not cached (NULL to read it
+	/// using the connection's thread)
+	boost::asio::io_service *				m_disk_io_service;
+
 	/// used to read the file from disk if it is not already cached in memory
 	boost::filesystem::ifstream				m_file_stream;
 
 	/// buffer used to send file content
 	boost::shared_array<char>				m_content_buf;
 
+	/// file descriptor used to send the file with sendfile if it is not
+	/// cached in memory and the connection is not encrypted (-1 if unused)
+	int										m_file_fd;
+
 	/**
 	 * maximum chunk size (in bytes): files larger than this size will be
 	 * delivered to clients using HTTP chunked responses.  A value of
@@ -219,10 +485,10 @@ private:
 	unsigned long							m_max_chunk_size;
 
 	/// the number of file bytes send in the last operation
-	unsigned long							m_file_bytes_to_send;
+	std::size_t								m_file_bytes_to_send;
 
 	/// the number of bytes we have sent so far
-	unsigned long							m_bytes_sent;
+	boost::uint64_t							m_bytes_sent;
 };
 
 /// data type for a DiskFileSender pointer
@@ -314,6 +580,49 @@ public:
 	 * scan:
 	 * max_chunk_size:
 	 * writable:
+	 * compress: 0 = never send gzip-encoded files (default), 1 = send
+	 *           precompressed (.gz) siblings, 2 = also compress cached text
+	 *           files.  Compression must be enabled explicitly, since
+	 *           responses then vary with the client's Accept-Encoding header
+	 * compress_level: zlib compression level used for cached files (1 = fastest,
+	 *                 9 = smallest)
+	 * compress_min_size: smallest cached file (in bytes) that is compressed
+	 * compress_types: comma-separated MIME types that may be compressed; types
+	 *                 that end with a slash match all subtypes (i.e. "text/")
+	 * cache_size: maximum number of bytes of file content (including gzip
+	 *             variants) kept in memory (0 = unlimited).  Content that has
+	 *             not been used recently is released, using the CLOCK
+	 *             algorithm as an approximation of LRU so that cache hits
+	 *             only set a flag, rather than reorder a shared list
+	 * mmap: if true, cached content is mapped read-only rather than copied, so
+	 *       it is shared with the page cache and other processes.  Files should
+	 *       be replaced (i.e. renamed over) rather than changed in place; a file
+	 *       that is changed in place is mapped again, or read from the disk if
+	 *       it is being sent, before its mapping is used
+	 * watch: if true, cached files and the scanned directory are updated when
+	 *        they change on disk (using inotify), rather than checked for
+	 *        updates by each request.  Ignored where inotify is not available
+	 * etag: stat = derive ETags from the size, timestamp and serial number of
+	 *       files (default), hash = derive them from a hash of their content
+	 *       (which is computed each time that a file is loaded)
+	 * max_age: "<seconds>" for all files, or "<path>=<seconds>" for the files
+	 *          within a path (relative to the directory); sets the max-age of
+	 *          the Cache-Control header, using the longest path that matches
+	 * io_threads: number of threads that read files from the disk (0 = none,
+	 *             the default; files are read by the connections' threads).
+	 *             Requests are handled by these threads unless the file is
+	 *             cached in memory and known to be current (cache = 2, or
+	 *             watch = true), so that a slow disk does not stop other
+	 *             connections from being served
+	 * scan_threads: number of threads that scan the directory (default 1)
+	 * lazy_scan: if true, the directory is scanned in the background while
+	 *            requests are served; until the scan has finished, requests
+	 *            for files that are not yet known use the uncached path
+	 *            rather than being refused (if scan = 1 or 3)
+	 * scan_manifest: file in which the directories' listings are saved after
+	 *                each scan, so that the next scan lists only directories
+	 *                that were modified since (the others' files are added
+	 *                without reading the directories)
 	 */
 	virtual void setOption(const std::string& name, const std::string& value);
 
@@ -333,15 +642,110 @@ public:
 	/// returns the logger currently in use
 	inline PionLogger getLogger(void) { return m_logger; }
 
+	/// returns the number of requests that used a file that was already cached
+	inline unsigned long getCacheHits(void) const { return m_cache_hits.load(boost::memory_order_relaxed); }
+
+	/// returns the number of requests that loaded a file into the cache
+	inline unsigned long getCacheMisses(void) const { return m_cache_misses.load(boost::memory_order_relaxed); }
+
+	/// returns the number of times that a file's content was released from the cache
+	inline unsigned long getCacheEvictions(void) const { return m_cache_evictions.load(boost::memory_order_relaxed); }
+
+	/// returns the number of bytes of file content that are cached in memory
+	inline unsigned long getCacheBytes(void) const { return m_cache_bytes.load(boost::memory_order_relaxed); }
+
+	/// returns true while the directory is being scanned
+	inline bool isScanning(void) const { return m_scanning.load(); }
+
 
 protected:
 
+	///
+	/// CacheEntry: a file in the cache, which is loaded (or reloaded) by one
+	///             request at a time, while requests for other files continue
+	///
+	class CacheEntry :
+		private boost::noncopyable
+	{
+	public:
+		/// constructs a cache entry whose file has not been loaded
+		CacheEntry(const boost::filesystem::path& file_path, const std::string& mime_type)
+			: m_file_path(file_path), m_mime_type(mime_type), m_cached_size(0)
+		{
+			m_referenced.store(false);
+		}
+
+		/// returns the path to the file
+		inline const boost::filesystem::path& getFilePath(void) const { return m_file_path; }
+
+		/// returns the mime type for the file
+		inline const std::string& getMimeType(void) const { return m_mime_type; }
+
+		/// returns the file that was loaded last (or null if it has not been loaded)
+		inline DiskFilePtr getFile(void) const { return boost::atomic_load(&m_file); }
+
+		/// replaces the file with one that was loaded
+		inline void setFile(const DiskFilePtr& file) { boost::atomic_store(&m_file, file); }
+
+		/// returns the mutex that is locked while the file is loaded
+		inline boost::mutex& getMutex(void) { return m_mutex; }
+
+		/// marks the entry as recently used, so that its content is kept longer
+		inline void setReferenced(void) {
+			if (! m_referenced.load(boost::memory_order_relaxed))
+				m_referenced.store(true, boost::memory_order_relaxed);
+		}
+
+	private:
+
+		/// FileService keeps track of the entries whose content is cached
+		friend class FileService;
+		/// path to the file
+		const boost::filesystem::path	m_file_path;
+
+		/// mime type for the file
+		const std::string				m_mime_type;
+
+		/// the file that was loaded last; replaced (not changed) when it is reloaded
+		DiskFilePtr						m_file;
+
+		/// mutex used to load the file one request at a time
+		boost::mutex					m_mutex;
+
+		/// true if the entry has been used since the clock hand last passed it
+		boost::atomic<bool>				m_referenced;
+
+		/// position of the entry in the clock (if its content is cached)
+		std::list<boost::shared_ptr<CacheEntry> >::iterator	m_clock_itr;
+
+		/// number of bytes of content that are cached (0 = not in the clock)
+		unsigned long					m_cached_size;
+	};
+
+	/// data type for a pointer to a cache entry
+	typedef boost::shared_ptr<CacheEntry>		CacheEntryPtr;
+
 	/// data type for map of file names to cache entries
-	typedef PION_HASH_MAP<std::string, DiskFile, PION_HASH_STRING >		CacheMap;
+	typedef PION_HASH_MAP<std::string, CacheEntryPtr, PION_HASH_STRING >	CacheMap;
+
+	/// data type for the circular list of entries whose content is cached
+	typedef std::list<CacheEntryPtr>	CacheClock;
+
+	/// a part of the cache, with its own mutex
+	struct CacheShard {
+		/// mutex used to find and add cache entries
+		boost::mutex		m_mutex;
+
+		/// the cache entries in this part of the cache
+		CacheMap			m_entries;
+	};
 
 	/// data type for map of file extensions to MIME types
 	typedef PION_HASH_MAP<std::string, std::string, PION_HASH_STRING >	MIMETypeMap;
 
+	/// data type for map of relative paths to Cache-Control header values
+	typedef std::map<std::string, std::string>	CacheControlMap;
+
 	/**
 	 * adds all files within a directory to the cache
 	 *
@@ -356,13 +760,158 @@ protected:
 	 * @param file_path actual path to the file on disk
 	 * @param placeholder if true, the file's contents are not cached
 	 *
-	 * @return std::pair<CacheMap::iterator, bool> if an entry is added to the
-	 *         cache, second will be true and first will point to the new entry
+	 * @return CacheEntryPtr the entry for the file (which was already in the
+	 *         cache if another request added it first), or null if the file
+	 *         could not be read
+	 */
+	CacheEntryPtr addCacheEntry(const std::string& relative_path,
+								const boost::filesystem::path& file_path,
+								const bool placeholder);
+
+	/**
+	 * finds the cache entry for a file
+	 *
+	 * @param relative_path path for the file relative to the root directory
+	 *
+	 * @return CacheEntryPtr the entry for the file, or null if there is none
+	 */
+	CacheEntryPtr findCacheEntry(const std::string& relative_path);
+
+	/**
+	 * returns the file of a cache entry, loading it if it has not been loaded
+	 * or (if the cache setting is 1) if it has been updated (may throw)
+	 *
+	 * @param entry the cache entry of the file
+	 */
+	DiskFilePtr getCachedFile(const CacheEntryPtr& entry);
+
+	/**
+	 * accounts for the content of a cache entry that was (re)loaded, and
+	 * releases the content of entries that have not been used recently
+	 * (using the CLOCK algorithm) until the cache is within its size
+	 *
+	 * @param entry the cache entry that was loaded (its mutex must be locked)
+	 * @param cached_size number of bytes of content that it has cached
+	 */
+	void admitCacheEntry(const CacheEntryPtr& entry, unsigned long cached_size);
+
+	/// returns true if the file is a temporary file that will replace another
+	static inline bool isTempFile(const std::string& file_name) {
+		return file_name.compare(0, TEMP_FILE_PREFIX.size(), TEMP_FILE_PREFIX) == 0;
+	}
+
+	/**
+	 * replaces a file with new content, by writing a temporary file and then
+	 * renaming it over the file (so that mappings of the file stay valid)
+	 *
+	 * @param file_path the file to replace
+	 * @param content the new content
+	 * @param length number of bytes of new content
+	 *
+	 * @return true if the file was replaced
+	 */
+	bool replaceFile(const boost::filesystem::path& file_path,
+					 const char *content, std::size_t length) const;
+
+	/// returns true if this many bytes of a file's content may be cached
+	inline bool isCacheable(boost::uint64_t file_size) const {
+		return ((m_max_cache_size == 0 || file_size <= m_max_cache_size)
+				&& (m_cache_size == 0 || file_size <= m_cache_size));
+	}
+
+	/**
+	 * handles a request, using the connection's thread or a disk I/O thread
+	 *
+	 * @param request the HTTP request to respond to
+	 * @param tcp_conn the TCP connection to send the response over
+	 */
+	void handleRequest(pion::net::HTTPRequestPtr& request,
+					   pion::net::TCPConnectionPtr& tcp_conn);
+
+	/// handles a request using a disk I/O thread, and responds with an error
+	/// (rather than throwing an exception) if it fails
+	void handleDiskRequest(pion::net::HTTPRequestPtr& request,
+						   pion::net::TCPConnectionPtr& tcp_conn);
+
+	/**
+	 * checks if a request may be handled without waiting for the disk
+	 *
+	 * @param relative_path path for the file relative to the root directory
+	 * @return true if the file is cached in memory, and known to be current
+	 */
+	bool isCachedInMemory(const std::string& relative_path);
+
+	/// adds the file and the directory's files to the cache (if scan != 0)
+	void populateCache(void);
+
+	/// adds the directory's files to the cache using the scanner, and saves its manifest
+	void scanFiles(void);
+
+	/**
+	 * starts scanning the directory, after stopping any scan that is still in
+	 * progress (m_scan_mutex must be locked)
+	 *
+	 * @param in_background if true, the directory is scanned by another thread
 	 */
-	std::pair<CacheMap::iterator, bool>
-		addCacheEntry(const std::string& relative_path,
-					  const boost::filesystem::path& file_path,
-					  const bool placeholder);
+	void startScanning(bool in_background);
+
+	/// stops the scanner, and waits for its threads to finish (m_scan_mutex
+	/// must be locked)
+	void stopScanning(void);
+
+	/// called by the watcher if changes to the files were lost: the cached
+	/// files are loaded again when they are next requested, and the directory
+	/// is scanned again in the background to find any new files
+	void handleLostChanges(void);
+
+	/// removes all the entries from the cache
+	void clearCache(void);
+
+	/// marks the file of a cache entry as not loaded, and releases its content
+	void releaseCacheEntry(const CacheEntryPtr& entry);
+
+	/**
+	 * removes a cache entry, or (if it is still needed) marks its file as
+	 * not loaded, so that it is loaded again by the next request for it
+	 *
+	 * @param relative_path path for the file relative to the root directory
+	 * @param removed if true, the file no longer exists
+	 */
+	void invalidateCacheEntry(const std::string& relative_path, bool removed);
+
+	/**
+	 * invalidates or removes the entry for a file that has changed on disk, or
+	 * adds an entry for a new file if only scanned files may be requested
+	 *
+	 * @param relative_path path for the file relative to the root directory
+	 * @param file_path actual path to the file on disk
+	 * @param removed true if the file was removed (or renamed)
+	 */
+	void updateCacheEntry(const std::string& relative_path,
+						  const boost::filesystem::path& file_path, bool removed);
+
+	/**
+	 * updates the cache after a file has changed on disk (called by the watcher)
+	 *
+	 * @param file_path path to the file (or directory) that changed
+	 * @param is_directory true if the path is a directory
+	 * @param removed true if the file was removed (or renamed)
+	 */
+	void handleFileChange(const boost::filesystem::path& file_path,
+						  bool is_directory, bool removed);
+
+	/**
+	 * reads a file's size, last modified timestamp, content (if it is not
+	 * too large to cache) and variants (may throw)
+	 *
+	 * @param entry the cache entry of the file
+	 */
+	DiskFilePtr loadFile(const CacheEntry& entry) const;
+
+	/// returns the part of the cache that has the entry for a file
+	inline CacheShard& getCacheShard(const std::string& relative_path) {
+		return m_cache_shards[boost::hash<std::string>()(relative_path) % NUM_CACHE_SHARDS];
+	}
 
 	/**
 	 * searches for a MIME type that matches a file
@@ -372,6 +921,28 @@ protected:
 	 */
 	static std::string findMIMEType(const std::string& file_name);
 
+	/**
+	 * finds the gzip-encoded variant of a file if its type may be compressed
+	 *
+	 * @param file the file to update (its content should be read first)
+	 */
+	void updateVariants(DiskFile& file) const;
+
+	/**
+	 * replaces the entity tag of a file with a hash of its content (if enabled)
+	 *
+	 * @param file the file to update (its content should be read first)
+	 */
+	void updateETag(DiskFile& file) const;
+
+	/**
+	 * finds the Cache-Control header for a file
+	 *
+	 * @param relative_path path for the file relative to the root directory
+	 * @return the header's value, or an empty string if none is configured
+	 */
+	const std::string& findCacheControl(const std::string& relative_path) const;
+
 	void sendNotFoundResponse(pion::net::HTTPRequestPtr& http_request,
 							  pion::net::TCPConnectionPtr& tcp_conn);
 
@@ -381,6 +952,12 @@ protected:
 
 private:
 
+	/// watches the directory and file for changes (defined in FileService.cpp)
+	class FileWatcher;
+
+	/// scans the directory using several threads (defined in FileService.cpp)
+	class DirectoryScanner;
+
 	/// function called once to initialize the map of MIME types
 	static void createMIMETypes(void);
 
@@ -397,9 +974,28 @@ private:
 	/// default setting for the maximum cache size option
 	static const unsigned long	DEFAULT_MAX_CACHE_SIZE;
 
+	/// default setting for the total cache size option
+	static const unsigned long	DEFAULT_CACHE_SIZE;
+
 	/// default setting for the maximum chunk size option
 	static const unsigned long	DEFAULT_MAX_CHUNK_SIZE;
 
+	/// default setting for compress configuration option
+	static const unsigned int	DEFAULT_COMPRESS_SETTING;
+
+	/// default setting for the number of disk I/O threads
+	static const unsigned int	DEFAULT_IO_THREADS;
+
+	/// default setting for the number of threads that scan the directory
+	static const unsigned int	DEFAULT_SCAN_THREADS;
+
+	/// number of parts that the cache is divided into
+	static const std::size_t	NUM_CACHE_SHARDS;
+
+	/// start of the names of temporary files that replace files (which are
+	/// never served or scanned)
+	static const std::string	TEMP_FILE_PREFIX;
+
 	/// flag used to make sure that createMIMETypes() is called only once
 	static boost::once_flag		m_mime_types_init_flag;
 
@@ -414,10 +1010,28 @@ private:
 	boost::filesystem::path		m_file;
 
 	/// used to cache file contents and metadata in memory
-	CacheMap					m_cache_map;
+	boost::scoped_array<CacheShard>	m_cache_shards;
 
-	/// mutex used to make the file cache thread-safe
-	boost::mutex				m_cache_mutex;
+	/// the entries whose content is cached, in the order that they are checked for eviction
+	CacheClock					m_cache_clock;
+
+	/// the next entry in m_cache_clock to be checked for eviction
+	CacheClock::iterator		m_clock_hand;
+
+	/// mutex used to protect m_cache_clock and the entries' positions within it
+	boost::mutex				m_clock_mutex;
+
+	/// number of bytes of file content that are cached in memory
+	boost::atomic<unsigned long>	m_cache_bytes;
+
+	/// number of requests that used a file that was already cached
+	boost::atomic<unsigned long>	m_cache_hits;
+
+	/// number of requests that loaded a file into the cache
+	boost::atomic<unsigned long>	m_cache_misses;
+
+	/// number of times that a file's content was released from the cache
+	boost::atomic<unsigned long>	m_cache_evictions;
 
 	/**
 	 * cache configuration setting:
@@ -442,6 +1056,14 @@ private:
 	 */
 	unsigned long				m_max_cache_size;
 
+	/**
+	 * total cache size (in bytes): when the content of the cached files is
+	 * larger than this, the content of the least recently used files is
+	 * released (their metadata is kept).  A value of zero means that the
+	 * size is unlimited.
+	 */
+	unsigned long				m_cache_size;
+
 	/**
 	 * maximum chunk size (in bytes): files larger than this size will be
 	 * delivered to clients using HTTP chunked responses.  A value of
@@ -453,6 +1075,82 @@ private:
 	 * Whether the file and/or directory served are writable.
 	 */
 	bool						m_writable;
+
+	/**
+	 * Whether cached content is mapped read-only into memory (shared with the
+	 * page cache and other processes) rather than copied into private buffers.
+	 */
+	bool						m_map_content;
+
+	/**
+	 * Whether the files are watched for changes, rather than checked for
+	 * updates by each request.
+	 */
+	bool						m_watch_files;
+
+	/// true while the watcher is keeping the cache up to date
+	boost::atomic<bool>			m_watching;
+
+	/**
+	 * compress configuration setting (for types that may be compressed):
+	 * 0 = always send the file's content as-is
+	 * 1 = send precompressed "<file>.gz" siblings if the client accepts gzip
+	 * 2 = same as 1, or else compress cached files once and keep the result
+	 */
+	unsigned int				m_compress_setting;
+
+	/// settings that determine which files are compressed, and how
+	HTTPCompressor::Options		m_compress_options;
+
+	/**
+	 * Whether ETags are derived from a hash of the files' content, rather
+	 * than from their size, timestamp and serial number.
+	 */
+	bool						m_hash_etags;
+
+	/// Cache-Control header values for the files within paths ("" = all files)
+	CacheControlMap				m_cache_controls;
+
+	/// number of threads that read files from the disk (0 = none)
+	unsigned int				m_io_threads;
+
+	/// runs the disk I/O threads (if there are any)
+	PionSingleServiceScheduler	m_io_scheduler;
+
+	/// true while the disk I/O threads are running
+	boost::atomic<bool>			m_io_running;
+
+	/// watches for changes to the files while the service is running (if enabled)
+	boost::shared_ptr<FileWatcher>	m_watcher;
+
+	/// number of threads that scan the directory
+	unsigned int				m_scan_threads;
+
+	/// Whether the directory is scanned in the background after starting
+	bool						m_lazy_scan;
+
+	/// file in which the directories' listings are saved (empty = none)
+	boost::filesystem::path		m_scan_manifest;
+
+	/// true while the directory is being scanned
+	boost::atomic<bool>			m_scanning;
+
+	/// true while the unit tests hold scans in the background (which are
+	/// never held otherwise), so that they may make requests during a scan
+	boost::atomic<bool>			m_scan_held;
+
+	/// the unit tests hold scans through m_scan_held
+	friend class FileServiceTester;
+
+	/// mutex used to protect m_scanner and m_scan_thread, so that the watcher
+	/// may start a scan while the service is stopped or started
+	boost::mutex				m_scan_mutex;
+
+	/// scans the directory (while it is being scanned)
+	boost::shared_ptr<DirectoryScanner>	m_scanner;
+
+	/// thread that scans the directory in the background (if lazy_scan is true)
+	boost::shared_ptr<boost::thread>	m_scan_thread;
 };
 
 
@@ -115,7 +115,7 @@ void LogServiceAppender::writeLogEvents(pion::net::HTTPResponseWriterPtr& writer
 // LogService member functions
 
 LogService::LogService(void)
-	: m_log_appender_ptr(new LogServiceAppender())
+	: m_log_appender_ptr(new LogServiceAppender()), m_compress(false)
 {
 #if defined(PION_USE_LOG4CXX)
 	m_log_appender_ptr->setName("LogServiceAppender");
@@ -144,6 +144,21 @@ LogService::~LogService()
 #endif
 }
 
+void LogService::setOption(const std::string& name, const std::string& value)
+{
+	if (name == "compress") {
+		if (value == "true") {
+			m_compress = true;
+		} else if (value == "false") {
+			m_compress = false;
+		} else {
+			throw InvalidOptionValueException("compress", value);
+		}
+	} else {
+		throw UnknownOptionException(name);
+	}
+}
+
 /// handles requests for LogService
 void LogService::operator()(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn)
 {
@@ -151,6 +166,9 @@ void LogService::operator()(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn)
 	HTTPResponseWriterPtr writer(HTTPResponseWriter::create(tcp_conn, *request,
 															boost::bind(&TCPConnection::finish, tcp_conn)));
 	writer->getResponse().setContentType(HTTPTypes::CONTENT_TYPE_TEXT);
+	// compress the response if enabled and the client accepts gzip or deflate
+	if (m_compress)
+		writer->setCompression(HTTPCompressor::getDefaultOptions());
 	getLogAppender().writeLogEvents(writer);
 	writer->send();
 }
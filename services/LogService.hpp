@@ -13,6 +13,7 @@
 #include <boost/thread/mutex.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <pion/PionLogger.hpp>
+#include <pion/PionException.hpp>
 #include <pion/net/WebService.hpp>
 #include <pion/net/HTTPResponseWriter.hpp>
 #include <string>
@@ -122,10 +123,28 @@ class LogService :
 	public pion::net::WebService
 {
 public:
+	/// exception thrown if an option has a value that is not supported
+	class InvalidOptionValueException : public PionException {
+	public:
+		InvalidOptionValueException(const std::string& option, const std::string& value)
+			: PionException("LogService invalid value for " + option + " option: ", value) {}
+	};
+
 	// default constructor and destructor
 	LogService(void);
 	virtual ~LogService();
 	
+	/**
+	 * configuration options supported by LogService:
+	 *
+	 * compress: if true, responses are compressed when the client accepts
+	 *           gzip or deflate (default false)
+	 *
+	 * @param name the name of the option to change
+	 * @param value the value of the option
+	 */
+	virtual void setOption(const std::string& name, const std::string& value);
+
 	/// handles a new HTTP request
 	virtual void operator()(pion::net::HTTPRequestPtr& request,
 							pion::net::TCPConnectionPtr& tcp_conn);
@@ -146,6 +165,9 @@ private:
 #else
 	LogServiceAppender *	m_log_appender_ptr;
 #endif
+
+	/// true if responses are compressed when the client accepts it
+	bool					m_compress;
 };
 
 	
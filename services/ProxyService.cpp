@@ -0,0 +1,622 @@
+// ------------------------------------------------------------------
+// pion-net: a C++ framework for building lightweight HTTP interfaces
+// ------------------------------------------------------------------
+// Copyright (C) 2007-2010 Atomic Labs, Inc.  (http://www.atomiclabs.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string.hpp>
+
+#include "ProxyService.hpp"
+#include <pion/net/HTTPServer.hpp>
+#include <pion/net/HTTPResponseWriter.hpp>
+
+using namespace pion;
+using namespace pion::net;
+using boost::asio::ip::tcp;
+
+namespace pion {		// begin namespace pion
+namespace plugins {		// begin namespace plugins
+
+
+// ProxyUpstream member functions
+
+TCPConnectionPtr ProxyUpstream::takeIdleConnection(void)
+{
+	boost::mutex::scoped_lock upstream_lock(m_mutex);
+	while (! m_idle.empty()) {
+		TCPConnectionPtr conn(m_idle.back());
+		m_idle.pop_back();
+		// once the idle timer is cancelled, it can no longer close the connection
+		if (conn->getTimer())
+			conn->getTimer()->cancel();
+		if (conn->is_open())
+			return conn;
+	}
+	return TCPConnectionPtr();
+}
+
+void ProxyUpstream::releaseConnection(TCPConnectionPtr& conn, bool reusable)
+{
+	boost::mutex::scoped_lock upstream_lock(m_mutex);
+	--m_active_requests;
+	if (! conn)
+		return;
+
+	// forget connections that were closed by their idle timers
+	std::vector<TCPConnectionPtr>::iterator i = m_idle.begin();
+	while (i != m_idle.end()) {
+		if ((*i)->is_open())
+			++i;
+		else
+			i = m_idle.erase(i);
+	}
+
+	if (reusable && conn->is_open() && m_idle.size() < m_max_idle) {
+		conn->setLifecycle(TCPConnection::LIFECYCLE_KEEPALIVE);
+		if (m_idle_timeout > 0) {
+			// the connection's timer closes it if it stays idle
+			if (! conn->getTimer())
+				conn->setTimer(TCPTimerPtr(new TCPTimer(conn)));
+			conn->getTimer()->start(m_idle_timeout);
+		}
+		m_idle.push_back(conn);
+	} else {
+		conn->close();
+	}
+}
+
+std::size_t ProxyUpstream::getIdleConnections(void)
+{
+	boost::mutex::scoped_lock upstream_lock(m_mutex);
+	std::size_t n = 0;
+	for (std::vector<TCPConnectionPtr>::const_iterator i = m_idle.begin(); i != m_idle.end(); ++i) {
+		if ((*i)->is_open())
+			++n;
+	}
+	return n;
+}
+
+void ProxyUpstream::closeIdleConnections(void)
+{
+	boost::mutex::scoped_lock upstream_lock(m_mutex);
+	for (std::vector<TCPConnectionPtr>::iterator i = m_idle.begin(); i != m_idle.end(); ++i) {
+		if ((*i)->getTimer())
+			(*i)->getTimer()->cancel();
+		(*i)->close();
+	}
+	m_idle.clear();
+}
+
+
+// ProxyRelay member functions
+
+ProxyRelay::ProxyRelay(ProxyUpstreamPtr& upstream,
+					   HTTPRequestPtr& request,
+					   TCPConnectionPtr& tcp_conn,
+					   boost::uint32_t timeout)
+	: m_logger(PION_GET_LOGGER("pion.ProxyService")),
+	m_upstream(upstream), m_request(request), m_client_conn(tcp_conn),
+	m_body_type(BODY_NONE), m_bytes_remaining(0), m_timeout(timeout),
+	m_reused_conn(false), m_retried(false), m_headers_sent(false),
+	m_body_finished(false), m_upstream_reusable(false)
+{}
+
+void ProxyRelay::start(void)
+{
+	m_upstream->addActiveRequest();
+	sendRequest();
+}
+
+void ProxyRelay::sendRequest(void)
+{
+	m_upstream_conn = m_upstream->takeIdleConnection();
+	m_reused_conn = (m_upstream_conn.get() != NULL);
+	if (m_reused_conn) {
+		handleConnect(boost::system::error_code());
+	} else {
+		m_upstream_conn.reset(new TCPConnection(m_client_conn->getIOService()));
+		m_upstream_conn->setLifecycle(TCPConnection::LIFECYCLE_KEEPALIVE);
+		m_upstream_conn->async_connect(m_upstream->getEndpoint(),
+									   boost::bind(&ProxyRelay::handleConnect, shared_from_this(),
+												   boost::asio::placeholders::error));
+	}
+}
+
+void ProxyRelay::handleConnect(const boost::system::error_code& ec)
+{
+	if (ec) {
+		handleUpstreamError("connect", ec, false);
+		return;
+	}
+
+	// the request's payload content has already been read by the server,
+	// and is sent from its buffer without being copied
+	m_write_buffers.clear();
+	m_request->prepareBuffersForSend(m_write_buffers, true, false);
+	if (m_request->getContentLength() > 0)
+		m_write_buffers.push_back(boost::asio::buffer(m_request->getContent(),
+													  m_request->getContentLength()));
+	m_upstream_conn->async_write(m_write_buffers,
+								 boost::bind(&ProxyRelay::handleRequestWrite, shared_from_this(),
+											 boost::asio::placeholders::error));
+}
+
+void ProxyRelay::handleRequestWrite(const boost::system::error_code& ec)
+{
+	if (ec) {
+		handleUpstreamError("write", ec, true);
+		return;
+	}
+
+	// read only the response headers: the payload content is relayed to the
+	// client as it arrives, instead of being buffered within the response
+	m_reader = HTTPResponseReader::create(m_upstream_conn, *m_request,
+										  boost::bind(&ProxyRelay::handleResponseHeaders,
+													  shared_from_this(), _1, _3));
+	m_reader->parseHeadersOnly();
+	m_reader->setMaxContentLength(0);
+	m_reader->setTimeout(m_timeout);
+	m_reader->receive();
+}
+
+void ProxyRelay::handleResponseHeaders(HTTPResponsePtr response,
+									   const boost::system::error_code& ec)
+{
+	// find any payload content that was read along with the headers
+	const char *read_ptr = NULL;
+	const char *read_end_ptr = NULL;
+	m_reader->loadReadPosition(read_ptr, read_end_ptr);
+	const bool nothing_received = (m_reader->getTotalBytesRead() == 0);
+	m_reader.reset();
+
+	if (ec || ! response->isValid()) {
+		handleUpstreamError("read", ec, nothing_received);
+		return;
+	}
+	m_response = response;
+
+	// determine how the end of the payload content will be found
+	if (m_response->isContentLengthImplied()) {
+		// keep any Content-Length header sent in response to a HEAD request
+		m_body_type = BODY_NONE;
+		m_response->setDoNotSendContentLength();
+	} else if (m_response->isChunked()) {
+		m_body_type = BODY_CHUNKED;
+	} else if (m_response->hasHeader(HTTPTypes::HEADER_CONTENT_LENGTH)) {
+		// the reader's maximum content length truncated the length
+		m_response->updateContentLengthUsingHeader();
+		m_body_type = BODY_LENGTH;
+		m_bytes_remaining = m_response->getContentLength();
+	} else {
+		m_body_type = BODY_UNTIL_CLOSE;
+		m_response->setDoNotSendContentLength();
+	}
+	m_upstream_reusable = (m_response->checkKeepAlive() && m_body_type != BODY_UNTIL_CLOSE);
+
+	// the client's connection is closed afterwards if the content length
+	// can only be determined by closing it
+	if (m_body_type == BODY_UNTIL_CLOSE)
+		m_client_conn->setLifecycle(TCPConnection::LIFECYCLE_CLOSE);
+	ProxyService::removeHopByHopHeaders(*m_response);
+	m_write_buffers.clear();
+	m_response->prepareBuffersForSend(m_write_buffers, m_client_conn->getKeepAlive(),
+									  m_body_type == BODY_CHUNKED);
+
+	// send the headers along with the content that has already been read
+	const std::size_t bytes_available = (read_ptr != NULL && read_end_ptr > read_ptr
+										 ? read_end_ptr - read_ptr : 0);
+	const std::size_t bytes_consumed = consumeBody(read_ptr, bytes_available);
+	if (bytes_consumed > 0)
+		m_write_buffers.push_back(boost::asio::buffer(read_ptr, bytes_consumed));
+	if (bytes_consumed < bytes_available)
+		m_upstream_reusable = false;	// the server sent more than one response
+
+	m_headers_sent = true;
+	m_client_conn->async_write(m_write_buffers,
+							   boost::bind(&ProxyRelay::handleClientWrite, shared_from_this(),
+										   boost::asio::placeholders::error));
+}
+
+void ProxyRelay::readUpstream(void)
+{
+	if (m_timeout > 0) {
+		// the connection keeps one timer, which is also used by its readers
+		if (! m_upstream_conn->getTimer())
+			m_upstream_conn->setTimer(TCPTimerPtr(new TCPTimer(m_upstream_conn)));
+		m_upstream_conn->getTimer()->start(m_timeout);
+	}
+	m_upstream_conn->async_read_some(boost::bind(&ProxyRelay::handleUpstreamRead,
+												 shared_from_this(),
+												 boost::asio::placeholders::error,
+												 boost::asio::placeholders::bytes_transferred));
+}
+
+void ProxyRelay::handleUpstreamRead(const boost::system::error_code& ec, std::size_t bytes_read)
+{
+	if (m_upstream_conn->getTimer())
+		m_upstream_conn->getTimer()->cancel();
+
+	if (ec) {
+		if (m_body_type == BODY_UNTIL_CLOSE) {
+			m_body_finished = true;
+			finish();
+		} else {
+			handleUpstreamError("read", ec, false);
+		}
+		return;
+	}
+
+	const char *read_ptr = m_upstream_conn->getReadBuffer().data();
+	const std::size_t bytes_consumed = consumeBody(read_ptr, bytes_read);
+	if (m_chunk_scanner.isInvalid()) {
+		handleUpstreamError("parse", boost::system::error_code(), false);
+		return;
+	}
+	if (bytes_consumed < bytes_read)
+		m_upstream_reusable = false;
+
+	// the next read waits until the client has accepted this data
+	m_client_conn->async_write(boost::asio::buffer(read_ptr, bytes_consumed),
+							   boost::bind(&ProxyRelay::handleClientWrite, shared_from_this(),
+										   boost::asio::placeholders::error));
+}
+
+void ProxyRelay::handleClientWrite(const boost::system::error_code& ec)
+{
+	if (ec) {
+		// the client went away: the rest of the response is not needed
+		PION_LOG_DEBUG(m_logger, "Unable to relay response to client ("
+					   << ec.message() << ')');
+		m_upstream_reusable = false;
+		m_client_conn->setLifecycle(TCPConnection::LIFECYCLE_CLOSE);
+		finish();
+	} else if (m_body_finished) {
+		finish();
+	} else {
+		readUpstream();
+	}
+}
+
+std::size_t ProxyRelay::consumeBody(const char *ptr, std::size_t len)
+{
+	std::size_t n = 0;
+	switch (m_body_type) {
+	case BODY_NONE:
+		m_body_finished = true;
+		break;
+	case BODY_LENGTH:
+		n = (len < m_bytes_remaining ? len : m_bytes_remaining);
+		m_bytes_remaining -= n;
+		m_body_finished = (m_bytes_remaining == 0);
+		break;
+	case BODY_CHUNKED:
+		n = m_chunk_scanner.scan(ptr, len);
+		m_body_finished = m_chunk_scanner.isFinished();
+		break;
+	case BODY_UNTIL_CLOSE:
+		n = len;
+		break;
+	}
+	return n;
+}
+
+void ProxyRelay::handleUpstreamError(const std::string& what, const boost::system::error_code& ec,
+									 bool nothing_received)
+{
+	if (m_upstream_conn->getTimer())
+		m_upstream_conn->getTimer()->cancel();
+	m_upstream_conn->close();
+
+	// an idle connection may have been closed by the server before the
+	// request arrived: send it again using a new connection
+	if (! m_headers_sent && m_reused_conn && nothing_received
+		&& ! m_retried && m_request->isIdempotent())
+	{
+		PION_LOG_DEBUG(m_logger, "Retrying request using a new connection to "
+					   << m_upstream->getName());
+		m_retried = true;
+		sendRequest();
+		return;
+	}
+
+	PION_LOG_WARN(m_logger, "Upstream " << what << " failed for " << m_upstream->getName()
+				  << " (" << (ec ? ec.message() : std::string("invalid response")) << ')');
+	m_upstream_reusable = false;
+	m_upstream->releaseConnection(m_upstream_conn, false);
+	m_upstream_conn.reset();
+
+	if (m_headers_sent) {
+		// part of the response was already sent: the client can only tell
+		// that it is incomplete if the connection is closed
+		m_client_conn->setLifecycle(TCPConnection::LIFECYCLE_CLOSE);
+		m_client_conn->finish();
+	} else {
+		static const std::string BAD_GATEWAY_HTML =
+			"<html><head>\n"
+			"<title>502 Bad Gateway</title>\n"
+			"</head><body>\n"
+			"<h1>Bad Gateway</h1>\n"
+			"<p>The upstream server did not respond.</p>\n"
+			"</body></html>\n";
+		HTTPResponseWriterPtr writer(HTTPResponseWriter::create(m_client_conn, *m_request,
+																boost::bind(&TCPConnection::finish, m_client_conn)));
+		writer->getResponse().setStatusCode(HTTPTypes::RESPONSE_CODE_BAD_GATEWAY);
+		writer->getResponse().setStatusMessage(HTTPTypes::RESPONSE_MESSAGE_BAD_GATEWAY);
+		writer->writeNoCopy(BAD_GATEWAY_HTML);
+		writer->send();
+	}
+}
+
+void ProxyRelay::finish(void)
+{
+	m_upstream->releaseConnection(m_upstream_conn, m_upstream_reusable && m_body_finished);
+	m_upstream_conn.reset();
+	m_client_conn->finish();
+}
+
+
+// ProxyRelay::ChunkScanner member functions
+
+std::size_t ProxyRelay::ChunkScanner::scan(const char *ptr, std::size_t len)
+{
+	const char * const start_ptr = ptr;
+	const char * const end_ptr = ptr + len;
+
+	while (ptr < end_ptr && m_state != CHUNK_FINISHED && m_state != CHUNK_INVALID) {
+		const char c = *ptr;
+		switch (m_state) {
+		case CHUNK_SIZE:
+			if (std::isxdigit(static_cast<unsigned char>(c))) {
+				// a size with more digits could overflow std::size_t
+				if (++m_size_digits > sizeof(std::size_t) * 2 - 1) {
+					m_state = CHUNK_INVALID;
+					break;
+				}
+				m_size = (m_size << 4) + (std::isdigit(static_cast<unsigned char>(c))
+										  ? c - '0' : (std::tolower(c) - 'a' + 10));
+			} else if (c == ';' || c == ' ' || c == '\t' || c == '\r') {
+				m_state = CHUNK_EXTENSION;
+			} else if (c == '\n' && m_size_digits > 0) {
+				m_state = (m_size > 0 ? CHUNK_DATA : CHUNK_TRAILER_START);
+			} else {
+				m_state = CHUNK_INVALID;
+				break;
+			}
+			++ptr;
+			break;
+		case CHUNK_EXTENSION:
+			if (c == '\n')
+				m_state = (m_size_digits == 0 ? CHUNK_INVALID
+						   : m_size > 0 ? CHUNK_DATA : CHUNK_TRAILER_START);
+			++ptr;
+			break;
+		case CHUNK_DATA:
+			{
+				// skip over as much of the chunk's data as is available
+				const std::size_t n = (static_cast<std::size_t>(end_ptr - ptr) < m_size
+									   ? end_ptr - ptr : m_size);
+				ptr += n;
+				m_size -= n;
+				if (m_size == 0)
+					m_state = CHUNK_DATA_END;
+			}
+			break;
+		case CHUNK_DATA_END:
+			if (c == '\n') {
+				m_state = CHUNK_SIZE;
+				m_size_digits = 0;
+			} else if (c != '\r') {
+				m_state = CHUNK_INVALID;
+				break;
+			}
+			++ptr;
+			break;
+		case CHUNK_TRAILER_START:
+			if (c == '\n')
+				m_state = CHUNK_FINISHED;
+			else if (c != '\r')
+				m_state = CHUNK_TRAILER;
+			++ptr;
+			break;
+		case CHUNK_TRAILER:
+			if (c == '\n')
+				m_state = CHUNK_TRAILER_START;
+			++ptr;
+			break;
+		case CHUNK_FINISHED:
+		case CHUNK_INVALID:
+			break;
+		}
+	}
+
+	return ptr - start_ptr;
+}
+
+
+// static members of ProxyService
+
+const std::size_t		ProxyService::DEFAULT_MAX_IDLE = 16;
+const boost::uint32_t	ProxyService::DEFAULT_TIMEOUT = 30;
+const boost::uint32_t	ProxyService::DEFAULT_IDLE_TIMEOUT = 60;
+
+
+// ProxyService member functions
+
+ProxyService::ProxyService(void)
+	: m_logger(PION_GET_LOGGER("pion.ProxyService")),
+	m_least_connections(false), m_next_upstream(0),
+	m_max_idle(DEFAULT_MAX_IDLE), m_timeout(DEFAULT_TIMEOUT),
+	m_idle_timeout(DEFAULT_IDLE_TIMEOUT)
+{}
+
+void ProxyService::setOption(const std::string& name, const std::string& value)
+{
+	if (name == "upstream") {
+		// the port number is optional
+		std::string host(value);
+		std::string port("80");
+		const std::string::size_type pos = value.rfind(':');
+		if (pos != std::string::npos && value.find(']', pos) == std::string::npos) {
+			host = value.substr(0, pos);
+			port = value.substr(pos + 1);
+		}
+		if (host.size() > 2 && host[0] == '[' && host[host.size() - 1] == ']')
+			host = host.substr(1, host.size() - 2);	// IPv6 address
+
+		// upstream servers are resolved once, when the service is configured
+		boost::asio::io_service io_service;
+		tcp::resolver resolver(io_service);
+		boost::system::error_code ec;
+		tcp::resolver::iterator endpoint_iterator = resolver.resolve(tcp::resolver::query(host, port), ec);
+		if (ec || endpoint_iterator == tcp::resolver::iterator())
+			throw UpstreamNotFoundException(value);
+		m_upstreams.push_back(ProxyUpstreamPtr(new ProxyUpstream(value, endpoint_iterator->endpoint(),
+															  m_max_idle, m_idle_timeout)));
+		PION_LOG_INFO(m_logger, "Added upstream server " << value
+					  << " (" << endpoint_iterator->endpoint() << ')');
+	} else if (name == "balance") {
+		if (value == "round-robin") {
+			m_least_connections = false;
+		} else if (value == "least-connections") {
+			m_least_connections = true;
+		} else {
+			throw InvalidOptionValueException("balance", value);
+		}
+	} else if (name == "max_idle") {
+		try {
+			m_max_idle = boost::lexical_cast<std::size_t>(value);
+		} catch (boost::bad_lexical_cast&) {
+			throw InvalidOptionValueException("max_idle", value);
+		}
+		for (std::vector<ProxyUpstreamPtr>::iterator i = m_upstreams.begin(); i != m_upstreams.end(); ++i)
+			(*i)->setMaxIdle(m_max_idle);
+	} else if (name == "timeout") {
+		try {
+			m_timeout = boost::lexical_cast<boost::uint32_t>(value);
+		} catch (boost::bad_lexical_cast&) {
+			throw InvalidOptionValueException("timeout", value);
+		}
+	} else if (name == "idle_timeout") {
+		try {
+			m_idle_timeout = boost::lexical_cast<boost::uint32_t>(value);
+		} catch (boost::bad_lexical_cast&) {
+			throw InvalidOptionValueException("idle_timeout", value);
+		}
+		for (std::vector<ProxyUpstreamPtr>::iterator i = m_upstreams.begin(); i != m_upstreams.end(); ++i)
+			(*i)->setIdleTimeout(m_idle_timeout);
+	} else {
+		throw UnknownOptionException(name);
+	}
+}
+
+void ProxyService::operator()(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn)
+{
+	ProxyUpstreamPtr upstream(selectUpstream());
+	if (! upstream) {
+		HTTPServer::handleServerError(request, tcp_conn, "no upstream servers are configured");
+		return;
+	}
+
+	// the request's payload content has been decoded and its length is known
+	removeHopByHopHeaders(*request);
+	request->deleteHeader(HTTPTypes::HEADER_TRANSFER_ENCODING);
+	request->deleteHeader("Expect");
+
+	// append the client's address, keeping the original client first so that
+	// HTTPParser::parseForwardedFor() finds its public IP address upstream
+	std::string forwarded_for;
+	std::pair<HTTPTypes::Headers::const_iterator, HTTPTypes::Headers::const_iterator>
+		range = request->getHeaders().equal_range(HTTPTypes::HEADER_X_FORWARDED_FOR);
+	for (HTTPTypes::Headers::const_iterator i = range.first; i != range.second; ++i) {
+		if (! forwarded_for.empty())
+			forwarded_for += ", ";
+		forwarded_for += i->second;
+	}
+	if (! forwarded_for.empty())
+		forwarded_for += ", ";
+	forwarded_for += tcp_conn->getRemoteIp().to_string();
+	request->changeHeader(HTTPTypes::HEADER_X_FORWARDED_FOR, forwarded_for);
+
+	PION_LOG_DEBUG(m_logger, "Forwarding request for " << request->getResource()
+				   << " to " << upstream->getName());
+	ProxyRelayPtr relay(ProxyRelay::create(upstream, request, tcp_conn, m_timeout));
+	relay->setLogger(m_logger);
+	relay->start();
+}
+
+void ProxyService::stop(void)
+{
+	for (std::vector<ProxyUpstreamPtr>::iterator i = m_upstreams.begin(); i != m_upstreams.end(); ++i)
+		(*i)->closeIdleConnections();
+}
+
+void ProxyService::removeHopByHopHeaders(HTTPMessage& http_msg)
+{
+	// headers named by the Connection header are also hop-by-hop
+	std::vector<std::string> connection_options;
+	boost::algorithm::split(connection_options, http_msg.getHeader(HTTPTypes::HEADER_CONNECTION),
+							boost::algorithm::is_any_of(", \t"), boost::algorithm::token_compress_on);
+	for (std::vector<std::string>::const_iterator i = connection_options.begin();
+		 i != connection_options.end(); ++i)
+	{
+		if (! i->empty() && ! boost::algorithm::iequals(*i, "close")
+			&& ! boost::algorithm::iequals(*i, "keep-alive"))
+		{
+			http_msg.deleteHeader(*i);
+		}
+	}
+
+	http_msg.deleteHeader(HTTPTypes::HEADER_CONNECTION);
+	http_msg.deleteHeader("Keep-Alive");
+	http_msg.deleteHeader("Proxy-Connection");
+	http_msg.deleteHeader("TE");
+	http_msg.deleteHeader("Trailer");
+	http_msg.deleteHeader("Upgrade");
+}
+
+ProxyUpstreamPtr ProxyService::selectUpstream(void)
+{
+	boost::mutex::scoped_lock proxy_lock(m_mutex);
+	if (m_upstreams.empty())
+		return ProxyUpstreamPtr();
+
+	if (m_least_connections) {
+		// start after the last server chosen, so that ties are spread evenly
+		std::size_t best = m_next_upstream % m_upstreams.size();
+		unsigned int best_active = m_upstreams[best]->getActiveRequests();
+		for (std::size_t n = 1; n < m_upstreams.size() && best_active > 0; ++n) {
+			const std::size_t candidate = (m_next_upstream + n) % m_upstreams.size();
+			const unsigned int active = m_upstreams[candidate]->getActiveRequests();
+			if (active < best_active) {
+				best = candidate;
+				best_active = active;
+			}
+		}
+		m_next_upstream = best + 1;
+		return m_upstreams[best];
+	}
+
+	return m_upstreams[m_next_upstream++ % m_upstreams.size()];
+}
+
+
+}	// end namespace plugins
+}	// end namespace pion
+
+
+/// creates new ProxyService objects
+extern "C" PION_SERVICE_API pion::plugins::ProxyService *pion_create_ProxyService(void)
+{
+	return new pion::plugins::ProxyService();
+}
+
+/// destroys ProxyService objects
+extern "C" PION_SERVICE_API void pion_destroy_ProxyService(pion::plugins::ProxyService *service_ptr)
+{
+	delete service_ptr;
+}
@@ -0,0 +1,423 @@
+// ------------------------------------------------------------------
+// pion-net: a C++ framework for building lightweight HTTP interfaces
+// ------------------------------------------------------------------
+// Copyright (C) 2007-2010 Atomic Labs, Inc.  (http://www.atomiclabs.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See http://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef __PION_PROXYSERVICE_HEADER__
+#define __PION_PROXYSERVICE_HEADER__
+
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/thread/mutex.hpp>
+#include <pion/PionLogger.hpp>
+#include <pion/PionException.hpp>
+#include <pion/net/WebService.hpp>
+#include <pion/net/TCPTimer.hpp>
+#include <pion/net/HTTPRequest.hpp>
+#include <pion/net/HTTPResponse.hpp>
+#include <pion/net/HTTPResponseReader.hpp>
+
+
+namespace pion {		// begin namespace pion
+namespace plugins {		// begin namespace plugins
+
+
+///
+/// ProxyUpstream: a backend server and its idle keep-alive connections
+///
+class ProxyUpstream :
+	private boost::noncopyable
+{
+public:
+
+	/**
+	 * creates a new upstream server
+	 *
+	 * @param name "host:port" string that identifies the server
+	 * @param endpoint the server's resolved address
+	 * @param max_idle maximum number of idle connections kept for re-use
+	 * @param idle_timeout number of seconds after which idle connections are
+	 *                     closed (0 = never)
+	 */
+	ProxyUpstream(const std::string& name, const boost::asio::ip::tcp::endpoint& endpoint,
+				  std::size_t max_idle, boost::uint32_t idle_timeout)
+		: m_name(name), m_endpoint(endpoint), m_max_idle(max_idle),
+		m_idle_timeout(idle_timeout), m_active_requests(0)
+	{}
+
+	/// returns the "host:port" string that identifies the server
+	inline const std::string& getName(void) const { return m_name; }
+
+	/// returns the server's resolved address
+	inline boost::asio::ip::tcp::endpoint& getEndpoint(void) { return m_endpoint; }
+
+	/// sets the maximum number of idle connections kept for re-use
+	inline void setMaxIdle(std::size_t n) {
+		boost::mutex::scoped_lock upstream_lock(m_mutex);
+		m_max_idle = n;
+	}
+
+	/// sets the number of seconds after which idle connections are closed
+	/// (connections that are already idle keep their previous timeout)
+	inline void setIdleTimeout(boost::uint32_t n) {
+		boost::mutex::scoped_lock upstream_lock(m_mutex);
+		m_idle_timeout = n;
+	}
+
+	/// returns the number of requests being relayed to the server
+	inline unsigned int getActiveRequests(void) {
+		boost::mutex::scoped_lock upstream_lock(m_mutex);
+		return m_active_requests;
+	}
+
+	/// returns the number of idle connections to the server that are still open
+	std::size_t getIdleConnections(void);
+
+	/// counts a new request that will be relayed to the server
+	inline void addActiveRequest(void) {
+		boost::mutex::scoped_lock upstream_lock(m_mutex);
+		++m_active_requests;
+	}
+
+	/// returns the most recently used idle connection, or an empty pointer if none are idle
+	pion::net::TCPConnectionPtr takeIdleConnection(void);
+
+	/**
+	 * called after a request has finished
+	 *
+	 * @param conn the connection used for the request (may be empty)
+	 * @param reusable true if the connection may be used for another request
+	 */
+	void releaseConnection(pion::net::TCPConnectionPtr& conn, bool reusable);
+
+	/// closes all of the idle connections
+	void closeIdleConnections(void);
+
+
+private:
+
+	/// "host:port" string that identifies the server
+	const std::string							m_name;
+
+	/// the server's resolved address
+	boost::asio::ip::tcp::endpoint				m_endpoint;
+
+	/// idle connections (most recently used last)
+	std::vector<pion::net::TCPConnectionPtr>	m_idle;
+
+	/// maximum number of idle connections kept for re-use
+	std::size_t									m_max_idle;
+
+	/// number of seconds after which idle connections are closed (0 = never)
+	boost::uint32_t								m_idle_timeout;
+
+	/// number of requests being relayed to the server
+	unsigned int								m_active_requests;
+
+	/// mutex used to protect the idle connections & counters
+	boost::mutex								m_mutex;
+};
+
+/// data type for a pointer to an upstream server
+typedef boost::shared_ptr<ProxyUpstream>		ProxyUpstreamPtr;
+
+
+///
+/// ProxyRelay: forwards one request to an upstream server, and streams the
+///             response back to the client as it arrives
+///
+class ProxyRelay :
+	public boost::enable_shared_from_this<ProxyRelay>,
+	private boost::noncopyable
+{
+public:
+
+	/**
+	 * creates new ProxyRelay objects
+	 *
+	 * @param upstream the server that the request is forwarded to
+	 * @param request the (rewritten) request to forward
+	 * @param tcp_conn the client's connection
+	 * @param timeout maximum number of seconds to wait for the server
+	 */
+	static inline boost::shared_ptr<ProxyRelay>
+		create(ProxyUpstreamPtr& upstream,
+			   pion::net::HTTPRequestPtr& request,
+			   pion::net::TCPConnectionPtr& tcp_conn,
+			   boost::uint32_t timeout)
+	{
+		return boost::shared_ptr<ProxyRelay>(new ProxyRelay(upstream, request, tcp_conn, timeout));
+	}
+
+	/// begins relaying the request
+	void start(void);
+
+	/// sets the logger to be used
+	inline void setLogger(PionLogger log_ptr) { m_logger = log_ptr; }
+
+	/// returns the logger currently in use
+	inline PionLogger getLogger(void) { return m_logger; }
+
+
+protected:
+
+	/// protected constructor restricts creation of objects (use create())
+	ProxyRelay(ProxyUpstreamPtr& upstream,
+			   pion::net::HTTPRequestPtr& request,
+			   pion::net::TCPConnectionPtr& tcp_conn,
+			   boost::uint32_t timeout);
+
+
+private:
+
+	/// how the end of the response's payload content is determined
+	enum BodyType {
+		BODY_NONE, BODY_LENGTH, BODY_CHUNKED, BODY_UNTIL_CLOSE
+	};
+
+	/// finds the end of chunked payload content without decoding it
+	class ChunkScanner {
+	public:
+		ChunkScanner(void) : m_state(CHUNK_SIZE), m_size(0), m_size_digits(0) {}
+
+		/**
+		 * scans data that follows the data scanned previously
+		 *
+		 * @return std::size_t number of bytes that belong to the message
+		 */
+		std::size_t scan(const char *ptr, std::size_t len);
+
+		/// returns true if the last chunk and trailers have been scanned
+		inline bool isFinished(void) const { return m_state == CHUNK_FINISHED; }
+
+		/// returns true if the chunk framing is invalid
+		inline bool isInvalid(void) const { return m_state == CHUNK_INVALID; }
+
+	private:
+		enum State {
+			CHUNK_SIZE, CHUNK_EXTENSION, CHUNK_DATA, CHUNK_DATA_END,
+			CHUNK_TRAILER_START, CHUNK_TRAILER, CHUNK_FINISHED, CHUNK_INVALID
+		};
+		State				m_state;
+		std::size_t			m_size;
+		unsigned int		m_size_digits;
+	};
+
+	/// sends the request using an idle connection, or a new one
+	void sendRequest(void);
+
+	/// called after a new upstream connection has been established
+	void handleConnect(const boost::system::error_code& ec);
+
+	/// called after the request has been written to the upstream connection
+	void handleRequestWrite(const boost::system::error_code& ec);
+
+	/// called after the upstream response's headers have been read
+	void handleResponseHeaders(pion::net::HTTPResponsePtr response,
+							   const boost::system::error_code& ec);
+
+	/// reads more of the response's payload content from the upstream connection
+	void readUpstream(void);
+
+	/// called after payload content has been read from the upstream connection
+	void handleUpstreamRead(const boost::system::error_code& ec, std::size_t bytes_read);
+
+	/// called after data has been written to the client
+	void handleClientWrite(const boost::system::error_code& ec);
+
+	/**
+	 * tracks the end of the response's payload content
+	 *
+	 * @return std::size_t number of bytes that belong to the response
+	 */
+	std::size_t consumeBody(const char *ptr, std::size_t len);
+
+	/// handles an upstream failure; retries the request if that is safe
+	void handleUpstreamError(const std::string& what, const boost::system::error_code& ec,
+							 bool nothing_received);
+
+	/// releases the upstream connection and finishes the client's request
+	void finish(void);
+
+
+	/// primary logging interface used by this class
+	PionLogger								m_logger;
+
+	/// the server that the request is forwarded to
+	ProxyUpstreamPtr						m_upstream;
+
+	/// the request being forwarded
+	pion::net::HTTPRequestPtr				m_request;
+
+	/// the client's connection
+	pion::net::TCPConnectionPtr				m_client_conn;
+
+	/// the connection to the upstream server
+	pion::net::TCPConnectionPtr				m_upstream_conn;
+
+	/// reads the headers of the upstream response
+	pion::net::HTTPResponseReaderPtr		m_reader;
+
+	/// the upstream response (headers only)
+	pion::net::HTTPResponsePtr				m_response;
+
+	/// buffers used to write the response headers to the client
+	pion::net::HTTPMessage::WriteBuffers	m_write_buffers;
+
+	/// finds the end of chunked payload content
+	ChunkScanner							m_chunk_scanner;
+
+	/// how the end of the response's payload content is determined
+	BodyType								m_body_type;
+
+	/// payload content bytes remaining for BODY_LENGTH responses
+	std::size_t								m_bytes_remaining;
+
+	/// maximum number of seconds to wait for the upstream server
+	const boost::uint32_t					m_timeout;
+
+	/// true if the upstream connection was re-used from the idle pool
+	bool									m_reused_conn;
+
+	/// true if the request has already been retried
+	bool									m_retried;
+
+	/// true if the response headers have been sent to the client
+	bool									m_headers_sent;
+
+	/// true if all of the response has been received
+	bool									m_body_finished;
+
+	/// true if the upstream connection may be re-used afterwards
+	bool									m_upstream_reusable;
+};
+
+/// data type for a pointer to a ProxyRelay
+typedef boost::shared_ptr<ProxyRelay>		ProxyRelayPtr;
+
+
+///
+/// ProxyService: web service that forwards requests to upstream servers
+///               over pooled keep-alive connections
+///
+class ProxyService :
+	public pion::net::WebService
+{
+public:
+
+	/// exception thrown if an upstream server cannot be resolved
+	class UpstreamNotFoundException : public PionException {
+	public:
+		UpstreamNotFoundException(const std::string& upstream)
+			: PionException("ProxyService unable to resolve upstream server: ", upstream) {}
+	};
+
+	/// exception thrown if an option has an invalid value
+	class InvalidOptionValueException : public PionException {
+	public:
+		InvalidOptionValueException(const std::string& option, const std::string& value)
+			: PionException("ProxyService invalid value for " + option + " option: ", value) {}
+	};
+
+	/// default constructor
+	ProxyService(void);
+
+	/// virtual destructor
+	virtual ~ProxyService() {}
+
+	/**
+	 * configuration options supported by ProxyService:
+	 *
+	 * upstream: "host:port" of a server that requests are forwarded to;
+	 *           may be given more than once
+	 * balance: how servers are chosen: "round-robin" (default) or
+	 *          "least-connections"
+	 * max_idle: maximum number of idle connections kept for each server
+	 * idle_timeout: number of seconds after which idle connections are
+	 *               closed (0 = never)
+	 * timeout: maximum number of seconds to wait for a server
+	 *
+	 * @param name the name of the option to change
+	 * @param value the value of the option
+	 */
+	virtual void setOption(const std::string& name, const std::string& value);
+
+	/// forwards a request to an upstream server
+	virtual void operator()(pion::net::HTTPRequestPtr& request,
+							pion::net::TCPConnectionPtr& tcp_conn);
+
+	/// closes idle upstream connections when the server is stopping
+	virtual void stop(void);
+
+	/// returns the number of upstream servers
+	inline std::size_t getUpstreamCount(void) const { return m_upstreams.size(); }
+
+	/// returns an upstream server
+	inline ProxyUpstreamPtr getUpstream(std::size_t n) const { return m_upstreams[n]; }
+
+	/// sets the logger to be used
+	inline void setLogger(PionLogger log_ptr) { m_logger = log_ptr; }
+
+	/// returns the logger currently in use
+	inline PionLogger getLogger(void) { return m_logger; }
+
+	/// removes hop-by-hop headers, which apply only to a single connection
+	static void removeHopByHopHeaders(pion::net::HTTPMessage& http_msg);
+
+
+protected:
+
+	/// chooses an upstream server for a new request
+	ProxyUpstreamPtr selectUpstream(void);
+
+
+private:
+
+	/// default maximum number of idle connections kept for each server
+	static const std::size_t				DEFAULT_MAX_IDLE;
+
+	/// default maximum number of seconds to wait for a server
+	static const boost::uint32_t			DEFAULT_TIMEOUT;
+
+	/// default number of seconds after which idle connections are closed
+	static const boost::uint32_t			DEFAULT_IDLE_TIMEOUT;
+
+
+	/// primary logging interface used by this class
+	PionLogger								m_logger;
+
+	/// the servers that requests are forwarded to
+	std::vector<ProxyUpstreamPtr>			m_upstreams;
+
+	/// true if the server with the fewest active requests is chosen
+	bool									m_least_connections;
+
+	/// the next server chosen by round-robin balancing
+	std::size_t								m_next_upstream;
+
+	/// maximum number of idle connections kept for each server
+	std::size_t								m_max_idle;
+
+	/// maximum number of seconds to wait for a server
+	boost::uint32_t							m_timeout;
+
+	/// number of seconds after which idle connections are closed
+	boost::uint32_t							m_idle_timeout;
+
+	/// mutex used to choose upstream servers
+	boost::mutex							m_mutex;
+};
+
+
+}	// end namespace plugins
+}	// end namespace pion
+
+#endif
@@ -20,20 +20,55 @@ namespace net {		// begin namespace net (Pion Network Library)
 
 void HTTPAuth::addRestrict(const std::string& resource)
 {
-	boost::mutex::scoped_lock resource_lock(m_resource_mutex);
 	const std::string clean_resource(HTTPServer::stripTrailingSlash(resource));
-	m_restrict_list.insert(clean_resource);
+	{
+		boost::mutex::scoped_lock resource_lock(m_resource_mutex);
+		m_restrict_list.insert(clean_resource);
+	}
+	notifyUpdate();
 	PION_LOG_INFO(m_logger, "Set authentication restrictions for HTTP resource: " << clean_resource);
 }
 
 void HTTPAuth::addPermit(const std::string& resource)
 {
-	boost::mutex::scoped_lock resource_lock(m_resource_mutex);
 	const std::string clean_resource(HTTPServer::stripTrailingSlash(resource));
-	m_white_list.insert(clean_resource);
+	{
+		boost::mutex::scoped_lock resource_lock(m_resource_mutex);
+		m_white_list.insert(clean_resource);
+	}
+	notifyUpdate();
 	PION_LOG_INFO(m_logger, "Set authentication permission for HTTP resource: " << clean_resource);
 }
 
+void HTTPAuth::getRules(AuthResourceSet& restrict_list, AuthResourceSet& white_list) const
+{
+	boost::mutex::scoped_lock resource_lock(m_resource_mutex);
+	restrict_list = m_restrict_list;
+	white_list = m_white_list;
+}
+
+void HTTPAuth::setUpdateHandler(const void *owner, const UpdateHandler& h)
+{
+	// waits for any handlers that are being called to return
+	boost::mutex::scoped_lock update_lock(m_update_mutex);
+	if (h)
+		m_update_handlers[owner] = h;
+	else
+		m_update_handlers.erase(owner);
+}
+
+void HTTPAuth::notifyUpdate(void)
+{
+	// the handlers are called without the rules' lock, since they will want
+	// the rules, but with the update lock, so that none are removed meanwhile
+	boost::mutex::scoped_lock update_lock(m_update_mutex);
+	for (UpdateHandlerMap::const_iterator i = m_update_handlers.begin();
+		 i != m_update_handlers.end(); ++i)
+	{
+		i->second();
+	}
+}
+
 bool HTTPAuth::needAuthentication(const HTTPRequestPtr& http_request) const
 {
 	// if no users are defined, authentication is never required
@@ -63,7 +98,7 @@ bool HTTPAuth::needAuthentication(const HTTPRequestPtr& http_request) const
 }
 
 bool HTTPAuth::findResource(const AuthResourceSet& resource_set,
-							const std::string& resource) const
+							const std::string& resource)
 {
 	AuthResourceSet::const_iterator i = resource_set.upper_bound(resource);
 	while (i != resource_set.begin()) {
@@ -7,7 +7,15 @@
 // See http://www.boost.org/LICENSE_1_0.txt
 //
 
+#include <list>
+#include <map>
 #include <boost/algorithm/string.hpp>
+#include <boost/asio.hpp>
+#include <boost/atomic.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <pion/PionAlgorithms.hpp>
 #include <pion/net/HTTPBasicAuth.hpp>
 #include <pion/net/HTTPResponseWriter.hpp>
@@ -20,54 +28,405 @@ namespace net {		// begin namespace net (Pion Network Library)
 	
 // static members of HTTPBasicAuth
 
-const unsigned int	HTTPBasicAuth::CACHE_EXPIRATION = 300;	// 5 minutes
+const unsigned int	HTTPBasicAuth::DEFAULT_CACHE_EXPIRATION = 300;	// 5 minutes
+const std::size_t	HTTPBasicAuth::DEFAULT_CACHE_SIZE = 10000;
+
+
+///
+/// HTTPBasicAuth::UserCache: maps authentication credentials to PionUser objects
+///
+/// The credentials are spread over shards that each have their own lock and
+/// keep their entries in least recently used order, so that requests seldom
+/// contend, a full shard evicts its oldest entry, and the expiry timer only
+/// has to look at the entries that have actually expired.
+///
+class HTTPBasicAuth::UserCache
+	: public boost::enable_shared_from_this<HTTPBasicAuth::UserCache>
+{
+private:
+
+	/// number of separately locked shards
+	enum { NUM_SHARDS = 16 };
+
+	/// a cached user, with the time it was last used
+	struct Entry {
+		Entry(const std::string& credentials, const PionDateTime& last_used,
+			  const PionUserPtr& user)
+			: m_credentials(credentials), m_last_used(last_used), m_user(user)
+		{}
+		std::string			m_credentials;
+		PionDateTime		m_last_used;
+		PionUserPtr			m_user;
+	};
+
+	/// data type for entries ordered by when they were last used (most recent first)
+	typedef std::list<Entry>								EntryList;
+
+	/// data type used to index the entries by their credentials
+	typedef std::map<std::string, EntryList::iterator>		EntryIndex;
+
+public:
+
+	/// a separately locked part of the cache
+	struct Shard {
+		Shard(void)
+			: m_hits(0), m_misses(0), m_evictions(0), m_expirations(0)
+		{}
+		EntryList			m_entries;
+		EntryIndex			m_index;
+		unsigned long		m_hits;
+		unsigned long		m_misses;
+		unsigned long		m_evictions;
+		unsigned long		m_expirations;
+		mutable boost::mutex	m_mutex;
+	};
+
+
+	/// constructs a new cache
+	UserCache(std::size_t max_size, unsigned int expiration)
+		: m_max_size(0), m_num_entries(0), m_expiration(expiration),
+		m_timer_active(false), m_timer_generation(0), m_stopped(false)
+	{
+		setMaxSize(max_size);
+	}
+
+	/**
+	 * finds the user for a set of credentials and marks them as recently used
+	 *
+	 * @param credentials the (encoded) credentials to look for
+	 * @param now the current time
+	 * @param user set to the user, if the credentials are found
+	 *
+	 * @return true if the credentials were found and have not expired
+	 */
+	bool find(const std::string& credentials, const PionDateTime& now, PionUserPtr& user);
+
+	/**
+	 * adds a user to the cache, and starts the expiry timer if it is not running
+	 *
+	 * @param credentials the (encoded) credentials of the user
+	 * @param now the current time
+	 * @param user the user that the credentials belong to
+	 * @param io_service used for the expiry timer
+	 */
+	void insert(const std::string& credentials, const PionDateTime& now,
+				const PionUserPtr& user, boost::asio::io_service& io_service);
+
+	/// removes the entries that have not been used since before a point in time
+	void expire(const PionDateTime& oldest);
+
+	/// sets the maximum number of entries (in all of the shards)
+	void setMaxSize(std::size_t max_size);
+
+	/// sets the number of seconds after which unused entries expire (a timer
+	/// that is already waiting uses the new interval after it next expires)
+	inline void setExpiration(unsigned int expiration) {
+		m_expiration.store(expiration, boost::memory_order_relaxed);
+	}
+
+	/// cancels the expiry timer, which the next insert starts again (with
+	/// its own io_service)
+	void cancel(void);
+
+	/// stops the expiry timer
+	void stop(void);
+
+	/// returns the sum of a counter over all the shards
+	unsigned long sum(unsigned long Shard::* counter) const;
+
+	/// returns the number of entries in the cache
+	std::size_t size(void) const;
+
+
+private:
+
+	/// returns the shard that a set of credentials belongs to
+	inline Shard& getShard(const std::string& credentials) {
+		return m_shards[boost::hash_value(credentials) % NUM_SHARDS];
+	}
+
+	/// returns the number of seconds after which unused entries expire
+	inline unsigned int getExpiration(void) const {
+		return m_expiration.load(boost::memory_order_relaxed);
+	}
+
+	/// removes the least recently used entry of a shard (its mutex must be locked)
+	void removeOldest(Shard& shard);
+
+	/// starts the expiry timer waiting for the next interval
+	void waitForTimer(void);
+
+	/// cancels and releases the expiry timer (m_timer_mutex must be locked)
+	void releaseTimer(void);
+
+	/**
+	 * expires old entries and waits for the next interval, if any are left
+	 *
+	 * @param generation the value of m_timer_generation when the wait began
+	 * @param ec the error code of the wait
+	 */
+	void handleTimer(unsigned long generation, const boost::system::error_code& ec);
+
+
+	/// the shards of the cache
+	Shard							m_shards[NUM_SHARDS];
+
+	/// maximum number of entries
+	boost::atomic<std::size_t>		m_max_size;
+
+	/// number of entries in all of the shards, including those being added
+	boost::atomic<std::size_t>		m_num_entries;
+
+	/// number of seconds after which unused entries expire
+	boost::atomic<unsigned int>		m_expiration;
+
+	/// timer used to expire old entries (created by the first insert after it
+	/// has been released)
+	boost::scoped_ptr<boost::asio::deadline_timer>	m_timer;
+
+	/// true while the expiry timer is waiting
+	bool							m_timer_active;
+
+	/// incremented whenever the timer is released, so that a handler of an
+	/// earlier wait does not change the state of the current one
+	unsigned long					m_timer_generation;
+
+	/// true after the cache has been stopped
+	bool							m_stopped;
+
+	/// mutex used to protect the expiry timer
+	boost::mutex					m_timer_mutex;
+};
+
+
+// HTTPBasicAuth::UserCache member functions
+
+bool HTTPBasicAuth::UserCache::find(const std::string& credentials,
+									const PionDateTime& now, PionUserPtr& user)
+{
+	Shard& shard(getShard(credentials));
+	boost::mutex::scoped_lock shard_lock(shard.m_mutex);
+	EntryIndex::iterator index_itr = shard.m_index.find(credentials);
+	if (index_itr == shard.m_index.end()) {
+		++shard.m_misses;
+		return false;
+	}
+	EntryList::iterator entry_itr = index_itr->second;
+	if (now > entry_itr->m_last_used + boost::posix_time::seconds(getExpiration())) {
+		// expired, but the timer has not removed it yet
+		shard.m_entries.erase(entry_itr);
+		shard.m_index.erase(index_itr);
+		m_num_entries.fetch_sub(1, boost::memory_order_relaxed);
+		++shard.m_expirations;
+		++shard.m_misses;
+		return false;
+	}
+	entry_itr->m_last_used = now;
+	shard.m_entries.splice(shard.m_entries.begin(), shard.m_entries, entry_itr);
+	user = entry_itr->m_user;
+	++shard.m_hits;
+	return true;
+}
+
+void HTTPBasicAuth::UserCache::insert(const std::string& credentials, const PionDateTime& now,
+									  const PionUserPtr& user, boost::asio::io_service& io_service)
+{
+	Shard& shard(getShard(credentials));
+	{
+		boost::mutex::scoped_lock shard_lock(shard.m_mutex);
+		const std::size_t max_size = m_max_size.load(boost::memory_order_relaxed);
+		if (max_size == 0)
+			return;
+		EntryIndex::iterator index_itr = shard.m_index.find(credentials);
+		if (index_itr != shard.m_index.end()) {
+			// another request has cached the same credentials
+			shard.m_entries.erase(index_itr->second);
+			shard.m_index.erase(index_itr);
+		} else if (m_num_entries.fetch_add(1, boost::memory_order_relaxed) >= max_size) {
+			// the cache is full: the entry takes the place of the least
+			// recently used entry of its shard, or it is not cached
+			if (shard.m_entries.empty()) {
+				m_num_entries.fetch_sub(1, boost::memory_order_relaxed);
+				return;
+			}
+			removeOldest(shard);
+			++shard.m_evictions;
+		}
+		shard.m_entries.push_front(Entry(credentials, now, user));
+		shard.m_index.insert(std::make_pair(credentials, shard.m_entries.begin()));
+	}
+
+	boost::mutex::scoped_lock timer_lock(m_timer_mutex);
+	if (m_timer_active || m_stopped)
+		return;
+	if (! m_timer)
+		m_timer.reset(new boost::asio::deadline_timer(io_service));
+	m_timer_active = true;
+	waitForTimer();
+}
+
+void HTTPBasicAuth::UserCache::expire(const PionDateTime& oldest)
+{
+	for (std::size_t n = 0; n < NUM_SHARDS; ++n) {
+		Shard& shard(m_shards[n]);
+		boost::mutex::scoped_lock shard_lock(shard.m_mutex);
+		while (! shard.m_entries.empty() && shard.m_entries.back().m_last_used < oldest) {
+			removeOldest(shard);
+			++shard.m_expirations;
+		}
+	}
+}
+
+void HTTPBasicAuth::UserCache::setMaxSize(std::size_t max_size)
+{
+	// the total is enforced (rather than a size for each shard), so that
+	// small caches are not rounded up to one entry per shard
+	m_max_size.store(max_size, boost::memory_order_relaxed);
+	bool removed = true;
+	while (removed && m_num_entries.load(boost::memory_order_relaxed) > max_size) {
+		// remove the least recently used entry of each shard in turn
+		removed = false;
+		for (std::size_t n = 0; n < NUM_SHARDS
+			 && m_num_entries.load(boost::memory_order_relaxed) > max_size; ++n)
+		{
+			Shard& shard(m_shards[n]);
+			boost::mutex::scoped_lock shard_lock(shard.m_mutex);
+			if (! shard.m_entries.empty()) {
+				removeOldest(shard);
+				++shard.m_evictions;
+				removed = true;
+			}
+		}
+	}
+}
+
+void HTTPBasicAuth::UserCache::removeOldest(Shard& shard)
+{
+	shard.m_index.erase(shard.m_entries.back().m_credentials);
+	shard.m_entries.pop_back();
+	m_num_entries.fetch_sub(1, boost::memory_order_relaxed);
+}
+
+void HTTPBasicAuth::UserCache::cancel(void)
+{
+	boost::mutex::scoped_lock timer_lock(m_timer_mutex);
+	releaseTimer();
+}
+
+void HTTPBasicAuth::UserCache::stop(void)
+{
+	boost::mutex::scoped_lock timer_lock(m_timer_mutex);
+	m_stopped = true;
+	releaseTimer();
+}
+
+void HTTPBasicAuth::UserCache::releaseTimer(void)
+{
+	// the handler of a pending wait receives operation_aborted, but it may
+	// never run if the io_service stops first, so the flag is cleared here
+	++m_timer_generation;
+	m_timer_active = false;
+	if (m_timer) {
+		m_timer->cancel();
+		m_timer.reset();
+	}
+}
+
+unsigned long HTTPBasicAuth::UserCache::sum(unsigned long Shard::* counter) const
+{
+	unsigned long total = 0;
+	for (std::size_t n = 0; n < NUM_SHARDS; ++n) {
+		boost::mutex::scoped_lock shard_lock(m_shards[n].m_mutex);
+		total += m_shards[n].*counter;
+	}
+	return total;
+}
+
+std::size_t HTTPBasicAuth::UserCache::size(void) const
+{
+	std::size_t total = 0;
+	for (std::size_t n = 0; n < NUM_SHARDS; ++n) {
+		boost::mutex::scoped_lock shard_lock(m_shards[n].m_mutex);
+		total += m_shards[n].m_entries.size();
+	}
+	return total;
+}
+
+void HTTPBasicAuth::UserCache::waitForTimer(void)
+{
+	// entries are removed within a tenth of the expiration time of expiring
+	const unsigned int interval = getExpiration() / 10;
+	m_timer->expires_from_now(boost::posix_time::seconds(interval > 0 ? interval : 1));
+	m_timer->async_wait(boost::bind(&UserCache::handleTimer, shared_from_this(),
+									m_timer_generation, boost::asio::placeholders::error));
+}
+
+void HTTPBasicAuth::UserCache::handleTimer(unsigned long generation,
+											const boost::system::error_code& ec)
+{
+	if (ec == boost::asio::error::operation_aborted) {
+		// the next insert starts the timer again
+		boost::mutex::scoped_lock timer_lock(m_timer_mutex);
+		if (generation == m_timer_generation)
+			m_timer_active = false;
+		return;
+	}
+
+	const PionDateTime time_now(boost::posix_time::second_clock::universal_time());
+	expire(time_now - boost::posix_time::seconds(getExpiration()));
+
+	// keep waiting only while there is something left to expire
+	boost::mutex::scoped_lock timer_lock(m_timer_mutex);
+	if (generation != m_timer_generation)
+		return;		// the timer was released, and may have been started again
+	if (m_stopped || size() == 0) {
+		m_timer_active = false;
+		return;
+	}
+	waitForTimer();
+}
 
 
 // HTTPBasicAuth member functions
 
 HTTPBasicAuth::HTTPBasicAuth(PionUserManagerPtr userManager, const std::string& realm)
 	: HTTPAuth(userManager), m_realm(realm),
-	m_cache_cleanup_time(boost::posix_time::second_clock::universal_time())
+	m_user_cache(new UserCache(DEFAULT_CACHE_SIZE, DEFAULT_CACHE_EXPIRATION))
 {
 	setLogger(PION_GET_LOGGER("pion.net.HTTPBasicAuth"));
 }
+
+HTTPBasicAuth::~HTTPBasicAuth()
+{
+	// the cache lives on until its timer's handler has been cancelled
+	m_user_cache->stop();
+}
+
+void HTTPBasicAuth::cancelTimers(void)
+{
+	m_user_cache->cancel();
+}
 	
-bool HTTPBasicAuth::handleRequest(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn)
+bool HTTPBasicAuth::handleRequest(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn,
+									bool restricted)
 {
-	if (!needAuthentication(request)) {
+	if (!needAuthentication(restricted)) {
 		return true; // this request does not require authentication
 	}
 	
+	// old entries are removed from the cache by its own timer
 	PionDateTime time_now(boost::posix_time::second_clock::universal_time());
-	if (time_now > m_cache_cleanup_time + boost::posix_time::seconds(CACHE_EXPIRATION)) {
-		// expire cache
-		boost::mutex::scoped_lock cache_lock(m_cache_mutex);
-		PionUserCache::iterator i;
-		PionUserCache::iterator next=m_user_cache.begin();
-		while (next!=m_user_cache.end()) {
-			i=next;
-			++next;
-			if (time_now > i->second.first + boost::posix_time::seconds(CACHE_EXPIRATION)) {
-				// ok - this is an old record.. expire it now
-				m_user_cache.erase(i);
-			}
-		}
-		m_cache_cleanup_time = time_now;
-	}
 	
 	// if we are here, we need to check if access authorized...
 	std::string authorization = request->getHeader(HTTPTypes::HEADER_AUTHORIZATION);
 	if (!authorization.empty()) {
 		std::string credentials;
 		if (parseAuthorization(authorization, credentials)) {
-			// to do - use fast cache to match with active credentials
-			boost::mutex::scoped_lock cache_lock(m_cache_mutex);
-			PionUserCache::iterator user_cache_ptr=m_user_cache.find(credentials);
-			if (user_cache_ptr!=m_user_cache.end()) {
+			PionUserPtr user;
+			if (m_user_cache->find(credentials, time_now, user)) {
 				// we found the credentials in our cache...
 				// we can approve authorization now!
-				request->setUser(user_cache_ptr->second.second);
-				user_cache_ptr->second.first = time_now;
+				request->setUser(user);
 				return true;
 			}
 	
@@ -76,10 +435,10 @@ bool HTTPBasicAuth::handleRequest(HTTPRequestPtr& request, TCPConnectionPtr& tcp
 	
 			if (parseCredentials(credentials, username, password)) {
 				// match username/password
-				PionUserPtr user=m_user_manager->getUser(username, password);
+				user=m_user_manager->getUser(username, password);
 				if (user) {
 					// add user to the cache
-					m_user_cache.insert(std::make_pair(credentials, std::make_pair(time_now, user)));
+					m_user_cache->insert(credentials, time_now, user, tcp_conn->getIOService());
 					// add user credentials to the request object
 					request->setUser(user);
 					return true;
@@ -97,9 +456,52 @@ void HTTPBasicAuth::setOption(const std::string& name, const std::string& value)
 {
 	if (name=="realm")
 		m_realm = value;
-	else
+	else if (name=="cache_size") {
+		std::size_t cache_size;
+		try {
+			cache_size = boost::lexical_cast<std::size_t>(value);
+		} catch (boost::bad_lexical_cast&) {
+			throw InvalidOptionValueException(name, value);
+		}
+		m_user_cache->setMaxSize(cache_size);
+	} else if (name=="cache_expiration") {
+		unsigned int cache_expiration;
+		try {
+			cache_expiration = boost::lexical_cast<unsigned int>(value);
+		} catch (boost::bad_lexical_cast&) {
+			throw InvalidOptionValueException(name, value);
+		}
+		if (cache_expiration == 0)
+			throw InvalidOptionValueException(name, value);
+		m_user_cache->setExpiration(cache_expiration);
+	} else
 		throw UnknownOptionException(name);
 }
+
+unsigned long HTTPBasicAuth::getCacheHits(void) const
+{
+	return m_user_cache->sum(&UserCache::Shard::m_hits);
+}
+
+unsigned long HTTPBasicAuth::getCacheMisses(void) const
+{
+	return m_user_cache->sum(&UserCache::Shard::m_misses);
+}
+
+unsigned long HTTPBasicAuth::getCacheEvictions(void) const
+{
+	return m_user_cache->sum(&UserCache::Shard::m_evictions);
+}
+
+unsigned long HTTPBasicAuth::getCacheExpirations(void) const
+{
+	return m_user_cache->sum(&UserCache::Shard::m_expirations);
+}
+
+std::size_t HTTPBasicAuth::getCacheSize(void) const
+{
+	return m_user_cache->size();
+}
 	
 bool HTTPBasicAuth::parseAuthorization(const std::string& authorization, std::string &credentials)
 {
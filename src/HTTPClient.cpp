@@ -0,0 +1,562 @@
+// ------------------------------------------------------------------
+// pion-net: a C++ framework for building lightweight HTTP interfaces
+// ------------------------------------------------------------------
+// Copyright (C) 2007-2010 Atomic Labs, Inc.  (http://www.atomiclabs.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <pion/net/HTTPClient.hpp>
+#include <pion/net/HTTPRequestWriter.hpp>
+#include <pion/net/HTTPResponseReader.hpp>
+
+using boost::asio::ip::tcp;
+
+
+namespace pion {	// begin namespace pion
+namespace net {		// begin namespace net (Pion Network Library)
+
+
+// static members of HTTPClient
+
+const unsigned int		HTTPClient::DEFAULT_MAX_CONNECTIONS = 8;
+const boost::uint32_t	HTTPClient::DEFAULT_IDLE_TIMEOUT = 30;
+const boost::uint32_t	HTTPClient::DEFAULT_DNS_CACHE_TTL = 300;
+const boost::uint32_t	HTTPClient::DEFAULT_READ_TIMEOUT = 10;
+
+
+// HTTPClient member functions
+
+HTTPClient::HTTPClient(PionScheduler& scheduler)
+	: m_logger(PION_GET_LOGGER("pion.net.HTTPClient")),
+	m_scheduler(scheduler),
+#ifdef PION_HAVE_SSL
+	m_ssl_context(m_scheduler.getIOService(), boost::asio::ssl::context::sslv23),
+#else
+	m_ssl_context(0),
+#endif
+	m_idle_timer(m_scheduler.getIOService()), m_idle_timer_active(false),
+	m_active_user(true), m_max_connections(DEFAULT_MAX_CONNECTIONS), m_idle_timeout(DEFAULT_IDLE_TIMEOUT),
+	m_pipeline_depth(1), m_dns_cache_ttl(DEFAULT_DNS_CACHE_TTL),
+	m_read_timeout(DEFAULT_READ_TIMEOUT), m_connections_opened(0)
+{
+	// keep the scheduler's threads running until the client is closed
+	m_scheduler.addActiveUser();
+}
+
+HTTPClient::~HTTPClient()
+{
+	close();
+}
+
+void HTTPClient::sendRequest(const std::string& host, const unsigned int port,
+							 HTTPRequestPtr& request, ResponseHandler handler,
+							 const bool ssl_flag)
+{
+	// HTTP/1.1 requires a Host header
+	if (! request->hasHeader(HTTPTypes::HEADER_HOST)) {
+		if (port == (ssl_flag ? 443U : 80U))
+			request->addHeader(HTTPTypes::HEADER_HOST, host);
+		else
+			request->addHeader(HTTPTypes::HEADER_HOST, host + ':'
+							   + boost::lexical_cast<std::string>(port));
+	}
+
+	DeferredWork work;
+	{
+		boost::mutex::scoped_lock client_lock(m_mutex);
+
+		// a client that was closed keeps the scheduler running again
+		if (! m_active_user) {
+			m_scheduler.addActiveUser();
+			m_active_user = true;
+		}
+
+		std::string pool_key(host + ':' + boost::lexical_cast<std::string>(port));
+		if (ssl_flag)
+			pool_key += ":ssl";
+		PoolMap::iterator pool_itr = m_pools.find(pool_key);
+		if (pool_itr == m_pools.end()) {
+			pool_itr = m_pools.insert(std::make_pair(pool_key,
+				boost::shared_ptr<HostPool>(new HostPool(host, port, ssl_flag)))).first;
+		}
+
+		dispatchRequest(*pool_itr->second, PendingRequest(request, handler), work);
+	}
+	runDeferredWork(work);
+}
+
+void HTTPClient::close(void)
+{
+	DeferredWork work;
+	{
+		boost::mutex::scoped_lock client_lock(m_mutex);
+
+		if (m_idle_timer_active)
+			m_idle_timer.cancel();
+
+		const boost::system::error_code aborted(boost::asio::error::operation_aborted);
+		for (PoolMap::iterator pool_itr = m_pools.begin(); pool_itr != m_pools.end(); ++pool_itr) {
+			HostPool& pool(*pool_itr->second);
+
+			// fail waiting requests first so that they are not assigned to connections
+			RequestQueue waiting;
+			waiting.swap(pool.m_waiting);
+			for (RequestQueue::iterator i = waiting.begin(); i != waiting.end(); ++i)
+				work.m_errors.push_back(std::make_pair(*i, aborted));
+
+			std::vector<ClientConnectionPtr> connections(pool.m_idle.begin(), pool.m_idle.end());
+			connections.insert(connections.end(), pool.m_busy.begin(), pool.m_busy.end());
+			for (std::vector<ClientConnectionPtr>::iterator i = connections.begin();
+				 i != connections.end(); ++i)
+			{
+				closeConnection(*i, aborted, false, work);
+			}
+		}
+		m_pools.clear();
+
+		// pending resolutions are cancelled when their resolvers are destroyed
+		m_dns_cache.clear();
+
+		if (m_active_user) {
+			m_scheduler.removeActiveUser();
+			m_active_user = false;
+		}
+	}
+	runDeferredWork(work);
+}
+
+std::size_t HTTPClient::getConnectionCount(void)
+{
+	boost::mutex::scoped_lock client_lock(m_mutex);
+	std::size_t count = 0;
+	for (PoolMap::const_iterator i = m_pools.begin(); i != m_pools.end(); ++i)
+		count += i->second->m_idle.size() + i->second->m_busy.size();
+	return count;
+}
+
+unsigned long HTTPClient::getConnectionsOpened(void)
+{
+	boost::mutex::scoped_lock client_lock(m_mutex);
+	return m_connections_opened;
+}
+
+std::size_t HTTPClient::getIdleConnectionCount(void)
+{
+	boost::mutex::scoped_lock client_lock(m_mutex);
+	std::size_t count = 0;
+	for (PoolMap::const_iterator i = m_pools.begin(); i != m_pools.end(); ++i)
+		count += i->second->m_idle.size();
+	return count;
+}
+
+void HTTPClient::runDeferredWork(DeferredWork& work)
+{
+	for (std::vector<std::pair<PendingRequest, HTTPResponsePtr> >::iterator i = work.m_responses.begin();
+		 i != work.m_responses.end(); ++i)
+	{
+		i->first.m_handler(i->second, boost::system::error_code());
+	}
+	for (std::vector<std::pair<PendingRequest, boost::system::error_code> >::iterator i = work.m_errors.begin();
+		 i != work.m_errors.end(); ++i)
+	{
+		i->first.m_handler(HTTPResponsePtr(), i->second);
+	}
+
+	// operations start after the handlers have been called, so that responses
+	// to pipelined requests are delivered in order
+	for (std::vector<boost::function0<void> >::iterator i = work.m_operations.begin();
+		 i != work.m_operations.end(); ++i)
+	{
+		(*i)();
+	}
+}
+
+void HTTPClient::dispatchRequest(HostPool& pool, const PendingRequest& request, DeferredWork& work)
+{
+	if (! pool.m_idle.empty()) {
+		// re-use the most recently used connection, which is least likely
+		// to have been closed by the server
+		ClientConnectionPtr conn(pool.m_idle.front());
+		pool.m_idle.pop_front();
+		pool.m_busy.insert(conn);
+		conn->m_requests.push_back(request);
+		fillPipeline(pool, *conn);
+		PION_LOG_DEBUG(m_logger, "Re-using connection to " << pool.m_host << ':' << pool.m_port);
+		writeNext(conn, work);
+	} else if (pool.m_busy.size() < m_max_connections) {
+		openConnection(pool, request, work);
+	} else {
+		pool.m_waiting.push_back(request);
+	}
+}
+
+void HTTPClient::dispatchWaitingRequests(HostPool& pool, DeferredWork& work)
+{
+	while (! pool.m_waiting.empty()
+		   && (! pool.m_idle.empty() || pool.m_busy.size() < m_max_connections))
+	{
+		PendingRequest request(pool.m_waiting.front());
+		pool.m_waiting.pop_front();
+		dispatchRequest(pool, request, work);
+	}
+}
+
+void HTTPClient::fillPipeline(HostPool& pool, ClientConnection& conn)
+{
+	while (conn.m_requests.size() < m_pipeline_depth && ! pool.m_waiting.empty()
+		   && conn.m_requests.back().m_request->isIdempotent()
+		   && pool.m_waiting.front().m_request->isIdempotent())
+	{
+		conn.m_requests.push_back(pool.m_waiting.front());
+		pool.m_waiting.pop_front();
+	}
+}
+
+void HTTPClient::openConnection(HostPool& pool, const PendingRequest& request, DeferredWork& work)
+{
+	TCPConnectionPtr tcp_conn(TCPConnection::create(m_scheduler.getIOService(), m_ssl_context,
+													pool.m_ssl_flag, TCPConnection::ConnectionHandler()));
+	ClientConnectionPtr conn(new ClientConnection(pool, tcp_conn));
+	pool.m_busy.insert(conn);
+	conn->m_requests.push_back(request);
+	++m_connections_opened;
+	PION_LOG_DEBUG(m_logger, "Opening connection to " << pool.m_host << ':' << pool.m_port);
+	resolveHost(conn, work);
+}
+
+void HTTPClient::resolveHost(ClientConnectionPtr& conn, DeferredWork& work)
+{
+	const std::string& host = conn->m_pool.m_host;
+	DNSCacheEntry& entry = m_dns_cache[host];
+
+	if (! entry.m_addresses.empty()
+		&& entry.m_expires > boost::posix_time::microsec_clock::universal_time())
+	{
+		conn->m_addresses = entry.m_addresses;
+		connectNext(conn, work);
+		return;
+	}
+
+	// connections opened while the host is being resolved share the result
+	entry.m_waiting.push_back(conn);
+	if (entry.m_resolver)
+		return;
+
+	entry.m_resolver.reset(new tcp::resolver(m_scheduler.getIOService()));
+	tcp::resolver::query query(host, boost::lexical_cast<std::string>(conn->m_pool.m_port));
+	entry.m_resolver->async_resolve(query,
+									boost::bind(&HTTPClient::handleResolve, shared_from_this(),
+												host, boost::asio::placeholders::error,
+												boost::asio::placeholders::iterator));
+}
+
+void HTTPClient::connectNext(ClientConnectionPtr& conn, DeferredWork& work)
+{
+	if (conn->m_next_address >= conn->m_addresses.size()) {
+		closeConnection(conn, boost::asio::error::host_not_found, false, work);
+		return;
+	}
+	tcp::endpoint remote_endpoint(conn->m_addresses[conn->m_next_address++], conn->m_pool.m_port);
+	conn->m_tcp_conn->async_connect(remote_endpoint,
+									boost::bind(&HTTPClient::handleConnect, shared_from_this(),
+												conn, boost::asio::placeholders::error));
+}
+
+void HTTPClient::writeNext(ClientConnectionPtr& conn, DeferredWork& work)
+{
+	if (! conn->m_tcp_conn->is_open()) {
+		closeConnection(conn, boost::asio::error::connection_reset, true, work);
+		return;
+	}
+
+	// ask the server to keep the connection open (reading the previous
+	// response may have changed the connection's lifecycle)
+	conn->m_tcp_conn->setLifecycle(TCPConnection::LIFECYCLE_KEEPALIVE);
+
+	PendingRequest& request = conn->m_requests[conn->m_num_written];
+	HTTPRequestWriterPtr writer(HTTPRequestWriter::create(conn->m_tcp_conn, request.m_request,
+		boost::bind(&HTTPClient::handleWrite, shared_from_this(),
+					conn, boost::asio::placeholders::error)));
+
+	// the response to the previous request may not have been delivered yet
+	work.m_operations.push_back(boost::bind(static_cast<void (HTTPWriter::*)(void)>(&HTTPWriter::send),
+											writer));
+}
+
+void HTTPClient::readNext(ClientConnectionPtr& conn, DeferredWork& work)
+{
+	HTTPResponseReaderPtr reader(HTTPResponseReader::create(conn->m_tcp_conn,
+		*conn->m_requests.front().m_request,
+		boost::bind(&HTTPClient::handleResponse, shared_from_this(), conn, _1, _3)));
+	reader->setTimeout(m_read_timeout);
+
+	// a pipelined response that has already been read finishes synchronously,
+	// so the reader must not be started until m_mutex has been released
+	work.m_operations.push_back(boost::bind(&HTTPReader::receive, reader));
+}
+
+void HTTPClient::releaseConnection(ClientConnectionPtr& conn, DeferredWork& work)
+{
+	HostPool& pool(conn->m_pool);
+	if (! pool.m_waiting.empty()) {
+		conn->m_requests.push_back(pool.m_waiting.front());
+		pool.m_waiting.pop_front();
+		fillPipeline(pool, *conn);
+		writeNext(conn, work);
+	} else if (m_idle_timeout == 0) {
+		closeConnection(conn, boost::system::error_code(), false, work);
+	} else {
+		pool.m_busy.erase(conn);
+		conn->m_idle_since = boost::posix_time::microsec_clock::universal_time();
+		pool.m_idle.push_front(conn);
+		startIdleTimer();
+	}
+}
+
+void HTTPClient::closeConnection(ClientConnectionPtr& conn, const boost::system::error_code& ec,
+								 bool retry, DeferredWork& work)
+{
+	// keep the connection alive until it has been removed from its pool
+	ClientConnectionPtr conn_ptr(conn);
+	HostPool& pool(conn_ptr->m_pool);
+	conn_ptr->m_closed = true;
+	conn_ptr->m_tcp_conn->close();
+	pool.m_busy.erase(conn_ptr);
+	pool.m_idle.remove(conn_ptr);
+
+	// an error on a re-used connection usually means that the server closed
+	// it while it was idle, and requests after the first one were never
+	// answered: these are sent again (once) if that is safe to do
+	const boost::system::error_code request_ec(ec ? ec
+		: boost::system::error_code(boost::asio::error::connection_aborted));
+	RequestQueue requests;
+	RequestQueue retries;
+	requests.swap(conn_ptr->m_requests);
+	for (RequestQueue::iterator i = requests.begin(); i != requests.end(); ++i) {
+		if (retry && ! i->m_retried && i->m_request->isIdempotent()
+			&& (conn_ptr->m_reused || i != requests.begin()))
+		{
+			i->m_retried = true;
+			retries.push_back(*i);
+		} else {
+			work.m_errors.push_back(std::make_pair(*i, request_ec));
+		}
+	}
+	if (! retries.empty()) {
+		PION_LOG_DEBUG(m_logger, "Retrying " << retries.size() << " requests to "
+					   << pool.m_host << ':' << pool.m_port);
+		pool.m_waiting.insert(pool.m_waiting.begin(), retries.begin(), retries.end());
+	}
+
+	dispatchWaitingRequests(pool, work);
+}
+
+void HTTPClient::startIdleTimer(void)
+{
+	if (m_idle_timer_active)
+		return;
+	m_idle_timer_active = true;
+	m_idle_timer.expires_from_now(boost::posix_time::seconds(m_idle_timeout));
+	m_idle_timer.async_wait(boost::bind(&HTTPClient::handleIdleTimerIfAlive,
+										boost::weak_ptr<HTTPClient>(shared_from_this()),
+										boost::asio::placeholders::error));
+}
+
+void HTTPClient::handleResolve(const std::string& host, const boost::system::error_code& ec,
+							   tcp::resolver::iterator endpoint_iterator)
+{
+	DeferredWork work;
+	{
+		boost::mutex::scoped_lock client_lock(m_mutex);
+
+		DNSCache::iterator entry_itr = m_dns_cache.find(host);
+		if (entry_itr == m_dns_cache.end())
+			return;		// the client was closed
+		DNSCacheEntry& entry = entry_itr->second;
+		entry.m_resolver.reset();
+
+		std::vector<ClientConnectionPtr> waiting;
+		waiting.swap(entry.m_waiting);
+
+		if (ec) {
+			PION_LOG_WARN(m_logger, "Unable to resolve " << host << ": " << ec.message());
+		} else {
+			entry.m_addresses.clear();
+			for (; endpoint_iterator != tcp::resolver::iterator(); ++endpoint_iterator)
+				entry.m_addresses.push_back(endpoint_iterator->endpoint().address());
+			entry.m_expires = boost::posix_time::microsec_clock::universal_time()
+				+ boost::posix_time::seconds(m_dns_cache_ttl);
+		}
+
+		for (std::vector<ClientConnectionPtr>::iterator i = waiting.begin(); i != waiting.end(); ++i) {
+			if ((*i)->m_closed)
+				continue;
+			if (ec) {
+				closeConnection(*i, ec, false, work);
+			} else {
+				(*i)->m_addresses = entry.m_addresses;
+				connectNext(*i, work);
+			}
+		}
+	}
+	runDeferredWork(work);
+}
+
+void HTTPClient::handleConnect(ClientConnectionPtr conn, const boost::system::error_code& ec)
+{
+	DeferredWork work;
+	{
+		boost::mutex::scoped_lock client_lock(m_mutex);
+		if (conn->m_closed)
+			return;
+
+		if (ec) {
+			conn->m_tcp_conn->close();
+			if (conn->m_next_address < conn->m_addresses.size()) {
+				connectNext(conn, work);
+			} else {
+				PION_LOG_WARN(m_logger, "Unable to connect to " << conn->m_pool.m_host
+							  << ':' << conn->m_pool.m_port << ": " << ec.message());
+				// the host may have moved: resolve it again for the next connection
+				DNSCache::iterator entry_itr = m_dns_cache.find(conn->m_pool.m_host);
+				if (entry_itr != m_dns_cache.end())
+					entry_itr->second.m_expires = boost::posix_time::ptime();
+				closeConnection(conn, ec, false, work);
+			}
+		} else if (conn->m_pool.m_ssl_flag) {
+			conn->m_tcp_conn->async_handshake_client(boost::bind(&HTTPClient::handleHandshake,
+																 shared_from_this(), conn,
+																 boost::asio::placeholders::error));
+		} else {
+			writeNext(conn, work);
+		}
+	}
+	runDeferredWork(work);
+}
+
+void HTTPClient::handleHandshake(ClientConnectionPtr conn, const boost::system::error_code& ec)
+{
+	DeferredWork work;
+	{
+		boost::mutex::scoped_lock client_lock(m_mutex);
+		if (conn->m_closed)
+			return;
+
+		if (ec) {
+			PION_LOG_WARN(m_logger, "SSL handshake with " << conn->m_pool.m_host
+						  << " failed: " << ec.message());
+			closeConnection(conn, ec, false, work);
+		} else {
+			writeNext(conn, work);
+		}
+	}
+	runDeferredWork(work);
+}
+
+void HTTPClient::handleWrite(ClientConnectionPtr conn, const boost::system::error_code& ec)
+{
+	DeferredWork work;
+	{
+		boost::mutex::scoped_lock client_lock(m_mutex);
+		if (conn->m_closed)
+			return;
+
+		// all of the requests assigned to a connection are written before
+		// any responses are read, so that reading and writing never overlap
+		if (ec)
+			closeConnection(conn, ec, true, work);
+		else if (++conn->m_num_written < conn->m_requests.size())
+			writeNext(conn, work);
+		else
+			readNext(conn, work);
+	}
+	runDeferredWork(work);
+}
+
+void HTTPClient::handleResponse(ClientConnectionPtr conn, HTTPResponsePtr http_response,
+								const boost::system::error_code& ec)
+{
+	DeferredWork work;
+	{
+		boost::mutex::scoped_lock client_lock(m_mutex);
+		if (conn->m_closed)
+			return;
+
+		if (ec) {
+			closeConnection(conn, ec, true, work);
+		} else {
+			work.m_responses.push_back(std::make_pair(conn->m_requests.front(), http_response));
+			conn->m_requests.pop_front();
+			--conn->m_num_written;
+			conn->m_reused = true;
+
+			if (! conn->m_tcp_conn->getKeepAlive()) {
+				// the server is closing the connection: any remaining
+				// (pipelined) requests are sent again using another one
+				closeConnection(conn, boost::system::error_code(), true, work);
+			} else if (! conn->m_requests.empty()) {
+				readNext(conn, work);
+			} else {
+				releaseConnection(conn, work);
+			}
+		}
+	}
+	runDeferredWork(work);
+}
+
+void HTTPClient::handleIdleTimer(const boost::system::error_code& ec)
+{
+	DeferredWork work;
+	{
+		boost::mutex::scoped_lock client_lock(m_mutex);
+		m_idle_timer_active = false;
+		if (ec == boost::asio::error::operation_aborted)
+			return;
+
+		// close connections that have been idle too long; the least recently
+		// used connections are at the back of each pool's idle list
+		const boost::posix_time::ptime now(boost::posix_time::microsec_clock::universal_time());
+		const boost::posix_time::time_duration timeout = boost::posix_time::seconds(m_idle_timeout);
+		boost::posix_time::ptime next_expiration;
+		for (PoolMap::iterator pool_itr = m_pools.begin(); pool_itr != m_pools.end(); ++pool_itr) {
+			HostPool& pool(*pool_itr->second);
+			while (! pool.m_idle.empty() && pool.m_idle.back()->m_idle_since + timeout <= now) {
+				ClientConnectionPtr conn(pool.m_idle.back());
+				PION_LOG_DEBUG(m_logger, "Closing idle connection to " << pool.m_host << ':' << pool.m_port);
+				closeConnection(conn, boost::system::error_code(), false, work);
+			}
+			if (! pool.m_idle.empty()) {
+				const boost::posix_time::ptime expiration(pool.m_idle.back()->m_idle_since + timeout);
+				if (next_expiration.is_not_a_date_time() || expiration < next_expiration)
+					next_expiration = expiration;
+			}
+		}
+
+		// wait for the next connection to expire
+		if (! next_expiration.is_not_a_date_time()) {
+			m_idle_timer_active = true;
+			m_idle_timer.expires_at(next_expiration);
+			m_idle_timer.async_wait(boost::bind(&HTTPClient::handleIdleTimerIfAlive,
+												boost::weak_ptr<HTTPClient>(shared_from_this()),
+												boost::asio::placeholders::error));
+		}
+	}
+	runDeferredWork(work);
+}
+
+void HTTPClient::handleIdleTimerIfAlive(boost::weak_ptr<HTTPClient> client_weak_ptr,
+										const boost::system::error_code& ec)
+{
+	HTTPClientPtr client(client_weak_ptr.lock());
+	if (client)
+		client->handleIdleTimer(ec);
+}
+
+
+}	// end namespace net
+}	// end namespace pion
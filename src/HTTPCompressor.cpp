@@ -0,0 +1,316 @@
+// ------------------------------------------------------------------
+// pion-net: a C++ framework for building lightweight HTTP interfaces
+// ------------------------------------------------------------------
+// Copyright (C) 2007-2010 Atomic Labs, Inc.  (http://www.atomiclabs.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include <cstdlib>
+#include <boost/algorithm/string.hpp>
+#include <boost/thread/tss.hpp>
+#include <pion/net/HTTPCompressor.hpp>
+#ifdef PION_HAVE_ZLIB
+	#include <zlib.h>
+#endif
+
+
+namespace pion {	// begin namespace pion
+namespace net {		// begin namespace net (Pion Network Library)
+
+
+// static members of HTTPCompressor
+
+const int				HTTPCompressor::DEFAULT_LEVEL = 6;
+const std::size_t		HTTPCompressor::DEFAULT_MIN_SIZE = 256;
+
+
+#ifdef PION_HAVE_ZLIB
+
+///
+/// PooledStream: a zlib stream that may be re-used by other compressors
+///
+struct PooledStream {
+	z_stream		m_zstream;
+	int				m_level;
+};
+
+///
+/// StreamPool: zlib streams that are not being used by the current thread;
+///             re-using them avoids re-initializing zlib for each response
+///
+class StreamPool {
+public:
+	/// maximum number of streams kept for each content-coding
+	enum { MAX_STREAMS = 8 };
+
+	~StreamPool() {
+		for (int n = 0; n < 2; ++n) {
+			for (std::vector<PooledStream*>::iterator i = m_streams[n].begin();
+				 i != m_streams[n].end(); ++i)
+			{
+				deflateEnd(&(*i)->m_zstream);
+				delete *i;
+			}
+		}
+	}
+
+	/// returns a reset stream for the content-coding, or NULL if none are pooled
+	inline PooledStream *acquire(bool gzip) {
+		std::vector<PooledStream*>& streams = m_streams[gzip ? 1 : 0];
+		if (streams.empty())
+			return NULL;
+		PooledStream *stream_ptr = streams.back();
+		streams.pop_back();
+		return stream_ptr;
+	}
+
+	/// resets a stream and adds it to the pool; returns false if the pool is full
+	inline bool release(bool gzip, PooledStream *stream_ptr) {
+		std::vector<PooledStream*>& streams = m_streams[gzip ? 1 : 0];
+		if (streams.size() >= MAX_STREAMS || deflateReset(&stream_ptr->m_zstream) != Z_OK)
+			return false;
+		streams.push_back(stream_ptr);
+		return true;
+	}
+
+private:
+	/// idle streams for the deflate (0) and gzip (1) content-codings
+	std::vector<PooledStream*>	m_streams[2];
+};
+
+/// the zlib streams that are pooled for each thread
+static boost::thread_specific_ptr<StreamPool>	g_stream_pool;
+
+#endif
+
+/// names used for each content-coding in Content-Encoding headers
+static const std::string						g_gzip_name("gzip");
+static const std::string						g_deflate_name("deflate");
+static const std::string						g_identity_name("identity");
+
+/// shared options that use the default settings
+static const HTTPCompressor::OptionsPtr			g_default_options(new HTTPCompressor::Options());
+
+
+// HTTPCompressor::Options member functions
+
+HTTPCompressor::Options::Options(void)
+	: m_level(DEFAULT_LEVEL), m_min_size(DEFAULT_MIN_SIZE)
+{
+	m_mime_types.push_back("text/");
+	m_mime_types.push_back("application/json");
+	m_mime_types.push_back("application/javascript");
+	m_mime_types.push_back("application/x-javascript");
+	m_mime_types.push_back("application/xml");
+	m_mime_types.push_back("application/xhtml+xml");
+	m_mime_types.push_back("application/rss+xml");
+	m_mime_types.push_back("application/atom+xml");
+	m_mime_types.push_back("image/svg+xml");
+}
+
+bool HTTPCompressor::Options::isCompressible(const std::string& content_type) const
+{
+	// strip parameters such as "; charset=utf-8"
+	std::string mime_type(content_type.substr(0, content_type.find(';')));
+	boost::algorithm::trim(mime_type);
+	boost::algorithm::to_lower(mime_type);
+	if (mime_type.empty())
+		return false;
+
+	for (std::vector<std::string>::const_iterator i = m_mime_types.begin();
+		 i != m_mime_types.end(); ++i)
+	{
+		if (i->empty())
+			continue;
+		if (*i->rbegin() == '/' ? boost::algorithm::istarts_with(mime_type, *i)
+			: boost::algorithm::iequals(mime_type, *i))
+			return true;
+	}
+	return false;
+}
+
+
+// HTTPCompressor member functions
+
+HTTPCompressor::HTTPCompressor(EncodingType encoding, int level)
+	: m_encoding(encoding), m_stream(NULL)
+{
+#ifdef PION_HAVE_ZLIB
+	if (m_encoding == ENCODING_IDENTITY)
+		return;
+	const bool gzip = (m_encoding == ENCODING_GZIP);
+
+	// try to re-use a stream that was released by this thread
+	StreamPool *pool_ptr = g_stream_pool.get();
+	PooledStream *stream_ptr = (pool_ptr == NULL ? NULL : pool_ptr->acquire(gzip));
+	if (stream_ptr != NULL) {
+		if (stream_ptr->m_level != level) {
+			if (deflateParams(&stream_ptr->m_zstream, level, Z_DEFAULT_STRATEGY) != Z_OK) {
+				deflateEnd(&stream_ptr->m_zstream);
+				delete stream_ptr;
+				return;
+			}
+			stream_ptr->m_level = level;
+		}
+	} else {
+		// windowBits 15 produces zlib ("deflate") format; +16 produces gzip
+		stream_ptr = new PooledStream;
+		stream_ptr->m_zstream.zalloc = Z_NULL;
+		stream_ptr->m_zstream.zfree = Z_NULL;
+		stream_ptr->m_zstream.opaque = Z_NULL;
+		stream_ptr->m_level = level;
+		if (deflateInit2(&stream_ptr->m_zstream, level, Z_DEFLATED,
+						 gzip ? 15 + 16 : 15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		{
+			delete stream_ptr;
+			return;
+		}
+	}
+	m_stream = stream_ptr;
+#endif
+}
+
+HTTPCompressor::~HTTPCompressor()
+{
+#ifdef PION_HAVE_ZLIB
+	if (m_stream != NULL) {
+		PooledStream *stream_ptr = static_cast<PooledStream*>(m_stream);
+		// note that this may be a different thread than the one that
+		// created the compressor; the stream joins the current thread's pool
+		StreamPool *pool_ptr = g_stream_pool.get();
+		if (pool_ptr == NULL) {
+			pool_ptr = new StreamPool;
+			g_stream_pool.reset(pool_ptr);
+		}
+		if (! pool_ptr->release(m_encoding == ENCODING_GZIP, stream_ptr)) {
+			deflateEnd(&stream_ptr->m_zstream);
+			delete stream_ptr;
+		}
+	}
+#endif
+}
+
+bool HTTPCompressor::compress(const void *ptr, std::size_t length, std::string& out)
+{
+#ifdef PION_HAVE_ZLIB
+	return deflateData(ptr, length, Z_NO_FLUSH, out);
+#else
+	return false;
+#endif
+}
+
+bool HTTPCompressor::flush(std::string& out)
+{
+#ifdef PION_HAVE_ZLIB
+	return deflateData(NULL, 0, Z_SYNC_FLUSH, out);
+#else
+	return false;
+#endif
+}
+
+bool HTTPCompressor::finish(std::string& out)
+{
+#ifdef PION_HAVE_ZLIB
+	return deflateData(NULL, 0, Z_FINISH, out);
+#else
+	return false;
+#endif
+}
+
+bool HTTPCompressor::deflateData(const void *ptr, std::size_t length,
+								 int flush_mode, std::string& out)
+{
+#ifdef PION_HAVE_ZLIB
+	if (m_stream == NULL)
+		return false;
+	z_stream& zstream = static_cast<PooledStream*>(m_stream)->m_zstream;
+	zstream.next_in = static_cast<Bytef*>(const_cast<void*>(ptr));
+	zstream.avail_in = static_cast<uInt>(length);
+
+	// keep deflating until zlib stops filling the output buffer
+	char buf[16384];
+	do {
+		zstream.next_out = reinterpret_cast<Bytef*>(buf);
+		zstream.avail_out = sizeof(buf);
+		if (deflate(&zstream, flush_mode) == Z_STREAM_ERROR)
+			return false;
+		out.append(buf, sizeof(buf) - zstream.avail_out);
+	} while (zstream.avail_out == 0);
+	return true;
+#else
+	return false;
+#endif
+}
+
+HTTPCompressor::EncodingType HTTPCompressor::parseAcceptEncoding(const std::string& accept_encoding)
+{
+	if (! isSupported() || accept_encoding.empty())
+		return ENCODING_IDENTITY;
+
+	// quality values for each coding (-1 = not listed)
+	double gzip_q = -1.0;
+	double deflate_q = -1.0;
+	double any_q = -1.0;
+
+	std::vector<std::string> codings;
+	boost::algorithm::split(codings, accept_encoding, boost::algorithm::is_any_of(","));
+	for (std::vector<std::string>::iterator i = codings.begin(); i != codings.end(); ++i) {
+		// parse "coding;q=value"
+		std::string::size_type pos = i->find(';');
+		std::string coding(i->substr(0, pos));
+		boost::algorithm::trim(coding);
+		double q = 1.0;
+		if (pos != std::string::npos) {
+			std::string param(i->substr(pos + 1));
+			boost::algorithm::trim(param);
+			if (param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=')
+				q = std::strtod(param.c_str() + 2, NULL);
+		}
+		if (boost::algorithm::iequals(coding, "gzip") || boost::algorithm::iequals(coding, "x-gzip"))
+			gzip_q = q;
+		else if (boost::algorithm::iequals(coding, "deflate"))
+			deflate_q = q;
+		else if (coding == "*")
+			any_q = q;
+	}
+
+	// codings that are not listed are acceptable only through "*"
+	if (gzip_q < 0) gzip_q = any_q;
+	if (deflate_q < 0) deflate_q = any_q;
+
+	// prefer gzip since some clients do not handle zlib-wrapped deflate properly
+	if (gzip_q > 0 && gzip_q >= deflate_q)
+		return ENCODING_GZIP;
+	if (deflate_q > 0)
+		return ENCODING_DEFLATE;
+	return ENCODING_IDENTITY;
+}
+
+const std::string& HTTPCompressor::getEncodingName(EncodingType encoding)
+{
+	switch (encoding) {
+		case ENCODING_GZIP: return g_gzip_name;
+		case ENCODING_DEFLATE: return g_deflate_name;
+		default: return g_identity_name;
+	}
+}
+
+bool HTTPCompressor::isSupported(void)
+{
+#ifdef PION_HAVE_ZLIB
+	return true;
+#else
+	return false;
+#endif
+}
+
+HTTPCompressor::OptionsPtr HTTPCompressor::getDefaultOptions(void)
+{
+	return g_default_options;
+}
+
+
+}	// end namespace net
+}	// end namespace pion
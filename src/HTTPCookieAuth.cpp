@@ -8,11 +8,17 @@
 //
 
 #include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
 #include <pion/PionAlgorithms.hpp>
 #include <pion/net/HTTPCookieAuth.hpp>
 #include <pion/net/HTTPResponseWriter.hpp>
 #include <pion/net/HTTPServer.hpp>
 #include <ctime>
+#ifdef PION_HAVE_SSL
+	#include <openssl/evp.h>
+	#include <openssl/hmac.h>
+	#include <openssl/rand.h>
+#endif
 
 
 namespace pion {	// begin namespace pion
@@ -34,6 +40,7 @@ HTTPCookieAuth::HTTPCookieAuth(PionUserManagerPtr userManager,
 							   const std::string& redirect)
 	: HTTPAuth(userManager), m_login(login), m_logout(logout), m_redirect(redirect),
 	m_random_gen(), m_random_range(0, 255), m_random_die(m_random_gen, m_random_range),
+	m_signed_sessions(false),
 	m_cache_cleanup_time(boost::posix_time::second_clock::universal_time())
 {
     // set logger for this class
@@ -50,13 +57,14 @@ HTTPCookieAuth::HTTPCookieAuth(PionUserManagerPtr userManager,
 		m_random_die();
 }
 	
-bool HTTPCookieAuth::handleRequest(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn)
+bool HTTPCookieAuth::handleRequest(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn,
+									bool restricted)
 {
 	if (processLogin(request,tcp_conn)) {
 		return false; // we processed login/logout request, no future processing for this request permitted
 	}
 
-	if (!needAuthentication(request)) {
+	if (!needAuthentication(restricted)) {
 		return true; // this request does not require authentication
 	}
 
@@ -67,11 +75,21 @@ bool HTTPCookieAuth::handleRequest(HTTPRequestPtr& request, TCPConnectionPtr& tc
 	
 	// check cache for expiration
 	PionDateTime time_now(boost::posix_time::second_clock::universal_time());
-	expireCache(time_now);
+	if (! m_signed_sessions)
+		expireCache(time_now);
 
 	// if we are here, we need to check if access authorized...
 	const std::string auth_cookie(request->getCookie(AUTH_COOKIE_NAME));
-	if (! auth_cookie.empty()) {
+	if (m_signed_sessions) {
+		// signed cookies are checked without looking at any sessions
+		PionUserPtr user;
+		if (! auth_cookie.empty())
+			user = checkSessionToken(auth_cookie, time_now);
+		if (user) {
+			request->setUser(user);
+			return true;
+		}
+	} else if (! auth_cookie.empty()) {
 		// check if this cookie is in user cache
 		boost::mutex::scoped_lock cache_lock(m_cache_mutex);
 		PionUserCache::iterator user_cache_itr=m_user_cache.find(auth_cookie);
@@ -98,7 +116,31 @@ void HTTPCookieAuth::setOption(const std::string& name, const std::string& value
 		m_logout = value;
 	else if (name=="redirect")
 		m_redirect = value;
-	else
+	else if (name=="session") {
+		if (value == "cache") {
+			m_signed_sessions = false;
+		} else if (value == "signed") {
+#ifdef PION_HAVE_SSL
+			if (m_session_key.empty()) {
+				// sessions will not be valid after a restart, or on other servers
+				unsigned char random_key[RANDOM_COOKIE_BYTES];
+				if (RAND_bytes(random_key, RANDOM_COOKIE_BYTES) != 1)
+					throw BadSessionModeException(value);
+				m_session_key.assign(reinterpret_cast<char*>(random_key), RANDOM_COOKIE_BYTES);
+			}
+			m_signed_sessions = true;
+#else
+			throw BadSessionModeException(value);
+#endif
+		} else {
+			throw BadSessionModeException(value);
+		}
+	} else if (name=="secret") {
+		// an empty key would let anyone sign their own session cookies
+		if (value.empty())
+			throw InvalidOptionValueException(name, value);
+		m_session_key = value;
+	} else
 		throw UnknownOptionException(name);
 }
 
@@ -128,21 +170,25 @@ bool HTTPCookieAuth::processLogin(HTTPRequestPtr& http_request, TCPConnectionPtr
 			return true;
 		}
 		// ok we have a new user session, create  a new cookie, add to cache
+		PionDateTime time_now(boost::posix_time::second_clock::universal_time());
+		if (m_signed_sessions) {
+			// the cookie itself proves the login, so there is nothing to cache
+			new_cookie = createSessionToken(username, time_now);
+		} else {
+			// create random cookie
+			std::string rand_binary;
+			rand_binary.reserve(RANDOM_COOKIE_BYTES);
+			for (unsigned int i=0; i<RANDOM_COOKIE_BYTES ; i++) {
+				rand_binary += static_cast<unsigned char>(m_random_die());
+			}
+			algo::base64_encode(rand_binary, new_cookie);
 
-		// create random cookie
-		std::string rand_binary;
-		rand_binary.reserve(RANDOM_COOKIE_BYTES);
-		for (unsigned int i=0; i<RANDOM_COOKIE_BYTES ; i++) {
-			rand_binary += static_cast<unsigned char>(m_random_die());
+			// add new session to cache
+			boost::mutex::scoped_lock cache_lock(m_cache_mutex);
+			m_user_cache.insert(std::make_pair(new_cookie,std::make_pair(time_now,user)));
 		}
-		algo::base64_encode(rand_binary, new_cookie);
-
-		// add new session to cache
-		PionDateTime time_now(boost::posix_time::second_clock::universal_time());
-		boost::mutex::scoped_lock cache_lock(m_cache_mutex);
-		m_user_cache.insert(std::make_pair(new_cookie,std::make_pair(time_now,user)));
 	} else {
-		// process logout sequence
+		// process logout sequence (signed cookies stay valid until they expire)
 		// if auth cookie presented - clean cache out
 		const std::string auth_cookie(http_request->getCookie(AUTH_COOKIE_NAME));
 		if (! auth_cookie.empty()) {
@@ -277,5 +323,76 @@ void HTTPCookieAuth::expireCache(const PionDateTime &time_now)
 	}
 }
 
+std::string HTTPCookieAuth::createSessionToken(const std::string& username,
+											  const PionDateTime& time_now) const
+{
+	// the payload is the (encoded) username and the login time, in seconds
+	static const PionDateTime EPOCH(boost::gregorian::date(1970, 1, 1));
+	std::string token;
+	algo::base64_encode(username, token);
+	token += '.';
+	token += boost::lexical_cast<std::string>((time_now - EPOCH).total_seconds());
+	const std::string signature(signSessionToken(token));
+	token += '.';
+	token += signature;
+	return token;
+}
+
+PionUserPtr HTTPCookieAuth::checkSessionToken(const std::string& token,
+											  const PionDateTime& time_now) const
+{
+	static const PionDateTime EPOCH(boost::gregorian::date(1970, 1, 1));
+	const std::string::size_type time_pos = token.find('.');
+	const std::string::size_type signature_pos = token.rfind('.');
+	if (time_pos == std::string::npos || time_pos == signature_pos)
+		return PionUserPtr();
+
+	// compare every byte of the signature, so the time taken gives nothing away
+	const std::string expected(signSessionToken(token.substr(0, signature_pos)));
+	if (expected.empty() || expected.size() != token.size() - signature_pos - 1)
+		return PionUserPtr();
+	unsigned char difference = 0;
+	for (std::string::size_type n = 0; n < expected.size(); ++n)
+		difference |= (expected[n] ^ token[signature_pos + 1 + n]);
+	if (difference != 0)
+		return PionUserPtr();
+
+	// the signature is valid, so the payload was created by createSessionToken()
+	long login_time;
+	try {
+		login_time = boost::lexical_cast<long>(token.substr(time_pos + 1, signature_pos - time_pos - 1));
+	} catch (boost::bad_lexical_cast&) {
+		return PionUserPtr();
+	}
+	const long now = (time_now - EPOCH).total_seconds();
+	if (login_time > now || now - login_time > static_cast<long>(CACHE_EXPIRATION))
+		return PionUserPtr();
+
+	std::string username;
+	if (! algo::base64_decode(token.substr(0, time_pos), username))
+		return PionUserPtr();
+	return m_user_manager->getUser(username);
+}
+
+#ifdef PION_HAVE_SSL
+std::string HTTPCookieAuth::signSessionToken(const std::string& payload) const
+{
+	std::string signature;
+	unsigned char digest[EVP_MAX_MD_SIZE];
+	unsigned int digest_length = 0;
+	HMAC(EVP_sha1(), m_session_key.data(), static_cast<int>(m_session_key.size()),
+		 reinterpret_cast<const unsigned char*>(payload.data()), payload.size(),
+		 digest, &digest_length);
+	algo::base64_encode(std::string(reinterpret_cast<char*>(digest), digest_length), signature);
+	return signature;
+}
+#else
+std::string HTTPCookieAuth::signSessionToken(const std::string& /* payload */) const
+{
+	// signed sessions cannot be enabled without OpenSSL
+	return std::string();
+}
+#endif
+
 }	// end namespace net
 }	// end namespace pion
@@ -8,7 +8,8 @@
 //
 
 #include <cstdlib>
-#include <boost/regex.hpp>
+#include <cstring>
+#include <algorithm>
 #include <boost/logic/tribool.hpp>
 #include <pion/net/HTTPParser.hpp>
 #include <pion/net/HTTPRequest.hpp>
@@ -32,6 +33,7 @@ const boost::uint32_t	HTTPParser::QUERY_NAME_MAX = 1024;	// 1 KB
 const boost::uint32_t	HTTPParser::QUERY_VALUE_MAX = 1024 * 1024;	// 1 MB
 const boost::uint32_t	HTTPParser::COOKIE_NAME_MAX = 1024;	// 1 KB
 const boost::uint32_t	HTTPParser::COOKIE_VALUE_MAX = 1024 * 1024;	// 1 MB
+const boost::uint32_t	HTTPParser::RANGES_MAX = 64;
 const std::size_t		HTTPParser::DEFAULT_CONTENT_MAX = 1024 * 1024;	// 1 MB
 HTTPParser::ErrorCategory *	HTTPParser::m_error_category_ptr = NULL;
 boost::once_flag			HTTPParser::m_instance_flag = BOOST_ONCE_INIT;
@@ -1236,39 +1238,253 @@ void HTTPParser::createErrorCategory(void)
 
 bool HTTPParser::parseForwardedFor(const std::string& header, std::string& public_ip)
 {
-	// static regex's used to check for ipv4 address
-	static const boost::regex IPV4_ADDR_RX("[0-9]{1,3}\\.[0-9]{1,3}\\.[0-9]{1,3}\\.[0-9]{1,3}");
-
-	/// static regex used to check for private/local networks:
-	/// 10.*
-	/// 127.*
-	/// 192.168.*
-	/// 172.16-31.*
-	static const boost::regex PRIVATE_NET_RX("(10\\.[0-9]{1,3}|127\\.[0-9]{1,3}|192\\.168|172\\.1[6-9]|172\\.2[0-9]|172\\.3[0-1])\\.[0-9]{1,3}\\.[0-9]{1,3}");
-
-	// sanity check
-	if (header.empty())
+	// the addresses are separated by commas; use the first one that is public
+	const IPNetworkTrie& private_networks = IPNetworkTrie::getPrivateNetworks();
+	boost::asio::ip::address address;
+	const char *ptr = header.c_str();
+	const char * const end = ptr + header.size();
+	while (ptr < end) {
+		const char *comma = ptr;
+		while (comma < end && *comma != ',')
+			++comma;
+		if (parseIPAddress(ptr, comma - ptr, address) && ! private_networks.contains(address)) {
+			public_ip = address.to_string();
+			return true;
+		}
+		ptr = comma + 1;
+	}
+
+	// no matches found
+	return false;
+}
+
+bool HTTPParser::parseForwardedFor(const std::string& header,
+								   const IPNetworkTrie& trusted_proxies,
+								   boost::asio::ip::address& client)
+{
+	// each proxy appends the address that it received the request from, so
+	// the addresses are checked from the last one back, skipping trusted
+	// proxies; anything before an address that is not valid may be forged
+	bool found = false;
+	boost::asio::ip::address address;
+	const char * const begin = header.c_str();
+	const char *end = begin + header.size();
+	while (end > begin) {
+		const char *ptr = end;
+		while (ptr > begin && *(ptr - 1) != ',')
+			--ptr;
+		if (! parseIPAddress(ptr, end - ptr, address))
+			break;
+		client = address;
+		found = true;
+		if (! trusted_proxies.contains(address))
+			break;
+		end = (ptr > begin ? ptr - 1 : begin);
+	}
+	return found;
+}
+
+bool HTTPParser::parseClientAddress(const HTTPMessage& http_msg,
+									const IPNetworkTrie& trusted_proxies,
+									boost::asio::ip::address& client)
+{
+	const HTTPTypes::Headers& headers = http_msg.getHeaders();
+	std::pair<HTTPTypes::Headers::const_iterator, HTTPTypes::Headers::const_iterator>
+		range = headers.equal_range(HTTPTypes::HEADER_X_FORWARDED_FOR);
+	if (range.first != range.second) {
+		HTTPTypes::Headers::const_iterator i = range.first;
+		if (++i == range.second)
+			return parseForwardedFor(range.first->second, trusted_proxies, client);
+		// several X-Forwarded-For headers are the same as one with all of their values
+		std::string forwarded_for(range.first->second);
+		for ( ; i != range.second; ++i) {
+			forwarded_for += ',';
+			forwarded_for += i->second;
+		}
+		return parseForwardedFor(forwarded_for, trusted_proxies, client);
+	}
+
+	// some proxies use Client-IP for the address of their client instead
+	const std::string& client_ip = http_msg.getHeader(HTTPTypes::HEADER_CLIENT_IP);
+	return parseIPAddress(client_ip.c_str(), client_ip.size(), client);
+}
+
+bool HTTPParser::parseIPAddress(const char *ptr, const std::size_t len,
+								boost::asio::ip::address& address)
+{
+	// strip surrounding spaces
+	const char *end = ptr + len;
+	while (ptr < end && (*ptr == ' ' || *ptr == '\t'))
+		++ptr;
+	while (end > ptr && (*(end - 1) == ' ' || *(end - 1) == '\t'))
+		--end;
+	if (ptr == end)
 		return false;
 
-	// local variables re-used by while loop
-	boost::match_results<std::string::const_iterator> m;
-	std::string::const_iterator start_it = header.begin();
-
-	// search for next ip address within the header
-	while (boost::regex_search(start_it, header.end(), m, IPV4_ADDR_RX)) {
-		// get ip that matched
-		std::string ip_str(m[0].first, m[0].second);
-		// check if public network ip address
-		if (! boost::regex_match(ip_str, PRIVATE_NET_RX) ) {
-			// match found!
-			public_ip = ip_str;
+	if (isDigit(*ptr)) {
+		// looks like an IPv4 address: four decimal octets, and maybe a port
+		boost::asio::ip::address_v4::bytes_type bytes;
+		const char *octet_ptr = ptr;
+		unsigned int n = 0;
+		while (n < 4) {
+			unsigned int octet = 0;
+			const char * const digits_ptr = octet_ptr;
+			while (octet_ptr < end && isDigit(*octet_ptr) && octet_ptr - digits_ptr < 3)
+				octet = octet * 10 + (*octet_ptr++ - '0');
+			if (octet_ptr == digits_ptr || octet > 255)
+				break;
+			bytes[n++] = static_cast<unsigned char>(octet);
+			if (n < 4 && (octet_ptr == end || *octet_ptr++ != '.'))
+				break;
+		}
+		if (n == 4) {
+			if (octet_ptr < end && *octet_ptr == ':') {
+				const char * const port_ptr = ++octet_ptr;
+				while (octet_ptr < end && isDigit(*octet_ptr))
+					++octet_ptr;
+				if (octet_ptr == port_ptr)
+					return false;
+			}
+			if (octet_ptr != end)
+				return false;
+			address = boost::asio::ip::address_v4(bytes);
 			return true;
 		}
-		// update search starting position
-		start_it = m[0].second;
+		// IPv6 addresses may also start with a digit
 	}
 
-	// no matches found
+	// IPv6 addresses are bracketed when there is a port
+	if (*ptr == '[') {
+		const char *bracket = ptr + 1;
+		while (bracket < end && *bracket != ']')
+			++bracket;
+		if (bracket == end)
+			return false;
+		if (bracket + 1 < end) {
+			if (bracket[1] != ':' || bracket + 2 == end)
+				return false;
+			for (const char *port_ptr = bracket + 2; port_ptr < end; ++port_ptr) {
+				if (! isDigit(*port_ptr))
+					return false;
+			}
+		}
+		++ptr;
+		end = bracket;
+	}
+	for (const char *hex_ptr = ptr; hex_ptr < end; ++hex_ptr) {
+		if (! isHexDigit(*hex_ptr) && *hex_ptr != ':' && *hex_ptr != '.')
+			return false;
+	}
+	if (end - ptr < 2)
+		return false;
+	boost::system::error_code ec;
+	const boost::asio::ip::address_v6 address_v6(boost::asio::ip::address_v6::from_string(std::string(ptr, end), ec));
+	if (ec)
+		return false;
+	address = address_v6;
+	return true;
+}
+
+bool HTTPParser::parseRange(const std::string& header, const boost::uint64_t content_length,
+							HTTPTypes::ByteRanges& ranges)
+{
+	ranges.clear();
+
+	// only byte ranges are supported
+	const char *ptr = header.c_str();
+	const char * const end = ptr + header.size();
+	while (ptr < end && (*ptr == ' ' || *ptr == '\t'))
+		++ptr;
+	if (end - ptr < 6 || std::strncmp(ptr, "bytes", 5) != 0)
+		return false;
+	ptr += 5;
+	while (ptr < end && (*ptr == ' ' || *ptr == '\t'))
+		++ptr;
+	if (ptr == end || *ptr++ != '=')
+		return false;
+
+	// the ranges are separated by commas (empty elements are allowed)
+	boost::uint32_t num_ranges = 0;
+	boost::uint64_t total_length = 0;
+	bool found_range = false;
+	while (ptr < end) {
+		while (ptr < end && (*ptr == ' ' || *ptr == '\t'))
+			++ptr;
+		if (ptr == end)
+			break;
+		if (*ptr == ',') {
+			++ptr;
+			continue;
+		}
+		if (++num_ranges > RANGES_MAX)
+			return false;
+
+		// "first-last", "first-" or "-suffix_length" (limited so they do not overflow)
+		static const boost::uint64_t POSITION_MAX = 0xFFFFFFFFFFFFULL;
+		boost::uint64_t first = 0, last = 0;
+		bool has_first = false, has_last = false;
+		for ( ; ptr < end && isDigit(*ptr); has_first = true)
+			first = std::min(first * 10 + (*ptr++ - '0'), POSITION_MAX);
+		while (ptr < end && (*ptr == ' ' || *ptr == '\t'))
+			++ptr;
+		if (ptr == end || *ptr++ != '-')
+			return false;
+		while (ptr < end && (*ptr == ' ' || *ptr == '\t'))
+			++ptr;
+		for ( ; ptr < end && isDigit(*ptr); has_last = true)
+			last = std::min(last * 10 + (*ptr++ - '0'), POSITION_MAX);
+		while (ptr < end && (*ptr == ' ' || *ptr == '\t'))
+			++ptr;
+		if (ptr < end && *ptr++ != ',')
+			return false;
+		if (has_first ? (has_last && last < first) : ! has_last)
+			return false;
+		found_range = true;
+
+		// convert suffix ranges, and keep the ranges that are satisfiable
+		if (! has_first) {
+			if (last == 0)
+				continue;
+			first = (last < content_length ? content_length - last : 0);
+			last = content_length - 1;
+		} else if (! has_last || last >= content_length) {
+			last = content_length - 1;
+		}
+		if (first >= content_length)
+			continue;
+		total_length += last - first + 1;
+		if (total_length > content_length)
+			return false;
+		ranges.push_back(HTTPTypes::ByteRange(first, last));
+	}
+	return found_range;
+}
+
+bool HTTPParser::matchETag(const std::string& header, const std::string& etag)
+{
+	// the entity tags are separated by commas; "*" matches any of them
+	const char *ptr = header.c_str();
+	const char * const end = ptr + header.size();
+	while (ptr < end) {
+		while (ptr < end && (*ptr == ' ' || *ptr == '\t' || *ptr == ','))
+			++ptr;
+		if (ptr == end)
+			break;
+		if (*ptr == '*')
+			return true;
+		// weak tags match strong ones with the same opaque tag
+		if (end - ptr > 2 && ptr[0] == 'W' && ptr[1] == '/')
+			ptr += 2;
+		if (*ptr != '"')
+			return false;
+		const char * const tag_end = std::find(ptr + 1, end, '"');
+		if (tag_end == end)
+			return false;
+		if (static_cast<std::size_t>(tag_end + 1 - ptr) == etag.size()
+			&& std::equal(ptr, tag_end + 1, etag.begin()))
+			return true;
+		ptr = tag_end + 1;
+	}
 	return false;
 }
 
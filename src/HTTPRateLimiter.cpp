@@ -0,0 +1,279 @@
+// ------------------------------------------------------------------
+// pion-net: a C++ framework for building lightweight HTTP interfaces
+// ------------------------------------------------------------------
+// Copyright (C) 2007-2010 Atomic Labs, Inc.  (http://www.atomiclabs.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <pion/net/HTTPTypes.hpp>
+#include <pion/net/HTTPRateLimiter.hpp>
+
+
+namespace pion {	// begin namespace pion
+namespace net {		// begin namespace net (Pion Network Library)
+
+
+// static members of HTTPRateLimiter
+
+const std::size_t		HTTPRateLimiter::DEFAULT_CAPACITY = 65536;
+const unsigned int		HTTPRateLimiter::MAX_BURST = 65535;
+const std::size_t		HTTPRateLimiter::NUM_SHARDS = 16;
+const std::size_t		HTTPRateLimiter::MAX_PROBES = 8;
+const unsigned int		HTTPRateLimiter::TOKEN_BITS = 24;
+const boost::uint64_t	HTTPRateLimiter::TOKEN = 256;
+std::string *			HTTPRateLimiter::m_response_ptr = NULL;
+std::string *			HTTPRateLimiter::m_head_response_ptr = NULL;
+boost::once_flag		HTTPRateLimiter::m_responses_flag = BOOST_ONCE_INIT;
+
+
+// returns a 64-bit FNV-1a hash of some bytes, continuing from a previous hash
+static inline boost::uint64_t hashBytes(const unsigned char *ptr, std::size_t len,
+										boost::uint64_t hash = 14695981039346656037ULL)
+{
+	for (std::size_t n = 0; n < len; ++n) {
+		hash ^= ptr[n];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+
+// HTTPRateLimiter member functions
+
+HTTPRateLimiter::HTTPRateLimiter(std::size_t capacity)
+	: m_config(new Config), m_shards(new Shard[NUM_SHARDS]),
+	m_shard_size(std::max(capacity / NUM_SHARDS, MAX_PROBES)),
+	m_epoch(boost::posix_time::microsec_clock::universal_time())
+{
+	for (std::size_t n = 0; n < NUM_SHARDS; ++n) {
+		Shard& shard = m_shards[n];
+		shard.m_slots.reset(new Slot[m_shard_size]);
+		for (std::size_t i = 0; i < m_shard_size; ++i) {
+			shard.m_slots[i].m_key.store(0);
+			shard.m_slots[i].m_state.store(0);
+		}
+		shard.m_allowed.store(0);
+		shard.m_rejected.store(0);
+		shard.m_overflows.store(0);
+	}
+}
+
+void HTTPRateLimiter::setLimit(const std::string& resource, double rate, unsigned int burst)
+{
+	Limit limit;
+	limit.m_refill = (rate > 0 ? rate : 0) * TOKEN / 1000;
+	limit.m_burst = std::max(std::min(burst, MAX_BURST), 1U) * TOKEN;
+	limit.m_hash = hashBytes(reinterpret_cast<const unsigned char*>(resource.data()), resource.size());
+	boost::mutex::scoped_lock config_lock(m_mutex);
+	boost::shared_ptr<Config> config(new Config(*boost::atomic_load(&m_config)));
+	config->m_limits[resource] = limit;
+	publish(config);
+}
+
+void HTTPRateLimiter::removeLimit(const std::string& resource)
+{
+	boost::mutex::scoped_lock config_lock(m_mutex);
+	boost::shared_ptr<Config> config(new Config(*boost::atomic_load(&m_config)));
+	config->m_limits.erase(resource);
+	publish(config);
+}
+
+bool HTTPRateLimiter::allow(const HTTPRequest& http_request)
+{
+	ConfigPtr config(boost::atomic_load(&m_config));
+	if (config->m_limits.empty())
+		return true;
+	return allow(*config, http_request.getResource(), http_request.getRemoteIp());
+}
+
+bool HTTPRateLimiter::allow(const std::string& resource, const boost::asio::ip::address& client)
+{
+	ConfigPtr config(boost::atomic_load(&m_config));
+	return allow(*config, resource, client);
+}
+
+bool HTTPRateLimiter::allow(const Config& config, const std::string& resource,
+							const boost::asio::ip::address& client)
+{
+	const Limit *limit = findLimit(config.m_limits, resource);
+	if (limit == NULL)
+		return true;
+
+	// each client has a bucket for each limited resource
+	boost::uint64_t key;
+	if (client.is_v4()) {
+		const boost::asio::ip::address_v4::bytes_type bytes(client.to_v4().to_bytes());
+		key = hashBytes(bytes.data(), bytes.size(), limit->m_hash);
+	} else {
+		const boost::asio::ip::address_v6::bytes_type bytes(client.to_v6().to_bytes());
+		key = hashBytes(bytes.data(), bytes.size(), limit->m_hash);
+	}
+	if (key == 0)
+		key = 1;	// zero is used for empty slots
+	Shard& shard = m_shards[key % NUM_SHARDS];
+	const std::size_t first = static_cast<std::size_t>((key / NUM_SHARDS) % m_shard_size);
+	const boost::uint64_t time_now = getTime();
+
+	// look for the client's bucket
+	for (std::size_t n = 0; n < MAX_PROBES; ++n) {
+		Slot& slot = shard.m_slots[(first + n) % m_shard_size];
+		if (slot.m_key.load(boost::memory_order_acquire) == key)
+			return take(shard, slot, *limit, time_now);
+	}
+
+	// claim a slot that is empty, or whose bucket would have been refilled by now
+	for (std::size_t n = 0; n < MAX_PROBES; ++n) {
+		Slot& slot = shard.m_slots[(first + n) % m_shard_size];
+		boost::uint64_t slot_key = slot.m_key.load(boost::memory_order_acquire);
+		if (slot_key == key)
+			return take(shard, slot, *limit, time_now);
+		const boost::uint64_t last_used = slot.m_state.load(boost::memory_order_relaxed) >> TOKEN_BITS;
+		if (slot_key != 0 && (time_now < last_used || time_now - last_used < config.m_idle_time))
+			continue;
+		if (slot.m_key.compare_exchange_strong(slot_key, key, boost::memory_order_acq_rel)) {
+			slot.m_state.store((time_now << TOKEN_BITS) | (limit->m_burst - TOKEN),
+							   boost::memory_order_release);
+			shard.m_allowed.fetch_add(1, boost::memory_order_relaxed);
+			return true;
+		}
+		if (slot_key == key)
+			return take(shard, slot, *limit, time_now);
+	}
+
+	// every slot is in use: let the request through rather than block a client
+	shard.m_overflows.fetch_add(1, boost::memory_order_relaxed);
+	return true;
+}
+
+bool HTTPRateLimiter::take(Shard& shard, Slot& slot, const Limit& limit, boost::uint64_t time_now)
+{
+	const boost::uint64_t token_mask = (static_cast<boost::uint64_t>(1) << TOKEN_BITS) - 1;
+	boost::uint64_t state = slot.m_state.load(boost::memory_order_acquire);
+	while (true) {
+		// refill the bucket for the time since it was last used
+		const boost::uint64_t last_used = state >> TOKEN_BITS;
+		boost::uint64_t tokens = state & token_mask;
+		if (time_now > last_used) {
+			const double refill = static_cast<double>(time_now - last_used) * limit.m_refill;
+			tokens = (refill >= static_cast<double>(limit.m_burst) ? limit.m_burst
+					  : std::min(limit.m_burst, tokens + static_cast<boost::uint64_t>(refill)));
+		}
+		if (tokens < TOKEN) {
+			shard.m_rejected.fetch_add(1, boost::memory_order_relaxed);
+			return false;
+		}
+		const boost::uint64_t new_state = (std::max(time_now, last_used) << TOKEN_BITS) | (tokens - TOKEN);
+		if (slot.m_state.compare_exchange_weak(state, new_state, boost::memory_order_acq_rel)) {
+			shard.m_allowed.fetch_add(1, boost::memory_order_relaxed);
+			return true;
+		}
+	}
+}
+
+void HTTPRateLimiter::sendTooManyRequests(TCPConnectionPtr& tcp_conn, bool head_request)
+{
+	boost::call_once(HTTPRateLimiter::createTooManyRequestsResponses, m_responses_flag);
+	const std::string& response(head_request ? *m_head_response_ptr : *m_response_ptr);
+	tcp_conn->setLifecycle(TCPConnection::LIFECYCLE_CLOSE);
+	tcp_conn->async_write(boost::asio::buffer(response),
+						  boost::bind(&TCPConnection::finish, tcp_conn));
+}
+
+unsigned long HTTPRateLimiter::getAllowed(void) const
+{
+	unsigned long total = 0;
+	for (std::size_t n = 0; n < NUM_SHARDS; ++n)
+		total += m_shards[n].m_allowed.load(boost::memory_order_relaxed);
+	return total;
+}
+
+unsigned long HTTPRateLimiter::getRejected(void) const
+{
+	unsigned long total = 0;
+	for (std::size_t n = 0; n < NUM_SHARDS; ++n)
+		total += m_shards[n].m_rejected.load(boost::memory_order_relaxed);
+	return total;
+}
+
+unsigned long HTTPRateLimiter::getOverflows(void) const
+{
+	unsigned long total = 0;
+	for (std::size_t n = 0; n < NUM_SHARDS; ++n)
+		total += m_shards[n].m_overflows.load(boost::memory_order_relaxed);
+	return total;
+}
+
+void HTTPRateLimiter::createTooManyRequestsResponses(void)
+{
+	static const std::string TOO_MANY_REQUESTS_HTML =
+		"<html><head>\n"
+		"<title>429 Too Many Requests</title>\n"
+		"</head><body>\n"
+		"<h1>Too Many Requests</h1>\n"
+		"<p>You have sent too many requests in a given amount of time.</p>\n"
+		"</body></html>\n";
+
+	// a response to a HEAD request has the same headers, but no content
+	static std::string head_response(HTTPTypes::STRING_HTTP_VERSION + "1.1 "
+		+ boost::lexical_cast<std::string>(HTTPTypes::RESPONSE_CODE_TOO_MANY_REQUESTS)
+		+ ' ' + HTTPTypes::RESPONSE_MESSAGE_TOO_MANY_REQUESTS + HTTPTypes::STRING_CRLF
+		+ HTTPTypes::HEADER_CONTENT_TYPE + ": " + HTTPTypes::CONTENT_TYPE_HTML + HTTPTypes::STRING_CRLF
+		+ HTTPTypes::HEADER_CONTENT_LENGTH + ": "
+		+ boost::lexical_cast<std::string>(TOO_MANY_REQUESTS_HTML.size()) + HTTPTypes::STRING_CRLF
+		+ "Retry-After: 1" + HTTPTypes::STRING_CRLF
+		+ HTTPTypes::HEADER_CONNECTION + ": close" + HTTPTypes::STRING_CRLF
+		+ HTTPTypes::STRING_CRLF);
+	static std::string response(head_response + TOO_MANY_REQUESTS_HTML);
+	m_head_response_ptr = &head_response;
+	m_response_ptr = &response;
+}
+
+const HTTPRateLimiter::Limit *HTTPRateLimiter::findLimit(const LimitMap& limits,
+														 const std::string& resource)
+{
+	// try the resource, and then each resource that it is within
+	std::string::size_type end = resource.size();
+	while (end > 0) {
+		LimitMap::const_iterator i = limits.find(resource.substr(0, end));
+		if (i != limits.end())
+			return &i->second;
+		end = resource.rfind('/', end - 1);
+		if (end == std::string::npos)
+			end = 0;
+	}
+
+	// every resource is within the root, whether it is named "/" or ""
+	LimitMap::const_iterator i = limits.find("/");
+	if (i == limits.end())
+		i = limits.find(std::string());
+	return (i == limits.end() ? NULL : &i->second);
+}
+
+void HTTPRateLimiter::publish(boost::shared_ptr<Config> config)
+{
+	// a bucket that has not been used for long enough is full again, so its
+	// slot may be given to another client without losing anything
+	config->m_idle_time = 1000;
+	for (LimitMap::const_iterator i = config->m_limits.begin(); i != config->m_limits.end(); ++i) {
+		const boost::uint64_t refill_time = (i->second.m_refill > 0
+			? static_cast<boost::uint64_t>(i->second.m_burst / i->second.m_refill) + 1
+			: static_cast<boost::uint64_t>(1) << (64 - TOKEN_BITS - 1));
+		config->m_idle_time = std::max(config->m_idle_time, refill_time);
+	}
+	boost::atomic_store(&m_config, ConfigPtr(config));
+}
+
+boost::uint64_t HTTPRateLimiter::getTime(void) const
+{
+	return static_cast<boost::uint64_t>((boost::posix_time::microsec_clock::universal_time()
+										 - m_epoch).total_milliseconds());
+}
+
+
+}	// end namespace net
+}	// end namespace pion
@@ -123,7 +123,12 @@ void HTTPReader::consumeBytes(void)
 void HTTPReader::readBytesWithTimeout(void)
 {
 	if (m_read_timeout > 0) {
-		m_timer_ptr.reset(new TCPTimer(m_tcp_conn));
+		// the connection keeps one timer, which is re-armed for each read
+		m_timer_ptr = m_tcp_conn->getTimer();
+		if (! m_timer_ptr) {
+			m_timer_ptr.reset(new TCPTimer(m_tcp_conn));
+			m_tcp_conn->setTimer(m_timer_ptr);
+		}
 		m_timer_ptr->start(m_read_timeout);
 	} else if (m_timer_ptr) {
 		m_timer_ptr.reset();
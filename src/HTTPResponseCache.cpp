@@ -0,0 +1,305 @@
+// ------------------------------------------------------------------
+// pion-net: a C++ framework for building lightweight HTTP interfaces
+// ------------------------------------------------------------------
+// Copyright (C) 2007-2010 Atomic Labs, Inc.  (http://www.atomiclabs.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/bind.hpp>
+#include <pion/net/HTTPResponseCache.hpp>
+#include <pion/net/HTTPResponse.hpp>
+
+
+namespace pion {	// begin namespace pion
+namespace net {		// begin namespace net (Pion Network Library)
+
+
+// static members of HTTPResponseCache
+
+const std::size_t	HTTPResponseCache::DEFAULT_MAX_SIZE = 16 * 1024 * 1024;	// 16 MB
+
+
+// HTTPResponseCache member functions
+
+std::string HTTPResponseCache::makeKey(const Policy& policy, const HTTPRequest& http_request,
+									   bool keep_alive)
+{
+	// everything that changes the bytes of the response is part of the key
+	std::string key(http_request.getMethod());
+	key += ' ';
+	key += http_request.getResource();
+	key += ' ';
+	key += boost::lexical_cast<std::string>(http_request.getVersionMajor());
+	key += '.';
+	key += boost::lexical_cast<std::string>(http_request.getVersionMinor());
+	key += (keep_alive ? " keep-alive" : " close");
+	for (std::vector<std::string>::const_iterator i = policy.m_query_keys.begin();
+		 i != policy.m_query_keys.end(); ++i)
+	{
+		key += "\n?";
+		key += *i;
+		key += '=';
+		key += http_request.getQuery(*i);
+	}
+	for (std::vector<std::string>::const_iterator i = policy.m_header_keys.begin();
+		 i != policy.m_header_keys.end(); ++i)
+	{
+		key += '\n';
+		key += *i;
+		key += ": ";
+		key += http_request.getHeader(*i);
+	}
+	return key;
+}
+
+HTTPResponseCache::ResponsePtr HTTPResponseCache::find(const std::string& key,
+													   std::string *etag_ptr)
+{
+	const PionDateTime time_now(boost::posix_time::second_clock::universal_time());
+	boost::mutex::scoped_lock cache_lock(m_mutex);
+	EntryIndex::iterator index_itr = m_index.find(key);
+	if (index_itr == m_index.end()) {
+		++m_misses;
+		return ResponsePtr();
+	}
+	if (index_itr->second->m_expires <= time_now) {
+		erase(index_itr);
+		++m_misses;
+		return ResponsePtr();
+	}
+	m_entries.splice(m_entries.begin(), m_entries, index_itr->second);
+	++m_hits;
+	if (etag_ptr != NULL)
+		*etag_ptr = index_itr->second->m_etag;
+	return index_itr->second->m_response;
+}
+
+HTTPResponseCache::ResponsePtr HTTPResponseCache::store(PolicyPtr policy, const std::string& key,
+														const HTTPMessage& http_response,
+														const std::string& response_bytes)
+{
+	// only keep responses that are the same for every request with the same key
+	const HTTPResponse *response_ptr = dynamic_cast<const HTTPResponse*>(&http_response);
+	if (response_ptr == NULL || response_ptr->getStatusCode() != HTTPTypes::RESPONSE_CODE_OK
+		|| http_response.hasHeader(HTTPTypes::HEADER_SET_COOKIE))
+		return ResponsePtr();
+	const std::string& cache_control(http_response.getHeader(HTTPTypes::HEADER_CACHE_CONTROL));
+	if (boost::algorithm::icontains(cache_control, "no-store")
+		|| boost::algorithm::icontains(cache_control, "private"))
+		return ResponsePtr();
+	const std::string& vary(http_response.getHeader(HTTPTypes::HEADER_VARY));
+	if (! vary.empty()) {
+		std::vector<std::string> vary_headers;
+		boost::algorithm::split(vary_headers, vary, boost::algorithm::is_any_of(","));
+		for (std::vector<std::string>::iterator i = vary_headers.begin(); i != vary_headers.end(); ++i) {
+			boost::algorithm::trim(*i);
+			if (i->empty())
+				continue;
+			bool in_key = false;
+			for (std::vector<std::string>::const_iterator j = policy->m_header_keys.begin();
+				 j != policy->m_header_keys.end() && ! in_key; ++j)
+			{
+				in_key = boost::algorithm::iequals(*i, *j);
+			}
+			if (! in_key)
+				return ResponsePtr();
+		}
+	}
+
+	Entry entry;
+	entry.m_key = key;
+	entry.m_response.reset(new std::string(response_bytes));
+	entry.m_etag = http_response.getHeader(HTTPTypes::HEADER_ETAG);
+	entry.m_expires = boost::posix_time::second_clock::universal_time()
+		+ boost::posix_time::seconds(policy->m_ttl);
+
+	boost::mutex::scoped_lock cache_lock(m_mutex);
+	if (response_bytes.size() > m_max_size)
+		return ResponsePtr();
+	EntryIndex::iterator index_itr = m_index.find(key);
+	if (index_itr != m_index.end())
+		erase(index_itr);
+	evict(m_max_size - response_bytes.size());
+	m_entries.push_front(entry);
+	m_index.insert(std::make_pair(key, m_entries.begin()));
+	m_size += response_bytes.size();
+	return entry.m_response;
+}
+
+HTTPResponseCache::FlightPtr HTTPResponseCache::join(PolicyPtr policy, const std::string& key,
+													 boost::asio::io_service& io_service,
+													 Waiter waiter, boost::uint32_t timeout)
+{
+	boost::mutex::scoped_lock cache_lock(m_mutex);
+	FlightIndex::iterator flight_itr = m_flights.find(key);
+	if (flight_itr == m_flights.end()) {
+		FlightPtr flight(new Flight(shared_from_this(), policy, key));
+		m_flights.insert(std::make_pair(key, flight.get()));
+		return flight;
+	}
+	PassengerPtr passenger(new Passenger(io_service, waiter));
+	passenger->m_epoch = m_epoch;
+	passenger->m_timer.expires_from_now(boost::posix_time::milliseconds(timeout));
+	passenger->m_timer.async_wait(boost::bind(&HTTPResponseCache::expire, shared_from_this(),
+											  passenger, boost::asio::placeholders::error));
+	flight_itr->second->m_passengers.push_back(passenger);
+	return FlightPtr();
+}
+
+void HTTPResponseCache::setMaxSize(std::size_t max_size)
+{
+	boost::mutex::scoped_lock cache_lock(m_mutex);
+	m_max_size = max_size;
+	evict(m_max_size);
+}
+
+void HTTPResponseCache::clear(void)
+{
+	boost::mutex::scoped_lock cache_lock(m_mutex);
+	m_entries.clear();
+	m_index.clear();
+	m_size = 0;
+}
+
+void HTTPResponseCache::cancelWaiters(void)
+{
+	std::vector<PassengerPtr> passengers;
+	{
+		boost::mutex::scoped_lock cache_lock(m_mutex);
+		++m_epoch;
+		for (FlightIndex::iterator flight_itr = m_flights.begin();
+			 flight_itr != m_flights.end(); ++flight_itr)
+		{
+			std::vector<PassengerPtr>& flight_passengers(flight_itr->second->m_passengers);
+			for (std::vector<PassengerPtr>::iterator i = flight_passengers.begin();
+				 i != flight_passengers.end(); ++i)
+			{
+				if (! (*i)->m_done) {
+					(*i)->m_done = true;
+					(*i)->m_timer.cancel();
+					passengers.push_back(*i);
+				}
+			}
+			flight_passengers.clear();
+		}
+	}
+
+	// the waiters (and what they are bound to) are released without the lock
+	for (std::vector<PassengerPtr>::iterator i = passengers.begin(); i != passengers.end(); ++i)
+		(*i)->m_waiter.clear();
+}
+
+std::size_t HTTPResponseCache::getSize(void) const
+{
+	boost::mutex::scoped_lock cache_lock(m_mutex);
+	return m_size;
+}
+
+unsigned long HTTPResponseCache::getHits(void) const
+{
+	boost::mutex::scoped_lock cache_lock(m_mutex);
+	return m_hits;
+}
+
+unsigned long HTTPResponseCache::getMisses(void) const
+{
+	boost::mutex::scoped_lock cache_lock(m_mutex);
+	return m_misses;
+}
+
+unsigned long HTTPResponseCache::getEvictions(void) const
+{
+	boost::mutex::scoped_lock cache_lock(m_mutex);
+	return m_evictions;
+}
+
+unsigned long HTTPResponseCache::getCoalesced(void) const
+{
+	boost::mutex::scoped_lock cache_lock(m_mutex);
+	return m_coalesced;
+}
+
+unsigned long HTTPResponseCache::getCoalesceTimeouts(void) const
+{
+	boost::mutex::scoped_lock cache_lock(m_mutex);
+	return m_coalesce_timeouts;
+}
+
+void HTTPResponseCache::finish(Flight& flight, ResponsePtr response)
+{
+	std::vector<PassengerPtr> passengers;
+	{
+		boost::mutex::scoped_lock cache_lock(m_mutex);
+		if (flight.m_landed)
+			return;
+		flight.m_landed = true;
+		m_flights.erase(flight.m_key);
+		for (std::vector<PassengerPtr>::iterator i = flight.m_passengers.begin();
+			 i != flight.m_passengers.end(); ++i)
+		{
+			if (! (*i)->m_done) {
+				(*i)->m_done = true;
+				(*i)->m_timer.cancel();
+				passengers.push_back(*i);
+			}
+		}
+		flight.m_passengers.clear();
+		if (response)
+			m_coalesced += passengers.size();
+	}
+
+	// the flight lands within the handling of its own request, so the
+	// passengers are handled by their connections' threads instead
+	for (std::vector<PassengerPtr>::iterator i = passengers.begin(); i != passengers.end(); ++i)
+		(*i)->m_io_service.post(boost::bind(&HTTPResponseCache::deliver, shared_from_this(),
+											*i, response));
+}
+
+void HTTPResponseCache::expire(PassengerPtr passenger, const boost::system::error_code& ec)
+{
+	if (ec == boost::asio::error::operation_aborted)
+		return;
+	{
+		boost::mutex::scoped_lock cache_lock(m_mutex);
+		if (passenger->m_done)
+			return;
+		passenger->m_done = true;
+		++m_coalesce_timeouts;
+	}
+	passenger->m_waiter(ResponsePtr());
+}
+
+void HTTPResponseCache::deliver(PassengerPtr passenger, ResponsePtr response)
+{
+	Waiter waiter;
+	{
+		boost::mutex::scoped_lock cache_lock(m_mutex);
+		if (passenger->m_epoch != m_epoch)
+			return;
+		waiter.swap(passenger->m_waiter);
+	}
+	waiter(response);
+}
+
+void HTTPResponseCache::evict(std::size_t max_size)
+{
+	while (m_size > max_size) {
+		erase(m_index.find(m_entries.back().m_key));
+		++m_evictions;
+	}
+}
+
+void HTTPResponseCache::erase(EntryIndex::iterator index_itr)
+{
+	m_size -= index_itr->second->m_response->size();
+	m_entries.erase(index_itr->second);
+	m_index.erase(index_itr);
+}
+
+
+}	// end namespace net
+}	// end namespace pion
@@ -0,0 +1,202 @@
+// ------------------------------------------------------------------
+// pion-net: a C++ framework for building lightweight HTTP interfaces
+// ------------------------------------------------------------------
+// Copyright (C) 2007-2010 Atomic Labs, Inc.  (http://www.atomiclabs.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include <pion/net/HTTPRouter.hpp>
+
+
+namespace pion {	// begin namespace pion
+namespace net {		// begin namespace net (Pion Network Library)
+
+
+// HTTPRouter member functions
+
+HTTPRouter::HTTPRouter(const ResourceMap& resources, const RedirectMap& redirects,
+					   unsigned int max_redirects,
+					   const AuthResourceSet& restrict_list,
+					   const AuthResourceSet& white_list,
+					   const HTTPResponseCache::PolicyMap& cache_policies)
+	: m_resources(resources), m_empty(resources.empty() && redirects.empty())
+{
+	// the nodes refer to the router's own copies of the handlers
+	for (ResourceMap::const_iterator i = m_resources.begin(); i != m_resources.end(); ++i)
+		insert(i->first).m_handler = &i->second;
+
+	// a resource requires authentication if it is within any restricted
+	// resource, unless it is also within any permitted resource
+	for (AuthResourceSet::const_iterator i = restrict_list.begin(); i != restrict_list.end(); ++i)
+		insert(*i).m_restricted = true;
+	for (AuthResourceSet::const_iterator i = white_list.begin(); i != white_list.end(); ++i)
+		insert(*i).m_permitted = true;
+
+	// the policy of the longest matching resource applies
+	for (HTTPResponseCache::PolicyMap::const_iterator i = cache_policies.begin(); i != cache_policies.end(); ++i)
+		insert(i->first).m_cache_policy = i->second;
+
+	// follow each chain of redirections to its end
+	for (RedirectMap::const_iterator i = redirects.begin(); i != redirects.end(); ++i) {
+		boost::shared_ptr<Redirect> redirect(new Redirect);
+		redirect->m_resource = i->second;
+		unsigned int num_redirects = 1;
+		RedirectMap::const_iterator next = redirects.find(redirect->m_resource);
+		while (next != redirects.end()) {
+			if (++num_redirects > max_redirects) {
+				redirect->m_too_many_redirects = true;
+				break;
+			}
+			redirect->m_resource = next->second;
+			next = redirects.find(redirect->m_resource);
+		}
+		if (! redirect->m_too_many_redirects)
+			walk(redirect->m_resource, redirect->m_route);
+		insert(i->first).m_redirect = redirect;
+	}
+}
+
+HTTPRouter::Match HTTPRouter::find(const std::string& resource) const
+{
+	Route route;
+	const Node *node = walk(resource, route);
+	Match match;
+	if (node != NULL && node->m_redirect) {
+		match.m_redirect = &node->m_redirect->m_resource;
+		match.m_too_many_redirects = node->m_redirect->m_too_many_redirects;
+		route = node->m_redirect->m_route;
+	}
+	match.m_handler = route.m_handler;
+	match.m_auth_required = route.authRequired();
+	match.m_cache_policy = route.m_cache_policy;
+	return match;
+}
+
+const HTTPRouter::RequestHandler *HTTPRouter::findHandler(const std::string& resource) const
+{
+	Route route;
+	walk(resource, route);
+	return route.m_handler;
+}
+
+HTTPRouter::Node& HTTPRouter::insert(const std::string& resource)
+{
+	// split the resource into its path segments (none for the empty resource)
+	std::vector<std::string> segments;
+	if (! resource.empty()) {
+		std::string::size_type pos = 0;
+		std::string::size_type end;
+		while ((end = resource.find('/', pos)) != std::string::npos) {
+			segments.push_back(resource.substr(pos, end - pos));
+			pos = end + 1;
+		}
+		segments.push_back(resource.substr(pos));
+	}
+
+	Node *node = &m_root;
+	std::size_t n = 0;
+	while (n < segments.size()) {
+		// find the child that begins with the next segment
+		std::vector<NodePtr>::iterator child_it = node->m_children.begin();
+		while (child_it != node->m_children.end()
+			   && (*child_it)->m_segments.front() < segments[n])
+		{
+			++child_it;
+		}
+		if (child_it == node->m_children.end() || (*child_it)->m_segments.front() != segments[n]) {
+			// no child shares the segment: the rest of the resource is a new leaf
+			NodePtr leaf(new Node);
+			leaf->m_segments.assign(segments.begin() + n, segments.end());
+			node->m_children.insert(child_it, leaf);
+			return *leaf;
+		}
+
+		// count the segments that the child has in common with the resource
+		Node& child = **child_it;
+		std::size_t common = 1;
+		while (common < child.m_segments.size() && n + common < segments.size()
+			   && child.m_segments[common] == segments[n + common])
+		{
+			++common;
+		}
+
+		if (common < child.m_segments.size()) {
+			// the resource ends or branches off within the child's segments
+			NodePtr branch(new Node);
+			branch->m_segments.assign(child.m_segments.begin(), child.m_segments.begin() + common);
+			child.m_segments.erase(child.m_segments.begin(), child.m_segments.begin() + common);
+			branch->m_children.push_back(*child_it);
+			*child_it = branch;
+			node = branch.get();
+		} else {
+			node = &child;
+		}
+		n += common;
+	}
+
+	return *node;
+}
+
+const HTTPRouter::Node *HTTPRouter::walk(const std::string& resource, Route& route) const
+{
+	visit(m_root, route);
+	if (resource.empty())
+		return &m_root;
+
+	// the segments are compared in place, without copying them
+	const Node *node = &m_root;
+	std::string::size_type pos = 0;
+	std::string::size_type end = resource.find('/');
+	if (end == std::string::npos)
+		end = resource.size();
+
+	while (true) {
+		// binary search for the child that begins with the next segment
+		const std::vector<NodePtr>& children = node->m_children;
+		std::size_t low = 0;
+		std::size_t high = children.size();
+		const Node *child = NULL;
+		while (low < high) {
+			const std::size_t mid = (low + high) / 2;
+			const int result = resource.compare(pos, end - pos, children[mid]->m_segments.front());
+			if (result < 0) {
+				high = mid;
+			} else if (result > 0) {
+				low = mid + 1;
+			} else {
+				child = children[mid].get();
+				break;
+			}
+		}
+		if (child == NULL)
+			return NULL;
+
+		// the rest of the child's segments must also match
+		for (std::size_t n = 1; n < child->m_segments.size(); ++n) {
+			if (end == resource.size())
+				return NULL;
+			pos = end + 1;
+			end = resource.find('/', pos);
+			if (end == std::string::npos)
+				end = resource.size();
+			if (resource.compare(pos, end - pos, child->m_segments[n]) != 0)
+				return NULL;
+		}
+
+		node = child;
+		visit(*node, route);
+		if (end == resource.size())
+			return node;
+
+		pos = end + 1;
+		end = resource.find('/', pos);
+		if (end == std::string::npos)
+			end = resource.size();
+	}
+}
+
+
+}	// end namespace net
+}	// end namespace pion
@@ -11,6 +11,7 @@
 #include <pion/net/HTTPRequest.hpp>
 #include <pion/net/HTTPRequestReader.hpp>
 #include <pion/net/HTTPResponseWriter.hpp>
+#include <pion/net/HTTPParser.hpp>
 
 
 namespace pion {	// begin namespace pion
@@ -20,6 +21,7 @@ namespace net {		// begin namespace net (Pion Network Library)
 // static members of HTTPServer
 
 const unsigned int			HTTPServer::MAX_REDIRECTS = 10;
+const boost::uint32_t		HTTPServer::DEFAULT_COALESCE_TIMEOUT = 5000;	// 5 seconds
 
 
 // HTTPServer member functions
@@ -52,27 +54,47 @@ void HTTPServer::handleRequest(HTTPRequestPtr& http_request,
 		
 	PION_LOG_DEBUG(m_logger, "Received a valid HTTP request");
 
+	// requests forwarded by trusted proxies are from the client that they name
+	IPNetworkTriePtr trusted_proxies(boost::atomic_load(&m_trusted_proxies));
+	if (trusted_proxies && trusted_proxies->contains(http_request->getRemoteIp())) {
+		boost::asio::ip::address client;
+		if (HTTPParser::parseClientAddress(*http_request, *trusted_proxies, client))
+			http_request->setRemoteIp(client);
+	}
+
+	// clients that make too many requests are turned away before routing
+	HTTPRateLimiterPtr rate_limiter(boost::atomic_load(&m_rate_limiter));
+	if (rate_limiter && ! rate_limiter->allow(*http_request)) {
+		PION_LOG_INFO(m_logger, "Too many requests from " << http_request->getRemoteIp()
+					  << " for HTTP resource: " << http_request->getResource());
+		HTTPRateLimiter::sendTooManyRequests(tcp_conn,
+			http_request->getMethod() == HTTPTypes::REQUEST_METHOD_HEAD);
+		return;
+	}
+
 	// strip off trailing slash if the request has one
 	std::string resource_requested(stripTrailingSlash(http_request->getResource()));
 
-	// apply any redirection
-	RedirectMap::const_iterator it = m_redirects.find(resource_requested);
-	unsigned int num_redirects = 0;
-	while (it != m_redirects.end()) {
-		if (++num_redirects > MAX_REDIRECTS) {
-			PION_LOG_ERROR(m_logger, "Maximum number of redirects (HTTPServer::MAX_REDIRECTS) exceeded for requested resource: " << http_request->getOriginalResource());
-			m_server_error_handler(http_request, tcp_conn, "Maximum number of redirects (HTTPServer::MAX_REDIRECTS) exceeded for requested resource");
-			return;
-		}
-		resource_requested = it->second;
+	// apply any redirection and find the rules for the resource; the router
+	// is never changed once it has been published, so no lock is needed
+	HTTPRouterPtr router(boost::atomic_load(&m_router));
+	HTTPRouter::Match match;
+	if (router)
+		match = router->find(resource_requested);
+	if (match.m_too_many_redirects) {
+		PION_LOG_ERROR(m_logger, "Maximum number of redirects (HTTPServer::MAX_REDIRECTS) exceeded for requested resource: " << http_request->getOriginalResource());
+		m_server_error_handler(http_request, tcp_conn, "Maximum number of redirects (HTTPServer::MAX_REDIRECTS) exceeded for requested resource");
+		return;
+	}
+	if (match.m_redirect != NULL) {
+		resource_requested = *match.m_redirect;
 		http_request->changeResource(resource_requested);
-		it = m_redirects.find(resource_requested);
 	}
 
 	// if authentication activated, check current request
 	if (m_auth) {
-		// try to verify authentication
-		if (! m_auth->handleRequest(http_request, tcp_conn)) {
+		// try to verify authentication (the router has already applied the rules)
+		if (! m_auth->handleRequest(http_request, tcp_conn, match.m_auth_required)) {
 			// the HTTP 401 message has already been sent by the authentication object
 			PION_LOG_DEBUG(m_logger, "Authentication required for HTTP resource: "
 				<< resource_requested);
@@ -82,28 +104,59 @@ void HTTPServer::handleRequest(HTTPRequestPtr& http_request,
 			return;
 		}
 	}
-	
-	// search for a handler matching the resource requested
-	RequestHandler request_handler;
-	if (findRequestHandler(resource_requested, request_handler)) {
-		
-		// try to handle the request
-		try {
-			request_handler(http_request, tcp_conn);
-			PION_LOG_DEBUG(m_logger, "Found request handler for HTTP resource: "
+
+	// choose the handler for the (redirected) resource
+	const RequestHandler *request_handler = selectRequestHandler(resource_requested, match);
+
+	// responses for cached resources are reused until they expire, unless
+	// they may depend upon who made the request; while one is not cached,
+	// identical requests wait for the first one to be handled
+	if (match.m_cache_policy && request_handler != NULL
+		&& (http_request->getMethod() == HTTPTypes::REQUEST_METHOD_GET
+			|| http_request->getMethod() == HTTPTypes::REQUEST_METHOD_HEAD)
+		&& ! http_request->hasHeader(HTTPTypes::HEADER_AUTHORIZATION)
+		&& ! (m_auth && match.m_auth_required))
+	{
+		const std::string key(HTTPResponseCache::makeKey(*match.m_cache_policy, *http_request,
+														 tcp_conn->getKeepAlive()));
+		std::string etag;
+		HTTPResponseCache::ResponsePtr response(m_response_cache->find(key, &etag));
+		if (response && ! etag.empty() && http_request->hasHeader(HTTPTypes::HEADER_IF_NONE_MATCH)
+			&& HTTPParser::matchETag(http_request->getHeader(HTTPTypes::HEADER_IF_NONE_MATCH), etag))
+		{
+			// the client already has the cached response
+			PION_LOG_DEBUG(m_logger, "Cached response not modified for HTTP resource: "
 						   << resource_requested);
-			if (http_request->getResource() != http_request->getOriginalResource()) {
-				PION_LOG_DEBUG(m_logger, "Original resource requested was: " << http_request->getOriginalResource());
+			sendNotModifiedResponse(http_request, tcp_conn, etag);
+			return;
+		}
+		if (response) {
+			PION_LOG_DEBUG(m_logger, "Sending cached response for HTTP resource: "
+						   << resource_requested);
+			sendCachedResponse(tcp_conn, response);
+			return;
+		}
+		if (m_coalesce_timeout > 0) {
+			HTTPResponseCache::FlightPtr flight(m_response_cache->join(match.m_cache_policy, key,
+				tcp_conn->getIOService(),
+				boost::bind(&HTTPServer::resumeRequest, this, http_request, tcp_conn, router,
+							request_handler, match.m_cache_policy, key, _1),
+				m_coalesce_timeout));
+			if (! flight) {
+				PION_LOG_DEBUG(m_logger, "Waiting for identical request for HTTP resource: "
+							   << resource_requested);
+				return;
 			}
-		} catch (std::bad_alloc&) {
-			// propagate memory errors (FATAL)
-			throw;
-		} catch (std::exception& e) {
-			// recover gracefully from other exceptions thrown request handlers
-			PION_LOG_ERROR(m_logger, "HTTP request handler: " << e.what());
-			m_server_error_handler(http_request, tcp_conn, e.what());
+			http_request->setResponseCapture(boost::bind(&HTTPResponseCache::Flight::land,
+														 flight, _1, _2));
+		} else {
+			http_request->setResponseCapture(boost::bind(&HTTPResponseCache::store, m_response_cache,
+														 match.m_cache_policy, key, _1, _2));
 		}
-		
+	}
+	
+	if (request_handler != NULL) {
+		runRequestHandler(http_request, tcp_conn, *request_handler);
 	} else {
 		
 		// no web services found that could handle the request
@@ -116,30 +169,65 @@ void HTTPServer::handleRequest(HTTPRequestPtr& http_request,
 	}
 }
 	
+void HTTPServer::runRequestHandler(HTTPRequestPtr& http_request, TCPConnectionPtr& tcp_conn,
+								   const RequestHandler& request_handler)
+{
+	// try to handle the request
+	try {
+		request_handler(http_request, tcp_conn);
+		PION_LOG_DEBUG(m_logger, "Found request handler for HTTP resource: "
+					   << http_request->getResource());
+		if (http_request->getResource() != http_request->getOriginalResource()) {
+			PION_LOG_DEBUG(m_logger, "Original resource requested was: " << http_request->getOriginalResource());
+		}
+	} catch (std::bad_alloc&) {
+		// propagate memory errors (FATAL)
+		throw;
+	} catch (std::exception& e) {
+		// recover gracefully from other exceptions thrown request handlers
+		PION_LOG_ERROR(m_logger, "HTTP request handler: " << e.what());
+		m_server_error_handler(http_request, tcp_conn, e.what());
+	}
+}
+
+void HTTPServer::resumeRequest(HTTPRequestPtr& http_request, TCPConnectionPtr& tcp_conn,
+							   HTTPRouterPtr /* router */, const RequestHandler *request_handler,
+							   HTTPResponseCache::PolicyPtr policy, const std::string& key,
+							   HTTPResponseCache::ResponsePtr response)
+{
+	if (response) {
+		PION_LOG_DEBUG(m_logger, "Sending response of identical request for HTTP resource: "
+					   << http_request->getResource());
+		sendCachedResponse(tcp_conn, response);
+	} else {
+		// the response could not be shared, or took too long
+		PION_LOG_DEBUG(m_logger, "Stopped waiting for identical request for HTTP resource: "
+					   << http_request->getResource());
+		http_request->setResponseCapture(boost::bind(&HTTPResponseCache::store, m_response_cache,
+													 policy, key, _1, _2));
+		runRequestHandler(http_request, tcp_conn, *request_handler);
+	}
+}
+
+const HTTPServer::RequestHandler *
+HTTPServer::selectRequestHandler(const std::string& /* resource */,
+								 const HTTPRouter::Match& match)
+{
+	return match.m_handler;
+}
+
 bool HTTPServer::findRequestHandler(const std::string& resource,
 									RequestHandler& request_handler) const
 {
-	// first make sure that HTTP resources are registered
-	boost::mutex::scoped_lock resource_lock(m_resource_mutex);
-	if (m_resources.empty())
+	// no redirection is applied to the resource
+	HTTPRouterPtr router(boost::atomic_load(&m_router));
+	if (! router)
 		return false;
-	
-	// iterate through each resource entry that may match the resource
-	ResourceMap::const_iterator i = m_resources.upper_bound(resource);
-	while (i != m_resources.begin()) {
-		--i;
-		// check for a match if the first part of the strings match
-		if (i->first.empty() || resource.compare(0, i->first.size(), i->first) == 0) {
-			// only if the resource matches the plug-in's identifier
-			// or if resource is followed first with a '/' character
-			if (resource.size() == i->first.size() || resource[i->first.size()]=='/') {
-				request_handler = i->second;
-				return true;
-			}
-		}
-	}
-	
-	return false;
+	const RequestHandler *handler = router->findHandler(resource);
+	if (handler == NULL)
+		return false;
+	request_handler = *handler;
+	return true;
 }
 
 void HTTPServer::addResource(const std::string& resource,
@@ -148,6 +236,7 @@ void HTTPServer::addResource(const std::string& resource,
 	boost::mutex::scoped_lock resource_lock(m_resource_mutex);
 	const std::string clean_resource(stripTrailingSlash(resource));
 	m_resources.insert(std::make_pair(clean_resource, request_handler));
+	updateRouter();
 	PION_LOG_INFO(m_logger, "Added request handler for HTTP resource: " << clean_resource);
 }
 
@@ -156,6 +245,7 @@ void HTTPServer::removeResource(const std::string& resource)
 	boost::mutex::scoped_lock resource_lock(m_resource_mutex);
 	const std::string clean_resource(stripTrailingSlash(resource));
 	m_resources.erase(clean_resource);
+	updateRouter();
 	PION_LOG_INFO(m_logger, "Removed request handler for HTTP resource: " << clean_resource);
 }
 
@@ -166,9 +256,111 @@ void HTTPServer::addRedirect(const std::string& requested_resource,
 	const std::string clean_requested_resource(stripTrailingSlash(requested_resource));
 	const std::string clean_new_resource(stripTrailingSlash(new_resource));
 	m_redirects.insert(std::make_pair(clean_requested_resource, clean_new_resource));
+	updateRouter();
 	PION_LOG_INFO(m_logger, "Added redirection for HTTP resource " << clean_requested_resource << " to resource " << clean_new_resource);
 }
 
+void HTTPServer::addCachedResource(const std::string& resource, unsigned int ttl,
+									const std::vector<std::string>& query_keys,
+									const std::vector<std::string>& header_keys)
+{
+	boost::shared_ptr<HTTPResponseCache::Policy> policy(new HTTPResponseCache::Policy);
+	policy->m_ttl = ttl;
+	policy->m_query_keys = query_keys;
+	policy->m_header_keys = header_keys;
+	boost::mutex::scoped_lock resource_lock(m_resource_mutex);
+	const std::string clean_resource(stripTrailingSlash(resource));
+	m_cache_policies[clean_resource] = policy;
+	updateRouter();
+	PION_LOG_INFO(m_logger, "Caching responses for HTTP resource " << clean_resource << " for " << ttl << " seconds");
+}
+
+void HTTPServer::addTrustedProxy(const std::string& network)
+{
+	boost::mutex::scoped_lock resource_lock(m_resource_mutex);
+	IPNetworkTriePtr old_proxies(boost::atomic_load(&m_trusted_proxies));
+	boost::shared_ptr<IPNetworkTrie> trusted_proxies(old_proxies
+		? new IPNetworkTrie(*old_proxies) : new IPNetworkTrie);
+	trusted_proxies->insert(network);
+	boost::atomic_store(&m_trusted_proxies, IPNetworkTriePtr(trusted_proxies));
+	PION_LOG_INFO(m_logger, "Trusting proxies in " << network << " to forward client addresses");
+}
+
+void HTTPServer::removeCachedResource(const std::string& resource)
+{
+	boost::mutex::scoped_lock resource_lock(m_resource_mutex);
+	const std::string clean_resource(stripTrailingSlash(resource));
+	m_cache_policies.erase(clean_resource);
+	updateRouter();
+	PION_LOG_INFO(m_logger, "Stopped caching responses for HTTP resource: " << clean_resource);
+}
+
+void HTTPServer::setAuthentication(HTTPAuthPtr auth)
+{
+	// the update handlers are changed without m_resource_mutex, which they
+	// lock; a change of the new rules before m_auth is set is picked up
+	// by updateRouter() below
+	if (auth)
+		auth->setUpdateHandler(this, boost::bind(&HTTPServer::updateAuthentication, this));
+	HTTPAuthPtr old_auth;
+	{
+		boost::mutex::scoped_lock resource_lock(m_resource_mutex);
+		old_auth = m_auth;
+		m_auth = auth;
+		updateRouter();
+	}
+	if (old_auth && old_auth != auth)
+		old_auth->setUpdateHandler(this, HTTPAuth::UpdateHandler());
+}
+
+void HTTPServer::updateAuthentication(void)
+{
+	boost::mutex::scoped_lock resource_lock(m_resource_mutex);
+	updateRouter();
+}
+
+void HTTPServer::updateRouter(void)
+{
+	// requests that are being handled keep using the previous router
+	HTTPRouter::AuthResourceSet restrict_list;
+	HTTPRouter::AuthResourceSet white_list;
+	if (m_auth)
+		m_auth->getRules(restrict_list, white_list);
+	HTTPRouterPtr router(new HTTPRouter(m_resources, m_redirects, MAX_REDIRECTS,
+										restrict_list, white_list, m_cache_policies));
+	boost::atomic_store(&m_router, router);
+}
+
+void HTTPServer::sendNotModifiedResponse(HTTPRequestPtr& http_request, TCPConnectionPtr& tcp_conn,
+										 const std::string& etag)
+{
+	HTTPResponseWriterPtr writer(HTTPResponseWriter::create(tcp_conn, *http_request,
+															boost::bind(&TCPConnection::finish, tcp_conn)));
+	writer->getResponse().setStatusCode(HTTPTypes::RESPONSE_CODE_NOT_MODIFIED);
+	writer->getResponse().setStatusMessage(HTTPTypes::RESPONSE_MESSAGE_NOT_MODIFIED);
+	writer->getResponse().addHeader(HTTPTypes::HEADER_ETAG, etag);
+	writer->send();
+}
+
+void HTTPServer::sendCachedResponse(TCPConnectionPtr& tcp_conn,
+									HTTPResponseCache::ResponsePtr response)
+{
+	tcp_conn->async_write(boost::asio::buffer(*response),
+						  boost::bind(&HTTPServer::finishCachedResponse,
+									  tcp_conn, response,
+									  boost::asio::placeholders::error));
+}
+
+void HTTPServer::finishCachedResponse(TCPConnectionPtr& tcp_conn,
+									  HTTPResponseCache::ResponsePtr /* response */,
+									  const boost::system::error_code& write_error)
+{
+	// the response is bound to the handler to keep its bytes until they are sent
+	if (write_error)
+		tcp_conn->setLifecycle(TCPConnection::LIFECYCLE_CLOSE);
+	tcp_conn->finish();
+}
+
 void HTTPServer::handleBadRequest(HTTPRequestPtr& http_request,
 								  TCPConnectionPtr& tcp_conn)
 {
@@ -34,8 +34,17 @@ const std::string	HTTPTypes::HEADER_CONTENT_TYPE("Content-Type");
 const std::string	HTTPTypes::HEADER_CONTENT_LENGTH("Content-Length");
 const std::string	HTTPTypes::HEADER_CONTENT_LOCATION("Content-Location");
 const std::string	HTTPTypes::HEADER_CONTENT_ENCODING("Content-Encoding");
+const std::string	HTTPTypes::HEADER_ACCEPT_ENCODING("Accept-Encoding");
+const std::string	HTTPTypes::HEADER_VARY("Vary");
+const std::string	HTTPTypes::HEADER_CACHE_CONTROL("Cache-Control");
 const std::string	HTTPTypes::HEADER_LAST_MODIFIED("Last-Modified");
 const std::string	HTTPTypes::HEADER_IF_MODIFIED_SINCE("If-Modified-Since");
+const std::string	HTTPTypes::HEADER_ETAG("ETag");
+const std::string	HTTPTypes::HEADER_IF_NONE_MATCH("If-None-Match");
+const std::string	HTTPTypes::HEADER_RANGE("Range");
+const std::string	HTTPTypes::HEADER_IF_RANGE("If-Range");
+const std::string	HTTPTypes::HEADER_CONTENT_RANGE("Content-Range");
+const std::string	HTTPTypes::HEADER_ACCEPT_RANGES("Accept-Ranges");
 const std::string	HTTPTypes::HEADER_TRANSFER_ENCODING("Transfer-Encoding");
 const std::string	HTTPTypes::HEADER_LOCATION("Location");
 const std::string	HTTPTypes::HEADER_AUTHORIZATION("Authorization");
@@ -62,6 +71,7 @@ const std::string	HTTPTypes::RESPONSE_MESSAGE_OK("OK");
 const std::string	HTTPTypes::RESPONSE_MESSAGE_CREATED("Created");
 const std::string	HTTPTypes::RESPONSE_MESSAGE_ACCEPTED("Accepted");
 const std::string	HTTPTypes::RESPONSE_MESSAGE_NO_CONTENT("No Content");
+const std::string	HTTPTypes::RESPONSE_MESSAGE_PARTIAL_CONTENT("Partial Content");
 const std::string	HTTPTypes::RESPONSE_MESSAGE_FOUND("Found");
 const std::string	HTTPTypes::RESPONSE_MESSAGE_UNAUTHORIZED("Unauthorized");
 const std::string	HTTPTypes::RESPONSE_MESSAGE_FORBIDDEN("Forbidden");
@@ -69,8 +79,11 @@ const std::string	HTTPTypes::RESPONSE_MESSAGE_NOT_FOUND("Not Found");
 const std::string	HTTPTypes::RESPONSE_MESSAGE_METHOD_NOT_ALLOWED("Method Not Allowed");
 const std::string	HTTPTypes::RESPONSE_MESSAGE_NOT_MODIFIED("Not Modified");
 const std::string	HTTPTypes::RESPONSE_MESSAGE_BAD_REQUEST("Bad Request");
+const std::string	HTTPTypes::RESPONSE_MESSAGE_RANGE_NOT_SATISFIABLE("Requested Range Not Satisfiable");
+const std::string	HTTPTypes::RESPONSE_MESSAGE_TOO_MANY_REQUESTS("Too Many Requests");
 const std::string	HTTPTypes::RESPONSE_MESSAGE_SERVER_ERROR("Server Error");
 const std::string	HTTPTypes::RESPONSE_MESSAGE_NOT_IMPLEMENTED("Not Implemented");
+const std::string	HTTPTypes::RESPONSE_MESSAGE_BAD_GATEWAY("Bad Gateway");
 const std::string	HTTPTypes::RESPONSE_MESSAGE_CONTINUE("Continue");
 
 // common HTTP response codes
@@ -78,6 +91,7 @@ const unsigned int	HTTPTypes::RESPONSE_CODE_OK = 200;
 const unsigned int	HTTPTypes::RESPONSE_CODE_CREATED = 201;
 const unsigned int	HTTPTypes::RESPONSE_CODE_ACCEPTED = 202;
 const unsigned int	HTTPTypes::RESPONSE_CODE_NO_CONTENT = 204;
+const unsigned int	HTTPTypes::RESPONSE_CODE_PARTIAL_CONTENT = 206;
 const unsigned int	HTTPTypes::RESPONSE_CODE_FOUND = 302;
 const unsigned int	HTTPTypes::RESPONSE_CODE_UNAUTHORIZED = 401;
 const unsigned int	HTTPTypes::RESPONSE_CODE_FORBIDDEN = 403;
@@ -85,8 +99,11 @@ const unsigned int	HTTPTypes::RESPONSE_CODE_NOT_FOUND = 404;
 const unsigned int	HTTPTypes::RESPONSE_CODE_METHOD_NOT_ALLOWED = 405;
 const unsigned int	HTTPTypes::RESPONSE_CODE_NOT_MODIFIED = 304;
 const unsigned int	HTTPTypes::RESPONSE_CODE_BAD_REQUEST = 400;
+const unsigned int	HTTPTypes::RESPONSE_CODE_RANGE_NOT_SATISFIABLE = 416;
+const unsigned int	HTTPTypes::RESPONSE_CODE_TOO_MANY_REQUESTS = 429;
 const unsigned int	HTTPTypes::RESPONSE_CODE_SERVER_ERROR = 500;
 const unsigned int	HTTPTypes::RESPONSE_CODE_NOT_IMPLEMENTED = 501;
+const unsigned int	HTTPTypes::RESPONSE_CODE_BAD_GATEWAY = 502;
 const unsigned int	HTTPTypes::RESPONSE_CODE_CONTINUE = 100;
 
 
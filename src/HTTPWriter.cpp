@@ -7,7 +7,15 @@
 // See http://www.boost.org/LICENSE_1_0.txt
 //
 
+#ifdef _MSC_VER
+	#include <io.h>
+#else
+	#include <unistd.h>
+	#include <errno.h>
+#endif
 #include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/algorithm/string/predicate.hpp>
 #include <pion/net/HTTPWriter.hpp>
 #include <pion/net/HTTPMessage.hpp>
 
@@ -16,11 +24,196 @@ namespace pion {	// begin namespace pion
 namespace net {		// begin namespace net (Pion Network Library)
 
 
+// static members of HTTPWriter
+
+const std::size_t		HTTPWriter::DEFAULT_QUEUE_HIGH_WATERMARK = 65536;
+const std::size_t		HTTPWriter::DEFAULT_QUEUE_LOW_WATERMARK = 16384;
+
+
 // HTTPWriter member functions
 
-void HTTPWriter::prepareWriteBuffers(HTTPMessage::WriteBuffers& write_buffers,
+bool HTTPWriter::writeFile(int file_fd, boost::uint64_t file_offset, std::size_t length)
+{
+	if (length == 0)
+		return true;
+	flushContentStream();
+	if (m_tcp_conn->canSendFile() && m_file_length == 0) {
+		// remember the region so that it can be sent using sendfile
+		m_file_fd = file_fd;
+		m_file_offset = file_offset;
+		m_file_length = length;
+		m_file_content_index = m_content_buffers.size();
+	} else {
+		// encrypted connection: read the region into memory
+		char *data_ptr = m_binary_cache.allocate(length);
+		if (! readFile(file_fd, file_offset, length, data_ptr))
+			return false;
+		m_content_buffers.push_back(boost::asio::buffer(data_ptr, length));
+	}
+	m_content_length += length;
+	return true;
+}
+
+bool HTTPWriter::readFile(int file_fd, boost::uint64_t file_offset,
+						  std::size_t length, char *buf)
+{
+#ifdef _MSC_VER
+	if (_lseeki64(file_fd, file_offset, SEEK_SET) < 0)
+		return false;
+	while (length > 0) {
+		const int n = _read(file_fd, buf, static_cast<unsigned int>(length));
+		if (n <= 0)
+			return false;
+		buf += n;
+		length -= n;
+	}
+#else
+	while (length > 0) {
+		const ssize_t n = ::pread(file_fd, buf, length, static_cast<off_t>(file_offset));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		buf += n;
+		file_offset += n;
+		length -= n;
+	}
+#endif
+	return true;
+}
+
+void HTTPWriter::captureMessage(const HTTPMessage::WriteBuffers& write_buffers)
+{
+	std::string message;
+	message.reserve(boost::asio::buffer_size(write_buffers) + m_file_length);
+	for (std::size_t n = 0; n <= write_buffers.size(); ++n) {
+		if (m_file_length > 0 && n == m_file_write_index) {
+			// the file region is sent separately, so read a copy of it
+			const std::size_t pos = message.size();
+			message.resize(pos + m_file_length);
+			if (! readFile(m_file_fd, m_file_offset, m_file_length, &message[pos])) {
+				PION_LOG_WARN(m_logger, "Unable to read file region for captured message");
+				return;
+			}
+		}
+		if (n < write_buffers.size()) {
+			message.append(boost::asio::buffer_cast<const char*>(write_buffers[n]),
+						   boost::asio::buffer_size(write_buffers[n]));
+		}
+	}
+	m_capture_handler(getMessage(), message);
+}
+
+void HTTPWriter::startCompression(void)
+{
+	if (! m_compression_options)
+		return;
+	
+	// never re-encode content, or compress types that do not benefit from it
+	HTTPMessage& http_message(getMessage());
+	if (http_message.hasHeader(HTTPTypes::HEADER_CONTENT_ENCODING)
+		|| ! m_compression_options->isCompressible(http_message.getHeader(HTTPTypes::HEADER_CONTENT_TYPE)))
+		return;
+	
+	// the content depends upon the request's Accept-Encoding header,
+	// which caches must take into account
+	const std::string vary(http_message.getHeader(HTTPTypes::HEADER_VARY));
+	if (vary.empty())
+		http_message.changeHeader(HTTPTypes::HEADER_VARY, HTTPTypes::HEADER_ACCEPT_ENCODING);
+	else if (vary != "*" && ! boost::algorithm::icontains(vary, HTTPTypes::HEADER_ACCEPT_ENCODING))
+		http_message.changeHeader(HTTPTypes::HEADER_VARY, vary + ", " + HTTPTypes::HEADER_ACCEPT_ENCODING);
+	
+	// the total size is only known in advance for non-chunked messages
+	if (m_accept_encoding == HTTPCompressor::ENCODING_IDENTITY
+		|| (! sendingChunkedMessage()
+			&& (m_content_length == 0 || m_content_length < m_compression_options->getMinSize())))
+		return;
+	
+	m_compressor.reset(new HTTPCompressor(m_accept_encoding, m_compression_options->getLevel()));
+	if (! m_compressor->isOpen()) {
+		PION_LOG_ERROR(m_logger, "Unable to initialize compressor; sending uncompressed content");
+		m_compressor.reset();
+		return;
+	}
+	http_message.changeHeader(HTTPTypes::HEADER_CONTENT_ENCODING,
+							  HTTPCompressor::getEncodingName(m_accept_encoding));
+}
+
+bool HTTPWriter::compressContent(const bool send_final_chunk)
+{
+	std::string compressed;
+	bool success = true;
+	
+	// compress each of the content buffers, including the file region (if any)
+	for (std::size_t n = 0; success && n <= m_content_buffers.size(); ++n) {
+		if (m_file_length > 0 && n == m_file_content_index) {
+			// file regions must be read into memory to be compressed
+			std::vector<char> file_buf(m_file_length < 65536 ? m_file_length : 65536);
+			for (std::size_t offset = 0; success && offset < m_file_length; offset += file_buf.size()) {
+				const std::size_t length = (m_file_length - offset < file_buf.size()
+											? m_file_length - offset : file_buf.size());
+				success = readFile(m_file_fd, m_file_offset + offset, length, &file_buf[0])
+					&& m_compressor->compress(&file_buf[0], length, compressed);
+			}
+		}
+		if (success && n < m_content_buffers.size()) {
+			success = m_compressor->compress(boost::asio::buffer_cast<const char*>(m_content_buffers[n]),
+											 boost::asio::buffer_size(m_content_buffers[n]),
+											 compressed);
+		}
+	}
+	
+	// make everything written so far decodable by the recipient
+	if (success) {
+		if (send_final_chunk)
+			success = m_compressor->finish(compressed);
+		else if (m_content_length > 0)
+			success = m_compressor->flush(compressed);
+	}
+	if (! success) {
+		// the headers may already have been sent, and anything else sent
+		// would not be encoded as they say: send nothing more at all
+		PION_LOG_ERROR(m_logger, "Unable to compress payload content");
+		clear();
+		m_compressor.reset();
+		m_send_failed = true;
+		return false;
+	}
+	
+	PION_LOG_DEBUG(m_logger, "Compressed " << m_content_length << " bytes of content to "
+				   << compressed.size() << " bytes");
+	
+	// replace the original content with the compressed data
+	clear();
+	if (! compressed.empty()) {
+		m_text_cache.push_back(std::string());
+		m_text_cache.back().swap(compressed);
+		m_content_buffers.push_back(boost::asio::buffer(m_text_cache.back()));
+		m_content_length = m_text_cache.back().size();
+	}
+	
+	// release the compressor once the stream has been finished
+	if (send_final_chunk)
+		m_compressor.reset();
+	return true;
+}
+
+bool HTTPWriter::prepareWriteBuffers(HTTPMessage::WriteBuffers& write_buffers,
 									 const bool send_final_chunk)
 {
+	// nothing more is sent once part of the message could not be prepared
+	if (m_send_failed) {
+		clear();
+		return false;
+	}
+	
+	// compression must be decided before the headers are prepared since
+	// it changes the headers and the content length
+	if (! m_sent_headers)
+		startCompression();
+	if (m_compressor && ! compressContent(send_final_chunk || ! sendingChunkedMessage()))
+		return false;
+	
 	// check if the HTTP headers have been sent yet
 	if (! m_sent_headers) {
 		// initialize write buffers for send operation
@@ -50,12 +243,14 @@ void HTTPWriter::prepareWriteBuffers(HTTPMessage::WriteBuffers& write_buffers,
 			write_buffers.push_back(boost::asio::buffer(HTTPTypes::STRING_CRLF));
 			
 			// append response content buffers
+			m_file_write_index = write_buffers.size() + m_file_content_index;
 			write_buffers.insert(write_buffers.end(), m_content_buffers.begin(),
 								 m_content_buffers.end());
 			// append an extra CRLF for chunk formatting
 			write_buffers.push_back(boost::asio::buffer(HTTPTypes::STRING_CRLF));
 		} else {
 			// append response content buffers
+			m_file_write_index = write_buffers.size() + m_file_content_index;
 			write_buffers.insert(write_buffers.end(), m_content_buffers.begin(),
 								 m_content_buffers.end());
 		}
@@ -71,6 +266,176 @@ void HTTPWriter::prepareWriteBuffers(HTTPMessage::WriteBuffers& write_buffers,
 		write_buffers.push_back(boost::asio::buffer(HTTPTypes::STRING_CRLF));
 		write_buffers.push_back(boost::asio::buffer(HTTPTypes::STRING_CRLF));
 	}
+	return true;
+}
+
+bool HTTPWriter::queueMoreData(const bool send_final_chunk)
+{
+	WriteHandler finished_handler;
+	boost::system::error_code ec;
+	bool queue_writable;
+	{
+		boost::mutex::scoped_lock queue_lock(m_queue_mutex);
+
+		// ignore any data written after the final chunk or after an error
+		if (m_queue_closed) {
+			clear();
+			return false;
+		}
+
+		m_sending_chunks = true;
+		if (!supportsChunkedMessages()) {
+			// sending data in chunks, but the client does not support chunking;
+			// make sure that the connection will be closed when we are all done
+			m_tcp_conn->setLifecycle(TCPConnection::LIFECYCLE_CLOSE);
+		}
+
+		// serialize the headers (first time only) & buffered content into a
+		// string owned by the queue so that the producer may keep writing
+		flushContentStream();
+		HTTPMessage::WriteBuffers write_buffers;
+		bool chunk_ok = prepareWriteBuffers(write_buffers, send_final_chunk);
+		std::string chunk;
+		chunk.reserve(boost::asio::buffer_size(write_buffers) + m_file_length);
+		for (std::size_t n = 0; chunk_ok && n <= write_buffers.size(); ++n) {
+			if (m_file_length > 0 && n == m_file_write_index) {
+				// the queue owns its data, so file regions are read into memory
+				const std::size_t pos = chunk.size();
+				chunk.resize(pos + m_file_length);
+				if (! readFile(m_file_fd, m_file_offset, m_file_length, &chunk[pos])) {
+					PION_LOG_ERROR(m_logger, "Unable to read file region for queued chunk");
+					chunk_ok = false;
+				}
+			}
+			if (chunk_ok && n < write_buffers.size()) {
+				chunk.append(boost::asio::buffer_cast<const char*>(write_buffers[n]),
+							 boost::asio::buffer_size(write_buffers[n]));
+			}
+		}
+		clear();
+
+		if (! chunk_ok) {
+			if (abortQueue(boost::system::errc::make_error_code(boost::system::errc::io_error))) {
+				ec = m_queue_error;
+				finished_handler = bindToWriteHandler();
+			}
+		} else {
+			if (! chunk.empty()) {
+				m_queued_bytes += chunk.size();
+				m_queue_pending.push_back(std::string());
+				m_queue_pending.back().swap(chunk);
+			}
+			if (send_final_chunk)
+				m_queue_closed = true;
+
+			if (! m_tcp_conn->is_open()) {
+				// make sure that we did not lose the TCP connection
+				m_queue_closed = true;
+				if (m_queue_bytes_in_flight == 0) {
+					m_queue_pending.clear();
+					m_queued_bytes = 0;
+					ec = boost::asio::error::connection_reset;
+					finished_handler = bindToWriteHandler();
+				}
+			} else if (m_queue_bytes_in_flight == 0) {
+				if (! m_queue_pending.empty()) {
+					// nothing is being sent right now: start a new write operation
+					startQueuedWrite(bindToWriteHandler());
+				} else if (send_final_chunk) {
+					// nothing left to send (i.e. no content for a non-chunked client)
+					finished_handler = bindToWriteHandler();
+				}
+			}
+		}
+
+		queue_writable = (!m_queue_closed && m_queued_bytes < m_queue_high_watermark);
+		if (! queue_writable && ! m_queue_closed)
+			m_queue_blocked = true;
+	}
+
+	if (finished_handler)
+		finished_handler(ec, m_queue_bytes_sent);
+	return queue_writable;
+}
+
+bool HTTPWriter::abortQueue(const boost::system::error_code& ec)
+{
+	// the length of the chunk (or message) has already been sent, so the
+	// message cannot be completed: drop everything that is waiting, and
+	// close the connection once the write in flight (if any) is done
+	m_queue_error = ec;
+	m_queue_closed = true;
+	m_queue_blocked = false;
+	m_queue_pending.clear();
+	m_queued_bytes = m_queue_bytes_in_flight;
+	m_tcp_conn->setLifecycle(TCPConnection::LIFECYCLE_CLOSE);
+	return m_queue_bytes_in_flight == 0;
+}
+
+void HTTPWriter::startQueuedWrite(WriteHandler finished_handler)
+{
+	// coalesce everything waiting in the queue into a single write operation
+	m_queue_in_flight.splice(m_queue_in_flight.end(), m_queue_pending);
+	HTTPMessage::WriteBuffers write_buffers;
+	write_buffers.reserve(m_queue_in_flight.size());
+	m_queue_bytes_in_flight = 0;
+	for (WriteQueue::const_iterator i = m_queue_in_flight.begin();
+		 i != m_queue_in_flight.end(); ++i)
+	{
+		write_buffers.push_back(boost::asio::buffer(*i));
+		m_queue_bytes_in_flight += i->size();
+	}
+	PION_LOG_DEBUG(m_logger, "Writing " << m_queue_in_flight.size() << " queued chunks ("
+				   << m_queue_bytes_in_flight << " bytes)");
+	m_tcp_conn->async_write(write_buffers,
+							boost::bind(&HTTPWriter::handleQueuedWrite, this, finished_handler,
+										boost::asio::placeholders::error,
+										boost::asio::placeholders::bytes_transferred));
+}
+
+void HTTPWriter::handleQueuedWrite(WriteHandler finished_handler,
+								   const boost::system::error_code& write_error,
+								   std::size_t bytes_written)
+{
+	// note: finished_handler is bound to a shared pointer for the derived
+	// writer, which keeps this object alive until the queue has been drained
+	WritableHandler writable_handler;
+	boost::system::error_code finished_error(write_error);
+	bool finished = false;
+	{
+		boost::mutex::scoped_lock queue_lock(m_queue_mutex);
+		m_queue_in_flight.clear();
+		m_queued_bytes -= m_queue_bytes_in_flight;
+		m_queue_bytes_in_flight = 0;
+		m_queue_bytes_sent += bytes_written;
+
+		if (write_error) {
+			// drop everything else and tell the producer that we are done
+			m_queue_pending.clear();
+			m_queued_bytes = 0;
+			m_queue_closed = true;
+			m_queue_blocked = false;
+			finished = true;
+		} else if (! m_queue_pending.empty()) {
+			startQueuedWrite(finished_handler);
+		} else if (m_queue_closed) {
+			// report any chunk that could not be queued after this write began
+			if (! finished_error)
+				finished_error = m_queue_error;
+			finished = true;
+		}
+
+		// wake up the producer once the queue drains below the low watermark
+		if (m_queue_blocked && m_queued_bytes <= m_queue_low_watermark) {
+			m_queue_blocked = false;
+			writable_handler = m_writable_handler;
+		}
+	}
+
+	if (writable_handler)
+		writable_handler();
+	if (finished)
+		finished_handler(finished_error, m_queue_bytes_sent);
 }
 
 }	// end namespace net
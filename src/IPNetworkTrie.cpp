@@ -0,0 +1,135 @@
+// ------------------------------------------------------------------
+// pion-net: a C++ framework for building lightweight HTTP interfaces
+// ------------------------------------------------------------------
+// Copyright (C) 2007-2010 Atomic Labs, Inc.  (http://www.atomiclabs.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include <cstdlib>
+#include <pion/net/IPNetworkTrie.hpp>
+
+
+namespace pion {	// begin namespace pion
+namespace net {		// begin namespace net (Pion Network Library)
+
+
+// static members of IPNetworkTrie
+
+const boost::uint32_t	IPNetworkTrie::IPV4_ROOT = 0;
+const boost::uint32_t	IPNetworkTrie::IPV6_ROOT = 1;
+IPNetworkTrie *			IPNetworkTrie::m_private_networks_ptr = NULL;
+boost::once_flag		IPNetworkTrie::m_private_flag = BOOST_ONCE_INIT;
+
+
+// IPNetworkTrie member functions
+
+IPNetworkTrie::IPNetworkTrie(void)
+	: m_nodes(2), m_empty(true)
+{}
+
+void IPNetworkTrie::insert(const std::string& network)
+{
+	const std::string::size_type slash = network.find('/');
+	boost::system::error_code ec;
+	const boost::asio::ip::address address(boost::asio::ip::address::from_string(network.substr(0, slash), ec));
+	if (ec)
+		throw BadNetworkException(network);
+
+	unsigned int prefix_length = (address.is_v4() ? 32 : 128);
+	if (slash != std::string::npos) {
+		const std::string length_str(network.substr(slash + 1));
+		char *end_ptr = NULL;
+		const unsigned long length = std::strtoul(length_str.c_str(), &end_ptr, 10);
+		if (length_str.empty() || *end_ptr != '\0' || length > prefix_length)
+			throw BadNetworkException(network);
+		prefix_length = static_cast<unsigned int>(length);
+	}
+	insert(address, prefix_length);
+}
+
+void IPNetworkTrie::insert(const boost::asio::ip::address& address, unsigned int prefix_length)
+{
+	if (address.is_v4()) {
+		if (prefix_length > 32)
+			throw BadNetworkException(address.to_string());
+		const boost::asio::ip::address_v4::bytes_type bytes(address.to_v4().to_bytes());
+		insert(bytes.data(), prefix_length, IPV4_ROOT);
+	} else {
+		if (prefix_length > 128)
+			throw BadNetworkException(address.to_string());
+		const boost::asio::ip::address_v6::bytes_type bytes(address.to_v6().to_bytes());
+		insert(bytes.data(), prefix_length, IPV6_ROOT);
+	}
+	m_empty = false;
+}
+
+bool IPNetworkTrie::contains(const boost::asio::ip::address& address) const
+{
+	if (m_empty)
+		return false;
+	if (address.is_v4()) {
+		const boost::asio::ip::address_v4::bytes_type bytes(address.to_v4().to_bytes());
+		return contains(bytes.data(), 32, IPV4_ROOT);
+	}
+	const boost::asio::ip::address_v6 address_v6(address.to_v6());
+	if (address_v6.is_v4_mapped()) {
+		const boost::asio::ip::address_v4::bytes_type bytes(address_v6.to_v4().to_bytes());
+		return contains(bytes.data(), 32, IPV4_ROOT);
+	}
+	const boost::asio::ip::address_v6::bytes_type bytes(address_v6.to_bytes());
+	return contains(bytes.data(), 128, IPV6_ROOT);
+}
+
+void IPNetworkTrie::insert(const unsigned char *bytes, unsigned int prefix_length,
+						   boost::uint32_t root)
+{
+	boost::uint32_t node = root;
+	for (unsigned int n = 0; n < prefix_length; ++n) {
+		// a network that is already in the set includes this one
+		if (m_nodes[node].m_network)
+			return;
+		const unsigned int bit = (bytes[n / 8] >> (7 - n % 8)) & 1;
+		if (m_nodes[node].m_children[bit] == 0) {
+			m_nodes[node].m_children[bit] = static_cast<boost::uint32_t>(m_nodes.size());
+			m_nodes.push_back(Node());
+		}
+		node = m_nodes[node].m_children[bit];
+	}
+	// the networks within this one are no longer needed
+	m_nodes[node].m_network = true;
+	m_nodes[node].m_children[0] = m_nodes[node].m_children[1] = 0;
+}
+
+bool IPNetworkTrie::contains(const unsigned char *bytes, unsigned int num_bits,
+							 boost::uint32_t root) const
+{
+	boost::uint32_t node = root;
+	for (unsigned int n = 0; ! m_nodes[node].m_network; ++n) {
+		if (n == num_bits)
+			return false;
+		node = m_nodes[node].m_children[(bytes[n / 8] >> (7 - n % 8)) & 1];
+		if (node == 0)
+			return false;
+	}
+	return true;
+}
+
+void IPNetworkTrie::createPrivateNetworks(void)
+{
+	static IPNetworkTrie private_networks;
+	private_networks.insert("127.0.0.0/8");		// loopback
+	private_networks.insert("10.0.0.0/8");		// private (RFC 1918)
+	private_networks.insert("172.16.0.0/12");
+	private_networks.insert("192.168.0.0/16");
+	private_networks.insert("169.254.0.0/16");	// link-local
+	private_networks.insert("::1/128");			// loopback
+	private_networks.insert("fc00::/7");		// unique local (RFC 4193)
+	private_networks.insert("fe80::/10");		// link-local
+	m_private_networks_ptr = &private_networks;
+}
+
+
+}	// end namespace net
+}	// end namespace pion
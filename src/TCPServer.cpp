@@ -130,6 +130,9 @@ void TCPServer::stop(bool wait_until_finished)
 			std::for_each(m_conn_pool.begin(), m_conn_pool.end(),
 						  boost::bind(&TCPConnection::close, _1));
 		}
+
+		// release anything that is holding connections open
+		beforeStopping();
 	
 		// wait for all pending connections to complete
 		while (! m_conn_pool.empty()) {
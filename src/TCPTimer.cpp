@@ -19,7 +19,8 @@ namespace net {		// begin namespace net (Pion Network Library)
 
 TCPTimer::TCPTimer(TCPConnectionPtr& conn_ptr)
 	: m_conn_ptr(conn_ptr), m_timer(conn_ptr->getIOService()),
-	m_timer_active(false), m_was_cancelled(false)
+	m_allocator(new HandlerAllocator), m_spare_allocator(new HandlerAllocator),
+	m_generation(0), m_timer_active(false), m_was_cancelled(false)
 {
 }
 
@@ -27,9 +28,14 @@ void TCPTimer::start(const boost::uint32_t seconds)
 {
 	boost::mutex::scoped_lock timer_lock(m_mutex);
 	m_timer_active = true;
+	m_was_cancelled = false;
+	++m_generation;
 	m_timer.expires_from_now(boost::posix_time::seconds(seconds));
-	m_timer.async_wait(boost::bind(&TCPTimer::timerCallback,
-		shared_from_this(), _1));
+	// the wait that was last cancelled may not have finished yet (if neither
+	// arena is free, the allocator falls back to the heap)
+	const HandlerAllocatorPtr& allocator = (m_allocator->isInUse() ? m_spare_allocator : m_allocator);
+	m_timer.async_wait(makeAllocHandler(allocator,
+		boost::bind(&TCPTimer::timerCallback, shared_from_this(), _1, m_generation)));
 }
 
 void TCPTimer::cancel(void)
@@ -40,12 +46,18 @@ void TCPTimer::cancel(void)
 		m_timer.cancel();
 }
 
-void TCPTimer::timerCallback(const boost::system::error_code& ec)
+void TCPTimer::timerCallback(const boost::system::error_code& ec, unsigned long generation)
 {
 	boost::mutex::scoped_lock timer_lock(m_mutex);
+	// ignore waits that finished before the timer was started again
+	if (generation != m_generation)
+		return;
 	m_timer_active = false;
-	if (! m_was_cancelled)
-		m_conn_ptr->close();
+	if (! m_was_cancelled) {
+		TCPConnectionPtr conn_ptr(m_conn_ptr.lock());
+		if (conn_ptr)
+			conn_ptr->close();
+	}
 }
 
 
@@ -85,6 +85,8 @@ void WebServer::loadServiceConfig(const std::string& config_name)
 	
 	// parse the contents of the file
 	HTTPAuthPtr auth_ptr;
+	PionUserManagerPtr user_manager;
+	PionUserManager::UserList users;	// added all at once, when parsing is finished
 	enum ParseState {
 		PARSE_NEWLINE, PARSE_COMMAND, PARSE_RESOURCE, PARSE_VALUE, PARSE_COMMENT, PARSE_USERNAME
 	} parse_state = PARSE_NEWLINE;
@@ -189,7 +191,10 @@ void WebServer::loadServiceConfig(const std::string& config_name)
 					}
 				} else if (command_string == "auth") {
 					// finished auth command
-					PionUserManagerPtr user_manager(new PionUserManager);
+					if (user_manager)
+						user_manager->addUsers(users);
+					users.clear();
+					user_manager.reset(new PionUserManager);
 					if (value_string == "basic"){
 						auth_ptr.reset(new HTTPBasicAuth(user_manager));
 					}
@@ -212,7 +217,7 @@ void WebServer::loadServiceConfig(const std::string& config_name)
 						throw AuthConfigException("Authentication type must be defined before users");
 					else if (value_string.empty())
 						throw AuthConfigException("No password defined for user parameter");
-					auth_ptr->addUser(username_string, value_string);
+					users.push_back(std::make_pair(username_string, value_string));
 				} else if (command_string == "service") {
 					// finished service command
 					loadService(resource_string, value_string);
@@ -250,6 +255,8 @@ void WebServer::loadServiceConfig(const std::string& config_name)
 	}
 	
 	// update authentication configuration for the server
+	if (user_manager)
+		user_manager->addUsers(users);
 	setAuthentication(auth_ptr);
 }
 
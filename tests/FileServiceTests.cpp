@@ -7,6 +7,7 @@
 // See http://www.boost.org/LICENSE_1_0.txt
 //
 
+#include <ctime>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 #include <boost/scoped_array.hpp>
@@ -24,6 +25,8 @@
 #include <pion/net/HTTPResponse.hpp>
 #include <pion/net/WebService.hpp>
 #include <pion/net/WebServer.hpp>
+#include <pion/net/HTTPCompressor.hpp>
+#include "../services/FileService.hpp"
 
 using namespace pion;
 using namespace pion::net;
@@ -31,6 +34,23 @@ using boost::asio::ip::tcp;
 
 PION_DECLARE_PLUGIN(FileService)
 
+namespace pion {	// begin namespace pion
+namespace plugins {	// begin namespace plugins
+
+///
+/// FileServiceTester: holds the scans of a FileService in the background, so
+///                    that tests may make requests while a scan is in progress
+///
+class FileServiceTester {
+public:
+	static inline void holdScanning(FileService& service, bool hold) {
+		service.m_scan_held.store(hold);
+	}
+};
+
+}	// end namespace plugins
+}	// end namespace pion
+
 #if defined(PION_XCODE)
 	static const std::string PATH_TO_PLUGINS(".");
 #else
@@ -107,6 +127,13 @@ public:
 	}
 	
 	inline boost::asio::io_service& getIOService(void) { return m_scheduler.getIOService(); }
+
+	/// returns the FileService that was loaded for "/resource1"
+	inline pion::plugins::FileService& getFileService(void) {
+		WebService *service_ptr = m_server.getService("/resource1");
+		BOOST_REQUIRE(service_ptr != NULL);
+		return *static_cast<pion::plugins::FileService*>(service_ptr);
+	}
 	
 	PionSingleServiceScheduler	m_scheduler;
 	WebServer					m_server;
@@ -158,6 +185,112 @@ BOOST_AUTO_TEST_CASE(checkSetServiceOptionWritableToNonBooleanThrows) {
 	//Original exception is FileService::InvalidOptionValueException
 }
 
+BOOST_AUTO_TEST_CASE(checkSetServiceOptionCompressWithValidValuesDoesntThrow) {
+	BOOST_CHECK_NO_THROW(m_server.setServiceOption("/resource1", "compress", "0"));
+	BOOST_CHECK_NO_THROW(m_server.setServiceOption("/resource1", "compress", "1"));
+	BOOST_CHECK_NO_THROW(m_server.setServiceOption("/resource1", "compress", "2"));
+}
+
+BOOST_AUTO_TEST_CASE(checkSetServiceOptionCompressWithInvalidValueThrows) {
+	BOOST_CHECK_THROW(m_server.setServiceOption("/resource1", "compress", "3"), WebServer::WebServiceException);
+}
+
+BOOST_AUTO_TEST_CASE(checkSetServiceOptionCompressSettingsWithValidValuesDoesntThrow) {
+	BOOST_CHECK_NO_THROW(m_server.setServiceOption("/resource1", "compress_level", "1"));
+	BOOST_CHECK_NO_THROW(m_server.setServiceOption("/resource1", "compress_level", "9"));
+	BOOST_CHECK_NO_THROW(m_server.setServiceOption("/resource1", "compress_min_size", "0"));
+	BOOST_CHECK_NO_THROW(m_server.setServiceOption("/resource1", "compress_types", "text/, application/json"));
+}
+
+BOOST_AUTO_TEST_CASE(checkSetServiceOptionCompressSettingsWithInvalidValuesThrow) {
+	BOOST_CHECK_THROW(m_server.setServiceOption("/resource1", "compress_level", "0"), WebServer::WebServiceException);
+	BOOST_CHECK_THROW(m_server.setServiceOption("/resource1", "compress_level", "fast"), WebServer::WebServiceException);
+	BOOST_CHECK_THROW(m_server.setServiceOption("/resource1", "compress_min_size", "small"), WebServer::WebServiceException);
+}
+
+BOOST_AUTO_TEST_CASE(checkSetServiceOptionCacheSizeWithValidValuesDoesntThrow) {
+	BOOST_CHECK_NO_THROW(m_server.setServiceOption("/resource1", "cache_size", "0"));
+	BOOST_CHECK_NO_THROW(m_server.setServiceOption("/resource1", "cache_size", "1048576"));
+}
+
+BOOST_AUTO_TEST_CASE(checkSetServiceOptionCacheSizeWithInvalidValueThrows) {
+	BOOST_CHECK_THROW(m_server.setServiceOption("/resource1", "cache_size", "lots"), WebServer::WebServiceException);
+}
+
+BOOST_AUTO_TEST_CASE(checkSetServiceOptionMmapWithValidValuesDoesntThrow) {
+	BOOST_CHECK_NO_THROW(m_server.setServiceOption("/resource1", "mmap", "true"));
+	BOOST_CHECK_NO_THROW(m_server.setServiceOption("/resource1", "mmap", "false"));
+}
+
+BOOST_AUTO_TEST_CASE(checkSetServiceOptionMmapToNonBooleanThrows) {
+	BOOST_CHECK_THROW(m_server.setServiceOption("/resource1", "mmap", "3"), WebServer::WebServiceException);
+}
+
+BOOST_AUTO_TEST_CASE(checkSetServiceOptionWatchWithValidValuesDoesntThrow) {
+	BOOST_CHECK_NO_THROW(m_server.setServiceOption("/resource1", "watch", "true"));
+	BOOST_CHECK_NO_THROW(m_server.setServiceOption("/resource1", "watch", "false"));
+}
+
+BOOST_AUTO_TEST_CASE(checkSetServiceOptionWatchToNonBooleanThrows) {
+	BOOST_CHECK_THROW(m_server.setServiceOption("/resource1", "watch", "yes"), WebServer::WebServiceException);
+}
+
+BOOST_AUTO_TEST_CASE(checkSetServiceOptionETagWithValidValuesDoesntThrow) {
+	BOOST_CHECK_NO_THROW(m_server.setServiceOption("/resource1", "etag", "stat"));
+	BOOST_CHECK_NO_THROW(m_server.setServiceOption("/resource1", "etag", "hash"));
+}
+
+BOOST_AUTO_TEST_CASE(checkSetServiceOptionETagWithInvalidValueThrows) {
+	BOOST_CHECK_THROW(m_server.setServiceOption("/resource1", "etag", "md5"), WebServer::WebServiceException);
+}
+
+BOOST_AUTO_TEST_CASE(checkSetServiceOptionMaxAgeWithValidValuesDoesntThrow) {
+	BOOST_CHECK_NO_THROW(m_server.setServiceOption("/resource1", "max_age", "60"));
+	BOOST_CHECK_NO_THROW(m_server.setServiceOption("/resource1", "max_age", "/images/=86400"));
+}
+
+BOOST_AUTO_TEST_CASE(checkSetServiceOptionMaxAgeWithInvalidValueThrows) {
+	BOOST_CHECK_THROW(m_server.setServiceOption("/resource1", "max_age", "images=soon"), WebServer::WebServiceException);
+}
+
+BOOST_AUTO_TEST_CASE(checkSetServiceOptionIOThreadsWithValidValuesDoesntThrow) {
+	BOOST_CHECK_NO_THROW(m_server.setServiceOption("/resource1", "io_threads", "0"));
+	BOOST_CHECK_NO_THROW(m_server.setServiceOption("/resource1", "io_threads", "4"));
+}
+
+BOOST_AUTO_TEST_CASE(checkSetServiceOptionIOThreadsWithInvalidValueThrows) {
+	BOOST_CHECK_THROW(m_server.setServiceOption("/resource1", "io_threads", "many"), WebServer::WebServiceException);
+}
+
+BOOST_AUTO_TEST_CASE(checkSetServiceOptionScanThreadsWithValidValuesDoesntThrow) {
+	BOOST_CHECK_NO_THROW(m_server.setServiceOption("/resource1", "scan_threads", "1"));
+	BOOST_CHECK_NO_THROW(m_server.setServiceOption("/resource1", "scan_threads", "8"));
+}
+
+BOOST_AUTO_TEST_CASE(checkSetServiceOptionScanThreadsWithInvalidValuesThrows) {
+	BOOST_CHECK_THROW(m_server.setServiceOption("/resource1", "scan_threads", "0"), WebServer::WebServiceException);
+	BOOST_CHECK_THROW(m_server.setServiceOption("/resource1", "scan_threads", "all"), WebServer::WebServiceException);
+}
+
+BOOST_AUTO_TEST_CASE(checkSetServiceOptionLazyScanWithValidValuesDoesntThrow) {
+	BOOST_CHECK_NO_THROW(m_server.setServiceOption("/resource1", "lazy_scan", "true"));
+	BOOST_CHECK_NO_THROW(m_server.setServiceOption("/resource1", "lazy_scan", "false"));
+}
+
+BOOST_AUTO_TEST_CASE(checkSetServiceOptionLazyScanToNonBooleanThrows) {
+	BOOST_CHECK_THROW(m_server.setServiceOption("/resource1", "lazy_scan", "later"), WebServer::WebServiceException);
+}
+
+BOOST_AUTO_TEST_CASE(checkScanManifestIsSavedWhenStarted) {
+	m_server.setServiceOption("/resource1", "directory", "sandbox");
+	m_server.setServiceOption("/resource1", "scan", "1");
+	m_server.setServiceOption("/resource1", "scan_manifest", "sandbox.manifest");
+	m_server.start();
+	BOOST_CHECK(boost::filesystem::exists("sandbox.manifest"));
+	m_server.stop();
+	boost::filesystem::remove("sandbox.manifest");
+}
+
 BOOST_AUTO_TEST_CASE(checkSetServiceOptionWithInvalidOptionNameThrows) {
 	BOOST_CHECK_THROW(m_server.setServiceOption("/resource1", "NotAnOption", "value1"), WebServer::WebServiceException);
 }
@@ -178,6 +311,16 @@ public:
 	}
 	~RunningFileService_F() {
 	}
+
+	/// restarts the server (for options that take effect when the service starts)
+	inline void restartServer(void) {
+		m_server.stop();
+		m_server.start();
+		m_http_stream.close();
+		m_http_stream.clear();
+		tcp::endpoint http_endpoint(boost::asio::ip::address::from_string("127.0.0.1"), m_server.getPort());
+		m_http_stream.connect(http_endpoint);
+	}
 	
 	/**
 	 * sends a request to the local HTTP server
@@ -277,6 +420,15 @@ public:
 		BOOST_CHECK(boost::regex_match(content_buf.get(), content_regex));
 	}
 	
+	/// reads all of the response content
+	inline std::string readResponseContent(void)
+	{
+		std::string content(m_content_length, '\0');
+		if (m_content_length > 0)
+			BOOST_CHECK(m_http_stream.read(&content[0], m_content_length));
+		return content;
+	}
+	
 	unsigned long m_content_length;
 	tcp::iostream m_http_stream;
 	std::map<std::string, std::string> m_response_headers;
@@ -311,6 +463,254 @@ BOOST_AUTO_TEST_CASE(checkResponseToGetRequestForSpecifiedFile) {
 	checkWebServerResponseContent(boost::regex("xyz\\s*"));
 }
 
+BOOST_AUTO_TEST_CASE(checkResponseToGetRequestForUpdatedFile) {
+	sendRequestAndCheckResponseHead("GET", "/resource1/file2");
+	checkWebServerResponseContent(boost::regex("xyz\\s*"));
+
+	// the cached file is reloaded because its size has changed
+	boost::filesystem::ofstream file2("sandbox/file2");
+	file2 << "uvwxyz" << std::endl;
+	file2.close();
+	sendRequestAndCheckResponseHead("GET", "/resource1/file2");
+	checkWebServerResponseContent(boost::regex("uvwxyz\\s*"));
+}
+
+BOOST_AUTO_TEST_CASE(checkResponseToGetRequestForMappedFile) {
+	m_server.setServiceOption("/resource1", "cache", "2");
+	m_server.setServiceOption("/resource1", "mmap", "true");
+	boost::filesystem::ofstream file6("sandbox/file6");
+	for (int n = 0; n < 1000; ++n)
+		file6 << "mapped content" << std::endl;
+	file6.close();
+	sendRequestAndCheckResponseHead("GET", "/resource1/file6");
+	BOOST_CHECK_EQUAL(m_content_length, boost::filesystem::file_size("sandbox/file6"));
+	checkWebServerResponseContent(boost::regex("(mapped content\\s*){1000}"));
+
+	// the file is truncated in place, so it is mapped again (although the
+	// cache is not otherwise checked for updates)
+	file6.open("sandbox/file6", std::ios::out | std::ios::trunc);
+	file6 << "short" << std::endl;
+	file6.close();
+	sendRequestAndCheckResponseHead("GET", "/resource1/file6");
+	checkWebServerResponseContent(boost::regex("short\\s*"));
+}
+
+BOOST_AUTO_TEST_CASE(checkCachedFilesAreEvictedToStayWithinCacheSize) {
+	const unsigned long CACHE_SIZE = 8000;
+	const unsigned int NUM_FILES = 5;
+	m_server.setServiceOption("/resource1", "cache_size",
+							  boost::lexical_cast<std::string>(CACHE_SIZE));
+	for (unsigned int n = 0; n < NUM_FILES; ++n) {
+		boost::filesystem::ofstream big_file("sandbox/big" + boost::lexical_cast<std::string>(n));
+		big_file << std::string(3000, 'a' + n);
+	}
+
+	// the files do not all fit, so some are released, but all are still served
+	for (unsigned int round = 0; round < 2; ++round) {
+		for (unsigned int n = 0; n < NUM_FILES; ++n) {
+			sendRequestAndCheckResponseHead("GET", "/resource1/big" + boost::lexical_cast<std::string>(n));
+			BOOST_CHECK_EQUAL(m_content_length, 3000UL);
+			checkWebServerResponseContent(boost::regex(std::string(1, 'a' + n) + "{3000}"));
+			BOOST_CHECK(getFileService().getCacheBytes() <= CACHE_SIZE);
+		}
+	}
+	BOOST_CHECK(getFileService().getCacheEvictions() > 0);
+	BOOST_CHECK(getFileService().getCacheBytes() > 0);
+}
+
+BOOST_AUTO_TEST_CASE(checkWatchedFileIsUpdatedWhenItChanges) {
+	// the watcher is started with the service
+	m_server.setServiceOption("/resource1", "cache", "1");
+	m_server.setServiceOption("/resource1", "watch", "true");
+	restartServer();
+
+	sendRequestAndCheckResponseHead("GET", "/resource1/file2");
+	checkWebServerResponseContent(boost::regex("xyz\\s*"));
+
+	// the file keeps its size (and probably its timestamp), so only the
+	// watcher can tell that it has changed
+	boost::filesystem::ofstream file2("sandbox/file2");
+	file2 << "XYZ" << std::endl;
+	file2.close();
+	PionScheduler::sleep(0, 500000000);	// 0.5 seconds
+	sendRequestAndCheckResponseHead("GET", "/resource1/file2");
+	checkWebServerResponseContent(boost::regex("XYZ\\s*"));
+
+	boost::filesystem::remove("sandbox/file2");
+	PionScheduler::sleep(0, 500000000);	// 0.5 seconds
+	sendRequestAndCheckResponseHead("GET", "/resource1/file2", 404);
+	checkWebServerResponseContent(boost::regex(".*404\\sNot\\sFound.*"));
+}
+
+BOOST_AUTO_TEST_CASE(checkFilesAreReadByDiskIOThreads) {
+	// the disk I/O threads are started with the service
+	m_server.setServiceOption("/resource1", "cache", "0");
+	m_server.setServiceOption("/resource1", "io_threads", "2");
+	restartServer();
+	std::string file_content;
+	for (unsigned int n = 0; file_content.size() < 200000; ++n)
+		file_content += "line " + boost::lexical_cast<std::string>(n) + '\n';
+	boost::filesystem::ofstream large_file("sandbox/large");
+	large_file << file_content;
+	large_file.close();
+
+	for (unsigned int n = 0; n < 3; ++n) {
+		sendRequestAndCheckResponseHead("GET", "/resource1/large");
+		BOOST_REQUIRE_EQUAL(m_content_length, file_content.size());
+		BOOST_CHECK(readResponseContent() == file_content);
+	}
+
+	m_http_stream << "GET /resource1/large HTTP/1.1" << HTTPTypes::STRING_CRLF
+		<< "Range: bytes=100000-150000" << HTTPTypes::STRING_CRLF << HTTPTypes::STRING_CRLF;
+	m_http_stream.flush();
+	checkResponseHead(206);
+	BOOST_REQUIRE_EQUAL(m_content_length, 50001UL);
+	BOOST_CHECK(readResponseContent() == file_content.substr(100000, 50001));
+}
+
+BOOST_AUTO_TEST_CASE(checkFileChangedBeforeItIsReadByDiskIOThreadsGetsServerError) {
+	// the file is too large to be cached, and cache = 2 does not check it
+	// for updates, so it is only found to have changed when it is read
+	m_server.setServiceOption("/resource1", "cache", "2");
+	m_server.setServiceOption("/resource1", "cache_size", "1000");
+	m_server.setServiceOption("/resource1", "io_threads", "2");
+	restartServer();
+	const std::string file_content(200000, 'a');
+	boost::filesystem::ofstream large_file("sandbox/large");
+	large_file << file_content;
+	large_file.close();
+	sendRequestAndCheckResponseHead("GET", "/resource1/large");
+	BOOST_REQUIRE_EQUAL(m_content_length, file_content.size());
+	BOOST_CHECK(readResponseContent() == file_content);
+
+	large_file.open("sandbox/large", std::ios::out | std::ios::trunc);
+	large_file << "short" << std::endl;
+	large_file.close();
+	sendRequestAndCheckResponseHead("GET", "/resource1/large", 500);
+	readResponseContent();
+
+	boost::filesystem::remove("sandbox/large");
+	sendRequestAndCheckResponseHead("GET", "/resource1/large", 500);
+	readResponseContent();
+
+	// the connection is still usable
+	sendRequestAndCheckResponseHead("GET", "/resource1/file2");
+	checkWebServerResponseContent(boost::regex("xyz\\s*"));
+}
+
+BOOST_AUTO_TEST_CASE(checkUnchangedDirectoriesAreReusedFromScanManifest) {
+	boost::filesystem::ofstream file4("sandbox/dir1/file4");
+	file4 << "def" << std::endl;
+	file4.close();
+	// directories modified since a scan started are not saved in the manifest
+	boost::filesystem::last_write_time("sandbox/dir1", std::time(NULL) - 60);
+	boost::filesystem::last_write_time("sandbox", std::time(NULL) - 60);
+	m_server.setServiceOption("/resource1", "scan", "1");
+	m_server.setServiceOption("/resource1", "scan_manifest", "sandbox.manifest");
+	restartServer();
+
+	// files added without changing the directories' timestamps are only
+	// found if the directories are listed again
+	const std::time_t saved_time = boost::filesystem::last_write_time("sandbox");
+	const std::time_t saved_dir1_time = boost::filesystem::last_write_time("sandbox/dir1");
+	boost::filesystem::ofstream file6("sandbox/file6");
+	file6 << "jkl" << std::endl;
+	file6.close();
+	boost::filesystem::ofstream file7("sandbox/dir1/file7");
+	file7 << "mno" << std::endl;
+	file7.close();
+	boost::filesystem::last_write_time("sandbox/dir1", saved_dir1_time);
+	boost::filesystem::last_write_time("sandbox", saved_time);
+
+	// the second scan lists neither directory, but still finds their files
+	restartServer();
+	sendRequestAndCheckResponseHead("GET", "/resource1/file2");
+	checkWebServerResponseContent(boost::regex("xyz\\s*"));
+	sendRequestAndCheckResponseHead("GET", "/resource1/dir1/file4");
+	checkWebServerResponseContent(boost::regex("def\\s*"));
+
+	// files that were not scanned are refused (scan = 1)
+	sendRequestAndCheckResponseHead("GET", "/resource1/file6", 404);
+	checkWebServerResponseContent(boost::regex(".*404\\sNot\\sFound.*"));
+	sendRequestAndCheckResponseHead("GET", "/resource1/dir1/file7", 404);
+	checkWebServerResponseContent(boost::regex(".*404\\sNot\\sFound.*"));
+	m_server.stop();
+	boost::filesystem::remove("sandbox.manifest");
+}
+
+BOOST_AUTO_TEST_CASE(checkModifiedDirectoriesInScanManifestAreListedAgain) {
+	const std::time_t saved_time = std::time(NULL) - 60;
+	boost::filesystem::last_write_time("sandbox/dir1", saved_time);
+	boost::filesystem::last_write_time("sandbox", saved_time);
+	m_server.setServiceOption("/resource1", "scan", "1");
+	m_server.setServiceOption("/resource1", "scan_manifest", "sandbox.manifest");
+	restartServer();
+
+	// a file added to dir1 changes its timestamp, so its saved listing is stale
+	boost::filesystem::ofstream file5("sandbox/dir1/file5");
+	file5 << "ghi" << std::endl;
+	file5.close();
+	boost::filesystem::last_write_time("sandbox/dir1", std::time(NULL) - 30);
+	// a file added to the root is hidden by restoring the root's timestamp
+	boost::filesystem::ofstream file6("sandbox/file6");
+	file6 << "jkl" << std::endl;
+	file6.close();
+	boost::filesystem::last_write_time("sandbox", saved_time);
+	restartServer();
+
+	// dir1 was listed again, so file5 was scanned
+	sendRequestAndCheckResponseHead("GET", "/resource1/dir1/file5");
+	checkWebServerResponseContent(boost::regex("ghi\\s*"));
+	sendRequestAndCheckResponseHead("GET", "/resource1/file2");
+	checkWebServerResponseContent(boost::regex("xyz\\s*"));
+
+	// the root's saved listing was reused, so file6 was not scanned and is
+	// refused (scan = 1)
+	sendRequestAndCheckResponseHead("GET", "/resource1/file6", 404);
+	checkWebServerResponseContent(boost::regex(".*404\\sNot\\sFound.*"));
+	m_server.stop();
+	boost::filesystem::remove("sandbox.manifest");
+}
+
+BOOST_AUTO_TEST_CASE(checkRequestsAreServedDuringLazyScan) {
+	const unsigned int NUM_DIRS = 20;
+	for (unsigned int n = 0; n < NUM_DIRS; ++n) {
+		const std::string dir_name("sandbox/dir1/sub" + boost::lexical_cast<std::string>(n));
+		BOOST_REQUIRE(boost::filesystem::create_directory(dir_name));
+		boost::filesystem::ofstream sub_file(dir_name + "/file");
+		sub_file << n << std::endl;
+	}
+	m_server.setServiceOption("/resource1", "scan", "1");
+	m_server.setServiceOption("/resource1", "lazy_scan", "true");
+	// the scan is held before it lists any directory
+	pion::plugins::FileServiceTester::holdScanning(getFileService(), true);
+	restartServer();
+	BOOST_REQUIRE(getFileService().isScanning());
+
+	// no file has been scanned yet, so they are all served from the disk
+	sendRequestAndCheckResponseHead("GET", "/resource1/file2");
+	checkWebServerResponseContent(boost::regex("xyz\\s*"));
+	sendRequestAndCheckResponseHead("GET", "/resource1/dir1/sub19/file");
+	checkWebServerResponseContent(boost::regex("19\\s*"));
+	BOOST_CHECK(getFileService().isScanning());
+
+	pion::plugins::FileServiceTester::holdScanning(getFileService(), false);
+	for (unsigned int n = 0; n < 100 && getFileService().isScanning(); ++n)
+		PionScheduler::sleep(0, 100000000);	// 0.1 seconds
+	BOOST_REQUIRE(! getFileService().isScanning());
+	sendRequestAndCheckResponseHead("GET", "/resource1/dir1/sub10/file");
+	checkWebServerResponseContent(boost::regex("10\\s*"));
+
+	// once the scan has finished, files that it did not find are refused
+	boost::filesystem::ofstream late_file("sandbox/dir1/sub10/late");
+	late_file << "late" << std::endl;
+	late_file.close();
+	sendRequestAndCheckResponseHead("GET", "/resource1/dir1/sub10/late", 404);
+	checkWebServerResponseContent(boost::regex(".*404\\sNot\\sFound.*"));
+	sendRequestAndCheckResponseHead("GET", "/resource1/file3", 404);
+	checkWebServerResponseContent(boost::regex(".*404\\sNot\\sFound.*"));
+}
+
 BOOST_AUTO_TEST_CASE(checkResponseToGetRequestForEmptyFile) {
 	sendRequestAndCheckResponseHead("GET", "/resource1/emptyFile");
 	BOOST_CHECK(m_content_length == 0);
@@ -404,6 +804,169 @@ BOOST_AUTO_TEST_CASE(checkResponseToHTTP_1_0_Request) {
 	checkWebServerResponseContent(boost::regex("abc\\s*"));
 }
 
+BOOST_AUTO_TEST_CASE(checkGzipIsNotSentByDefault) {
+	boost::filesystem::ofstream file5("sandbox/file5.txt");
+	for (int n = 0; n < 1000; ++n)
+		file5 << "compress me please" << std::endl;
+	file5.close();
+	boost::filesystem::ofstream file5_gz("sandbox/file5.txt.gz");
+	file5_gz << "precompressed" << std::endl;
+	file5_gz.close();
+
+	m_http_stream << "GET /resource1/file5.txt HTTP/1.1" << HTTPTypes::STRING_CRLF
+		<< "Accept-Encoding: gzip" << HTTPTypes::STRING_CRLF << HTTPTypes::STRING_CRLF;
+	m_http_stream.flush();
+	checkResponseHead(200);
+	BOOST_CHECK(m_response_headers.find("Content-Encoding") == m_response_headers.end());
+	BOOST_CHECK(m_response_headers.find("Vary") == m_response_headers.end());
+	BOOST_CHECK_EQUAL(m_content_length, boost::filesystem::file_size("sandbox/file5.txt"));
+	checkWebServerResponseContent(boost::regex("(compress me please\\s*){1000}"));
+}
+
+BOOST_AUTO_TEST_CASE(checkPrecompressedFileIsSentIfGzipIsAccepted) {
+	m_server.setServiceOption("/resource1", "compress", "1");
+	boost::filesystem::ofstream file3("sandbox/file3.txt");
+	file3 << "plain text" << std::endl;
+	file3.close();
+	boost::filesystem::ofstream file3_gz("sandbox/file3.txt.gz");
+	file3_gz << "precompressed" << std::endl;
+	file3_gz.close();
+
+	// the client does not accept gzip -> send the file itself
+	sendRequestAndCheckResponseHead("GET", "/resource1/file3.txt");
+	BOOST_CHECK(m_response_headers.find("Content-Encoding") == m_response_headers.end());
+	BOOST_CHECK_EQUAL(m_response_headers["Vary"], "Accept-Encoding");
+	checkWebServerResponseContent(boost::regex("plain text\\s*"));
+
+	if (HTTPCompressor::isSupported()) {
+		// the client accepts gzip -> send the precompressed sibling
+		m_http_stream << "GET /resource1/file3.txt HTTP/1.1" << HTTPTypes::STRING_CRLF
+			<< "Accept-Encoding: gzip" << HTTPTypes::STRING_CRLF << HTTPTypes::STRING_CRLF;
+		m_http_stream.flush();
+		checkResponseHead(200);
+		BOOST_CHECK_EQUAL(m_response_headers["Content-Encoding"], "gzip");
+		BOOST_CHECK_EQUAL(m_response_headers["Vary"], "Accept-Encoding");
+		checkWebServerResponseContent(boost::regex("precompressed\\s*"));
+	}
+}
+
+BOOST_AUTO_TEST_CASE(checkRegeneratedPrecompressedFileIsSentWithNewETag) {
+	m_server.setServiceOption("/resource1", "compress", "1");
+	boost::filesystem::ofstream file3("sandbox/file3.txt");
+	file3 << "plain text" << std::endl;
+	file3.close();
+	boost::filesystem::ofstream file3_gz("sandbox/file3.txt.gz");
+	file3_gz << "precompressed" << std::endl;
+	file3_gz.close();
+	if (! HTTPCompressor::isSupported())
+		return;
+
+	m_http_stream << "GET /resource1/file3.txt HTTP/1.1" << HTTPTypes::STRING_CRLF
+		<< "Accept-Encoding: gzip" << HTTPTypes::STRING_CRLF << HTTPTypes::STRING_CRLF;
+	m_http_stream.flush();
+	checkResponseHead(200);
+	const std::string gzip_etag(m_response_headers["ETag"]);
+	checkWebServerResponseContent(boost::regex("precompressed\\s*"));
+
+	// only the sibling changes, so its own size and timestamp tell
+	file3_gz.open("sandbox/file3.txt.gz", std::ios::out | std::ios::trunc);
+	file3_gz << "precompressed again" << std::endl;
+	file3_gz.close();
+	m_http_stream << "GET /resource1/file3.txt HTTP/1.1" << HTTPTypes::STRING_CRLF
+		<< "Accept-Encoding: gzip" << HTTPTypes::STRING_CRLF
+		<< "If-None-Match: " << gzip_etag << HTTPTypes::STRING_CRLF << HTTPTypes::STRING_CRLF;
+	m_http_stream.flush();
+	checkResponseHead(200);
+	BOOST_CHECK(m_response_headers["ETag"] != gzip_etag);
+	checkWebServerResponseContent(boost::regex("precompressed again\\s*"));
+}
+
+BOOST_AUTO_TEST_CASE(checkCachedTextFileIsCompressedIfGzipIsAccepted) {
+	m_server.setServiceOption("/resource1", "compress", "2");
+	boost::filesystem::ofstream file5("sandbox/file5.txt");
+	for (int n = 0; n < 1000; ++n)
+		file5 << "compress me please" << std::endl;
+	file5.close();
+	const unsigned long file5_size = boost::filesystem::file_size("sandbox/file5.txt");
+
+	m_http_stream << "GET /resource1/file5.txt HTTP/1.1" << HTTPTypes::STRING_CRLF
+		<< "Accept-Encoding: gzip" << HTTPTypes::STRING_CRLF << HTTPTypes::STRING_CRLF;
+	m_http_stream.flush();
+	checkResponseHead(200);
+	BOOST_CHECK_EQUAL(m_response_headers["Vary"], "Accept-Encoding");
+	if (HTTPCompressor::isSupported()) {
+		BOOST_CHECK_EQUAL(m_response_headers["Content-Encoding"], "gzip");
+		BOOST_CHECK(m_content_length < file5_size);
+	} else {
+		BOOST_CHECK_EQUAL(m_content_length, file5_size);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(checkCachedTextFileIsNotCompressedIfTypeIsNotConfigured) {
+	m_server.setServiceOption("/resource1", "compress", "2");
+	m_server.setServiceOption("/resource1", "compress_types", "application/json");
+	boost::filesystem::ofstream file5("sandbox/file5.txt");
+	for (int n = 0; n < 1000; ++n)
+		file5 << "compress me please" << std::endl;
+	file5.close();
+	const unsigned long file5_size = boost::filesystem::file_size("sandbox/file5.txt");
+
+	m_http_stream << "GET /resource1/file5.txt HTTP/1.1" << HTTPTypes::STRING_CRLF
+		<< "Accept-Encoding: gzip" << HTTPTypes::STRING_CRLF << HTTPTypes::STRING_CRLF;
+	m_http_stream.flush();
+	checkResponseHead(200);
+	BOOST_CHECK(m_response_headers.find("Content-Encoding") == m_response_headers.end());
+	BOOST_CHECK_EQUAL(m_content_length, file5_size);
+}
+
+BOOST_AUTO_TEST_CASE(checkCachedTextFileIsNotCompressedIfSmallerThanMinSize) {
+	m_server.setServiceOption("/resource1", "compress", "2");
+	m_server.setServiceOption("/resource1", "compress_min_size", "1000000");
+	boost::filesystem::ofstream file5("sandbox/file5.txt");
+	for (int n = 0; n < 1000; ++n)
+		file5 << "compress me please" << std::endl;
+	file5.close();
+	const unsigned long file5_size = boost::filesystem::file_size("sandbox/file5.txt");
+
+	m_http_stream << "GET /resource1/file5.txt HTTP/1.1" << HTTPTypes::STRING_CRLF
+		<< "Accept-Encoding: gzip" << HTTPTypes::STRING_CRLF << HTTPTypes::STRING_CRLF;
+	m_http_stream.flush();
+	checkResponseHead(200);
+	BOOST_CHECK(m_response_headers.find("Content-Encoding") == m_response_headers.end());
+	BOOST_CHECK_EQUAL(m_content_length, file5_size);
+}
+
+BOOST_AUTO_TEST_CASE(checkResponseToRangeRequestForDefaultFile) {
+	m_http_stream << "GET /resource1 HTTP/1.1" << HTTPTypes::STRING_CRLF
+		<< "Range: bytes=1-2" << HTTPTypes::STRING_CRLF << HTTPTypes::STRING_CRLF;
+	m_http_stream.flush();
+	checkResponseHead(206);
+	BOOST_CHECK_EQUAL(m_response_headers["Content-Range"], "bytes 1-2/4");
+	BOOST_CHECK_EQUAL(m_content_length, 2UL);
+	checkWebServerResponseContent(boost::regex("bc"));
+}
+
+BOOST_AUTO_TEST_CASE(checkResponseToIfNoneMatchRequestForDefaultFile) {
+	sendRequestAndCheckResponseHead("GET", "/resource1");
+	const std::string etag(m_response_headers["ETag"]);
+	BOOST_REQUIRE(! etag.empty());
+	checkWebServerResponseContent(boost::regex("abc\\s*"));
+
+	m_http_stream << "GET /resource1 HTTP/1.1" << HTTPTypes::STRING_CRLF
+		<< "If-None-Match: \"other\", " << etag << HTTPTypes::STRING_CRLF << HTTPTypes::STRING_CRLF;
+	m_http_stream.flush();
+	checkResponseHead(304);
+	BOOST_CHECK_EQUAL(m_response_headers["ETag"], etag);
+}
+
+BOOST_AUTO_TEST_CASE(checkResponseToUnsatisfiableRangeRequestForDefaultFile) {
+	m_http_stream << "GET /resource1 HTTP/1.1" << HTTPTypes::STRING_CRLF
+		<< "Range: bytes=100-" << HTTPTypes::STRING_CRLF << HTTPTypes::STRING_CRLF;
+	m_http_stream.flush();
+	checkResponseHead(416);
+	BOOST_CHECK_EQUAL(m_response_headers["Content-Range"], "bytes */4");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 class RunningFileServiceWithWritingEnabled_F : public RunningFileService_F {
@@ -463,6 +1026,29 @@ BOOST_AUTO_TEST_CASE(checkResponseToPutRequestForSpecifiedFile) {
 	checkFileContents("sandbox/file2", "1234");
 }
 
+BOOST_AUTO_TEST_CASE(checkPutRequestForMappedFileHidesTemporaryFile) {
+	m_server.setServiceOption("/resource1", "mmap", "true");
+
+	// a replacement still being written is never served, even by its own name
+	boost::filesystem::ofstream temp_file("sandbox/.pion-put.file2.AbC123");
+	temp_file << "partial" << std::endl;
+	temp_file.close();
+	sendRequestAndCheckResponseHead("GET", "/resource1/.pion-put.file2.AbC123", 404);
+	checkWebServerResponseContent(boost::regex(".*404\\sNot\\sFound.*"));
+	boost::filesystem::remove("sandbox/.pion-put.file2.AbC123");
+
+	sendRequestWithContent("PUT", "/resource1/file2", "1234");
+	checkResponseHead(204);
+	checkFileContents("sandbox/file2", "1234");
+	sendRequestAndCheckResponseHead("GET", "/resource1/file2");
+	checkWebServerResponseContent(boost::regex("1234"));
+
+	// nothing is left behind once the replacement is in place
+	boost::filesystem::directory_iterator end;
+	for (boost::filesystem::directory_iterator itr("sandbox"); itr != end; ++itr)
+		BOOST_CHECK(itr->path().string().find("/.pion-put.") == std::string::npos);
+}
+
 /* TODO: write a couple tests of PUT requests with header 'If-None-Match: *'.
    The response should be 412 (Precondition Failed) if the file exists, and
    204 if it doesn't.
@@ -0,0 +1,218 @@
+// ------------------------------------------------------------------
+// pion-net: a C++ framework for building lightweight HTTP interfaces
+// ------------------------------------------------------------------
+// Copyright (C) 2007-2010 Atomic Labs, Inc.  (http://www.atomiclabs.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include <pion/PionConfig.hpp>
+#include <pion/PionScheduler.hpp>
+#include <pion/net/HTTPClient.hpp>
+#include <pion/net/HTTPServer.hpp>
+#include <pion/net/HTTPResponseWriter.hpp>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+using namespace pion;
+using namespace pion::net;
+using boost::asio::ip::tcp;
+
+
+///
+/// HTTPClientTests_F: fixture that runs a local HTTPServer and an HTTPClient
+///
+class HTTPClientTests_F {
+public:
+	HTTPClientTests_F()
+		: m_server(new HTTPServer(0)),
+		m_client(HTTPClient::create(m_scheduler))
+	{
+		m_server->addResource("/echo", &HTTPClientTests_F::handleEcho);
+		m_server->addResource("/close", &HTTPClientTests_F::handleClose);
+		m_server->start();
+	}
+	~HTTPClientTests_F() {
+		if (m_client)
+			m_client->close();
+		m_client.reset();
+		m_server->stop();
+	}
+
+	/// sends a GET request for a resource to the local server
+	void sendGet(const std::string& resource) {
+		HTTPRequestPtr request(new HTTPRequest(resource));
+		m_client->sendRequest("127.0.0.1", m_server->getPort(), request,
+							  boost::bind(&HTTPClientTests_F::handleResponse, this, _1, _2));
+	}
+
+	/// waits up to five seconds for a number of responses (or errors)
+	bool waitForResponses(std::size_t n) {
+		boost::mutex::scoped_lock responses_lock(m_mutex);
+		while (m_contents.size() + m_errors.size() < n) {
+			if (! m_responses_received.timed_wait(responses_lock,
+				boost::get_system_time() + boost::posix_time::seconds(5)))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/// responds with the resource that was requested
+	static void handleEcho(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn) {
+		HTTPResponseWriterPtr writer(HTTPResponseWriter::create(tcp_conn, *request,
+			boost::bind(&TCPConnection::finish, tcp_conn)));
+		writer << request->getOriginalResource();
+		writer->send();
+	}
+
+	/// responds and closes the connection
+	static void handleClose(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn) {
+		tcp_conn->setLifecycle(TCPConnection::LIFECYCLE_CLOSE);
+		handleEcho(request, tcp_conn);
+	}
+
+	/// saves the content of a response, or the error
+	void handleResponse(HTTPResponsePtr response, const boost::system::error_code& ec) {
+		boost::mutex::scoped_lock responses_lock(m_mutex);
+		if (ec) {
+			BOOST_CHECK(! response);
+			m_errors.push_back(ec);
+		} else {
+			BOOST_CHECK_EQUAL(response->getStatusCode(), HTTPTypes::RESPONSE_CODE_OK);
+			m_contents.push_back(std::string(response->getContent(), response->getContentLength()));
+		}
+		m_responses_received.notify_all();
+	}
+
+	PionSingleServiceScheduler					m_scheduler;
+	HTTPServerPtr								m_server;
+	HTTPClientPtr								m_client;
+	boost::mutex								m_mutex;
+	boost::condition							m_responses_received;
+	std::vector<std::string>					m_contents;
+	std::vector<boost::system::error_code>		m_errors;
+};
+
+
+BOOST_FIXTURE_TEST_SUITE(HTTPClientTests_S, HTTPClientTests_F)
+
+BOOST_AUTO_TEST_CASE(checkSendRequestReceivesResponse) {
+	sendGet("/echo/hello");
+	BOOST_REQUIRE(waitForResponses(1));
+	BOOST_REQUIRE_EQUAL(m_contents.size(), 1U);
+	BOOST_CHECK_EQUAL(m_contents[0], "/echo/hello");
+}
+
+BOOST_AUTO_TEST_CASE(checkSequentialRequestsReuseConnection) {
+	for (std::size_t n = 1; n <= 5; ++n) {
+		sendGet("/echo/" + boost::lexical_cast<std::string>(n));
+		BOOST_REQUIRE(waitForResponses(n));
+	}
+	BOOST_CHECK(m_errors.empty());
+	BOOST_CHECK_EQUAL(m_contents[4], "/echo/5");
+	BOOST_CHECK_EQUAL(m_client->getConnectionsOpened(), 1UL);
+	BOOST_CHECK_EQUAL(m_client->getIdleConnectionCount(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(checkMaxConnectionsLimitsConcurrentRequests) {
+	m_client->setMaxConnections(2);
+	for (int n = 0; n < 20; ++n)
+		sendGet("/echo");
+	BOOST_REQUIRE(waitForResponses(20));
+	BOOST_CHECK_EQUAL(m_contents.size(), 20U);
+	BOOST_CHECK(m_client->getConnectionsOpened() <= 2UL);
+	BOOST_CHECK(m_client->getConnectionCount() <= 2U);
+}
+
+BOOST_AUTO_TEST_CASE(checkPipelinedResponsesAreReceivedInOrder) {
+	m_client->setMaxConnections(1);
+	m_client->setPipelineDepth(4);
+	for (int n = 0; n < 12; ++n)
+		sendGet("/echo/" + boost::lexical_cast<std::string>(n));
+	BOOST_REQUIRE(waitForResponses(12));
+	BOOST_REQUIRE_EQUAL(m_contents.size(), 12U);
+	for (int n = 0; n < 12; ++n)
+		BOOST_CHECK_EQUAL(m_contents[n], "/echo/" + boost::lexical_cast<std::string>(n));
+	BOOST_CHECK_EQUAL(m_client->getConnectionsOpened(), 1UL);
+}
+
+BOOST_AUTO_TEST_CASE(checkConnectionClosedByServerIsNotReused) {
+	sendGet("/close");
+	BOOST_REQUIRE(waitForResponses(1));
+	BOOST_CHECK_EQUAL(m_client->getConnectionCount(), 0U);
+	sendGet("/echo");
+	BOOST_REQUIRE(waitForResponses(2));
+	BOOST_CHECK(m_errors.empty());
+	BOOST_CHECK_EQUAL(m_client->getConnectionsOpened(), 2UL);
+}
+
+BOOST_AUTO_TEST_CASE(checkIdleConnectionIsClosedAfterTimeout) {
+	m_client->setIdleTimeout(1);
+	sendGet("/echo");
+	BOOST_REQUIRE(waitForResponses(1));
+	BOOST_CHECK_EQUAL(m_client->getIdleConnectionCount(), 1U);
+	for (int i = 0; i < 30 && m_client->getIdleConnectionCount() > 0; ++i)
+		PionScheduler::sleep(0, 100000000);	// 0.1 seconds
+	BOOST_CHECK_EQUAL(m_client->getIdleConnectionCount(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(checkIdleConnectionsDoNotKeepClientAlive) {
+	sendGet("/echo");
+	BOOST_REQUIRE(waitForResponses(1));
+	BOOST_CHECK_EQUAL(m_client->getIdleConnectionCount(), 1U);
+
+	// the client is destroyed once it is no longer used, not when its idle
+	// connections time out
+	boost::weak_ptr<HTTPClient> client_weak_ptr(m_client);
+	m_client.reset();
+	for (int i = 0; i < 30 && ! client_weak_ptr.expired(); ++i)
+		PionScheduler::sleep(0, 100000000);	// 0.1 seconds
+	BOOST_CHECK(client_weak_ptr.expired());
+}
+
+BOOST_AUTO_TEST_CASE(checkRequestAfterCloseIsSent) {
+	sendGet("/echo/first");
+	BOOST_REQUIRE(waitForResponses(1));
+	m_client->close();
+	BOOST_CHECK_EQUAL(m_client->getConnectionCount(), 0U);
+	sendGet("/echo/second");
+	BOOST_REQUIRE(waitForResponses(2));
+	BOOST_CHECK(m_errors.empty());
+	BOOST_CHECK_EQUAL(m_contents[1], "/echo/second");
+	BOOST_CHECK_EQUAL(m_client->getConnectionsOpened(), 2UL);
+}
+
+BOOST_AUTO_TEST_CASE(checkRequestToClosedPortReturnsError) {
+	// find a port that nothing is listening on
+	unsigned int closed_port;
+	{
+		boost::asio::io_service io_service;
+		tcp::acceptor acceptor(io_service, tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), 0));
+		closed_port = acceptor.local_endpoint().port();
+	}
+	HTTPRequestPtr request(new HTTPRequest("/echo"));
+	m_client->sendRequest("127.0.0.1", closed_port, request,
+						  boost::bind(&HTTPClientTests_F::handleResponse, this, _1, _2));
+	BOOST_REQUIRE(waitForResponses(1));
+	BOOST_CHECK_EQUAL(m_errors.size(), 1U);
+	BOOST_CHECK_EQUAL(m_client->getConnectionCount(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(checkHostNameIsResolved) {
+	HTTPRequestPtr request(new HTTPRequest("/echo"));
+	m_client->sendRequest("localhost", m_server->getPort(), request,
+						  boost::bind(&HTTPClientTests_F::handleResponse, this, _1, _2));
+	BOOST_REQUIRE(waitForResponses(1));
+	BOOST_CHECK_EQUAL(m_contents.size(), 1U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
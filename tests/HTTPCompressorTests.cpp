@@ -0,0 +1,99 @@
+// ------------------------------------------------------------------
+// pion-net: a C++ framework for building lightweight HTTP interfaces
+// ------------------------------------------------------------------
+// Copyright (C) 2007-2010 Atomic Labs, Inc.  (http://www.atomiclabs.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include <pion/PionConfig.hpp>
+#include <pion/net/HTTPCompressor.hpp>
+#include <pion/PionUnitTestDefs.hpp>
+#include <boost/test/unit_test.hpp>
+#ifdef PION_HAVE_ZLIB
+	#include <zlib.h>
+#endif
+
+using namespace pion;
+using namespace pion::net;
+
+
+BOOST_AUTO_TEST_CASE(checkDefaultOptionsAllowTextTypes) {
+	HTTPCompressor::Options options;
+	BOOST_CHECK(options.isCompressible("text/html"));
+	BOOST_CHECK(options.isCompressible("text/plain; charset=utf-8"));
+	BOOST_CHECK(options.isCompressible("Application/JSON"));
+	BOOST_CHECK(! options.isCompressible("image/png"));
+	BOOST_CHECK(! options.isCompressible("application/octet-stream"));
+	BOOST_CHECK(! options.isCompressible(""));
+}
+
+BOOST_AUTO_TEST_CASE(checkOptionsMimeTypesCanBeReplaced) {
+	HTTPCompressor::Options options;
+	options.clearMimeTypes();
+	BOOST_CHECK(! options.isCompressible("text/html"));
+	options.addMimeType("application/");
+	BOOST_CHECK(options.isCompressible("application/octet-stream"));
+	BOOST_CHECK(! options.isCompressible("text/html"));
+}
+
+#ifdef PION_HAVE_ZLIB
+
+BOOST_AUTO_TEST_CASE(checkParseAcceptEncoding) {
+	BOOST_CHECK_EQUAL(HTTPCompressor::parseAcceptEncoding(""), HTTPCompressor::ENCODING_IDENTITY);
+	BOOST_CHECK_EQUAL(HTTPCompressor::parseAcceptEncoding("identity"), HTTPCompressor::ENCODING_IDENTITY);
+	BOOST_CHECK_EQUAL(HTTPCompressor::parseAcceptEncoding("gzip, deflate"), HTTPCompressor::ENCODING_GZIP);
+	BOOST_CHECK_EQUAL(HTTPCompressor::parseAcceptEncoding("deflate"), HTTPCompressor::ENCODING_DEFLATE);
+	BOOST_CHECK_EQUAL(HTTPCompressor::parseAcceptEncoding("gzip;q=0, deflate"), HTTPCompressor::ENCODING_DEFLATE);
+	BOOST_CHECK_EQUAL(HTTPCompressor::parseAcceptEncoding("gzip;q=0.5, deflate;q=0.8"), HTTPCompressor::ENCODING_DEFLATE);
+	BOOST_CHECK_EQUAL(HTTPCompressor::parseAcceptEncoding("*"), HTTPCompressor::ENCODING_GZIP);
+	BOOST_CHECK_EQUAL(HTTPCompressor::parseAcceptEncoding("*;q=0"), HTTPCompressor::ENCODING_IDENTITY);
+}
+
+BOOST_AUTO_TEST_CASE(checkCompressedChunksDecompressToOriginalData) {
+	std::string original;
+	for (int n = 0; n < 4096; ++n)
+		original += "compress me please ";
+
+	// compress the data using two flushed chunks, and a second compressor
+	// that re-uses the pooled zlib stream
+	for (int pass = 0; pass < 2; ++pass) {
+		std::string compressed;
+		{
+			HTTPCompressor compressor(HTTPCompressor::ENCODING_GZIP, HTTPCompressor::DEFAULT_LEVEL);
+			BOOST_REQUIRE(compressor.isOpen());
+			const std::size_t half = original.size() / 2;
+			BOOST_CHECK(compressor.compress(original.data(), half, compressed));
+			BOOST_CHECK(compressor.flush(compressed));
+			BOOST_CHECK(compressor.compress(original.data() + half, original.size() - half, compressed));
+			BOOST_CHECK(compressor.finish(compressed));
+		}
+		BOOST_CHECK(compressed.size() < original.size() / 10);
+
+		// decompress and compare
+		std::string decompressed(original.size(), '\0');
+		z_stream zstream;
+		zstream.zalloc = Z_NULL;
+		zstream.zfree = Z_NULL;
+		zstream.opaque = Z_NULL;
+		BOOST_REQUIRE(inflateInit2(&zstream, 15 + 16) == Z_OK);
+		zstream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(compressed.data()));
+		zstream.avail_in = compressed.size();
+		zstream.next_out = reinterpret_cast<Bytef*>(&decompressed[0]);
+		zstream.avail_out = decompressed.size();
+		BOOST_CHECK_EQUAL(inflate(&zstream, Z_FINISH), Z_STREAM_END);
+		BOOST_CHECK_EQUAL(zstream.avail_out, 0U);
+		inflateEnd(&zstream);
+		BOOST_CHECK(decompressed == original);
+	}
+}
+
+#else
+
+BOOST_AUTO_TEST_CASE(checkCompressionIsDisabledWithoutZlib) {
+	BOOST_CHECK(! HTTPCompressor::isSupported());
+	BOOST_CHECK_EQUAL(HTTPCompressor::parseAcceptEncoding("gzip"), HTTPCompressor::ENCODING_IDENTITY);
+}
+
+#endif
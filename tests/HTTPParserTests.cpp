@@ -393,4 +393,112 @@ BOOST_AUTO_TEST_CASE(checkParseForwardedForHeaderFirstNotPublic) {
 	checkParsingTrue("192.168.2.12, 172.32.31.2", "172.32.31.2");
 }
 
+BOOST_AUTO_TEST_CASE(checkParseForwardedForHeaderIPv6AndPorts) {
+	checkParsingFalse("::1, fd00::12, fe80::1");
+	checkParsingFalse("999.2.31.24");
+	checkParsingTrue("fd00::12, 2001:db8::7", "2001:db8::7");
+	checkParsingTrue("[2001:db8::7]:4711", "2001:db8::7");
+	checkParsingTrue("10.0.0.1:80, 129.2.31.24:8080", "129.2.31.24");
+}
+
+BOOST_AUTO_TEST_CASE(checkParseForwardedForHeaderWithTrustedProxies) {
+	IPNetworkTrie trusted_proxies;
+	trusted_proxies.insert("10.0.0.0/8");
+	trusted_proxies.insert("2001:db8::/32");
+	boost::asio::ip::address client;
+
+	// the last address that is not a trusted proxy is the client
+	BOOST_CHECK(HTTPParser::parseForwardedFor("62.31.21.2, 129.2.31.24, 10.1.2.3", trusted_proxies, client));
+	BOOST_CHECK_EQUAL(client.to_string(), "129.2.31.24");
+	BOOST_CHECK(HTTPParser::parseForwardedFor("62.31.21.2,2001:db8::1", trusted_proxies, client));
+	BOOST_CHECK_EQUAL(client.to_string(), "62.31.21.2");
+
+	// nothing before an address that is not valid is used
+	BOOST_CHECK(HTTPParser::parseForwardedFor("62.31.21.2, unknown, 10.1.2.3", trusted_proxies, client));
+	BOOST_CHECK_EQUAL(client.to_string(), "10.1.2.3");
+	BOOST_CHECK(! HTTPParser::parseForwardedFor(" ,unknown", trusted_proxies, client));
+}
+
+BOOST_AUTO_TEST_CASE(checkParseClientAddress) {
+	IPNetworkTrie trusted_proxies;
+	trusted_proxies.insert("10.0.0.0/8");
+	boost::asio::ip::address client;
+	HTTPRequest http_request;
+	BOOST_CHECK(! HTTPParser::parseClientAddress(http_request, trusted_proxies, client));
+
+	http_request.addHeader(HTTPTypes::HEADER_CLIENT_IP, "62.31.21.2");
+	BOOST_CHECK(HTTPParser::parseClientAddress(http_request, trusted_proxies, client));
+	BOOST_CHECK_EQUAL(client.to_string(), "62.31.21.2");
+
+	// X-Forwarded-For is used before Client-IP, and its headers are combined
+	http_request.addHeader(HTTPTypes::HEADER_X_FORWARDED_FOR, "129.2.31.24");
+	http_request.addHeader(HTTPTypes::HEADER_X_FORWARDED_FOR, "10.1.2.3");
+	BOOST_CHECK(HTTPParser::parseClientAddress(http_request, trusted_proxies, client));
+	BOOST_CHECK_EQUAL(client.to_string(), "129.2.31.24");
+}
+
+BOOST_AUTO_TEST_CASE(checkParseRangeHeader) {
+	HTTPTypes::ByteRanges ranges;
+	BOOST_CHECK(HTTPParser::parseRange("bytes=0-499", 10000, ranges));
+	BOOST_REQUIRE_EQUAL(ranges.size(), 1U);
+	BOOST_CHECK_EQUAL(ranges[0].first, 0UL);
+	BOOST_CHECK_EQUAL(ranges[0].second, 499UL);
+
+	// open-ended and suffix ranges are limited to the content
+	BOOST_CHECK(HTTPParser::parseRange("bytes = 9500- , -100,500-999", 10000, ranges));
+	BOOST_REQUIRE_EQUAL(ranges.size(), 3U);
+	BOOST_CHECK_EQUAL(ranges[0].first, 9500UL);
+	BOOST_CHECK_EQUAL(ranges[0].second, 9999UL);
+	BOOST_CHECK_EQUAL(ranges[1].first, 9900UL);
+	BOOST_CHECK_EQUAL(ranges[1].second, 9999UL);
+	BOOST_CHECK_EQUAL(ranges[2].first, 500UL);
+	BOOST_CHECK_EQUAL(ranges[2].second, 999UL);
+	BOOST_CHECK(HTTPParser::parseRange("bytes=-20000", 10000, ranges));
+	BOOST_REQUIRE_EQUAL(ranges.size(), 1U);
+	BOOST_CHECK_EQUAL(ranges[0].first, 0UL);
+	BOOST_CHECK_EQUAL(ranges[0].second, 9999UL);
+
+	// offsets past 4 GB are not truncated
+	BOOST_CHECK(HTTPParser::parseRange("bytes=5000000000-", 6000000000ULL, ranges));
+	BOOST_REQUIRE_EQUAL(ranges.size(), 1U);
+	BOOST_CHECK_EQUAL(ranges[0].first, 5000000000ULL);
+	BOOST_CHECK_EQUAL(ranges[0].second, 5999999999ULL);
+}
+
+BOOST_AUTO_TEST_CASE(checkParseRangeHeaderNotSatisfiable) {
+	HTTPTypes::ByteRanges ranges;
+	BOOST_CHECK(HTTPParser::parseRange("bytes=10000-", 10000, ranges));
+	BOOST_CHECK(ranges.empty());
+	BOOST_CHECK(HTTPParser::parseRange("bytes=-0,99999999999999999999-", 10000, ranges));
+	BOOST_CHECK(ranges.empty());
+	BOOST_CHECK(HTTPParser::parseRange("bytes=0-", 0, ranges));
+	BOOST_CHECK(ranges.empty());
+	BOOST_CHECK(HTTPParser::parseRange("bytes=20000-,0-0", 10000, ranges));
+	BOOST_CHECK_EQUAL(ranges.size(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(checkParseRangeHeaderNotValid) {
+	HTTPTypes::ByteRanges ranges;
+	BOOST_CHECK(! HTTPParser::parseRange("", 10000, ranges));
+	BOOST_CHECK(! HTTPParser::parseRange("bytes=", 10000, ranges));
+	BOOST_CHECK(! HTTPParser::parseRange("items=0-1", 10000, ranges));
+	BOOST_CHECK(! HTTPParser::parseRange("bytes=500-499", 10000, ranges));
+	BOOST_CHECK(! HTTPParser::parseRange("bytes=-", 10000, ranges));
+	BOOST_CHECK(! HTTPParser::parseRange("bytes=1-2-3", 10000, ranges));
+	// ranges that overlap too much are ignored
+	BOOST_CHECK(! HTTPParser::parseRange("bytes=0-,0-", 10000, ranges));
+}
+
+BOOST_AUTO_TEST_CASE(checkMatchETag) {
+	const std::string etag("\"2a-1f4-5f5e1000\"");
+	BOOST_CHECK(HTTPParser::matchETag("\"2a-1f4-5f5e1000\"", etag));
+	BOOST_CHECK(HTTPParser::matchETag("*", etag));
+	BOOST_CHECK(HTTPParser::matchETag("\"abc\", W/\"2a-1f4-5f5e1000\"", etag));
+	BOOST_CHECK(HTTPParser::matchETag(" \"x,y\" ,\"2a-1f4-5f5e1000\" ", etag));
+	BOOST_CHECK(! HTTPParser::matchETag("", etag));
+	BOOST_CHECK(! HTTPParser::matchETag("\"2a-1f4-5f5e1000-gzip\"", etag));
+	BOOST_CHECK(! HTTPParser::matchETag("\"2a-1f4-5f5e1000", etag));
+	BOOST_CHECK(! HTTPParser::matchETag("2a-1f4-5f5e1000", etag));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
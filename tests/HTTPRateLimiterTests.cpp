@@ -0,0 +1,115 @@
+// ------------------------------------------------------------------
+// pion-net: a C++ framework for building lightweight HTTP interfaces
+// ------------------------------------------------------------------
+// Copyright (C) 2007-2010 Atomic Labs, Inc.  (http://www.atomiclabs.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include <pion/PionConfig.hpp>
+#include <pion/net/HTTPRateLimiter.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/test/unit_test.hpp>
+
+using namespace pion;
+using namespace pion::net;
+
+
+///
+/// HTTPRateLimiterTests_F: limits two resources
+///
+class HTTPRateLimiterTests_F {
+public:
+	HTTPRateLimiterTests_F()
+		: m_client(boost::asio::ip::address::from_string("192.0.2.1")),
+		m_other_client(boost::asio::ip::address::from_string("2001:db8::1"))
+	{
+		m_limiter.setLimit("/api", 0, 3);
+		m_limiter.setLimit("/api/search", 0, 1);
+	}
+
+	/// returns the number of requests allowed out of a number made
+	unsigned int count(const std::string& resource, const boost::asio::ip::address& client,
+					   unsigned int num_requests)
+	{
+		unsigned int allowed = 0;
+		for (unsigned int n = 0; n < num_requests; ++n) {
+			if (m_limiter.allow(resource, client))
+				++allowed;
+		}
+		return allowed;
+	}
+
+	HTTPRateLimiter					m_limiter;
+	const boost::asio::ip::address	m_client;
+	const boost::asio::ip::address	m_other_client;
+};
+
+
+BOOST_FIXTURE_TEST_SUITE(HTTPRateLimiterTests_S, HTTPRateLimiterTests_F)
+
+BOOST_AUTO_TEST_CASE(checkBurstIsAllowed) {
+	BOOST_CHECK_EQUAL(count("/api/items", m_client, 10), 3U);
+	BOOST_CHECK_EQUAL(count("/api", m_client, 10), 0U);
+	BOOST_CHECK_EQUAL(m_limiter.getAllowed(), 3UL);
+	BOOST_CHECK_EQUAL(m_limiter.getRejected(), 17UL);
+}
+
+BOOST_AUTO_TEST_CASE(checkClientsHaveTheirOwnBuckets) {
+	BOOST_CHECK_EQUAL(count("/api", m_client, 10), 3U);
+	BOOST_CHECK_EQUAL(count("/api", m_other_client, 10), 3U);
+}
+
+BOOST_AUTO_TEST_CASE(checkRequestsAreLimitedByRemoteIp) {
+	HTTPRequest http_request("/api/items");
+	http_request.setRemoteIp(m_client);
+	BOOST_CHECK(m_limiter.allow(http_request));
+	BOOST_CHECK(m_limiter.allow("/api", m_client));
+	BOOST_CHECK(m_limiter.allow(http_request));
+	BOOST_CHECK(! m_limiter.allow(http_request));
+	http_request.setRemoteIp(m_other_client);
+	BOOST_CHECK(m_limiter.allow(http_request));
+}
+
+BOOST_AUTO_TEST_CASE(checkLongestResourceLimitApplies) {
+	BOOST_CHECK_EQUAL(count("/api/search/", m_client, 10), 1U);
+	BOOST_CHECK_EQUAL(count("/api/searching", m_client, 10), 3U);
+	BOOST_CHECK_EQUAL(count("/other", m_client, 10), 10U);
+	BOOST_CHECK_EQUAL(m_limiter.getAllowed(), 4UL);
+
+	m_limiter.removeLimit("/api/search");
+	BOOST_CHECK_EQUAL(count("/api/search", m_client, 10), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(checkRootLimitCoversNestedResources) {
+	BOOST_CHECK_EQUAL(count("/static/css/site.css", m_client, 5), 5U);
+	m_limiter.setLimit("/", 0, 2);
+	BOOST_CHECK_EQUAL(count("/static/css/site.css", m_client, 5), 2U);
+	BOOST_CHECK_EQUAL(count("/", m_other_client, 5), 2U);
+
+	// more specific limits still apply instead
+	BOOST_CHECK_EQUAL(count("/api/search", m_other_client, 5), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(checkBucketsAreRefilled) {
+	m_limiter.setLimit("/fast", 100, 1);
+	BOOST_CHECK_EQUAL(count("/fast", m_client, 10), 1U);
+	boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+	BOOST_CHECK_EQUAL(count("/fast", m_client, 10), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(checkClientsAreAllowedWhenFull) {
+	HTTPRateLimiter limiter(16);
+	limiter.setLimit("", 0, 1);
+	for (unsigned int n = 0; n < 1000; ++n) {
+		boost::asio::ip::address_v4 client(0x0a000000 + n);
+		limiter.allow("/", client);
+		limiter.allow("/", client);
+	}
+	BOOST_CHECK(limiter.getOverflows() > 0);
+	BOOST_CHECK(limiter.getRejected() > 0);
+	BOOST_CHECK_EQUAL(limiter.getAllowed() + limiter.getRejected() + limiter.getOverflows(), 2000UL);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,220 @@
+// ------------------------------------------------------------------
+// pion-net: a C++ framework for building lightweight HTTP interfaces
+// ------------------------------------------------------------------
+// Copyright (C) 2007-2010 Atomic Labs, Inc.  (http://www.atomiclabs.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include <pion/PionConfig.hpp>
+#include <pion/net/HTTPResponseCache.hpp>
+#include <pion/net/HTTPRequest.hpp>
+#include <pion/net/HTTPResponse.hpp>
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+
+using namespace pion;
+using namespace pion::net;
+
+
+///
+/// HTTPResponseCacheTests_F: caches responses with a one minute policy
+///
+class HTTPResponseCacheTests_F {
+public:
+	HTTPResponseCacheTests_F()
+		: m_cache(100), m_policy(new HTTPResponseCache::Policy)
+	{
+		m_policy->m_ttl = 60;
+		m_request.setResource("/hello");
+		m_response.setStatusCode(HTTPTypes::RESPONSE_CODE_OK);
+	}
+
+	/// stores the response and returns true if it was kept
+	bool store(const std::string& key, const std::string& bytes) {
+		m_cache.store(m_policy, key, m_response, bytes);
+		return m_cache.find(key).get() != NULL;
+	}
+
+	/// a waiter that records the response it was called with
+	void wait(HTTPResponseCache::ResponsePtr response) {
+		m_waited.push_back(response ? *response : "none");
+	}
+
+	HTTPResponseCache								m_cache;
+	boost::shared_ptr<HTTPResponseCache::Policy>	m_policy;
+	HTTPRequest										m_request;
+	HTTPResponse									m_response;
+	std::vector<std::string>						m_waited;
+};
+
+
+BOOST_FIXTURE_TEST_SUITE(HTTPResponseCacheTests_S, HTTPResponseCacheTests_F)
+
+BOOST_AUTO_TEST_CASE(checkStoredResponseIsFound) {
+	BOOST_CHECK(! m_cache.find("key"));
+	BOOST_CHECK(store("key", "response"));
+	BOOST_CHECK_EQUAL(*m_cache.find("key"), "response");
+	BOOST_CHECK_EQUAL(m_cache.getSize(), 8U);
+	BOOST_CHECK_EQUAL(m_cache.getHits(), 2UL);
+	BOOST_CHECK_EQUAL(m_cache.getMisses(), 1UL);
+}
+
+BOOST_AUTO_TEST_CASE(checkStoredResponseETagIsFound) {
+	std::string etag("stale");
+	BOOST_CHECK(store("plain", "response"));
+	BOOST_CHECK(m_cache.find("plain", &etag));
+	BOOST_CHECK_EQUAL(etag, "");
+	m_response.addHeader(HTTPTypes::HEADER_ETAG, "\"v1\"");
+	BOOST_CHECK(store("tagged", "response"));
+	BOOST_CHECK(m_cache.find("tagged", &etag));
+	BOOST_CHECK_EQUAL(etag, "\"v1\"");
+}
+
+BOOST_AUTO_TEST_CASE(checkExpiredResponseIsNotFound) {
+	m_policy->m_ttl = 0;
+	BOOST_CHECK(! store("key", "response"));
+	BOOST_CHECK_EQUAL(m_cache.getSize(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(checkUncacheableResponsesAreNotKept) {
+	m_response.setStatusCode(HTTPTypes::RESPONSE_CODE_NOT_FOUND);
+	BOOST_CHECK(! store("not found", "response"));
+	m_response.setStatusCode(HTTPTypes::RESPONSE_CODE_OK);
+
+	m_response.addHeader(HTTPTypes::HEADER_CACHE_CONTROL, "max-age=0, private");
+	BOOST_CHECK(! store("private", "response"));
+	m_response.deleteHeader(HTTPTypes::HEADER_CACHE_CONTROL);
+
+	m_response.addHeader(HTTPTypes::HEADER_SET_COOKIE, "session=1");
+	BOOST_CHECK(! store("cookie", "response"));
+	m_response.deleteHeader(HTTPTypes::HEADER_SET_COOKIE);
+
+	BOOST_CHECK(store("ok", "response"));
+}
+
+BOOST_AUTO_TEST_CASE(checkVaryMustBePartOfTheKey) {
+	m_response.addHeader(HTTPTypes::HEADER_VARY, "Accept-Encoding, Accept-Language");
+	m_policy->m_header_keys.push_back("accept-encoding");
+	BOOST_CHECK(! store("key", "response"));
+	m_policy->m_header_keys.push_back("Accept-Language");
+	BOOST_CHECK(store("key", "response"));
+}
+
+BOOST_AUTO_TEST_CASE(checkKeyIncludesPolicyKeys) {
+	m_request.addQuery("page", "1");
+	m_request.addQuery("session", "abc");
+	m_request.addHeader("Accept-Language", "en");
+	m_policy->m_query_keys.push_back("page");
+	m_policy->m_header_keys.push_back("Accept-Language");
+	const std::string key(HTTPResponseCache::makeKey(*m_policy, m_request, true));
+
+	// parameters that are not in the policy do not change the key
+	m_request.changeQuery("session", "def");
+	BOOST_CHECK_EQUAL(HTTPResponseCache::makeKey(*m_policy, m_request, true), key);
+	BOOST_CHECK(HTTPResponseCache::makeKey(*m_policy, m_request, false) != key);
+	m_request.changeQuery("page", "2");
+	BOOST_CHECK(HTTPResponseCache::makeKey(*m_policy, m_request, true) != key);
+	m_request.changeQuery("page", "1");
+	m_request.changeHeader("Accept-Language", "fr");
+	BOOST_CHECK(HTTPResponseCache::makeKey(*m_policy, m_request, true) != key);
+}
+
+BOOST_AUTO_TEST_CASE(checkLeastRecentlyUsedResponsesAreEvicted) {
+	const std::string bytes(40, 'x');
+	BOOST_CHECK(store("a", bytes));
+	BOOST_CHECK(store("b", bytes));
+	BOOST_CHECK(m_cache.find("a"));
+	BOOST_CHECK(store("c", bytes));
+	BOOST_CHECK(m_cache.find("a"));
+	BOOST_CHECK(! m_cache.find("b"));
+	BOOST_CHECK_EQUAL(m_cache.getSize(), 80U);
+	BOOST_CHECK_EQUAL(m_cache.getEvictions(), 1UL);
+
+	// responses larger than the cache are never kept
+	BOOST_CHECK(! store("d", std::string(101, 'x')));
+	m_cache.setMaxSize(40);
+	BOOST_CHECK_EQUAL(m_cache.getSize(), 40U);
+}
+
+BOOST_AUTO_TEST_CASE(checkIdenticalRequestsWaitForFlight) {
+	boost::asio::io_service io_service;
+	HTTPResponseCachePtr cache(new HTTPResponseCache);
+	HTTPResponseCache::Waiter waiter(boost::bind(&HTTPResponseCacheTests_F::wait, this, _1));
+
+	// the first request starts a flight, which the others join
+	HTTPResponseCache::FlightPtr flight(cache->join(m_policy, "key", io_service, waiter, 60000));
+	BOOST_REQUIRE(flight);
+	BOOST_CHECK(! cache->join(m_policy, "key", io_service, waiter, 60000));
+	BOOST_CHECK(! cache->join(m_policy, "key", io_service, waiter, 60000));
+	flight->land(m_response, "response");
+	io_service.run();
+	BOOST_REQUIRE_EQUAL(m_waited.size(), 2U);
+	BOOST_CHECK_EQUAL(m_waited[0], "response");
+	BOOST_CHECK_EQUAL(cache->getCoalesced(), 2UL);
+	BOOST_CHECK(cache->find("key"));
+
+	// a response that is not cached is not shared either
+	io_service.reset();
+	m_waited.clear();
+	m_response.addHeader(HTTPTypes::HEADER_SET_COOKIE, "session=1");
+	flight = cache->join(m_policy, "other", io_service, waiter, 60000);
+	BOOST_REQUIRE(flight);
+	BOOST_CHECK(! cache->join(m_policy, "other", io_service, waiter, 60000));
+	flight->land(m_response, "response");
+	io_service.run();
+	BOOST_REQUIRE_EQUAL(m_waited.size(), 1U);
+	BOOST_CHECK_EQUAL(m_waited[0], "none");
+	BOOST_CHECK_EQUAL(cache->getCoalesced(), 2UL);
+}
+
+BOOST_AUTO_TEST_CASE(checkWaitForFlightIsBounded) {
+	boost::asio::io_service io_service;
+	HTTPResponseCachePtr cache(new HTTPResponseCache);
+	HTTPResponseCache::Waiter waiter(boost::bind(&HTTPResponseCacheTests_F::wait, this, _1));
+
+	HTTPResponseCache::FlightPtr flight(cache->join(m_policy, "key", io_service, waiter, 60000));
+	BOOST_CHECK(! cache->join(m_policy, "key", io_service, waiter, 10));
+	io_service.run();
+	BOOST_REQUIRE_EQUAL(m_waited.size(), 1U);
+	BOOST_CHECK_EQUAL(m_waited[0], "none");
+	BOOST_CHECK_EQUAL(cache->getCoalesceTimeouts(), 1UL);
+
+	// requests that are still waiting are released if the flight is abandoned
+	io_service.reset();
+	BOOST_CHECK(! cache->join(m_policy, "key", io_service, waiter, 60000));
+	flight.reset();
+	io_service.run();
+	BOOST_REQUIRE_EQUAL(m_waited.size(), 2U);
+	BOOST_CHECK_EQUAL(m_waited[1], "none");
+	BOOST_CHECK(cache->join(m_policy, "key", io_service, waiter, 60000));
+}
+
+BOOST_AUTO_TEST_CASE(checkCancelledWaitersAreNotCalled) {
+	boost::asio::io_service io_service;
+	HTTPResponseCachePtr cache(new HTTPResponseCache);
+	HTTPResponseCache::Waiter waiter(boost::bind(&HTTPResponseCacheTests_F::wait, this, _1));
+
+	// a request that is still waiting, and one whose response has been posted
+	HTTPResponseCache::FlightPtr flight(cache->join(m_policy, "key", io_service, waiter, 60000));
+	HTTPResponseCache::FlightPtr landed(cache->join(m_policy, "landed", io_service, waiter, 60000));
+	BOOST_CHECK(! cache->join(m_policy, "key", io_service, waiter, 60000));
+	BOOST_CHECK(! cache->join(m_policy, "landed", io_service, waiter, 60000));
+	landed->land(m_response, "response");
+	cache->cancelWaiters();
+	flight->land(m_response, "response");
+	io_service.run();
+	BOOST_CHECK(m_waited.empty());
+
+	// requests that join afterwards are called as usual
+	io_service.reset();
+	flight = cache->join(m_policy, "other", io_service, waiter, 60000);
+	BOOST_CHECK(! cache->join(m_policy, "other", io_service, waiter, 60000));
+	flight->land(m_response, "response");
+	io_service.run();
+	BOOST_REQUIRE_EQUAL(m_waited.size(), 1U);
+	BOOST_CHECK_EQUAL(m_waited[0], "response");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
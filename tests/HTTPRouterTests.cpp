@@ -0,0 +1,176 @@
+// ------------------------------------------------------------------
+// pion-net: a C++ framework for building lightweight HTTP interfaces
+// ------------------------------------------------------------------
+// Copyright (C) 2007-2010 Atomic Labs, Inc.  (http://www.atomiclabs.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include <pion/PionConfig.hpp>
+#include <pion/net/HTTPRouter.hpp>
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+
+using namespace pion;
+using namespace pion::net;
+
+
+///
+/// HTTPRouterTests_F: builds routers for a set of resources
+///
+class HTTPRouterTests_F {
+public:
+	HTTPRouterTests_F() {
+		addResource("/hello");
+		addResource("/hello/world/again");
+		addResource("/files/images");
+		addResource("/files/docs/2010");
+	}
+
+	/// adds a resource, with a handler that records the resource's name
+	void addResource(const std::string& resource) {
+		m_resources[resource] = boost::bind(&HTTPRouterTests_F::handleRequest,
+											this, resource, _1, _2);
+	}
+
+	/// returns the name of the resource whose handler matches, or "none"
+	std::string find(const std::string& resource) {
+		HTTPRouter router(m_resources, m_redirects, 10);
+		HTTPRouter::Match match(router.find(resource));
+		if (match.m_handler == NULL)
+			return "none";
+		HTTPRequestPtr request;
+		TCPConnectionPtr tcp_conn;
+		(*match.m_handler)(request, tcp_conn);
+		return m_handled;
+	}
+
+	void handleRequest(const std::string& resource, HTTPRequestPtr&, TCPConnectionPtr&) {
+		m_handled = resource;
+	}
+
+	HTTPRouter::ResourceMap		m_resources;
+	HTTPRouter::RedirectMap		m_redirects;
+	std::string					m_handled;
+};
+
+
+BOOST_FIXTURE_TEST_SUITE(HTTPRouterTests_S, HTTPRouterTests_F)
+
+BOOST_AUTO_TEST_CASE(checkExactMatch) {
+	BOOST_CHECK_EQUAL(find("/hello"), "/hello");
+	BOOST_CHECK_EQUAL(find("/hello/world/again"), "/hello/world/again");
+	BOOST_CHECK_EQUAL(find("/files/images"), "/files/images");
+}
+
+BOOST_AUTO_TEST_CASE(checkLongestPrefixMatch) {
+	BOOST_CHECK_EQUAL(find("/hello/world"), "/hello");
+	BOOST_CHECK_EQUAL(find("/hello/world/again/and/again"), "/hello/world/again");
+	BOOST_CHECK_EQUAL(find("/files/images/logo.png"), "/files/images");
+	BOOST_CHECK_EQUAL(find("/files/docs/2010/readme.txt"), "/files/docs/2010");
+}
+
+BOOST_AUTO_TEST_CASE(checkMatchIsOnSegmentBoundary) {
+	BOOST_CHECK_EQUAL(find("/hellothere"), "none");
+	BOOST_CHECK_EQUAL(find("/files"), "none");
+	BOOST_CHECK_EQUAL(find("/files/docs"), "none");
+	BOOST_CHECK_EQUAL(find("/files/docs/20101"), "none");
+	BOOST_CHECK_EQUAL(find(""), "none");
+}
+
+BOOST_AUTO_TEST_CASE(checkEmptyResourceMatchesEverything) {
+	addResource("");
+	BOOST_CHECK_EQUAL(find(""), "");
+	BOOST_CHECK_EQUAL(find("/files"), "");
+	BOOST_CHECK_EQUAL(find("/files/images/logo.png"), "/files/images");
+	BOOST_CHECK_EQUAL(find("nothing"), "");
+}
+
+BOOST_AUTO_TEST_CASE(checkResourceAddedWithinCompressedPath) {
+	addResource("/files/docs");
+	addResource("/hello/world");
+	BOOST_CHECK_EQUAL(find("/files/docs/2009"), "/files/docs");
+	BOOST_CHECK_EQUAL(find("/files/docs/2010/readme.txt"), "/files/docs/2010");
+	BOOST_CHECK_EQUAL(find("/hello/world/other"), "/hello/world");
+	BOOST_CHECK_EQUAL(find("/hello/world/again"), "/hello/world/again");
+}
+
+BOOST_AUTO_TEST_CASE(checkRedirectIsResolved) {
+	m_redirects["/old"] = "/older";
+	m_redirects["/older"] = "/files/images/old";
+	HTTPRouter router(m_resources, m_redirects, 10);
+	HTTPRouter::Match match(router.find("/old"));
+	BOOST_REQUIRE(match.m_redirect != NULL);
+	BOOST_CHECK_EQUAL(*match.m_redirect, "/files/images/old");
+	BOOST_CHECK(! match.m_too_many_redirects);
+	BOOST_CHECK(match.m_handler != NULL);
+
+	// only exact matches are redirected
+	match = router.find("/old/file");
+	BOOST_CHECK(match.m_redirect == NULL);
+	BOOST_CHECK(match.m_handler == NULL);
+}
+
+BOOST_AUTO_TEST_CASE(checkRedirectLoopIsDetected) {
+	m_redirects["/a"] = "/b";
+	m_redirects["/b"] = "/a";
+	HTTPRouter router(m_resources, m_redirects, 10);
+	HTTPRouter::Match match(router.find("/a"));
+	BOOST_CHECK(match.m_too_many_redirects);
+	BOOST_CHECK(match.m_handler == NULL);
+}
+
+BOOST_AUTO_TEST_CASE(checkAuthRulesAreResolved) {
+	HTTPRouter::AuthResourceSet restrict_list;
+	HTTPRouter::AuthResourceSet white_list;
+	restrict_list.insert("/files");
+	restrict_list.insert("/private");
+	white_list.insert("/files/images");
+	m_redirects["/logo"] = "/files/images/logo.png";
+	m_redirects["/docs"] = "/files/docs";
+	HTTPRouter router(m_resources, m_redirects, 10, restrict_list, white_list);
+
+	BOOST_CHECK(! router.find("/hello").m_auth_required);
+	BOOST_CHECK(! router.find("/filesystem").m_auth_required);
+	BOOST_CHECK(router.find("/files").m_auth_required);
+	BOOST_CHECK(router.find("/files/docs/2010/readme.txt").m_auth_required);
+	BOOST_CHECK(! router.find("/files/images/logo.png").m_auth_required);
+	BOOST_CHECK(router.find("/private/data").m_auth_required);
+	BOOST_CHECK(router.find("/private/data").m_handler == NULL);
+
+	// the rules apply to the resource that a request is redirected to
+	BOOST_CHECK(! router.find("/logo").m_auth_required);
+	BOOST_CHECK(router.find("/docs").m_auth_required);
+}
+
+BOOST_AUTO_TEST_CASE(checkAuthRuleForEmptyResource) {
+	HTTPRouter::AuthResourceSet restrict_list;
+	HTTPRouter::AuthResourceSet white_list;
+	restrict_list.insert("");
+	white_list.insert("/hello/world");
+	HTTPRouter router(m_resources, m_redirects, 10, restrict_list, white_list);
+
+	BOOST_CHECK(router.find("").m_auth_required);
+	BOOST_CHECK(router.find("/hello").m_auth_required);
+	BOOST_CHECK(router.find("/unknown").m_auth_required);
+	BOOST_CHECK(! router.find("/hello/world/again").m_auth_required);
+}
+
+BOOST_AUTO_TEST_CASE(checkCachePolicyIsResolved) {
+	HTTPResponseCache::PolicyMap cache_policies;
+	HTTPResponseCache::PolicyPtr files_policy(new HTTPResponseCache::Policy);
+	HTTPResponseCache::PolicyPtr images_policy(new HTTPResponseCache::Policy);
+	cache_policies["/files"] = files_policy;
+	cache_policies["/files/images"] = images_policy;
+	m_redirects["/logo"] = "/files/images/logo.png";
+	HTTPRouter router(m_resources, m_redirects, 10, HTTPRouter::AuthResourceSet(),
+					  HTTPRouter::AuthResourceSet(), cache_policies);
+
+	BOOST_CHECK(! router.find("/hello").m_cache_policy);
+	BOOST_CHECK(router.find("/files/docs/2010").m_cache_policy == files_policy);
+	BOOST_CHECK(router.find("/files/images/logo.png").m_cache_policy == images_policy);
+	BOOST_CHECK(router.find("/logo").m_cache_policy == images_policy);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,141 @@
+// ------------------------------------------------------------------
+// pion-net: a C++ framework for building lightweight HTTP interfaces
+// ------------------------------------------------------------------
+// Copyright (C) 2007-2010 Atomic Labs, Inc.  (http://www.atomiclabs.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include <pion/PionConfig.hpp>
+#include <pion/net/HandlerAllocator.hpp>
+#include <pion/net/TCPConnection.hpp>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+
+using namespace pion;
+using namespace pion::net;
+using boost::asio::ip::tcp;
+
+
+BOOST_AUTO_TEST_CASE(checkHandlerAllocatorReusesArena) {
+	HandlerAllocator allocator;
+	void *ptr = allocator.allocate(100);
+	allocator.deallocate(ptr);
+	BOOST_CHECK(allocator.allocate(200) == ptr);
+	BOOST_CHECK_EQUAL(allocator.getArenaAllocations(), 2UL);
+	BOOST_CHECK_EQUAL(allocator.getHeapAllocations(), 0UL);
+	allocator.deallocate(ptr);
+}
+
+BOOST_AUTO_TEST_CASE(checkHandlerAllocatorFallsBackToHeap) {
+	HandlerAllocator allocator;
+	void *arena_ptr = allocator.allocate(100);
+
+	// the arena is already in use
+	void *heap_ptr = allocator.allocate(100);
+	BOOST_CHECK(heap_ptr != arena_ptr);
+	allocator.deallocate(heap_ptr);
+	allocator.deallocate(arena_ptr);
+
+	// the operation is too large for the arena
+	heap_ptr = allocator.allocate(HandlerAllocator::ARENA_SIZE + 1);
+	BOOST_CHECK(heap_ptr != arena_ptr);
+	allocator.deallocate(heap_ptr);
+
+	BOOST_CHECK_EQUAL(allocator.getArenaAllocations(), 1UL);
+	BOOST_CHECK_EQUAL(allocator.getHeapAllocations(), 2UL);
+}
+
+
+///
+/// PingPong: exchanges one-byte messages between two connections
+///
+class PingPong {
+public:
+	PingPong(TCPConnectionPtr& client, TCPConnectionPtr& server, unsigned int rounds)
+		: m_client(client), m_server(server), m_rounds(rounds), m_finished_rounds(0)
+	{}
+
+	void start(void) {
+		m_server->async_read_some(boost::bind(&PingPong::handleServerRead, this,
+											  boost::asio::placeholders::error));
+		sendPing();
+	}
+
+	inline unsigned int getFinishedRounds(void) const { return m_finished_rounds; }
+
+private:
+	void sendPing(void) {
+		m_client->async_write(boost::asio::buffer("?", 1),
+							  boost::bind(&PingPong::handleClientWrite, this,
+										  boost::asio::placeholders::error));
+	}
+
+	void handleClientWrite(const boost::system::error_code& ec) {
+		if (! ec)
+			m_client->async_read_some(boost::bind(&PingPong::handleClientRead, this,
+												  boost::asio::placeholders::error));
+	}
+
+	void handleClientRead(const boost::system::error_code& ec) {
+		if (ec)
+			return;
+		if (++m_finished_rounds < m_rounds) {
+			sendPing();
+		} else {
+			m_client->close();
+			m_server->close();
+		}
+	}
+
+	void handleServerRead(const boost::system::error_code& ec) {
+		if (! ec)
+			m_server->async_write(boost::asio::buffer("!", 1),
+								  boost::bind(&PingPong::handleServerWrite, this,
+											  boost::asio::placeholders::error));
+	}
+
+	void handleServerWrite(const boost::system::error_code& ec) {
+		if (! ec)
+			m_server->async_read_some(boost::bind(&PingPong::handleServerRead, this,
+												  boost::asio::placeholders::error));
+	}
+
+	TCPConnectionPtr	m_client;
+	TCPConnectionPtr	m_server;
+	unsigned int		m_rounds;
+	unsigned int		m_finished_rounds;
+};
+
+BOOST_AUTO_TEST_CASE(checkAsyncReadWriteCycleDoesNotAllocateFromHeap) {
+	boost::asio::io_service io_service;
+	tcp::acceptor acceptor(io_service, tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), 0));
+	tcp::endpoint server_endpoint(acceptor.local_endpoint());
+	TCPConnectionPtr client(new TCPConnection(io_service));
+	TCPConnectionPtr server(new TCPConnection(io_service));
+	BOOST_REQUIRE(! client->connect(server_endpoint));
+	BOOST_REQUIRE(! server->accept(acceptor));
+
+	const unsigned int ROUNDS = 1000;
+	PingPong ping_pong(client, server, ROUNDS);
+	ping_pong.start();
+	io_service.run();
+	BOOST_CHECK_EQUAL(ping_pong.getFinishedRounds(), ROUNDS);
+
+	// every operation's memory came from the connections' arenas
+	const unsigned long arena_allocations = client->getReadAllocator().getArenaAllocations()
+		+ client->getWriteAllocator().getArenaAllocations()
+		+ server->getReadAllocator().getArenaAllocations()
+		+ server->getWriteAllocator().getArenaAllocations();
+	const unsigned long heap_allocations = client->getReadAllocator().getHeapAllocations()
+		+ client->getWriteAllocator().getHeapAllocations()
+		+ server->getReadAllocator().getHeapAllocations()
+		+ server->getWriteAllocator().getHeapAllocations();
+	BOOST_TEST_MESSAGE("async operations for " << ROUNDS << " round trips: "
+					   << arena_allocations << " from arenas, "
+					   << heap_allocations << " from the heap");
+	BOOST_CHECK(arena_allocations >= 4 * ROUNDS);
+	BOOST_CHECK_EQUAL(heap_allocations, 0UL);
+}
@@ -0,0 +1,89 @@
+// ------------------------------------------------------------------
+// pion-net: a C++ framework for building lightweight HTTP interfaces
+// ------------------------------------------------------------------
+// Copyright (C) 2007-2010 Atomic Labs, Inc.  (http://www.atomiclabs.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include <pion/PionConfig.hpp>
+#include <pion/net/IPNetworkTrie.hpp>
+#include <boost/test/unit_test.hpp>
+
+using namespace pion;
+using namespace pion::net;
+
+
+///
+/// IPNetworkTrieTests_F: has a few IPv4 and IPv6 networks
+///
+class IPNetworkTrieTests_F {
+public:
+	IPNetworkTrieTests_F() {
+		m_networks.insert("192.0.2.0/24");
+		m_networks.insert("198.51.100.7");
+		m_networks.insert("2001:db8::/32");
+	}
+
+	/// returns true if an address is within any of the networks
+	bool contains(const std::string& address) const {
+		return m_networks.contains(boost::asio::ip::address::from_string(address));
+	}
+
+	IPNetworkTrie	m_networks;
+};
+
+
+BOOST_FIXTURE_TEST_SUITE(IPNetworkTrieTests_S, IPNetworkTrieTests_F)
+
+BOOST_AUTO_TEST_CASE(checkIPv4NetworksContainAddresses) {
+	BOOST_CHECK(contains("192.0.2.0"));
+	BOOST_CHECK(contains("192.0.2.255"));
+	BOOST_CHECK(! contains("192.0.3.1"));
+	BOOST_CHECK(contains("198.51.100.7"));
+	BOOST_CHECK(! contains("198.51.100.6"));
+	BOOST_CHECK(contains("::ffff:192.0.2.9"));
+}
+
+BOOST_AUTO_TEST_CASE(checkIPv6NetworksContainAddresses) {
+	BOOST_CHECK(contains("2001:db8::1"));
+	BOOST_CHECK(contains("2001:db8:ffff::"));
+	BOOST_CHECK(! contains("2001:db9::1"));
+	BOOST_CHECK(! contains("::1"));
+}
+
+BOOST_AUTO_TEST_CASE(checkWiderNetworksIncludeNarrowerOnes) {
+	m_networks.insert("192.0.0.0/16");
+	BOOST_CHECK(contains("192.0.200.1"));
+	BOOST_CHECK(contains("192.0.2.1"));
+	m_networks.insert("0.0.0.0/0");
+	BOOST_CHECK(contains("203.0.113.1"));
+	BOOST_CHECK(! contains("2001:db9::1"));
+}
+
+BOOST_AUTO_TEST_CASE(checkEmptyTrieContainsNothing) {
+	IPNetworkTrie networks;
+	BOOST_CHECK(networks.empty());
+	BOOST_CHECK(! networks.contains(boost::asio::ip::address::from_string("0.0.0.0")));
+	BOOST_CHECK(! m_networks.empty());
+}
+
+BOOST_AUTO_TEST_CASE(checkBadNetworksAreRejected) {
+	BOOST_CHECK_THROW(m_networks.insert("192.0.2.0/33"), IPNetworkTrie::BadNetworkException);
+	BOOST_CHECK_THROW(m_networks.insert("192.0.2.0/"), IPNetworkTrie::BadNetworkException);
+	BOOST_CHECK_THROW(m_networks.insert("192.0.2/24"), IPNetworkTrie::BadNetworkException);
+	BOOST_CHECK_THROW(m_networks.insert("2001:db8::/129"), IPNetworkTrie::BadNetworkException);
+	BOOST_CHECK_THROW(m_networks.insert("proxy"), IPNetworkTrie::BadNetworkException);
+}
+
+BOOST_AUTO_TEST_CASE(checkPrivateNetworks) {
+	const IPNetworkTrie& networks = IPNetworkTrie::getPrivateNetworks();
+	BOOST_CHECK(networks.contains(boost::asio::ip::address::from_string("172.31.255.1")));
+	BOOST_CHECK(! networks.contains(boost::asio::ip::address::from_string("172.32.0.1")));
+	BOOST_CHECK(networks.contains(boost::asio::ip::address::from_string("fd00::1")));
+	BOOST_CHECK(networks.contains(boost::asio::ip::address::from_string("fe80::1")));
+	BOOST_CHECK(! networks.contains(boost::asio::ip::address::from_string("2001:db8::1")));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
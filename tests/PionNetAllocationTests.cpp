@@ -0,0 +1,191 @@
+// ------------------------------------------------------------------
+// pion-net: a C++ framework for building lightweight HTTP interfaces
+// ------------------------------------------------------------------
+// Copyright (C) 2007-2010 Atomic Labs, Inc.  (http://www.atomiclabs.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See http://www.boost.org/LICENSE_1_0.txt
+//
+
+// These tests replace the global operator new and delete, so that they can
+// count every allocation; they are built as a separate program so that the
+// other unit tests are not affected.
+
+#include <pion/PionConfig.hpp>
+#include <pion/PionScheduler.hpp>
+#include <pion/net/TCPConnection.hpp>
+#include <pion/net/TCPTimer.hpp>
+#include <pion/net/HTTPServer.hpp>
+#include <pion/net/HTTPParser.hpp>
+#include <pion/net/HTTPRequest.hpp>
+#include <boost/asio.hpp>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#define BOOST_TEST_MODULE pion-net-allocation-tests
+#include <boost/test/unit_test.hpp>
+
+#include <pion/PionUnitTestDefs.hpp>
+
+using namespace pion;
+using namespace pion::net;
+using boost::asio::ip::tcp;
+
+BOOST_GLOBAL_FIXTURE(PionUnitTestsConfig);
+
+
+/// counts every global allocation made by the test program
+static boost::atomic<unsigned long>	g_global_allocations(0);
+
+void *operator new(std::size_t n) {
+	++g_global_allocations;
+	void *ptr = std::malloc(n == 0 ? 1 : n);
+	if (ptr == NULL)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void *operator new[](std::size_t n) {
+	++g_global_allocations;
+	void *ptr = std::malloc(n == 0 ? 1 : n);
+	if (ptr == NULL)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void operator delete(void *ptr) throw() { std::free(ptr); }
+
+void operator delete[](void *ptr) throw() { std::free(ptr); }
+
+
+BOOST_AUTO_TEST_CASE(checkRearmedTimerDoesNotAllocate) {
+	boost::asio::io_service io_service;
+	tcp::acceptor acceptor(io_service, tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), 0));
+	TCPConnectionPtr client(new TCPConnection(io_service));
+	TCPConnectionPtr server(new TCPConnection(io_service));
+	tcp::endpoint server_endpoint(acceptor.local_endpoint());
+	BOOST_REQUIRE(! client->connect(server_endpoint));
+	BOOST_REQUIRE(! server->accept(acceptor));
+	TCPTimerPtr timer_ptr(new TCPTimer(server));
+
+	// re-arm the timer without letting the cancelled waits finish first
+	const unsigned int ROUNDS = 1000;
+	unsigned long allocations = 0;
+	for (unsigned int warm_up = 0; warm_up < 2; ++warm_up) {
+		const unsigned long before = g_global_allocations;
+		for (unsigned int n = 0; n < ROUNDS; ++n) {
+			timer_ptr->start(60);
+			timer_ptr->cancel();
+			timer_ptr->start(60);
+			timer_ptr->cancel();
+			io_service.poll();
+			io_service.reset();
+		}
+		allocations = g_global_allocations - before;
+	}
+	BOOST_CHECK_EQUAL(allocations, 0UL);
+	BOOST_CHECK(server->is_open());
+	client->close();
+	server->close();
+}
+
+
+/// request sent by the keep-alive tests' client
+static const char STATIC_REQUEST[] = "GET /static HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+/// response sent by the keep-alive tests' server
+static const char STATIC_RESPONSE[] = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+
+/// returns the number of global allocations made to parse one request into
+/// a new HTTPRequest, which the server cannot avoid
+static unsigned long countRequestAllocations(void) {
+	const unsigned long before = g_global_allocations;
+	{
+		HTTPParser parser(true);
+		HTTPRequestPtr request(new HTTPRequest);
+		boost::system::error_code ec;
+		parser.setReadBuffer(STATIC_REQUEST, sizeof(STATIC_REQUEST) - 1);
+		BOOST_REQUIRE(parser.parse(*request, ec) == true);
+	}
+	return g_global_allocations - before;
+}
+
+///
+/// KeepAliveClient: sends requests to an HTTPServer over one persistent connection
+///
+class KeepAliveClient {
+public:
+	KeepAliveClient(unsigned int port)
+		: m_socket(m_io_service)
+	{
+		m_socket.connect(tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), port));
+	}
+
+	/// sends a batch of requests, each in the given number of pieces, and returns
+	/// the number of global allocations made while the server handled them
+	unsigned long sendRequests(unsigned int num_requests, unsigned int num_pieces) {
+		const std::size_t request_size = sizeof(STATIC_REQUEST) - 1;
+		const std::size_t piece_size = (request_size + num_pieces - 1) / num_pieces;
+		const unsigned long before = g_global_allocations;
+		for (unsigned int n = 0; n < num_requests; ++n) {
+			for (std::size_t pos = 0; pos < request_size; pos += piece_size) {
+				if (pos > 0)	// give the server a chance to read each piece separately
+					PionScheduler::sleep(0, 1000000);	// 1 millisecond
+				boost::asio::write(m_socket, boost::asio::buffer(STATIC_REQUEST + pos,
+					std::min(piece_size, request_size - pos)));
+			}
+			receiveResponse();
+		}
+		// let the server finish the last request before counting
+		PionScheduler::sleep(0, 100000000);	// 0.1 seconds
+		return g_global_allocations - before;
+	}
+
+private:
+	void receiveResponse(void) {
+		const std::size_t response_size = sizeof(STATIC_RESPONSE) - 1;
+		std::size_t bytes_read = 0;
+		while (bytes_read < response_size)
+			bytes_read += m_socket.read_some(boost::asio::buffer(m_buffer + bytes_read,
+				response_size - bytes_read));
+		BOOST_REQUIRE(std::memcmp(m_buffer, STATIC_RESPONSE, response_size) == 0);
+	}
+
+	boost::asio::io_service		m_io_service;
+	tcp::socket					m_socket;
+	char						m_buffer[256];
+};
+
+static void sendStaticResponse(HTTPRequestPtr& /* request */, TCPConnectionPtr& tcp_conn) {
+	tcp_conn->async_write(boost::asio::buffer(STATIC_RESPONSE,
+		sizeof(STATIC_RESPONSE) - 1), boost::bind(&TCPConnection::finish, tcp_conn));
+}
+
+BOOST_AUTO_TEST_CASE(checkKeepAliveReadsAndTimersDoNotAllocate) {
+	HTTPServerPtr server_ptr(new HTTPServer(0));
+	server_ptr->addResource("/static", &sendStaticResponse);
+	server_ptr->start();
+	KeepAliveClient client(server_ptr->getPort());
+
+	const unsigned int REQUESTS = 100;
+	client.sendRequests(REQUESTS, 1);	// warm-up
+	const unsigned long request_allocations = countRequestAllocations();
+	const unsigned long whole_requests = client.sendRequests(REQUESTS, 1);
+	const unsigned long split_requests = client.sendRequests(REQUESTS, 3);
+	BOOST_TEST_MESSAGE("global allocations for " << REQUESTS << " keep-alive requests: "
+					   << whole_requests << " read at once, "
+					   << split_requests << " read in pieces ("
+					   << request_allocations << " to parse each request)");
+
+	// reading a request in several pieces re-arms the connection's read timer and
+	// issues more async reads, none of which may allocate; what remains is the
+	// parsed request, and the per-request reader and its reference count (each
+	// read, write and timer wait that allocated would add at least one more)
+	BOOST_CHECK_EQUAL(split_requests, whole_requests);
+	BOOST_CHECK(whole_requests <= REQUESTS * (request_allocations + 2));
+	server_ptr->stop();
+}
@@ -17,17 +17,23 @@
 #include <boost/test/unit_test.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/condition.hpp>
+#include <boost/thread/thread.hpp>
 #include <boost/filesystem.hpp>
 #include <pion/PionPlugin.hpp>
 #include <pion/PionScheduler.hpp>
 #include <pion/net/HTTPRequest.hpp>
 #include <pion/net/HTTPResponse.hpp>
 #include <pion/net/HTTPRequestWriter.hpp>
+#include <pion/net/HTTPResponseWriter.hpp>
 #include <pion/net/HTTPResponseReader.hpp>
+#include <pion/net/HTTPServer.hpp>
 #include <pion/net/WebServer.hpp>
 #include <pion/net/PionUser.hpp>
 #include <pion/net/HTTPBasicAuth.hpp>
 #include <pion/net/HTTPCookieAuth.hpp>
+#include <pion/net/HTTPRateLimiter.hpp>
+#include <iterator>
+#include <set>
 
 
 using namespace std;
@@ -40,6 +46,7 @@ PION_DECLARE_PLUGIN(FileService)
 PION_DECLARE_PLUGIN(HelloService)
 PION_DECLARE_PLUGIN(LogService)
 PION_DECLARE_PLUGIN(CookieService)
+PION_DECLARE_PLUGIN(ProxyService)
 
 #if defined(PION_XCODE)
 	static const std::string PATH_TO_PLUGINS(".");
@@ -425,6 +432,67 @@ BOOST_AUTO_TEST_CASE(checkSendRequestAndReceiveResponseFromEchoService) {
 	BOOST_CHECK(boost::regex_match(http_response.getContent(), post_content));
 }
 
+BOOST_AUTO_TEST_CASE(checkEchoServiceCompressesResponseIfAccepted) {
+	m_server.loadService("/echo", "EchoService");
+	m_server.setServiceOption("/echo", "compress", "true");
+	m_server.start();
+
+	// open a connection
+	TCPConnectionPtr tcp_conn(new TCPConnection(getIOService()));
+	boost::system::error_code error_code;
+	error_code = tcp_conn->connect(boost::asio::ip::address::from_string("127.0.0.1"), m_server.getPort());
+	BOOST_REQUIRE(!error_code);
+
+	// send a request that accepts gzip content
+	HTTPRequest http_request("/echo");
+	http_request.addHeader(HTTPTypes::HEADER_ACCEPT_ENCODING, "gzip");
+	for (int n = 0; n < 64; ++n)
+		http_request.addHeader("X-Padding-" + boost::lexical_cast<std::string>(n), "make the response larger");
+	http_request.send(*tcp_conn, error_code);
+	BOOST_REQUIRE(!error_code);
+
+	// receive the response from the server
+	HTTPResponse http_response(http_request);
+	http_response.receive(*tcp_conn, error_code);
+	BOOST_REQUIRE(!error_code);
+	BOOST_CHECK(http_response.getStatusCode() == 200);
+	BOOST_CHECK_EQUAL(http_response.getHeader(HTTPTypes::HEADER_VARY), HTTPTypes::HEADER_ACCEPT_ENCODING);
+
+	if (HTTPCompressor::isSupported()) {
+		// the content should be compressed (and so it should not be readable)
+		BOOST_CHECK_EQUAL(http_response.getHeader(HTTPTypes::HEADER_CONTENT_ENCODING), "gzip");
+		BOOST_CHECK(http_response.getContentLength() > 0);
+		BOOST_CHECK(std::string(http_response.getContent(), http_response.getContentLength()).find("[Request Echo]") == std::string::npos);
+	} else {
+		BOOST_CHECK(! http_response.hasHeader(HTTPTypes::HEADER_CONTENT_ENCODING));
+	}
+}
+
+BOOST_AUTO_TEST_CASE(checkEchoServiceDoesNotCompressResponseByDefault) {
+	m_server.loadService("/echo", "EchoService");
+	m_server.start();
+
+	// open a connection
+	TCPConnectionPtr tcp_conn(new TCPConnection(getIOService()));
+	boost::system::error_code error_code;
+	error_code = tcp_conn->connect(boost::asio::ip::address::from_string("127.0.0.1"), m_server.getPort());
+	BOOST_REQUIRE(!error_code);
+
+	// send a request that accepts gzip content
+	HTTPRequest http_request("/echo");
+	http_request.addHeader(HTTPTypes::HEADER_ACCEPT_ENCODING, "gzip");
+	http_request.send(*tcp_conn, error_code);
+	BOOST_REQUIRE(!error_code);
+
+	// the response should not be compressed, since compression is not enabled
+	HTTPResponse http_response(http_request);
+	http_response.receive(*tcp_conn, error_code);
+	BOOST_REQUIRE(!error_code);
+	BOOST_CHECK(http_response.getStatusCode() == 200);
+	BOOST_CHECK(! http_response.hasHeader(HTTPTypes::HEADER_CONTENT_ENCODING));
+	BOOST_CHECK(std::string(http_response.getContent(), http_response.getContentLength()).find("[Request Echo]") != std::string::npos);
+}
+
 BOOST_AUTO_TEST_CASE(checkRedirectHelloServiceToEchoService) {
 	m_server.loadService("/hello", "HelloService");
 	m_server.loadService("/echo", "EchoService");
@@ -687,6 +755,38 @@ BOOST_AUTO_TEST_CASE(checkPionUserPasswordSanity) {
 #endif
 }
 
+BOOST_AUTO_TEST_CASE(checkPionUserManagerSnapshots) {
+	PionUserManager user_manager;
+	BOOST_CHECK(user_manager.empty());
+	BOOST_CHECK(user_manager.addUser("mike", "123456"));
+	BOOST_CHECK(! user_manager.addUser("mike", "654321"));
+	BOOST_CHECK(! user_manager.empty());
+
+	// users that have been looked up are not changed by later updates
+	PionUserPtr user(user_manager.getUser("mike", "123456"));
+	BOOST_REQUIRE(user);
+	BOOST_CHECK(user_manager.updateUser("mike", "654321"));
+	BOOST_CHECK(user->matchPassword("123456"));
+	BOOST_CHECK(! user_manager.getUser("mike", "123456"));
+	BOOST_CHECK(user_manager.getUser("mike", "654321"));
+	BOOST_CHECK(! user_manager.updateUser("joe", "123456"));
+
+	// existing users are skipped when adding many at once
+	PionUserManager::UserList users;
+	users.push_back(std::make_pair(std::string("joe"), std::string("abc")));
+	users.push_back(std::make_pair(std::string("mike"), std::string("def")));
+	users.push_back(std::make_pair(std::string("ann"), std::string("ghi")));
+	BOOST_CHECK_EQUAL(user_manager.addUsers(users), 2U);
+	BOOST_CHECK(user_manager.getUser("joe", "abc"));
+	BOOST_CHECK(user_manager.getUser("ann", "ghi"));
+	BOOST_CHECK(user_manager.getUser("mike", "654321"));
+
+	BOOST_CHECK(user_manager.removeUser("mike"));
+	BOOST_CHECK(! user_manager.removeUser("mike"));
+	BOOST_CHECK(! user_manager.getUser("mike"));
+	BOOST_CHECK(user_manager.getUser("joe"));
+}
+
 BOOST_AUTO_TEST_CASE(checkBasicAuthServiceFailure) {
 	m_server.loadService("/auth", "EchoService");
 	PionUserManagerPtr userManager(new PionUserManager());
@@ -763,6 +863,152 @@ BOOST_AUTO_TEST_CASE(checkBasicAuthServiceLogin) {
 	BOOST_CHECK(boost::regex_match(http_response.getContent(), post_content));
 }
 
+BOOST_AUTO_TEST_CASE(checkAuthRulesStillUpdateServerAfterAnotherServerIsDestroyed) {
+	m_server.loadService("/auth", "EchoService");
+	PionUserManagerPtr userManager(new PionUserManager());
+	HTTPAuthPtr auth_ptr(new HTTPBasicAuth(userManager));
+	auth_ptr->addUser("mike", "123456");
+	m_server.setAuthentication(auth_ptr);
+	{
+		// another server shares the rules for a while
+		WebServer other_server(m_scheduler);
+		other_server.setAuthentication(auth_ptr);
+	}
+	auth_ptr->addRestrict("/auth");
+	m_server.start();
+
+	// open a connection
+	TCPConnectionPtr tcp_conn(new TCPConnection(getIOService()));
+	boost::system::error_code error_code;
+	error_code = tcp_conn->connect(boost::asio::ip::address::from_string("127.0.0.1"), m_server.getPort());
+	BOOST_REQUIRE(!error_code);
+
+	// the restriction was added after the other server was destroyed
+	HTTPRequest http_request("/auth/something");
+	http_request.send(*tcp_conn, error_code);
+	BOOST_REQUIRE(!error_code);
+	HTTPResponse http_response(http_request);
+	http_response.receive(*tcp_conn, error_code);
+	BOOST_REQUIRE(!error_code);
+	BOOST_CHECK_EQUAL(http_response.getStatusCode(), 401U);
+}
+
+BOOST_AUTO_TEST_CASE(checkBasicAuthCredentialCache) {
+	m_server.loadService("/auth", "EchoService");
+	PionUserManagerPtr userManager(new PionUserManager());
+	boost::shared_ptr<HTTPBasicAuth> auth_ptr(new HTTPBasicAuth(userManager));
+	m_server.setAuthentication(auth_ptr);
+	auth_ptr->addRestrict("/auth");
+	auth_ptr->addUser("mike", "123456");
+	m_server.start();
+	
+	// open a connection
+	TCPConnectionPtr tcp_conn(new TCPConnection(getIOService()));
+	tcp_conn->setLifecycle(TCPConnection::LIFECYCLE_KEEPALIVE);
+	boost::system::error_code error_code;
+	error_code = tcp_conn->connect(boost::asio::ip::address::from_string("127.0.0.1"), m_server.getPort());
+	BOOST_REQUIRE(!error_code);
+	
+	// the credentials are checked once, and then found in the cache
+	for (int n = 0; n < 3; ++n) {
+		HTTPRequest http_request("/auth/something");
+		http_request.addHeader(HTTPTypes::HEADER_AUTHORIZATION, "Basic bWlrZToxMjM0NTY=");
+		http_request.send(*tcp_conn, error_code);
+		BOOST_REQUIRE(!error_code);
+		HTTPResponse http_response(http_request);
+		http_response.receive(*tcp_conn, error_code);
+		BOOST_REQUIRE(!error_code);
+		BOOST_CHECK_EQUAL(http_response.getStatusCode(), 200U);
+	}
+	BOOST_CHECK_EQUAL(auth_ptr->getCacheMisses(), 1UL);
+	BOOST_CHECK_EQUAL(auth_ptr->getCacheHits(), 2UL);
+	BOOST_CHECK_EQUAL(auth_ptr->getCacheSize(), 1U);
+	
+	// shrinking the cache evicts the credentials
+	auth_ptr->setOption("cache_size", "0");
+	BOOST_CHECK_EQUAL(auth_ptr->getCacheSize(), 0U);
+	BOOST_CHECK_EQUAL(auth_ptr->getCacheEvictions(), 1UL);
+}
+
+BOOST_AUTO_TEST_CASE(checkBasicAuthCacheSizeIsTotal) {
+	m_server.loadService("/auth", "EchoService");
+	PionUserManagerPtr userManager(new PionUserManager());
+	boost::shared_ptr<HTTPBasicAuth> auth_ptr(new HTTPBasicAuth(userManager));
+	auth_ptr->setOption("cache_size", "1");
+	m_server.setAuthentication(auth_ptr);
+	auth_ptr->addRestrict("/auth");
+	auth_ptr->addUser("mike", "123456");
+	auth_ptr->addUser("anna", "abcdef");
+	m_server.start();
+
+	// open a connection
+	TCPConnectionPtr tcp_conn(new TCPConnection(getIOService()));
+	tcp_conn->setLifecycle(TCPConnection::LIFECYCLE_KEEPALIVE);
+	boost::system::error_code error_code;
+	error_code = tcp_conn->connect(boost::asio::ip::address::from_string("127.0.0.1"), m_server.getPort());
+	BOOST_REQUIRE(!error_code);
+
+	// only one user's credentials are cached, whichever shards they are in
+	const char *credentials[] = { "Basic bWlrZToxMjM0NTY=", "Basic YW5uYTphYmNkZWY=" };
+	for (int n = 0; n < 2; ++n) {
+		HTTPRequest http_request("/auth/something");
+		http_request.addHeader(HTTPTypes::HEADER_AUTHORIZATION, credentials[n]);
+		http_request.send(*tcp_conn, error_code);
+		BOOST_REQUIRE(!error_code);
+		HTTPResponse http_response(http_request);
+		http_response.receive(*tcp_conn, error_code);
+		BOOST_REQUIRE(!error_code);
+		BOOST_CHECK_EQUAL(http_response.getStatusCode(), 200U);
+	}
+	BOOST_CHECK_EQUAL(auth_ptr->getCacheMisses(), 2UL);
+	BOOST_CHECK_EQUAL(auth_ptr->getCacheSize(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(checkBasicAuthInvalidCacheSizeThrows) {
+	PionUserManagerPtr userManager(new PionUserManager());
+	HTTPAuthPtr auth_ptr(new HTTPBasicAuth(userManager));
+	BOOST_CHECK_THROW(auth_ptr->setOption("cache_size", "lots"), HTTPAuth::InvalidOptionValueException);
+	BOOST_CHECK_THROW(auth_ptr->setOption("cache_size", ""), HTTPAuth::InvalidOptionValueException);
+	BOOST_CHECK_NO_THROW(auth_ptr->setOption("cache_size", "100"));
+}
+
+BOOST_AUTO_TEST_CASE(checkBasicAuthIdleCredentialsExpire) {
+	m_server.loadService("/auth", "EchoService");
+	PionUserManagerPtr userManager(new PionUserManager());
+	boost::shared_ptr<HTTPBasicAuth> auth_ptr(new HTTPBasicAuth(userManager));
+	BOOST_CHECK_THROW(auth_ptr->setOption("cache_expiration", "0"), HTTPAuth::InvalidOptionValueException);
+	BOOST_CHECK_THROW(auth_ptr->setOption("cache_expiration", "soon"), HTTPAuth::InvalidOptionValueException);
+	auth_ptr->setOption("cache_expiration", "1");
+	m_server.setAuthentication(auth_ptr);
+	auth_ptr->addRestrict("/auth");
+	auth_ptr->addUser("mike", "123456");
+	m_server.start();
+
+	// open a connection
+	TCPConnectionPtr tcp_conn(new TCPConnection(getIOService()));
+	tcp_conn->setLifecycle(TCPConnection::LIFECYCLE_KEEPALIVE);
+	boost::system::error_code error_code;
+	error_code = tcp_conn->connect(boost::asio::ip::address::from_string("127.0.0.1"), m_server.getPort());
+	BOOST_REQUIRE(!error_code);
+
+	HTTPRequest http_request("/auth/something");
+	http_request.addHeader(HTTPTypes::HEADER_AUTHORIZATION, "Basic bWlrZToxMjM0NTY=");
+	http_request.send(*tcp_conn, error_code);
+	BOOST_REQUIRE(!error_code);
+	HTTPResponse http_response(http_request);
+	http_response.receive(*tcp_conn, error_code);
+	BOOST_REQUIRE(!error_code);
+	BOOST_CHECK_EQUAL(http_response.getStatusCode(), 200U);
+	BOOST_CHECK_EQUAL(auth_ptr->getCacheSize(), 1U);
+
+	// the expiry timer removes the credentials without any further requests
+	for (int n = 0; n < 50 && auth_ptr->getCacheSize() > 0; ++n)
+		PionScheduler::sleep(0, 100000000);	// 0.1 seconds
+	BOOST_CHECK_EQUAL(auth_ptr->getCacheSize(), 0U);
+	BOOST_CHECK_EQUAL(auth_ptr->getCacheExpirations(), 1UL);
+	BOOST_CHECK_EQUAL(auth_ptr->getCacheHits(), 0UL);
+}
+
 BOOST_AUTO_TEST_CASE(checkCookieAuthServiceFailure) {
 	m_server.loadService("/auth", "EchoService");
 	PionUserManagerPtr userManager(new PionUserManager());
@@ -861,6 +1107,74 @@ BOOST_AUTO_TEST_CASE(checkCookieAuthServiceLogin) {
 	BOOST_CHECK(boost::regex_match(http_response2.getContent(), post_content));
 }
 
+BOOST_AUTO_TEST_CASE(checkCookieAuthEmptySecretThrows) {
+	PionUserManagerPtr userManager(new PionUserManager());
+	HTTPAuthPtr auth_ptr(new HTTPCookieAuth(userManager));
+	BOOST_CHECK_THROW(auth_ptr->setOption("secret", ""), HTTPAuth::InvalidOptionValueException);
+	BOOST_CHECK_NO_THROW(auth_ptr->setOption("secret", "shared secret"));
+}
+
+#ifdef PION_HAVE_SSL
+BOOST_AUTO_TEST_CASE(checkCookieAuthSignedSessions) {
+	m_server.loadService("/auth", "EchoService");
+	PionUserManagerPtr userManager(new PionUserManager());
+	userManager->addUser("mike", "123456");
+	HTTPAuthPtr auth_ptr(new HTTPCookieAuth(userManager));
+	auth_ptr->setOption("secret", "shared secret");
+	auth_ptr->setOption("session", "signed");
+	m_server.setAuthentication(auth_ptr);
+	auth_ptr->addRestrict("/auth");
+	m_server.start();
+
+	// open a login connection
+	TCPConnectionPtr tcp_conn(new TCPConnection(getIOService()));
+	tcp_conn->setLifecycle(TCPConnection::LIFECYCLE_KEEPALIVE);
+	boost::system::error_code error_code;
+	error_code = tcp_conn->connect(boost::asio::ip::address::from_string("127.0.0.1"), m_server.getPort());
+	BOOST_REQUIRE(!error_code);
+
+	// login as "mike:123456"
+	HTTPRequest login_request("/login?user=mike&pass=123456");
+	login_request.send(*tcp_conn, error_code);
+	BOOST_REQUIRE(!error_code);
+	HTTPResponse login_response(login_request);
+	login_response.receive(*tcp_conn, error_code);
+	BOOST_REQUIRE(!error_code);
+	BOOST_CHECK_EQUAL(login_response.getStatusCode(), 204U);
+	BOOST_REQUIRE(login_response.hasHeader(HTTPTypes::HEADER_SET_COOKIE));
+	const std::string cookie(login_response.getHeader(HTTPTypes::HEADER_SET_COOKIE));
+
+	// another authentication object that shares the secret (as another server
+	// would) accepts the cookie, without having seen the login
+	HTTPAuthPtr other_auth_ptr(new HTTPCookieAuth(userManager));
+	other_auth_ptr->setOption("secret", "shared secret");
+	other_auth_ptr->setOption("session", "signed");
+	other_auth_ptr->addRestrict("/auth");
+	m_server.setAuthentication(other_auth_ptr);
+
+	HTTPRequest http_request("/auth/something/somewhere");
+	http_request.addHeader(HTTPTypes::HEADER_COOKIE, cookie);
+	http_request.send(*tcp_conn, error_code);
+	BOOST_REQUIRE(!error_code);
+	HTTPResponse http_response(http_request);
+	http_response.receive(*tcp_conn, error_code);
+	BOOST_REQUIRE(!error_code);
+	BOOST_CHECK_EQUAL(http_response.getStatusCode(), 200U);
+
+	// a cookie that has been changed is rejected
+	std::string bad_cookie(cookie);
+	bad_cookie[bad_cookie.find("=\"") + 2] ^= 1;
+	HTTPRequest bad_request("/auth/something/somewhere");
+	bad_request.addHeader(HTTPTypes::HEADER_COOKIE, bad_cookie);
+	bad_request.send(*tcp_conn, error_code);
+	BOOST_REQUIRE(!error_code);
+	HTTPResponse bad_response(bad_request);
+	bad_response.receive(*tcp_conn, error_code);
+	BOOST_REQUIRE(!error_code);
+	BOOST_CHECK_EQUAL(bad_response.getStatusCode(), 401U);
+}
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
 
 
@@ -1008,3 +1322,691 @@ BOOST_AUTO_TEST_CASE(checkSendContentWithoutLengthAndReceiveAsyncResponse) {
 }
 
 BOOST_AUTO_TEST_SUITE_END()
+
+
+#define QUEUED_CHUNK_SIZE 512
+
+///
+/// QueuedResponseWriterTests_F: 
+/// streams a "big content buffer" using many small queued chunks and tiny
+/// watermarks, so that the producer has to wait for the writable handler
+/// 
+class QueuedResponseWriterTests_F
+	: public WebServerTests_F
+{
+public:
+	// default constructor and destructor
+	QueuedResponseWriterTests_F() {
+		// fill the buffer with non-random characters
+		for (unsigned long n = 0; n < BIG_BUF_SIZE; ++n) {
+			m_big_buf[n] = char(n);
+		}
+	}
+	virtual ~QueuedResponseWriterTests_F() {}
+	
+	/**
+	 * sends an HTTP response using the writer's queued chunks
+	 *
+	 * @param request the HTTP request to respond to
+	 * @param tcp_conn the TCP connection to send the response over
+	 */
+	void sendQueuedResponse(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn)
+	{
+		HTTPResponseWriterPtr writer(HTTPResponseWriter::create(tcp_conn, *request,
+										boost::bind(&TCPConnection::finish, tcp_conn)));
+		boost::shared_ptr<unsigned long> bytes_queued(new unsigned long(0));
+		writer->setQueueWatermarks(QUEUED_CHUNK_SIZE * 2, QUEUED_CHUNK_SIZE * 4);
+		// the handler keeps a weak reference to avoid a circular reference
+		writer->setWritableHandler(boost::bind(&QueuedResponseWriterTests_F::resumeQueuedResponse,
+											   this, boost::weak_ptr<HTTPResponseWriter>(writer),
+											   bytes_queued));
+		queueMoreChunks(writer, bytes_queued);
+	}
+	
+	/// called by the writer when the producer may resume queuing data
+	void resumeQueuedResponse(boost::weak_ptr<HTTPResponseWriter> writer_weak_ptr,
+							  boost::shared_ptr<unsigned long> bytes_queued)
+	{
+		HTTPResponseWriterPtr writer(writer_weak_ptr.lock());
+		if (writer) {
+			++m_num_resumed;
+			queueMoreChunks(writer, bytes_queued);
+		}
+	}
+	
+	/// queues chunks until the buffer has been sent or the writer is full
+	void queueMoreChunks(HTTPResponseWriterPtr& writer,
+						 boost::shared_ptr<unsigned long> bytes_queued)
+	{
+		while (*bytes_queued < BIG_BUF_SIZE) {
+			writer->write(m_big_buf + *bytes_queued, QUEUED_CHUNK_SIZE);
+			*bytes_queued += QUEUED_CHUNK_SIZE;
+			if (! writer->queueChunk())
+				return;
+		}
+		writer->queueFinalChunk();
+	}
+	
+	/// queues a chunk, then a file region that cannot be read
+	void sendUnreadableFileRegion(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn)
+	{
+		HTTPResponseWriterPtr writer(HTTPResponseWriter::create(tcp_conn, *request,
+										boost::bind(&QueuedResponseWriterTests_F::finishedResponse,
+													this, tcp_conn, _1)));
+		writer->write(m_big_buf, QUEUED_CHUNK_SIZE);
+		writer->queueChunk();
+		writer->writeFile(-1, 0, QUEUED_CHUNK_SIZE);
+		writer->queueFinalChunk();
+	}
+	
+	/// queues a compressed chunk, then a file region that cannot be read (or compressed)
+	void sendUnreadableCompressedFileRegion(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn)
+	{
+		HTTPResponseWriterPtr writer(HTTPResponseWriter::create(tcp_conn, *request,
+										boost::bind(&QueuedResponseWriterTests_F::finishedResponse,
+													this, tcp_conn, _1)));
+		writer->getResponse().setContentType(HTTPTypes::CONTENT_TYPE_TEXT);
+		writer->setCompression(HTTPCompressor::getDefaultOptions());
+		writer->write(std::string(QUEUED_CHUNK_SIZE, 'x'));
+		writer->queueChunk();
+		writer->writeFile(-1, 0, QUEUED_CHUNK_SIZE);
+		writer->queueFinalChunk();
+	}
+	
+	/// records the error reported to the writer's finished handler
+	void finishedResponse(TCPConnectionPtr& tcp_conn, const boost::system::error_code& ec)
+	{
+		m_finished_error = ec;
+		tcp_conn->finish();
+	}
+	
+	/// big data buffer used for the tests
+	char				m_big_buf[BIG_BUF_SIZE];
+	
+	/// number of times that the writable handler resumed the producer
+	volatile unsigned long	m_num_resumed;
+	
+	/// error reported to the finished handler by finishedResponse()
+	boost::system::error_code	m_finished_error;
+};
+
+
+// QueuedResponseWriterTests_F Test Cases
+
+BOOST_FIXTURE_TEST_SUITE(QueuedResponseWriterTests_S, QueuedResponseWriterTests_F)
+
+BOOST_AUTO_TEST_CASE(checkSendQueuedChunksAndReceiveResponse) {
+	// startup the server 
+	m_num_resumed = 0;
+	m_server.addResource("/big", boost::bind(&QueuedResponseWriterTests_F::sendQueuedResponse,
+											 this, _1, _2));
+	m_server.start();
+	
+	// open a connection
+	TCPConnectionPtr tcp_conn(new TCPConnection(getIOService()));
+	boost::system::error_code error_code;
+	error_code = tcp_conn->connect(boost::asio::ip::address::from_string("127.0.0.1"), m_server.getPort());
+	BOOST_REQUIRE(!error_code);
+
+	// send an HTTP request
+	HTTPRequest http_request("/big");
+	http_request.send(*tcp_conn, error_code);
+	BOOST_REQUIRE(! error_code);
+	
+	// receive the response from the server
+	HTTPResponse http_response(http_request);
+	http_response.receive(*tcp_conn, error_code);
+	BOOST_REQUIRE(! error_code);
+	
+	// check that the chunks were received in order
+	BOOST_REQUIRE(http_response.getStatusCode() == 200);
+	BOOST_CHECK_EQUAL(http_response.getHeader(HTTPTypes::HEADER_TRANSFER_ENCODING), "chunked");
+	BOOST_REQUIRE(http_response.getContentLength() == BIG_BUF_SIZE);
+	BOOST_CHECK_EQUAL(memcmp(http_response.getContent(), m_big_buf, BIG_BUF_SIZE), 0);
+	
+	// the producer must have been throttled at least once
+	BOOST_CHECK(m_num_resumed > 0);
+}
+
+BOOST_AUTO_TEST_CASE(checkUnreadableQueuedFileRegionClosesConnection) {
+	m_server.addResource("/unreadable", boost::bind(&QueuedResponseWriterTests_F::sendUnreadableFileRegion,
+													this, _1, _2));
+	m_server.start();
+	
+	// open a connection
+	TCPConnectionPtr tcp_conn(new TCPConnection(getIOService()));
+	boost::system::error_code error_code;
+	error_code = tcp_conn->connect(boost::asio::ip::address::from_string("127.0.0.1"), m_server.getPort());
+	BOOST_REQUIRE(!error_code);
+
+	// send an HTTP request
+	HTTPRequest http_request("/unreadable");
+	http_request.send(*tcp_conn, error_code);
+	BOOST_REQUIRE(! error_code);
+	
+	// the response must end without a final chunk (rather than a short one)
+	HTTPResponse http_response(http_request);
+	http_response.receive(*tcp_conn, error_code);
+	BOOST_CHECK(error_code);
+	BOOST_CHECK(m_finished_error);
+}
+
+BOOST_AUTO_TEST_CASE(checkCompressionFailureClosesConnection) {
+	if (! HTTPCompressor::isSupported())
+		return;
+	m_server.addResource("/unreadable", boost::bind(&QueuedResponseWriterTests_F::sendUnreadableCompressedFileRegion,
+													this, _1, _2));
+	m_server.start();
+	
+	// open a connection
+	TCPConnectionPtr tcp_conn(new TCPConnection(getIOService()));
+	boost::system::error_code error_code;
+	error_code = tcp_conn->connect(boost::asio::ip::address::from_string("127.0.0.1"), m_server.getPort());
+	BOOST_REQUIRE(!error_code);
+
+	// send an HTTP request that accepts gzip content
+	HTTPRequest http_request("/unreadable");
+	http_request.addHeader(HTTPTypes::HEADER_ACCEPT_ENCODING, "gzip");
+	http_request.send(*tcp_conn, error_code);
+	BOOST_REQUIRE(! error_code);
+	
+	// nothing is sent after the first (compressed) chunk, not even uncompressed data
+	HTTPResponse http_response(http_request);
+	http_response.receive(*tcp_conn, error_code);
+	BOOST_CHECK(error_code);
+	BOOST_CHECK(m_finished_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+
+///
+/// ProxyServiceTests_F: forwards requests through a ProxyService to an
+///                      upstream HTTPServer
+///
+class ProxyServiceTests_F
+	: public WebServerTests_F
+{
+public:
+	// default constructor and destructor
+	ProxyServiceTests_F() : m_upstream(new HTTPServer(m_scheduler)) {
+		m_upstream->addResource("/proxy/data", &ProxyServiceTests_F::sendData);
+		m_upstream->addResource("/proxy/chunks", &ProxyServiceTests_F::sendChunks);
+		m_upstream->addResource("/proxy/xff", &ProxyServiceTests_F::sendForwardedFor);
+		m_upstream->start();
+		m_server.loadService("/proxy", "ProxyService");
+		m_server.setServiceOption("/proxy", "upstream",
+								  "127.0.0.1:" + boost::lexical_cast<std::string>(m_upstream->getPort()));
+		m_server.start();
+	}
+	virtual ~ProxyServiceTests_F() {
+		m_server.stop();
+		m_upstream->stop();
+	}
+
+	/// sends a request through the proxy and receives the response
+	void sendRequest(TCPConnection& tcp_conn, HTTPRequest& http_request,
+					 HTTPResponse& http_response)
+	{
+		boost::system::error_code error_code;
+		http_request.send(tcp_conn, error_code);
+		BOOST_REQUIRE(! error_code);
+		http_response.receive(tcp_conn, error_code);
+		BOOST_REQUIRE(! error_code);
+	}
+
+	/// responds with fixed content and the port that the proxy connected from
+	static void sendData(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn) {
+		HTTPResponseWriterPtr writer(HTTPResponseWriter::create(tcp_conn, *request,
+										boost::bind(&TCPConnection::finish, tcp_conn)));
+		writer->getResponse().addHeader("X-Upstream-Port",
+										boost::lexical_cast<std::string>(tcp_conn->getRemotePort()));
+		writer << "upstream data";
+		writer->send();
+	}
+
+	/// responds with content that is split into two chunks
+	static void sendChunks(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn) {
+		HTTPResponseWriterPtr writer(HTTPResponseWriter::create(tcp_conn, *request,
+										boost::bind(&TCPConnection::finish, tcp_conn)));
+		writer << "first chunk, ";
+		writer->sendChunk(boost::bind(&ProxyServiceTests_F::sendFinalChunk, writer));
+	}
+
+	/// sends the last chunk for sendChunks()
+	static void sendFinalChunk(HTTPResponseWriterPtr writer) {
+		writer->clear();
+		writer << "second chunk";
+		writer->sendFinalChunk();
+	}
+
+	/// responds with the X-Forwarded-For header that was received
+	static void sendForwardedFor(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn) {
+		HTTPResponseWriterPtr writer(HTTPResponseWriter::create(tcp_conn, *request,
+										boost::bind(&TCPConnection::finish, tcp_conn)));
+		writer << request->getHeader(HTTPTypes::HEADER_X_FORWARDED_FOR);
+		writer->send();
+	}
+
+	HTTPServerPtr	m_upstream;
+};
+
+
+// ProxyServiceTests_F Test Cases
+
+BOOST_FIXTURE_TEST_SUITE(ProxyServiceTests_S, ProxyServiceTests_F)
+
+BOOST_AUTO_TEST_CASE(checkProxyServiceRelaysResponseAndReusesConnection) {
+	TCPConnection tcp_conn(getIOService());
+	tcp_conn.setLifecycle(TCPConnection::LIFECYCLE_KEEPALIVE);
+	boost::system::error_code error_code;
+	error_code = tcp_conn.connect(boost::asio::ip::address::from_string("127.0.0.1"), m_server.getPort());
+	BOOST_REQUIRE(! error_code);
+
+	HTTPRequest http_request("/proxy/data");
+	HTTPResponse first_response(http_request);
+	sendRequest(tcp_conn, http_request, first_response);
+	BOOST_CHECK_EQUAL(first_response.getStatusCode(), 200U);
+	BOOST_REQUIRE_EQUAL(first_response.getContentLength(), 13U);
+	BOOST_CHECK_EQUAL(std::string(first_response.getContent()), "upstream data");
+
+	// the second request must use the same upstream connection
+	HTTPResponse second_response(http_request);
+	sendRequest(tcp_conn, http_request, second_response);
+	BOOST_CHECK_EQUAL(second_response.getStatusCode(), 200U);
+	BOOST_CHECK_EQUAL(std::string(second_response.getContent()), "upstream data");
+	BOOST_CHECK_EQUAL(second_response.getHeader("X-Upstream-Port"),
+					  first_response.getHeader("X-Upstream-Port"));
+}
+
+BOOST_AUTO_TEST_CASE(checkProxyServiceClosesIdleUpstreamConnections) {
+	m_server.setServiceOption("/proxy", "idle_timeout", "1");
+
+	TCPConnection tcp_conn(getIOService());
+	tcp_conn.setLifecycle(TCPConnection::LIFECYCLE_KEEPALIVE);
+	boost::system::error_code error_code;
+	error_code = tcp_conn.connect(boost::asio::ip::address::from_string("127.0.0.1"), m_server.getPort());
+	BOOST_REQUIRE(! error_code);
+
+	HTTPRequest http_request("/proxy/data");
+	HTTPResponse first_response(http_request);
+	sendRequest(tcp_conn, http_request, first_response);
+	BOOST_CHECK_EQUAL(first_response.getStatusCode(), 200U);
+
+	// the upstream connection is closed after it has been idle for too long,
+	// so the next request uses a new one
+	PionScheduler::sleep(2, 0);
+	HTTPResponse second_response(http_request);
+	sendRequest(tcp_conn, http_request, second_response);
+	BOOST_CHECK_EQUAL(second_response.getStatusCode(), 200U);
+	BOOST_CHECK_EQUAL(std::string(second_response.getContent()), "upstream data");
+	BOOST_CHECK_NE(second_response.getHeader("X-Upstream-Port"),
+				   first_response.getHeader("X-Upstream-Port"));
+}
+
+BOOST_AUTO_TEST_CASE(checkProxyServiceRelaysChunkedResponse) {
+	TCPConnection tcp_conn(getIOService());
+	boost::system::error_code error_code;
+	error_code = tcp_conn.connect(boost::asio::ip::address::from_string("127.0.0.1"), m_server.getPort());
+	BOOST_REQUIRE(! error_code);
+
+	HTTPRequest http_request("/proxy/chunks");
+	HTTPResponse http_response(http_request);
+	sendRequest(tcp_conn, http_request, http_response);
+	BOOST_CHECK_EQUAL(http_response.getStatusCode(), 200U);
+	BOOST_CHECK_EQUAL(http_response.getHeader(HTTPTypes::HEADER_TRANSFER_ENCODING), "chunked");
+	BOOST_CHECK_EQUAL(std::string(http_response.getContent()), "first chunk, second chunk");
+}
+
+BOOST_AUTO_TEST_CASE(checkProxyServiceAppendsForwardedFor) {
+	TCPConnection tcp_conn(getIOService());
+	boost::system::error_code error_code;
+	error_code = tcp_conn.connect(boost::asio::ip::address::from_string("127.0.0.1"), m_server.getPort());
+	BOOST_REQUIRE(! error_code);
+
+	HTTPRequest http_request("/proxy/xff");
+	http_request.addHeader(HTTPTypes::HEADER_X_FORWARDED_FOR, "10.0.0.1");
+	HTTPResponse http_response(http_request);
+	sendRequest(tcp_conn, http_request, http_response);
+	BOOST_CHECK_EQUAL(std::string(http_response.getContent()), "10.0.0.1, 127.0.0.1");
+}
+
+BOOST_AUTO_TEST_CASE(checkProxyServiceRespondsBadGatewayIfUpstreamIsDown) {
+	m_upstream->stop();
+
+	TCPConnection tcp_conn(getIOService());
+	boost::system::error_code error_code;
+	error_code = tcp_conn.connect(boost::asio::ip::address::from_string("127.0.0.1"), m_server.getPort());
+	BOOST_REQUIRE(! error_code);
+
+	HTTPRequest http_request("/proxy/data");
+	HTTPResponse http_response(http_request);
+	sendRequest(tcp_conn, http_request, http_response);
+	BOOST_CHECK_EQUAL(http_response.getStatusCode(), HTTPTypes::RESPONSE_CODE_BAD_GATEWAY);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+
+///
+/// CountedResourceTests_F: fixture used to check when HTTPServer runs the
+/// request handler of a resource, and when it reuses responses instead
+///
+class CountedResourceTests_F
+	: public WebServerTests_F
+{
+public:
+	// default constructor and destructor
+	CountedResourceTests_F() : m_num_handled(0), m_handler_delay(0) {
+		m_server.addResource("/counted", boost::bind(&CountedResourceTests_F::sendCountedResponse,
+													 this, _1, _2));
+		m_server.addResource("/client", &CountedResourceTests_F::sendClientAddress);
+		m_server.start();
+	}
+	virtual ~CountedResourceTests_F() {
+		m_server.stop();
+	}
+
+	/// opens a connection to the server
+	void connect(TCPConnection& tcp_conn) {
+		boost::system::error_code error_code;
+		error_code = tcp_conn.connect(boost::asio::ip::address::from_string("127.0.0.1"), m_server.getPort());
+		BOOST_REQUIRE(! error_code);
+	}
+
+	/// sends a request to the server and receives the response
+	void sendRequest(TCPConnection& tcp_conn, HTTPRequest& http_request,
+					 HTTPResponse& http_response)
+	{
+		boost::system::error_code error_code;
+		http_request.send(tcp_conn, error_code);
+		BOOST_REQUIRE(! error_code);
+		http_response.receive(tcp_conn, error_code);
+		BOOST_REQUIRE(! error_code);
+	}
+
+	/**
+	 * sends a request to the server, and reads everything that it sends
+	 * back until it closes the connection
+	 *
+	 * @param request_line the method and resource of the request
+	 *
+	 * @return std::string the bytes that the server sent
+	 */
+	std::string sendRequestUntilClosed(const std::string& request_line) {
+		tcp::endpoint http_endpoint(boost::asio::ip::address::from_string("127.0.0.1"), m_server.getPort());
+		tcp::iostream http_stream(http_endpoint);
+		http_stream << request_line << " HTTP/1.1" << HTTPTypes::STRING_CRLF << HTTPTypes::STRING_CRLF;
+		http_stream.flush();
+		return std::string((std::istreambuf_iterator<char>(http_stream)), std::istreambuf_iterator<char>());
+	}
+
+	/**
+	 * requests the address of the client, as the server sees it
+	 *
+	 * @param forwarded_for the X-Forwarded-For header of the request
+	 * @param client the address of the client, if the request is allowed
+	 *
+	 * @return unsigned int the status code of the response
+	 */
+	unsigned int requestClientAddress(const std::string& forwarded_for, std::string& client) {
+		TCPConnection tcp_conn(getIOService());
+		connect(tcp_conn);
+		HTTPRequest http_request("/client");
+		http_request.addHeader(HTTPTypes::HEADER_X_FORWARDED_FOR, forwarded_for);
+		HTTPResponse http_response(http_request);
+		sendRequest(tcp_conn, http_request, http_response);
+		if (http_response.getStatusCode() == 200)
+			client = http_response.getContent();
+		return http_response.getStatusCode();
+	}
+
+	/// returns the number of requests that the handler has responded to
+	unsigned int getNumHandled(void) {
+		boost::mutex::scoped_lock counter_lock(m_counter_mutex);
+		return m_num_handled;
+	}
+
+	/// responds with the number of requests handled so far (after a delay)
+	void sendCountedResponse(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn) {
+		unsigned int num_handled;
+		{
+			boost::mutex::scoped_lock counter_lock(m_counter_mutex);
+			num_handled = ++m_num_handled;
+		}
+		if (m_handler_delay > 0)
+			boost::this_thread::sleep(boost::posix_time::milliseconds(m_handler_delay));
+		HTTPResponseWriterPtr writer(HTTPResponseWriter::create(tcp_conn, *request,
+										boost::bind(&TCPConnection::finish, tcp_conn)));
+		writer->getResponse().addHeader(HTTPTypes::HEADER_ETAG,
+										'"' + boost::lexical_cast<std::string>(num_handled) + '"');
+		if (! m_cookie.empty())
+			writer->getResponse().addHeader(HTTPTypes::HEADER_SET_COOKIE, m_cookie);
+		writer << "response " << num_handled;
+		writer->send();
+	}
+
+	/// responds with the remote IP address of the request
+	static void sendClientAddress(HTTPRequestPtr& request, TCPConnectionPtr& tcp_conn) {
+		HTTPResponseWriterPtr writer(HTTPResponseWriter::create(tcp_conn, *request,
+										boost::bind(&TCPConnection::finish, tcp_conn)));
+		writer << request->getRemoteIp().to_string();
+		writer->send();
+	}
+
+	/// protects m_num_handled
+	boost::mutex			m_counter_mutex;
+
+	/// number of requests that the handler has responded to
+	unsigned int			m_num_handled;
+
+	/// number of milliseconds that the handler waits before it responds
+	unsigned int			m_handler_delay;
+
+	/// cookie that the handler sets in its responses, if not empty
+	std::string				m_cookie;
+};
+
+
+// CountedResourceTests_F Test Cases
+
+BOOST_FIXTURE_TEST_SUITE(CountedResourceTests_S, CountedResourceTests_F)
+
+BOOST_AUTO_TEST_CASE(checkCachedResourceIsNotHandledAgain) {
+	m_server.addCachedResource("/counted", 60);
+	TCPConnection tcp_conn(getIOService());
+	connect(tcp_conn);
+
+	HTTPRequest http_request("/counted");
+	HTTPResponse first_response(http_request);
+	sendRequest(tcp_conn, http_request, first_response);
+	BOOST_CHECK_EQUAL(first_response.getStatusCode(), 200U);
+	BOOST_CHECK_EQUAL(std::string(first_response.getContent()), "response 1");
+
+	// the second request is answered from the cache
+	HTTPResponse second_response(http_request);
+	sendRequest(tcp_conn, http_request, second_response);
+	BOOST_CHECK_EQUAL(second_response.getStatusCode(), 200U);
+	BOOST_CHECK_EQUAL(std::string(second_response.getContent()), "response 1");
+	BOOST_CHECK_EQUAL(getNumHandled(), 1U);
+	BOOST_CHECK_EQUAL(m_server.getResponseCache().getHits(), 1UL);
+}
+
+BOOST_AUTO_TEST_CASE(checkCachedResourceWithCookieIsHandledAgain) {
+	m_server.addCachedResource("/counted", 60);
+	m_cookie = "session=1234";
+	TCPConnection tcp_conn(getIOService());
+	connect(tcp_conn);
+
+	// responses that set cookies belong to one client, so they are not reused
+	HTTPRequest http_request("/counted");
+	HTTPResponse first_response(http_request);
+	sendRequest(tcp_conn, http_request, first_response);
+	BOOST_CHECK_EQUAL(std::string(first_response.getContent()), "response 1");
+	HTTPResponse second_response(http_request);
+	sendRequest(tcp_conn, http_request, second_response);
+	BOOST_CHECK_EQUAL(std::string(second_response.getContent()), "response 2");
+	BOOST_CHECK_EQUAL(second_response.getHeader(HTTPTypes::HEADER_SET_COOKIE), m_cookie);
+	BOOST_CHECK_EQUAL(getNumHandled(), 2U);
+	BOOST_CHECK_EQUAL(m_server.getResponseCache().getSize(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(checkCachedResourceIsNotModified) {
+	m_server.addCachedResource("/counted", 60);
+	TCPConnection tcp_conn(getIOService());
+	connect(tcp_conn);
+
+	HTTPRequest http_request("/counted");
+	HTTPResponse first_response(http_request);
+	sendRequest(tcp_conn, http_request, first_response);
+	BOOST_CHECK_EQUAL(first_response.getStatusCode(), 200U);
+	const std::string etag(first_response.getHeader(HTTPTypes::HEADER_ETAG));
+	BOOST_CHECK_EQUAL(etag, "\"1\"");
+
+	// a client that has the cached response is told that it is current
+	HTTPRequest conditional_request("/counted");
+	conditional_request.addHeader(HTTPTypes::HEADER_IF_NONE_MATCH, etag);
+	HTTPResponse conditional_response(conditional_request);
+	sendRequest(tcp_conn, conditional_request, conditional_response);
+	BOOST_CHECK_EQUAL(conditional_response.getStatusCode(), HTTPTypes::RESPONSE_CODE_NOT_MODIFIED);
+	BOOST_CHECK_EQUAL(conditional_response.getHeader(HTTPTypes::HEADER_ETAG), etag);
+	BOOST_CHECK_EQUAL(conditional_response.getContentLength(), 0U);
+	BOOST_CHECK_EQUAL(getNumHandled(), 1U);
+
+	// an ETag that does not match gets the whole response
+	HTTPRequest other_request("/counted");
+	other_request.addHeader(HTTPTypes::HEADER_IF_NONE_MATCH, "\"2\"");
+	HTTPResponse other_response(other_request);
+	sendRequest(tcp_conn, other_request, other_response);
+	BOOST_CHECK_EQUAL(other_response.getStatusCode(), 200U);
+	BOOST_CHECK_EQUAL(std::string(other_response.getContent()), "response 1");
+	BOOST_CHECK_EQUAL(getNumHandled(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(checkIdenticalRequestsAreHandledOnce) {
+	static const unsigned int NUM_CLIENTS = 4;
+	m_server.addCachedResource("/counted", 60);
+	m_handler_delay = 500;
+
+	// each client has its own connection, so that the requests arrive while
+	// the first one is still being handled
+	HTTPRequest http_request("/counted");
+	std::vector<TCPConnectionPtr> connections;
+	for (unsigned int n = 0; n < NUM_CLIENTS; ++n) {
+		TCPConnectionPtr tcp_conn(new TCPConnection(getIOService()));
+		connect(*tcp_conn);
+		boost::system::error_code error_code;
+		http_request.send(*tcp_conn, error_code);
+		BOOST_REQUIRE(! error_code);
+		connections.push_back(tcp_conn);
+	}
+
+	// they all receive the response of the one request that was handled
+	for (unsigned int n = 0; n < NUM_CLIENTS; ++n) {
+		HTTPResponse http_response(http_request);
+		boost::system::error_code error_code;
+		http_response.receive(*connections[n], error_code);
+		BOOST_REQUIRE(! error_code);
+		BOOST_CHECK_EQUAL(http_response.getStatusCode(), 200U);
+		BOOST_CHECK_EQUAL(std::string(http_response.getContent()), "response 1");
+		BOOST_CHECK_EQUAL(http_response.getHeader(HTTPTypes::HEADER_ETAG), "\"1\"");
+	}
+	BOOST_CHECK_EQUAL(getNumHandled(), 1U);
+	BOOST_CHECK_EQUAL(m_server.getResponseCache().getCoalesced(), NUM_CLIENTS - 1);
+}
+
+BOOST_AUTO_TEST_CASE(checkIdenticalRequestIsHandledAfterCoalesceTimeout) {
+	m_server.addCachedResource("/counted", 60);
+	m_server.setCoalesceTimeout(100);
+	m_handler_delay = 1000;
+
+	HTTPRequest http_request("/counted");
+	TCPConnection first_conn(getIOService());
+	TCPConnection second_conn(getIOService());
+	connect(first_conn);
+	connect(second_conn);
+	boost::system::error_code error_code;
+	http_request.send(first_conn, error_code);
+	BOOST_REQUIRE(! error_code);
+	http_request.send(second_conn, error_code);
+	BOOST_REQUIRE(! error_code);
+
+	// the second request stops waiting for the first, and is handled on its own
+	std::set<std::string> contents;
+	HTTPResponse first_response(http_request);
+	first_response.receive(first_conn, error_code);
+	BOOST_REQUIRE(! error_code);
+	BOOST_CHECK_EQUAL(first_response.getStatusCode(), 200U);
+	contents.insert(first_response.getContent());
+	HTTPResponse second_response(http_request);
+	second_response.receive(second_conn, error_code);
+	BOOST_REQUIRE(! error_code);
+	BOOST_CHECK_EQUAL(second_response.getStatusCode(), 200U);
+	contents.insert(second_response.getContent());
+	BOOST_CHECK(contents.count("response 1") == 1 && contents.count("response 2") == 1);
+	BOOST_CHECK_EQUAL(getNumHandled(), 2U);
+	BOOST_CHECK_EQUAL(m_server.getResponseCache().getCoalesceTimeouts(), 1UL);
+	BOOST_CHECK_EQUAL(m_server.getResponseCache().getCoalesced(), 0UL);
+}
+
+BOOST_AUTO_TEST_CASE(checkRateLimitedRequestsAreTurnedAway) {
+	HTTPRateLimiterPtr rate_limiter(new HTTPRateLimiter);
+	rate_limiter->setLimit("/counted", 0.1, 1);
+	m_server.setRateLimiter(rate_limiter);
+	TCPConnection tcp_conn(getIOService());
+	connect(tcp_conn);
+
+	// the first request is allowed
+	HTTPRequest http_request("/counted");
+	HTTPResponse http_response(http_request);
+	sendRequest(tcp_conn, http_request, http_response);
+	BOOST_CHECK_EQUAL(http_response.getStatusCode(), 200U);
+
+	// the next ones are not, and their connections are closed
+	const boost::regex regex_content_length("\r\nContent-Length: (\\d+)\r\n", boost::regex::icase);
+	const std::string get_response(sendRequestUntilClosed("GET /counted"));
+	BOOST_CHECK_EQUAL(get_response.substr(0, 13), "HTTP/1.1 429 ");
+	boost::smatch get_matches;
+	BOOST_REQUIRE(boost::regex_search(get_response, get_matches, regex_content_length));
+	const std::string::size_type get_content_pos = get_response.find("\r\n\r\n") + 4;
+	BOOST_CHECK_EQUAL(get_matches[1], boost::lexical_cast<std::string>(get_response.size() - get_content_pos));
+	BOOST_CHECK(get_response.size() > get_content_pos);
+
+	// the response to a HEAD request has the same headers, but no content
+	const std::string head_response(sendRequestUntilClosed("HEAD /counted"));
+	BOOST_CHECK_EQUAL(head_response.substr(0, 13), "HTTP/1.1 429 ");
+	boost::smatch head_matches;
+	BOOST_REQUIRE(boost::regex_search(head_response, head_matches, regex_content_length));
+	BOOST_CHECK_EQUAL(head_matches[1], get_matches[1]);
+	BOOST_CHECK_EQUAL(head_response.find("\r\n\r\n") + 4, head_response.size());
+
+	BOOST_CHECK_EQUAL(getNumHandled(), 1U);
+	BOOST_CHECK_EQUAL(rate_limiter->getAllowed(), 1UL);
+	BOOST_CHECK_EQUAL(rate_limiter->getRejected(), 2UL);
+}
+
+BOOST_AUTO_TEST_CASE(checkTrustedProxiesForwardClientAddresses) {
+	HTTPRateLimiterPtr rate_limiter(new HTTPRateLimiter);
+	rate_limiter->setLimit("/client", 0.1, 1);
+	m_server.setRateLimiter(rate_limiter);
+	m_server.addTrustedProxy("192.168.0.0/16");
+
+	// the header is ignored for requests that are not from a trusted proxy
+	std::string client;
+	BOOST_CHECK_EQUAL(requestClientAddress("192.0.2.1", client), 200U);
+	BOOST_CHECK_EQUAL(client, "127.0.0.1");
+	BOOST_CHECK_EQUAL(requestClientAddress("192.0.2.1", client), HTTPTypes::RESPONSE_CODE_TOO_MANY_REQUESTS);
+
+	// requests from a trusted proxy are from the client that it names, and
+	// each client is limited on its own
+	m_server.addTrustedProxy("127.0.0.1");
+	BOOST_CHECK_EQUAL(requestClientAddress("192.0.2.1", client), 200U);
+	BOOST_CHECK_EQUAL(client, "192.0.2.1");
+	BOOST_CHECK_EQUAL(requestClientAddress("192.0.2.2", client), 200U);
+	BOOST_CHECK_EQUAL(client, "192.0.2.2");
+	BOOST_CHECK_EQUAL(requestClientAddress("192.0.2.1", client), HTTPTypes::RESPONSE_CODE_TOO_MANY_REQUESTS);
+	BOOST_CHECK_EQUAL(rate_limiter->getAllowed(), 3UL);
+	BOOST_CHECK_EQUAL(rate_limiter->getRejected(), 2UL);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
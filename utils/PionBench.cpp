@@ -0,0 +1,695 @@
+// ------------------------------------------------------------------
+// pion-net: a C++ framework for building lightweight HTTP interfaces
+// ------------------------------------------------------------------
+// Copyright (C) 2007-2010 Atomic Labs, Inc.  (http://www.atomiclabs.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include <deque>
+#include <cstdlib>
+#include <sstream>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <pion/PionScheduler.hpp>
+#include <pion/net/TCPConnection.hpp>
+#include <pion/net/HTTPRequest.hpp>
+#include <pion/net/HTTPRequestWriter.hpp>
+#include <pion/net/HTTPResponseReader.hpp>
+
+using namespace std;
+using namespace pion;
+using namespace pion::net;
+using boost::asio::ip::tcp;
+
+
+/// settings for a benchmark run
+struct BenchConfig {
+	BenchConfig(void)
+		: m_connections(1), m_depth(1), m_max_requests(0), m_duration(0),
+		m_rate(0), m_threads(1), m_timeout(30)
+	{}
+
+	/// address of the server being tested
+	tcp::endpoint					m_endpoint;
+
+	/// requests are sent in this order, repeatedly
+	std::vector<HTTPRequestPtr>		m_templates;
+
+	/// number of connections to the server
+	unsigned int					m_connections;
+
+	/// maximum number of requests in flight for each connection (> 1 pipelines them)
+	unsigned int					m_depth;
+
+	/// total number of requests to send (0 = unlimited)
+	unsigned long					m_max_requests;
+
+	/// number of seconds to send requests for (0 = unlimited)
+	unsigned int					m_duration;
+
+	/// total number of requests to send per second (0 = as fast as possible)
+	double							m_rate;
+
+	/// number of threads used to run the connections
+	unsigned int					m_threads;
+
+	/// maximum number of seconds to wait for a response
+	unsigned int					m_timeout;
+};
+
+
+/// results collected by one connection, or by all of them
+struct BenchResults {
+	BenchResults(void)
+		: m_responses(0), m_errors(0), m_non_2xx(0), m_content_bytes(0)
+	{}
+
+	/// adds another set of results to this one
+	void add(const BenchResults& r) {
+		m_responses += r.m_responses;
+		m_errors += r.m_errors;
+		m_non_2xx += r.m_non_2xx;
+		m_content_bytes += r.m_content_bytes;
+		m_latency.insert(m_latency.end(), r.m_latency.begin(), r.m_latency.end());
+		m_scheduled_latency.insert(m_scheduled_latency.end(),
+								   r.m_scheduled_latency.begin(), r.m_scheduled_latency.end());
+	}
+
+	/// number of responses received
+	unsigned long					m_responses;
+
+	/// number of requests that failed (including those lost by a closed connection)
+	unsigned long					m_errors;
+
+	/// number of responses with a status code other than 2xx
+	unsigned long					m_non_2xx;
+
+	/// number of payload content bytes received
+	unsigned long long				m_content_bytes;
+
+	/// microseconds between sending each request and receiving its response
+	std::vector<boost::uint32_t>	m_latency;
+
+	/// microseconds between each request's scheduled send time and its response
+	std::vector<boost::uint32_t>	m_scheduled_latency;
+};
+
+
+///
+/// BenchRun: state shared by the connections of a benchmark run
+///
+class BenchRun :
+	private boost::noncopyable
+{
+public:
+
+	/// constructs a new run for the given settings
+	explicit BenchRun(const BenchConfig& config)
+		: m_config(config), m_requests_reserved(0),
+		m_active_connections(0), m_stopping(false)
+	{}
+
+	/// returns the settings for the run
+	inline const BenchConfig& getConfig(void) const { return m_config; }
+
+	/// returns true if another request may be sent, and counts it
+	inline bool reserveRequest(void) {
+		boost::mutex::scoped_lock run_lock(m_mutex);
+		if (m_stopping || (m_config.m_max_requests > 0
+						   && m_requests_reserved >= m_config.m_max_requests))
+			return false;
+		++m_requests_reserved;
+		return true;
+	}
+
+	/// stops sending new requests
+	inline void stop(void) {
+		boost::mutex::scoped_lock run_lock(m_mutex);
+		m_stopping = true;
+	}
+
+	/// returns true if no more requests will be sent
+	inline bool isStopping(void) {
+		boost::mutex::scoped_lock run_lock(m_mutex);
+		return m_stopping;
+	}
+
+	/// called before a connection is started
+	inline void addConnection(void) {
+		boost::mutex::scoped_lock run_lock(m_mutex);
+		++m_active_connections;
+	}
+
+	/// called when a connection has finished, with the results it collected
+	inline void connectionFinished(const BenchResults& results) {
+		boost::mutex::scoped_lock run_lock(m_mutex);
+		m_results.add(results);
+		if (--m_active_connections == 0)
+			m_all_finished.notify_all();
+	}
+
+	/**
+	 * waits for all of the connections to finish
+	 *
+	 * @param deadline stops waiting at this time (if not special)
+	 * @return true if all of the connections have finished
+	 */
+	inline bool waitForConnections(const boost::system_time& deadline) {
+		boost::mutex::scoped_lock run_lock(m_mutex);
+		while (m_active_connections > 0) {
+			if (deadline.is_special())
+				m_all_finished.wait(run_lock);
+			else if (! m_all_finished.timed_wait(run_lock, deadline))
+				return false;
+		}
+		return true;
+	}
+
+	/// returns the results collected by all of the connections that have finished
+	inline BenchResults& getResults(void) { return m_results; }
+
+
+private:
+
+	/// settings for the run
+	const BenchConfig				m_config;
+
+	/// results collected by the connections that have finished
+	BenchResults					m_results;
+
+	/// number of requests that connections have been allowed to send
+	unsigned long					m_requests_reserved;
+
+	/// number of connections that have not finished
+	unsigned int					m_active_connections;
+
+	/// true if no more requests will be sent
+	bool							m_stopping;
+
+	/// signaled when all of the connections have finished
+	boost::condition				m_all_finished;
+
+	/// mutex used to protect the run's state
+	boost::mutex					m_mutex;
+};
+
+
+///
+/// BenchConnection: sends requests over one connection, and times the responses
+///
+/// all of a connection's handlers run in the thread that owns its io_service,
+/// so that the request writers and response readers never run concurrently
+///
+class BenchConnection :
+	public boost::enable_shared_from_this<BenchConnection>,
+	private boost::noncopyable
+{
+public:
+
+	/// creates new BenchConnection objects
+	static inline boost::shared_ptr<BenchConnection>
+		create(BenchRun& run, boost::asio::io_service& io_service, unsigned int id)
+	{
+		return boost::shared_ptr<BenchConnection>(new BenchConnection(run, io_service, id));
+	}
+
+	/// opens the connection and starts sending requests
+	void start(void) {
+		m_tcp_conn.reset(new TCPConnection(m_io_service));
+		m_tcp_conn->setLifecycle(TCPConnection::LIFECYCLE_KEEPALIVE);
+		m_tcp_conn->async_connect(m_endpoint,
+								  boost::bind(&BenchConnection::handleConnect, shared_from_this(),
+											  m_tcp_conn, boost::asio::placeholders::error));
+	}
+
+
+protected:
+
+	/// protected constructor restricts creation of objects (use create())
+	BenchConnection(BenchRun& run, boost::asio::io_service& io_service, unsigned int id)
+		: m_run(run), m_io_service(io_service), m_pace_timer(io_service),
+		m_endpoint(run.getConfig().m_endpoint),
+		m_next_template(id % run.getConfig().m_templates.size()),
+		m_writing(false), m_pace_timer_active(false), m_finished(false)
+	{
+		// each connection sends its share of the total rate, with the
+		// connections' schedules spread evenly across one interval
+		if (run.getConfig().m_rate > 0) {
+			m_interval = boost::posix_time::microseconds(static_cast<boost::int64_t>(
+				1000000.0 * run.getConfig().m_connections / run.getConfig().m_rate));
+			m_next_send = boost::posix_time::microsec_clock::universal_time()
+				+ boost::posix_time::microseconds(m_interval.total_microseconds()
+												  * id / run.getConfig().m_connections);
+		}
+	}
+
+
+private:
+
+	/// a request that has been sent, and is waiting for its response
+	struct PendingRequest {
+		PendingRequest(const HTTPRequestPtr& request,
+					   const boost::posix_time::ptime& scheduled,
+					   const boost::posix_time::ptime& sent)
+			: m_request(request), m_scheduled(scheduled), m_sent(sent)
+		{}
+		HTTPRequestPtr				m_request;
+		boost::posix_time::ptime	m_scheduled;
+		boost::posix_time::ptime	m_sent;
+	};
+
+	/// called after the connection has been established
+	void handleConnect(TCPConnectionPtr tcp_conn, const boost::system::error_code& ec) {
+		if (tcp_conn != m_tcp_conn)
+			return;
+		if (ec) {
+			std::cerr << "PionBench: Unable to connect to " << m_endpoint
+				<< " (" << ec.message() << ')' << std::endl;
+			++m_results.m_errors;
+			finish();
+			return;
+		}
+		sendRequests();
+	}
+
+	/// sends the next request, if the pipeline depth and schedule allow it
+	void sendRequests(void) {
+		if (m_finished || m_writing || m_pace_timer_active)
+			return;
+		const BenchConfig& config = m_run.getConfig();
+		if (m_pending.size() >= config.m_depth)
+			return;
+
+		boost::posix_time::ptime now(boost::posix_time::microsec_clock::universal_time());
+		boost::posix_time::ptime scheduled(now);
+		if (config.m_rate > 0) {
+			if (now < m_next_send) {
+				m_pace_timer_active = true;
+				m_pace_timer.expires_at(m_next_send);
+				m_pace_timer.async_wait(boost::bind(&BenchConnection::handlePaceTimer,
+													shared_from_this(), m_tcp_conn));
+				return;
+			}
+			// the time that the request should have been sent is used to
+			// measure its latency, so that a stalled server is not excused
+			// for the requests that it prevented from being sent
+			scheduled = m_next_send;
+			m_next_send += m_interval;
+		}
+
+		if (! m_run.reserveRequest()) {
+			if (m_pending.empty())
+				finish();
+			return;
+		}
+
+		const HTTPRequestPtr& request_template(config.m_templates[m_next_template]);
+		m_next_template = (m_next_template + 1) % config.m_templates.size();
+
+		HTTPRequestWriterPtr writer(HTTPRequestWriter::create(m_tcp_conn,
+			boost::bind(&BenchConnection::handleWrite, shared_from_this(), m_tcp_conn, _1)));
+		writer->getRequest() = *request_template;
+		if (request_template->getContentLength() > 0)
+			writer->writeNoCopy(request_template->getContent(), request_template->getContentLength());
+
+		const bool start_reading = m_pending.empty();
+		m_pending.push_back(PendingRequest(request_template, scheduled, now));
+		m_writing = true;
+
+		// the writer chooses the Connection header using the connection's
+		// lifecycle, which a response reader may have changed
+		const TCPConnection::LifecycleType lifecycle = m_tcp_conn->getLifecycle();
+		m_tcp_conn->setLifecycle(TCPConnection::LIFECYCLE_KEEPALIVE);
+		writer->send();
+		m_tcp_conn->setLifecycle(lifecycle);
+
+		if (start_reading)
+			readResponse();
+	}
+
+	/// called after a request has been written
+	void handleWrite(TCPConnectionPtr tcp_conn, const boost::system::error_code& ec) {
+		if (tcp_conn != m_tcp_conn)
+			return;
+		m_writing = false;
+		if (ec)
+			handleError(ec);
+		else
+			sendRequests();
+	}
+
+	/// called when the next request is scheduled to be sent
+	void handlePaceTimer(TCPConnectionPtr tcp_conn) {
+		if (tcp_conn != m_tcp_conn)
+			return;
+		m_pace_timer_active = false;
+		sendRequests();
+	}
+
+	/// reads the response to the oldest pending request
+	void readResponse(void) {
+		HTTPResponseReaderPtr reader(HTTPResponseReader::create(m_tcp_conn,
+			*m_pending.front().m_request,
+			boost::bind(&BenchConnection::handleResponse, shared_from_this(), m_tcp_conn, _1, _3)));
+		reader->setTimeout(m_run.getConfig().m_timeout);
+		reader->receive();
+	}
+
+	/// called after a response has been read
+	void handleResponse(TCPConnectionPtr tcp_conn, HTTPResponsePtr http_response,
+						const boost::system::error_code& ec)
+	{
+		if (tcp_conn != m_tcp_conn)
+			return;
+		if (ec || ! http_response->isValid()) {
+			handleError(ec);
+			return;
+		}
+
+		const boost::posix_time::ptime now(boost::posix_time::microsec_clock::universal_time());
+		const PendingRequest& pending = m_pending.front();
+		m_results.m_latency.push_back(static_cast<boost::uint32_t>((now - pending.m_sent).total_microseconds()));
+		m_results.m_scheduled_latency.push_back(static_cast<boost::uint32_t>((now - pending.m_scheduled).total_microseconds()));
+		++m_results.m_responses;
+		m_results.m_content_bytes += http_response->getContentLength();
+		if (http_response->getStatusCode() < 200 || http_response->getStatusCode() >= 300)
+			++m_results.m_non_2xx;
+		m_pending.pop_front();
+
+		if (! m_tcp_conn->getKeepAlive()) {
+			// the server is closing the connection
+			reconnect();
+			return;
+		}
+
+		const bool more_responses = ! m_pending.empty();
+		sendRequests();
+		if (more_responses)
+			readResponse();
+	}
+
+	/// counts a failure, and any requests that were lost with the connection
+	void handleError(const boost::system::error_code& ec) {
+		if (ec && ec != boost::asio::error::eof && ! m_run.isStopping())
+			std::cerr << "PionBench: Connection failed (" << ec.message() << ')' << std::endl;
+		if (m_pending.empty())
+			++m_results.m_errors;
+		reconnect();
+	}
+
+	/// discards the current connection and opens a new one
+	void reconnect(void) {
+		m_results.m_errors += m_pending.size();
+		m_pending.clear();
+		m_writing = false;
+		if (m_pace_timer_active) {
+			m_pace_timer.cancel();
+			m_pace_timer_active = false;
+		}
+		m_tcp_conn->close();
+		if (m_run.isStopping())
+			finish();
+		else
+			start();
+	}
+
+	/// closes the connection and reports its results
+	void finish(void) {
+		if (m_finished)
+			return;
+		m_finished = true;
+		m_tcp_conn->close();
+		m_run.connectionFinished(m_results);
+	}
+
+
+	/// the run that this connection belongs to
+	BenchRun &						m_run;
+
+	/// the io_service used by the connection
+	boost::asio::io_service &		m_io_service;
+
+	/// timer used to wait until the next request is scheduled to be sent
+	boost::asio::deadline_timer		m_pace_timer;
+
+	/// address of the server being tested
+	tcp::endpoint					m_endpoint;
+
+	/// the current connection to the server
+	TCPConnectionPtr				m_tcp_conn;
+
+	/// requests that have been sent, oldest first
+	std::deque<PendingRequest>		m_pending;
+
+	/// results collected by this connection
+	BenchResults					m_results;
+
+	/// index of the next request template to send
+	std::size_t						m_next_template;
+
+	/// time between requests sent by this connection, if the rate is fixed
+	boost::posix_time::time_duration	m_interval;
+
+	/// time that the next request is scheduled to be sent, if the rate is fixed
+	boost::posix_time::ptime		m_next_send;
+
+	/// true if a request is being written
+	bool							m_writing;
+
+	/// true if waiting for the next request's scheduled time
+	bool							m_pace_timer_active;
+
+	/// true if the connection has reported its results
+	bool							m_finished;
+};
+
+/// data type for a pointer to a BenchConnection
+typedef boost::shared_ptr<BenchConnection>	BenchConnectionPtr;
+
+
+/**
+ * adds the latencies that a server which stalled for each of the given latencies
+ * would have caused for requests sent at a fixed interval, but which a closed-loop
+ * client never sent (coordinated omission); equivalent to HdrHistogram's
+ * recordValueWithExpectedInterval()
+ */
+void correct_for_coordinated_omission(std::vector<boost::uint32_t>& latency,
+									  boost::uint32_t expected_interval)
+{
+	if (expected_interval == 0)
+		return;
+	const std::size_t num_measured = latency.size();
+	for (std::size_t n = 0; n < num_measured; ++n) {
+		for (boost::uint32_t missing = latency[n] - std::min(latency[n], expected_interval);
+			 missing >= expected_interval; missing -= expected_interval)
+		{
+			latency.push_back(missing);
+		}
+	}
+}
+
+/// returns the latency below which a given percentage of the (sorted) latencies fall
+boost::uint32_t get_percentile(const std::vector<boost::uint32_t>& sorted_latency, double percent)
+{
+	if (sorted_latency.empty())
+		return 0;
+	std::size_t n = static_cast<std::size_t>(percent / 100.0 * sorted_latency.size() + 0.5);
+	if (n > 0) --n;
+	return sorted_latency[std::min(n, sorted_latency.size() - 1)];
+}
+
+/// prints the results of a run
+void print_results(BenchResults& results, const BenchConfig& config, double elapsed_seconds)
+{
+	// without a fixed rate, assume that requests would have been sent at the
+	// interval that a connection averaged over the run
+	std::vector<boost::uint32_t>& corrected_latency(results.m_scheduled_latency);
+	if (config.m_rate <= 0 && results.m_responses > 0) {
+		const boost::uint32_t expected_interval = static_cast<boost::uint32_t>(
+			1000000.0 * elapsed_seconds * config.m_connections / results.m_responses);
+		correct_for_coordinated_omission(corrected_latency, expected_interval);
+	}
+	std::sort(results.m_latency.begin(), results.m_latency.end());
+	std::sort(corrected_latency.begin(), corrected_latency.end());
+
+	std::cout << std::fixed << std::setprecision(2)
+		<< "Connections:   " << config.m_connections << " (up to " << config.m_depth
+		<< " requests in flight on each)" << std::endl
+		<< "Elapsed:       " << elapsed_seconds << " seconds" << std::endl
+		<< "Responses:     " << results.m_responses << " ("
+		<< (elapsed_seconds > 0 ? results.m_responses / elapsed_seconds : 0) << " per second)" << std::endl
+		<< "Non-2xx:       " << results.m_non_2xx << std::endl
+		<< "Errors:        " << results.m_errors << std::endl
+		<< "Content:       " << results.m_content_bytes << " bytes ("
+		<< (elapsed_seconds > 0 ? results.m_content_bytes / elapsed_seconds / 1024 : 0) << " KB per second)" << std::endl
+		<< std::endl
+		<< "Latency (ms)   measured  corrected" << std::endl;
+
+	static const double PERCENTILES[] = { 50, 75, 90, 99, 99.9, 99.99, 100 };
+	for (std::size_t n = 0; n < sizeof(PERCENTILES) / sizeof(PERCENTILES[0]); ++n) {
+		std::ostringstream label;
+		label << PERCENTILES[n] << '%';
+		std::cout << "  " << std::setw(8) << std::left << label.str() << std::right
+			<< std::setprecision(3)
+			<< std::setw(11) << get_percentile(results.m_latency, PERCENTILES[n]) / 1000.0
+			<< std::setw(11) << get_percentile(corrected_latency, PERCENTILES[n]) / 1000.0
+			<< std::endl;
+	}
+}
+
+
+/// displays an error message if the arguments are invalid
+void argument_error(void)
+{
+	std::cerr << "usage:   PionBench [OPTIONS] HOST[:PORT] [RESOURCE]" << std::endl
+		<< "options: [-c CONNECTIONS] [-m IN_FLIGHT] [-d SECONDS] [-n REQUESTS]" << std::endl
+		<< "         [-r REQUESTS_PER_SECOND] [-f REQUEST_FILE] [-t THREADS] [-T TIMEOUT]" << std::endl;
+}
+
+
+/// main control function
+int main (int argc, char *argv[])
+{
+	static const unsigned int DEFAULT_PORT = 80;
+	static const unsigned int DEFAULT_DURATION = 10;
+
+	// parse command line
+	BenchConfig config;
+	std::vector<std::string> request_files;
+	std::string host_name;
+	std::string resource("/");
+
+	for (int argnum=1; argnum < argc; ++argnum) {
+		if (argv[argnum][0] == '-' && argv[argnum][1] != '\0' && argv[argnum][2] == '\0'
+			&& argnum+1 < argc)
+		{
+			const char option = argv[argnum][1];
+			const char *value = argv[++argnum];
+			switch (option) {
+			case 'c': config.m_connections = strtoul(value, 0, 10); break;
+			case 'm': config.m_depth = strtoul(value, 0, 10); break;
+			case 'd': config.m_duration = strtoul(value, 0, 10); break;
+			case 'n': config.m_max_requests = strtoul(value, 0, 10); break;
+			case 'r': config.m_rate = strtod(value, 0); break;
+			case 'f': request_files.push_back(value); break;
+			case 't': config.m_threads = strtoul(value, 0, 10); break;
+			case 'T': config.m_timeout = strtoul(value, 0, 10); break;
+			default:
+				argument_error();
+				return 1;
+			}
+		} else if (host_name.empty()) {
+			host_name = argv[argnum];
+		} else if (argnum+1 == argc) {
+			resource = argv[argnum];
+		} else {
+			argument_error();
+			return 1;
+		}
+	}
+	if (host_name.empty() || config.m_connections == 0 || config.m_depth == 0
+		|| config.m_threads == 0)
+	{
+		argument_error();
+		return 1;
+	}
+	if (config.m_duration == 0 && config.m_max_requests == 0)
+		config.m_duration = DEFAULT_DURATION;
+	if (config.m_threads > config.m_connections)
+		config.m_threads = config.m_connections;
+
+	// resolve the server's address
+	std::string port_str(boost::lexical_cast<std::string>(DEFAULT_PORT));
+	const std::string::size_type pos = host_name.rfind(':');
+	if (pos != std::string::npos) {
+		port_str = host_name.substr(pos + 1);
+		host_name.resize(pos);
+	}
+	try {
+		boost::asio::io_service io_service;
+		tcp::resolver resolver(io_service);
+		config.m_endpoint = *resolver.resolve(tcp::resolver::query(host_name, port_str));
+	} catch (std::exception& e) {
+		std::cerr << "PionBench: Unable to resolve " << host_name << " (" << e.what() << ')' << std::endl;
+		return 1;
+	}
+
+	// load the request templates
+	const std::string host_header(port_str == "80" ? host_name : host_name + ':' + port_str);
+	for (std::vector<std::string>::const_iterator i = request_files.begin(); i != request_files.end(); ++i) {
+		std::ifstream request_file(i->c_str(), std::ios::in | std::ios::binary);
+		HTTPRequestPtr request(new HTTPRequest);
+		boost::system::error_code ec;
+		if (request_file.is_open())
+			request->read(request_file, ec);
+		if (! request_file.is_open() || ec || ! request->isValid()) {
+			std::cerr << "PionBench: Unable to read request file: " << *i << std::endl;
+			return 1;
+		}
+		if (! request->hasHeader(HTTPTypes::HEADER_HOST))
+			request->addHeader(HTTPTypes::HEADER_HOST, host_header);
+		config.m_templates.push_back(request);
+	}
+	if (config.m_templates.empty()) {
+		HTTPRequestPtr request(new HTTPRequest(resource));
+		request->addHeader(HTTPTypes::HEADER_HOST, host_header);
+		config.m_templates.push_back(request);
+	}
+
+	// each thread has its own io_service, so that a connection's
+	// handlers are never run concurrently
+	PionOneToOneScheduler scheduler;
+	scheduler.setNumThreads(config.m_threads);
+	scheduler.startup();
+
+	BenchRun run(config);
+	std::vector<BenchConnectionPtr> connections;
+	for (unsigned int n = 0; n < config.m_connections; ++n) {
+		connections.push_back(BenchConnection::create(run,
+			scheduler.getIOService(n % config.m_threads), n));
+		run.addConnection();
+	}
+
+	std::cout << "Sending requests to " << config.m_endpoint;
+	if (config.m_duration > 0)
+		std::cout << " for " << config.m_duration << " seconds";
+	if (config.m_max_requests > 0)
+		std::cout << " (" << config.m_max_requests << " requests at most)";
+	std::cout << std::endl;
+
+	const boost::posix_time::ptime start_time(boost::posix_time::microsec_clock::universal_time());
+	for (std::vector<BenchConnectionPtr>::iterator i = connections.begin(); i != connections.end(); ++i)
+		(*i)->start();
+
+	if (config.m_duration == 0) {
+		run.waitForConnections(boost::system_time());
+	} else if (! run.waitForConnections(boost::get_system_time()
+										+ boost::posix_time::seconds(config.m_duration)))
+	{
+		run.stop();
+	}
+	const boost::posix_time::ptime stop_time(boost::posix_time::microsec_clock::universal_time());
+	run.waitForConnections(boost::system_time());
+	scheduler.shutdown();
+	connections.clear();
+
+	// responses that arrive after the duration has passed are counted, but
+	// do not add to the elapsed time
+	print_results(run.getResults(), config,
+				  (stop_time - start_time).total_microseconds() / 1000000.0);
+
+	return (run.getResults().m_responses > 0 ? 0 : 1);
+}
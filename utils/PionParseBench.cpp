@@ -0,0 +1,117 @@
+// ------------------------------------------------------------------
+// pion-net: a C++ framework for building lightweight HTTP interfaces
+// ------------------------------------------------------------------
+// Copyright (C) 2007-2010 Atomic Labs, Inc.  (http://www.atomiclabs.com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include <cstdlib>
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <boost/regex.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <pion/net/HTTPParser.hpp>
+#include <pion/net/IPNetworkTrie.hpp>
+
+using namespace std;
+using namespace pion;
+using namespace pion::net;
+
+
+/// X-Forwarded-For headers that are parsed by the benchmark
+static const char *HEADERS[] = {
+	"62.31.21.2",
+	"10.21.31.2, 172.15.31.2",
+	"127.0.0.1, 192.168.2.12, 10.1.2.3, 129.2.31.24",
+	"unknown, 203.0.113.9, 10.0.0.1, 10.0.0.2",
+	"192.168.2.12, 172.16.31.2, 10.1.1.1"
+};
+
+/// number of headers that are parsed by the benchmark
+static const std::size_t NUM_HEADERS = sizeof(HEADERS) / sizeof(HEADERS[0]);
+
+
+/// parses an X-Forwarded-For header the way that HTTPParser used to (with regular expressions)
+bool regex_parse_forwarded_for(const std::string& header, std::string& public_ip)
+{
+	static const boost::regex IPV4_ADDR_RX("[0-9]{1,3}\\.[0-9]{1,3}\\.[0-9]{1,3}\\.[0-9]{1,3}");
+	static const boost::regex PRIVATE_NET_RX("(10\\.[0-9]{1,3}|127\\.[0-9]{1,3}|192\\.168|172\\.1[6-9]|172\\.2[0-9]|172\\.3[0-1])\\.[0-9]{1,3}\\.[0-9]{1,3}");
+
+	boost::match_results<std::string::const_iterator> m;
+	std::string::const_iterator start_it = header.begin();
+	while (boost::regex_search(start_it, header.end(), m, IPV4_ADDR_RX)) {
+		std::string ip_str(m[0].first, m[0].second);
+		if (! boost::regex_match(ip_str, PRIVATE_NET_RX) ) {
+			public_ip = ip_str;
+			return true;
+		}
+		start_it = m[0].second;
+	}
+	return false;
+}
+
+/// displays the time taken to parse the headers a number of times
+void print_result(const std::string& label, const boost::posix_time::ptime& start_time,
+				  unsigned long iterations, unsigned long found)
+{
+	const double elapsed_ns = static_cast<double>((boost::posix_time::microsec_clock::universal_time()
+												   - start_time).total_microseconds()) * 1000.0;
+	std::cout << std::left << std::setw(24) << label << std::right << std::fixed << std::setprecision(1)
+		<< std::setw(10) << elapsed_ns / (iterations * NUM_HEADERS) << " ns per header"
+		<< " (" << found << " found)" << std::endl;
+}
+
+
+/// main control function
+int main (int argc, char *argv[])
+{
+	unsigned long iterations = 200000;
+	if (argc == 3 && std::string(argv[1]) == "-n") {
+		iterations = strtoul(argv[2], 0, 10);
+	} else if (argc != 1) {
+		std::cerr << "usage:   PionParseBench [-n ITERATIONS]" << std::endl;
+		return 1;
+	}
+	if (iterations == 0)
+		iterations = 1;
+
+	const std::string headers[NUM_HEADERS] = {
+		HEADERS[0], HEADERS[1], HEADERS[2], HEADERS[3], HEADERS[4]
+	};
+	IPNetworkTrie trusted_proxies;
+	trusted_proxies.insert("10.0.0.0/8");
+	trusted_proxies.insert("192.168.0.0/16");
+	std::string public_ip;
+	boost::asio::ip::address client;
+
+	std::cout << "Parsing " << NUM_HEADERS << " X-Forwarded-For headers " << iterations << " times" << std::endl;
+
+	unsigned long found = 0;
+	boost::posix_time::ptime start_time(boost::posix_time::microsec_clock::universal_time());
+	for (unsigned long n = 0; n < iterations; ++n) {
+		for (std::size_t i = 0; i < NUM_HEADERS; ++i)
+			found += regex_parse_forwarded_for(headers[i], public_ip);
+	}
+	print_result("regex (public IP)", start_time, iterations, found);
+
+	found = 0;
+	start_time = boost::posix_time::microsec_clock::universal_time();
+	for (unsigned long n = 0; n < iterations; ++n) {
+		for (std::size_t i = 0; i < NUM_HEADERS; ++i)
+			found += HTTPParser::parseForwardedFor(headers[i], public_ip);
+	}
+	print_result("scanner (public IP)", start_time, iterations, found);
+
+	found = 0;
+	start_time = boost::posix_time::microsec_clock::universal_time();
+	for (unsigned long n = 0; n < iterations; ++n) {
+		for (std::size_t i = 0; i < NUM_HEADERS; ++i)
+			found += HTTPParser::parseForwardedFor(headers[i], trusted_proxies, client);
+	}
+	print_result("scanner (trusted proxy)", start_time, iterations, found);
+
+	return 0;
+}